@@ -0,0 +1,338 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// atlaspacker: packs small TGA textures (HUD icons, buttons, map overlays) into one atlas image with
+// the MaxRects algorithm, and writes a table of where each one went, keyed by the filename it was given
+// as (so run it from the Game folder with "Media/..." paths, as the game loads them). Adding the table
+// to an XMediaGroup (see -[XMediaGroup addTextureAtlas:]) makes every texture it lists load as a region
+// of the shared atlas texture, so 2D drawing can switch between them without rebinding. The atlas
+// image is uncompressed, so cook it with "texturecooker -n" and ship only the .xtex it writes (the
+// atlas costs more texture memory than PVRTC sources it replaces; RenderCheck shows what it saves).
+// Plain C, so it builds anywhere:
+//   cc -O2 -std=gnu99 -o atlaspacker AtlasPacker/main.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_IMAGES 256
+#define MAX_FREE_RECTS 4096
+
+typedef struct {
+	int x, y, width, height;
+} Rect;
+
+typedef struct {
+	const char *path;
+	int width, height;
+	uint8_t *pixels;	// RGBA, top row first
+	Rect placed;		// including padding
+} Image;
+
+static uint8_t *readFile(const char *path, size_t *size)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return NULL;
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint8_t *data = (length > 0) ? malloc(length) : NULL;
+	if (data && fread(data, 1, length, file) != (size_t)length) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	*size = (size_t)length;
+	return data;
+}
+
+// reads a type 2 (raw) or type 10 (RLE) 24/32 bit TGA; returns an error message, or NULL
+static const char *loadTGA(const char *path, Image *image)
+{
+	size_t size;
+	uint8_t *file = readFile(path, &size);
+	if (!file)
+		return "Could not read file";
+	if (size < 18 || (file[2] != 2 && file[2] != 10) || (file[16] != 24 && file[16] != 32)) {
+		free(file);
+		return "TGA file must be a 24 or 32 bit type 2 or type 10";
+	}
+	int w = file[12] | (file[13] << 8), h = file[14] | (file[15] << 8);
+	int bytesPerPixel = file[16] / 8;
+	int topDown = (file[17] & 0x20) != 0;
+	const uint8_t *src = file + 18 + file[0], *end = file + size;
+
+	uint8_t *pixels = malloc((size_t)w * h * 4);
+	int pixelCount = w * h, pixel = 0;
+	while (pixel < pixelCount) {
+		int run = 1, raw = 1;
+		if (file[2] == 10) {
+			if (src >= end) break;
+			uint8_t header = *src++;
+			run = (header & 0x7f) + 1;
+			raw = (header & 0x80) == 0;
+		}
+		for (int i = 0; i < run && pixel < pixelCount; ++i, ++pixel) {
+			if (src + bytesPerPixel > end) {
+				free(pixels);
+				free(file);
+				return "Could not read image data";
+			}
+			int row = pixel / w, column = pixel % w;
+			uint8_t *dest = &pixels[((topDown ? row : h - 1 - row) * w + column) * 4];
+			dest[0] = src[2]; dest[1] = src[1]; dest[2] = src[0];
+			dest[3] = (bytesPerPixel == 4) ? src[3] : 255;
+			if (raw || i == run - 1)
+				src += bytesPerPixel;
+		}
+	}
+	free(file);
+	if (pixel != pixelCount) {
+		free(pixels);
+		return "Could not read image data";
+	}
+	image->width = w;
+	image->height = h;
+	image->pixels = pixels;
+	return NULL;
+}
+
+//------------------------------ MaxRects Packing -----------------------------------
+
+// The free space is kept as a list of maximal (possibly overlapping) rectangles. Each image goes into
+// the free rectangle which leaves the shortest leftover side (best short side fit); every free rectangle
+// it overlaps is then split into the up to 4 maximal rectangles around it, and free rectangles which
+// end up inside others are dropped.
+
+typedef struct {
+	Rect freeRects[MAX_FREE_RECTS];
+	int freeCount;
+} MaxRects;
+
+static void MaxRects_init(MaxRects *packer, int width, int height)
+{
+	packer->freeRects[0].x = 0;
+	packer->freeRects[0].y = 0;
+	packer->freeRects[0].width = width;
+	packer->freeRects[0].height = height;
+	packer->freeCount = 1;
+}
+
+static int MaxRects_contains(const Rect *outer, const Rect *inner)
+{
+	return inner->x >= outer->x && inner->y >= outer->y &&
+		inner->x + inner->width <= outer->x + outer->width && inner->y + inner->height <= outer->y + outer->height;
+}
+
+static void MaxRects_addFree(MaxRects *packer, int x, int y, int width, int height)
+{
+	if (width > 0 && height > 0 && packer->freeCount < MAX_FREE_RECTS) {
+		Rect *rect = &packer->freeRects[packer->freeCount++];
+		rect->x = x; rect->y = y; rect->width = width; rect->height = height;
+	}
+}
+
+static int MaxRects_insert(MaxRects *packer, int width, int height, Rect *result)
+{
+	int best = -1, bestShortSide = 0x7fffffff, bestLongSide = 0x7fffffff;
+	for (int i = 0; i < packer->freeCount; ++i) {
+		const Rect *free = &packer->freeRects[i];
+		if (free->width < width || free->height < height)
+			continue;
+		int leftoverX = free->width - width, leftoverY = free->height - height;
+		int shortSide = (leftoverX < leftoverY) ? leftoverX : leftoverY;
+		int longSide = (leftoverX < leftoverY) ? leftoverY : leftoverX;
+		if (shortSide < bestShortSide || (shortSide == bestShortSide && longSide < bestLongSide)) {
+			best = i;
+			bestShortSide = shortSide;
+			bestLongSide = longSide;
+		}
+	}
+	if (best < 0)
+		return 0;
+	result->x = packer->freeRects[best].x;
+	result->y = packer->freeRects[best].y;
+	result->width = width;
+	result->height = height;
+
+	// split the free rectangles the placed one overlaps
+	int count = packer->freeCount;
+	for (int i = 0; i < count; ++i) {
+		Rect free = packer->freeRects[i];
+		if (result->x >= free.x + free.width || result->x + result->width <= free.x ||
+			result->y >= free.y + free.height || result->y + result->height <= free.y)
+			continue;
+		MaxRects_addFree(packer, free.x, free.y, result->x - free.x, free.height);
+		MaxRects_addFree(packer, result->x + result->width, free.y, free.x + free.width - (result->x + result->width), free.height);
+		MaxRects_addFree(packer, free.x, free.y, free.width, result->y - free.y);
+		MaxRects_addFree(packer, free.x, result->y + result->height, free.width, free.y + free.height - (result->y + result->height));
+		packer->freeRects[i].width = 0;	// (removed below)
+	}
+
+	// drop empty and contained free rectangles
+	int kept = 0;
+	for (int i = 0; i < packer->freeCount; ++i) {
+		Rect *rect = &packer->freeRects[i];
+		if (rect->width <= 0)
+			continue;
+		int contained = 0;
+		for (int j = 0; j < packer->freeCount && !contained; ++j) {
+			if (j == i || packer->freeRects[j].width <= 0)
+				continue;
+			// (of two identical rectangles, only the later one is dropped)
+			if (MaxRects_contains(&packer->freeRects[j], rect) && (j < i || !MaxRects_contains(rect, &packer->freeRects[j])))
+				contained = 1;
+		}
+		if (!contained)
+			packer->freeRects[kept++] = *rect;
+		else
+			rect->width = 0;
+	}
+	packer->freeCount = kept;
+	return 1;
+}
+
+static int compareImages(const void *a, const void *b)
+{
+	const Image *imageA = *(const Image**)a, *imageB = *(const Image**)b;
+	int sideA = (imageA->width > imageA->height) ? imageA->width : imageA->height;
+	int sideB = (imageB->width > imageB->height) ? imageB->width : imageB->height;
+	if (sideA != sideB)
+		return sideB - sideA;
+	return imageB->width * imageB->height - imageA->width * imageA->height;
+}
+
+// packs all images (largest first) into a width x height atlas; returns 0 if they don't fit
+static int packImages(Image **sorted, int count, int width, int height, int padding)
+{
+	static MaxRects packer;
+	MaxRects_init(&packer, width, height);
+	for (int i = 0; i < count; ++i) {
+		if (!MaxRects_insert(&packer, sorted[i]->width + padding * 2, sorted[i]->height + padding * 2, &sorted[i]->placed))
+			return 0;
+	}
+	return 1;
+}
+
+//------------------------------ Output -----------------------------------
+
+// copies an image into the atlas, extending its edge pixels into the padding around it so filtering
+// at its borders doesn't pick up its neighbors
+static void blitImage(uint8_t *atlas, int atlasWidth, const Image *image, int padding)
+{
+	for (int y = 0; y < image->placed.height; ++y) {
+		int sy = y - padding;
+		sy = (sy < 0) ? 0 : ((sy >= image->height) ? image->height - 1 : sy);
+		for (int x = 0; x < image->placed.width; ++x) {
+			int sx = x - padding;
+			sx = (sx < 0) ? 0 : ((sx >= image->width) ? image->width - 1 : sx);
+			memcpy(&atlas[((image->placed.y + y) * atlasWidth + image->placed.x + x) * 4], &image->pixels[(sy * image->width + sx) * 4], 4);
+		}
+	}
+}
+
+static int saveTGA(const char *path, const uint8_t *pixels, int width, int height)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return 0;
+	// (top-left origin, like the rest of the game's TGAs)
+	uint8_t header[18] = { 0, 0, 2, 0,0,0,0,0, 0,0,0,0, width & 0xff, width >> 8, height & 0xff, height >> 8, 32, 0x28 };
+	fwrite(header, 1, sizeof(header), file);
+	for (int i = 0; i < width * height; ++i) {
+		uint8_t bgra[4] = { pixels[i*4+2], pixels[i*4+1], pixels[i*4], pixels[i*4+3] };
+		fwrite(bgra, 1, 4, file);
+	}
+	int ok = (ferror(file) == 0);
+	fclose(file);
+	return ok;
+}
+
+int main(int argc, const char *argv[])
+{
+	int padding = 2, maxSize = 1024;
+	const char *tablePath = NULL;
+	int firstFile = 1;
+	for (; firstFile + 1 < argc && argv[firstFile][0] == '-'; firstFile += 2) {
+		char option = argv[firstFile][1];
+		if (option == 'o') tablePath = argv[firstFile + 1];
+		else if (option == 'p') padding = atoi(argv[firstFile + 1]);
+		else if (option == 'm') maxSize = atoi(argv[firstFile + 1]);
+		else break;
+	}
+	if (!tablePath || firstFile >= argc || argc - firstFile > MAX_IMAGES || padding < 0) {
+		printf("Usage: atlaspacker -o Media/HUD/hud.atlas [-p padding] [-m maxSize] Media/HUD/a.tga [Media/HUD/b.tga ...]\n");
+		printf("Writes the atlas table to the -o path and the atlas image next to it (e.g. hud.atlas.tga).\n");
+		printf("Images are padded by 2 pixels by default, and the atlas may grow up to 1024x1024.\n");
+		printf("Cook the atlas image afterwards with \"texturecooker -n\" and ship the .xtex instead of the .tga.\n\n");
+		return 1;
+	}
+
+	static Image images[MAX_IMAGES];
+	static Image *sorted[MAX_IMAGES];
+	int count = argc - firstFile;
+	long totalArea = 0;
+	for (int i = 0; i < count; ++i) {
+		images[i].path = argv[firstFile + i];
+		const char *error = loadTGA(images[i].path, &images[i]);
+		if (error) {
+			printf("Error loading \"%s\": %s\n", images[i].path, error);
+			return 1;
+		}
+		sorted[i] = &images[i];
+		totalArea += (long)(images[i].width + padding * 2) * (images[i].height + padding * 2);
+	}
+	qsort(sorted, count, sizeof(Image*), compareImages);
+
+	// try power of two sizes from the smallest which could hold everything, growing the shorter side
+	int width = 16, height = 16;
+	while ((long)width * height < totalArea) {
+		if (width <= height) width *= 2;
+		else height *= 2;
+	}
+	while (!packImages(sorted, count, width, height, padding)) {
+		if (width <= height) width *= 2;
+		else height *= 2;
+		if (width > maxSize || height > maxSize) {
+			printf("Error: Images don't fit in a %dx%d atlas.\n", maxSize, maxSize);
+			return 1;
+		}
+	}
+
+	uint8_t *atlas = calloc((size_t)width * height, 4);
+	for (int i = 0; i < count; ++i)
+		blitImage(atlas, width, &images[i], padding);
+
+	char imagePath[512];
+	snprintf(imagePath, sizeof(imagePath), "%s.tga", tablePath);
+	if (!saveTGA(imagePath, atlas, width, height)) {
+		printf("Could not write \"%s\"\n", imagePath);
+		return 1;
+	}
+	free(atlas);
+
+	// the table names the atlas image by the path the game loads it with, which is the table's own
+	// path plus ".tga" (so the table must be given with a "Media/..." path too)
+	FILE *table = fopen(tablePath, "w");
+	if (!table) {
+		printf("Could not write \"%s\"\n", tablePath);
+		return 1;
+	}
+	fprintf(table, "// generated by atlaspacker; regions are left top right bottom, in pixels\n");
+	fprintf(table, "atlas %s\n{\n", imagePath);
+	fprintf(table, "\tsize %d %d\n", width, height);
+	for (int i = 0; i < count; ++i) {
+		const Image *image = &images[i];
+		fprintf(table, "\ttexture %s %d %d %d %d\n", image->path, image->placed.x + padding, image->placed.y + padding,
+			image->placed.x + padding + image->width, image->placed.y + padding + image->height);
+	}
+	fprintf(table, "}\n");
+	fclose(table);
+
+	printf("Packed %d images into a %dx%d atlas (%.0f%% used): \"%s\", \"%s\"\n", count, width, height,
+		100.0 * totalArea / ((double)width * height), tablePath, imagePath);
+	printf("Cook it with \"texturecooker -n %s\" and ship the .xtex in its place.\n", imagePath);
+	return 0;
+}
+
@@ -0,0 +1,360 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// frustumbench: times XFrustumCulling's batch test (the NEON/SSE kernel this machine builds, and the
+// scalar version) against the per node test XScene used before it (a bounding sphere test, then the 8
+// transformed corners of the node's box against every plane), over randomly placed and rotated boxes
+// seen by a camera turning a full circle. Also checks that the SIMD and scalar kernels agree exactly,
+// and that the batch test never culls a box the per node test kept (it tests the box's world space
+// AABB, so it may only keep more).
+// Then moves some of the boxes every frame and culls them as XScene does: the moved boxes are refit in
+// XBoundingVolumeTree, the tree is queried, and the leaves straddling the frustum are batch tested. This
+// is timed against the flat loop over every node XScene used before the tree (the per node test), and
+// checked to find exactly the boxes the batch test finds when given every box.
+// Plain C, so it builds anywhere:
+//   cc -O2 -std=gnu99 -include Game/Source/XStandalone.h -o frustumbench FrustumBench/main.c -x c Game/Source/XFrustumCulling.m Game/Source/XBoundingVolumeTree.m Game/Source/XMath.m -lm
+
+#include "../Game/Source/XFrustumCulling.h"
+#include "../Game/Source/XBoundingVolumeTree.h"
+#include <stdio.h>
+#include <time.h>
+
+#define WORLD_SIZE 2000.0f
+#define FRAME_TIME (1.0f / 30.0f)
+#define MAX_SPEED 12.0f //(world units per second, about a tank's top speed)
+#define CULLING_TREE_MARGIN 2.0f //(as in XScene.m)
+
+typedef struct {
+	XBoundingBox box;
+	XVector3 position;
+	XMatrix3 rotation;
+	XScalar radius;
+	XVector3 velocity;
+	int proxy;
+} Node;
+
+// what XScene's tree visitor needs: the nodes straddling the frustum are collected for a batch test,
+// and those fully inside it are visible right away
+typedef struct {
+	Node *nodes;
+	BOOL *visible;
+	XCullingBoundsArray *pending;
+} TreeCullContext;
+
+static double currentTime()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static float randomRange(float min, float max)
+{
+	return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+// the frustum planes of a camera at the world's center (see -[XCamera frameUpdate])
+static void buildFrustumPlanes(XVector4 *planes, XAngle yaw)
+{
+	XVector3 origin = { 0, 20, 0 };
+	XVector3 look = { xSin(yaw), -0.1f, xCos(yaw) };
+	XVector3 up = { 0, 1, 0 };
+	xNormalize_Vec3(&look);
+	XScalar left, right, top, bottom, nearClip = 1, farClip = 600;
+	XMatrix4 projMatrix, viewMatrix;
+	xCalculateProjectionParameters(60.0f, 1.0f / 1.5f, nearClip, farClip, &left, &right, &top, &bottom);
+	xBuildProjectionMatrix(&projMatrix, left, right, top, bottom, nearClip, farClip);
+	xBuildViewMatrix(&viewMatrix, &origin, &look, &up);
+	XMatrix4 mat = xMul_Mat4Mat4(&projMatrix, &viewMatrix);
+
+	planes[0].x = mat.m30 + mat.m20; planes[0].y = mat.m31 + mat.m21; planes[0].z = mat.m32 + mat.m22; planes[0].w = mat.m33 + mat.m23;
+	planes[1].x = mat.m30 + mat.m00; planes[1].y = mat.m31 + mat.m01; planes[1].z = mat.m32 + mat.m02; planes[1].w = mat.m33 + mat.m03;
+	planes[2].x = mat.m30 - mat.m00; planes[2].y = mat.m31 - mat.m01; planes[2].z = mat.m32 - mat.m02; planes[2].w = mat.m33 - mat.m03;
+	planes[3].x = mat.m30 - mat.m20; planes[3].y = mat.m31 - mat.m21; planes[3].z = mat.m32 - mat.m22; planes[3].w = mat.m33 - mat.m23;
+	planes[4].x = mat.m30 + mat.m10; planes[4].y = mat.m31 + mat.m11; planes[4].z = mat.m32 + mat.m12; planes[4].w = mat.m33 + mat.m13;
+	planes[5].x = mat.m30 - mat.m10; planes[5].y = mat.m31 - mat.m11; planes[5].z = mat.m32 - mat.m12; planes[5].w = mat.m33 - mat.m13;
+	for (int p = 0; p < 6; ++p)
+		xNormalizePlane_Vec4(&planes[p]);
+}
+
+// the per node test, as -[XCamera isVisibleSphere:radius:] and -[XCamera isVisibleBox:boxOffset:boxRotation:] did it
+static BOOL perNodeVisible(const XVector4 *planes, Node *node)
+{
+	for (int p = 0; p < 6; ++p) {
+		XScalar distance = planes[p].x * node->position.x + planes[p].y * node->position.y + planes[p].z * node->position.z + planes[p].w;
+		if (distance < -node->radius)
+			return NO;
+	}
+
+	XBoundingBox *box = &node->box;
+	XVector3 corners[8];
+	for (int i = 0; i < 8; ++i) {
+		corners[i].x = (i & 1) ? box->max.x : box->min.x;
+		corners[i].y = (i & 2) ? box->max.y : box->min.y;
+		corners[i].z = (i & 4) ? box->max.z : box->min.z;
+		corners[i] = xMul_Vec3Mat3(&corners[i], &node->rotation);
+		xAdd_Vec3Vec3(&corners[i], &node->position);
+	}
+	for (int p = 0; p < 6; ++p) {
+		int inCount = 8;
+		for (int i = 0; i < 8; ++i) {
+			XScalar dist = planes[p].x * corners[i].x + planes[p].y * corners[i].y + planes[p].z * corners[i].z + planes[p].w;
+			if (dist < 0)
+				--inCount;
+		}
+		if (inCount == 0)
+			return NO;
+	}
+	return YES;
+}
+
+// the world space AABB XScene keeps for a node (see XScene_nodeWorldBounds)
+static XBoundingBox worldBounds(const Node *node)
+{
+	XVector3 center, extent;
+	XBoundingBox box;
+	FrustumCulling_transformBox(&node->box, &node->position, &node->rotation, &center, &extent);
+	box.min.x = center.x - extent.x; box.min.y = center.y - extent.y; box.min.z = center.z - extent.z;
+	box.max.x = center.x + extent.x; box.max.y = center.y + extent.y; box.max.z = center.z + extent.z;
+	return box;
+}
+
+static void treeCullNode(void *userData, BOOL fullyInside, void *context)
+{
+	TreeCullContext *cull = (TreeCullContext*)context;
+	Node *node = (Node*)userData;
+	if (fullyInside)
+		cull->visible[node - cull->nodes] = YES;
+	else {
+		XBoundingBox worldBox = worldBounds(node);
+		CullingBoundsArray_add(cull->pending, &worldBox, node);
+	}
+}
+
+static int countVisible(const XCullingBoundsArray *bounds)
+{
+	int visible = 0;
+	for (int i = 0; i < bounds->count; ++i)
+		visible += CullingBoundsArray_isVisible(bounds, i);
+	return visible;
+}
+
+static const char *simdKernelName()
+{
+#if defined(__ARM_NEON__)
+	return "NEON";
+#elif defined(__SSE__)
+	return "SSE";
+#else
+	return "none (scalar fallback)";
+#endif
+}
+
+static void printUsage()
+{
+	printf("Usage: frustumbench [options]\n\n");
+	printf("  -n <count>  number of boxes (default 20000)\n");
+	printf("  -r <count>  number of camera angles (frames) to test them from (default 200)\n");
+	printf("  -m <count>  percentage of boxes moving each frame, for the culling tree (default 20)\n\n");
+}
+
+int main(int argc, const char *argv[])
+{
+	int count = 20000, frames = 200, movingPercent = 20;
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc || argv[i][0] != '-') {
+			printUsage();
+			return 1;
+		}
+		char option = argv[i][1];
+		int value = atoi(argv[i + 1]);
+		if (option == 'n') count = (value > 0) ? value : 1;
+		else if (option == 'r') frames = (value > 0) ? value : 1;
+		else if (option == 'm') movingPercent = (value < 0) ? 0 : ((value > 100) ? 100 : value);
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	// scatter the boxes, and cache their world space bounds as XScene does when nodes move
+	srand(1);
+	Node *nodes = malloc(sizeof(Node) * count);
+	XCullingBoundsArray bounds;
+	CullingBoundsArray_init(&bounds);
+	for (int i = 0; i < count; ++i) {
+		Node *node = &nodes[i];
+		XVector3 halfSize = { randomRange(0.5f, 5), randomRange(0.5f, 5), randomRange(0.5f, 5) };
+		node->box.min.x = -halfSize.x; node->box.min.y = -halfSize.y; node->box.min.z = -halfSize.z;
+		node->box.max = halfSize;
+		node->radius = xLength_Vec3(&halfSize);
+		node->position.x = randomRange(-WORLD_SIZE * 0.5f, WORLD_SIZE * 0.5f);
+		node->position.y = randomRange(0, 40);
+		node->position.z = randomRange(-WORLD_SIZE * 0.5f, WORLD_SIZE * 0.5f);
+		XVector3 axis = { randomRange(-0.3f, 0.3f), 1, randomRange(-0.3f, 0.3f) };
+		xNormalize_Vec3(&axis);
+		xBuildAxisRotationMatrix3(&node->rotation, randomRange(0, TWO_PI), &axis);
+		XAngle heading = randomRange(0, TWO_PI);
+		XScalar speed = randomRange(0, MAX_SPEED);
+		node->velocity.x = xSin(heading) * speed; node->velocity.y = 0; node->velocity.z = xCos(heading) * speed;
+
+		XBoundingBox worldBox = worldBounds(node);
+		CullingBoundsArray_add(&bounds, &worldBox, node);
+	}
+	XVector4 *planes = malloc(sizeof(XVector4) * 6 * frames);
+	for (int f = 0; f < frames; ++f)
+		buildFrustumPlanes(&planes[f * 6], TWO_PI * f / frames);
+	printf("%d boxes, %d frames, SIMD kernel: %s\n\n", count, frames, simdKernelName());
+
+	// per node
+	long perNodeVisibleTotal = 0;
+	double startTime = currentTime();
+	for (int f = 0; f < frames; ++f)
+		for (int i = 0; i < count; ++i)
+			perNodeVisibleTotal += perNodeVisible(&planes[f * 6], &nodes[i]);
+	double perNodeTime = currentTime() - startTime;
+
+	// batch, scalar
+	long scalarVisibleTotal = 0;
+	startTime = currentTime();
+	for (int f = 0; f < frames; ++f) {
+		FrustumCulling_testBoundsScalar(&planes[f * 6], &bounds);
+		scalarVisibleTotal += countVisible(&bounds);
+	}
+	double scalarTime = currentTime() - startTime;
+
+	// batch, SIMD
+	long simdVisibleTotal = 0;
+	startTime = currentTime();
+	for (int f = 0; f < frames; ++f) {
+		FrustumCulling_testBounds(&planes[f * 6], &bounds);
+		simdVisibleTotal += countVisible(&bounds);
+	}
+	double simdTime = currentTime() - startTime;
+
+	double tests = (double)count * frames;
+	printf("per node (sphere + 8 corners): %8.2f ns/box, %.1f%% visible\n", perNodeTime / tests * 1e9, 100.0 * perNodeVisibleTotal / tests);
+	printf("batch, scalar:                 %8.2f ns/box, %.1f%% visible, %.2fx\n", scalarTime / tests * 1e9, 100.0 * scalarVisibleTotal / tests,
+		(scalarTime > 0) ? perNodeTime / scalarTime : 0.0);
+	printf("batch, SIMD:                   %8.2f ns/box, %.1f%% visible, %.2fx\n\n", simdTime / tests * 1e9, 100.0 * simdVisibleTotal / tests,
+		(simdTime > 0) ? perNodeTime / simdTime : 0.0);
+
+	// check the results box by box
+	long kernelMismatches = 0, wronglyCulled = 0, extraVisible = 0;
+	uint32_t *scalarMask = malloc(sizeof(uint32_t) * ((count + 31) / 32));
+	for (int f = 0; f < frames; ++f) {
+		const XVector4 *framePlanes = &planes[f * 6];
+		FrustumCulling_testBoundsScalar(framePlanes, &bounds);
+		memcpy(scalarMask, bounds.visibleMask, sizeof(uint32_t) * ((count + 31) / 32));
+		FrustumCulling_testBounds(framePlanes, &bounds);
+		for (int i = 0; i < count; ++i) {
+			BOOL simd = CullingBoundsArray_isVisible(&bounds, i);
+			BOOL scalar = (scalarMask[i >> 5] >> (i & 31)) & 1;
+			BOOL perNode = perNodeVisible(framePlanes, &nodes[i]);
+			if (simd != scalar)
+				++kernelMismatches;
+			if (perNode && !simd)
+				++wronglyCulled;
+			if (!perNode && simd)
+				++extraVisible;
+		}
+	}
+	printf("SIMD/scalar mismatches: %ld\n", kernelMismatches);
+	printf("culled but visible per node: %ld\n", wronglyCulled);
+	printf("kept but culled per node (AABB is conservative): %ld (%.2f%%)\n\n", extraVisible, 100.0 * extraVisible / tests);
+
+	// the culling tree, with some boxes moving every frame
+	XBoundingVolumeTree tree;
+	BoundingVolumeTree_init(&tree, CULLING_TREE_MARGIN);
+	startTime = currentTime();
+	for (int i = 0; i < count; ++i) {
+		XBoundingBox worldBox = worldBounds(&nodes[i]);
+		nodes[i].proxy = BoundingVolumeTree_insert(&tree, &worldBox, &nodes[i]);
+	}
+	double buildTime = currentTime() - startTime;
+	XCullingBoundsArray pending;
+	CullingBoundsArray_init(&pending);
+	BOOL *treeVisible = malloc(sizeof(BOOL) * count);
+	TreeCullContext cull = { nodes, treeVisible, &pending };
+	double refitTime = 0, treeTime = 0, flatTime = 0;
+	long moved = 0, reinserted = 0, nodesVisited = 0, leavesTested = 0, treeVisibleTotal = 0, flatVisibleTotal = 0;
+	long treeMismatches = 0, treeWronglyCulled = 0;
+	for (int f = 0; f < frames; ++f) {
+		const XVector4 *framePlanes = &planes[f * 6];
+
+		// move some boxes, and refit them (as -[XScene updateCullingTree])
+		for (int i = 0; i < count; ++i) {
+			if ((i + f) % 100 >= movingPercent)
+				continue;
+			Node *node = &nodes[i];
+			node->position.x += node->velocity.x * FRAME_TIME;
+			node->position.z += node->velocity.z * FRAME_TIME;
+			++moved;
+		}
+		startTime = currentTime();
+		for (int i = 0; i < count; ++i) {
+			if ((i + f) % 100 >= movingPercent)
+				continue;
+			XBoundingBox worldBox = worldBounds(&nodes[i]);
+			reinserted += BoundingVolumeTree_move(&tree, nodes[i].proxy, &worldBox);
+		}
+		refitTime += currentTime() - startTime;
+
+		// cull through the tree (as -[XScene cullNodes])
+		startTime = currentTime();
+		memset(treeVisible, 0, sizeof(BOOL) * count);
+		CullingBoundsArray_clear(&pending);
+		nodesVisited += BoundingVolumeTree_queryFrustum(&tree, framePlanes, treeCullNode, &cull);
+		FrustumCulling_testBounds(framePlanes, &pending);
+		for (int i = 0; i < pending.count; ++i) {
+			if (CullingBoundsArray_isVisible(&pending, i))
+				treeVisible[(Node*)pending.userData[i] - nodes] = YES;
+		}
+		treeTime += currentTime() - startTime;
+		leavesTested += pending.count;
+
+		// the flat loop it replaced
+		startTime = currentTime();
+		int flatVisible = 0;
+		for (int i = 0; i < count; ++i)
+			flatVisible += perNodeVisible(framePlanes, &nodes[i]);
+		flatTime += currentTime() - startTime;
+		flatVisibleTotal += flatVisible;
+
+		// the tree must find exactly the boxes the batch test finds given every box, and so never cull one the per node test keeps
+		CullingBoundsArray_clear(&bounds);
+		for (int i = 0; i < count; ++i) {
+			XBoundingBox worldBox = worldBounds(&nodes[i]);
+			CullingBoundsArray_add(&bounds, &worldBox, &nodes[i]);
+		}
+		FrustumCulling_testBoundsScalar(framePlanes, &bounds);
+		for (int i = 0; i < count; ++i) {
+			treeVisibleTotal += treeVisible[i];
+			if (treeVisible[i] != CullingBoundsArray_isVisible(&bounds, i))
+				++treeMismatches;
+			if (!treeVisible[i] && perNodeVisible(framePlanes, &nodes[i]))
+				++treeWronglyCulled;
+		}
+	}
+	printf("culling tree: built from %d boxes in %.2f ms, %d%% of them moving each frame (%.1f%% of moves reinserted)\n", count, buildTime * 1000,
+		movingPercent, (moved > 0) ? 100.0 * reinserted / moved : 0.0);
+	printf("refit:           %8.1f us/frame\n", refitTime / frames * 1e6);
+	printf("tree + batch:    %8.1f us/frame, %ld tree nodes and %ld leaves tested per frame, %.1f%% visible\n", treeTime / frames * 1e6,
+		nodesVisited / frames, leavesTested / frames, 100.0 * treeVisibleTotal / tests);
+	printf("flat (per node): %8.1f us/frame, %.1f%% visible, tree is %.2fx (%.2fx with refit)\n", flatTime / frames * 1e6, 100.0 * flatVisibleTotal / tests,
+		(treeTime > 0) ? flatTime / treeTime : 0.0, (treeTime + refitTime > 0) ? flatTime / (treeTime + refitTime) : 0.0);
+	printf("tree/batch test mismatches: %ld\n", treeMismatches);
+	printf("culled by the tree but visible per node: %ld\n\n", treeWronglyCulled);
+
+	free(treeVisible);
+	CullingBoundsArray_free(&pending);
+	BoundingVolumeTree_free(&tree);
+	free(scalarMask);
+	free(planes);
+	free(nodes);
+	CullingBoundsArray_free(&bounds);
+	if (kernelMismatches > 0 || wronglyCulled > 0 || treeMismatches > 0 || treeWronglyCulled > 0) {
+		printf("FAILED\n");
+		return 1;
+	}
+	return 0;
+}
@@ -6,7 +6,7 @@
 #import "XTexture.h"
 #import "XGL.h"
 #import "XTerrain.h"
-#import "XParticleSystem.h"
+#import "XParticleManager.h"
 #import "GSoundPool.h"
 
 
@@ -49,6 +49,9 @@ typedef GLubyte GBulletIndex;
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glIndexBuffer);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, glIndexCount * sizeof(GBulletIndex), iBuffArray, GL_STATIC_DRAW);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		
+		memoryType = XResourceMemory_Mesh;
+		memorySize = glVertexCount * sizeof(GBulletVertex) + glIndexCount * sizeof(GBulletIndex);
 	}
 	return self;
 }
@@ -148,22 +151,22 @@ typedef GLubyte GBulletIndex;
 		if (self.originator) {
 			XScalar camDistSq = [gGame->camera distanceSquaredTo:&intersect.point];
 			
-			XParticleEffect *effect;
+			// pick the detail level by distance; the particle manager may lower it further when over budget
+			XParticleEffect *lodEffects[3] = {
+				self.originator->groundImpactEffect_high,
+				self.originator->groundImpactEffect_medium,
+				self.originator->groundImpactEffect_low
+			};
+			int lod;
 			if (camDistSq < 150*150)
-				effect = self.originator->groundImpactEffect_high;
+				lod = 0;
 			else if (camDistSq < 300*300)
-				effect = self.originator->groundImpactEffect_medium;
+				lod = 1;
 			else
-				effect = self.originator->groundImpactEffect_low;
+				lod = 2;
 			
 			float light = xSaturate([gGame->terrain sampleTerrainLightmapAt:&intersect.point] * 4 - 0.3f);			
-			XParticleSystem *particles = [[XParticleSystem alloc] initWithEffect:effect andShade:light];
-			particles->position = intersect.point;
-			[particles notifyTransformsChanged];
-			[particles beginAnimation];
-			particles.scene = gGame->scene;
-			[gGame->particlesPool addObject:particles];
-			[particles release];
+			[gGame->particleManager spawnEffectLODs:&lodEffects[lod] count:(3 - lod) at:&intersect.point shade:light];
 		}
 		// sound effect
 		[gGame->soundPool playImpactSoundAt:&intersect.point forcePlay:NO];
@@ -241,20 +244,20 @@ typedef GLubyte GBulletIndex;
 }
 
 
--(NSString*)getRenderGroupID
+-(XRenderSortKey)getRenderGroupKey
 {
-	return @"0_bullet";
+	return xRenderGroupKey(XRenderPass_Bullets, 0, type.texture.glTexture, type.glVertexBuffer);
 }
 
 -(void)beginRenderGroup
 {
-	glDisable(GL_LIGHTING);
-	glDisable(GL_CULL_FACE);
+	xglDisable(GL_LIGHTING);
+	xglDisable(GL_CULL_FACE);
 
 	if (xglCheckBindTextures(type.texture.glTexture, 0)) {
-		glActiveTexture(GL_TEXTURE0);
+		xglActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, type.texture.glTexture);
-		glEnable(GL_TEXTURE_2D);
+		xglEnable(GL_TEXTURE_2D);
 	}
 	
 	if (xglCheckBindMesh(type.glVertexBuffer, type.glIndexBuffer)) {
@@ -263,15 +266,15 @@ typedef GLubyte GBulletIndex;
 		glVertexPointer(3, GL_FLOAT, sizeof(GBulletVertex), (void*)offsetof(GBulletVertex,position));
 		glTexCoordPointer(2, GL_FLOAT, sizeof(GBulletVertex), (void*)offsetof(GBulletVertex,texcoord));
 		
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		xglEnableClientState(GL_VERTEX_ARRAY);
+		xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	}
 }
 
 -(void)endRenderGroup
 {
-	glEnable(GL_LIGHTING);	
-	glEnable(GL_CULL_FACE);
+	xglEnable(GL_LIGHTING);	
+	xglEnable(GL_CULL_FACE);
 }
 
 -(void)render:(XCamera*)cam
@@ -8,6 +8,7 @@
 #import "XSkyBox.h"
 #import "XClutterSystem.h"
 #import "XTreeSystem.h"
+#import "GMapLoader.h"
 @class GTank;
 @class GTankPlayerController;
 @class GBulletPool;
@@ -17,6 +18,8 @@
 @class GSoundPool;
 @class MMenu;
 @class GBMusicTrack;
+@class XMapBundle;
+@class XParticleManager;
 
 #define MAX_ACTIVE_TOUCHES 3
 
@@ -27,12 +30,24 @@ typedef enum {
 	GWinStatus_Defeat,
 } GWinStatus;
 
+typedef enum {
+	MapLoad_Preparing,	// waiting for the GMapLoader worker thread
+	MapLoad_Terrain,
+	MapLoad_Trees,
+	MapLoad_Clutter,
+	MapLoad_Sky,
+	MapLoad_Teams,		// one team per stage
+	MapLoad_Objects,
+	MapLoad_Done
+} GMapLoadStage;
+
 
 @interface GGame : NSObject <GLViewDelegate, UIAccelerometerDelegate> {
 	// frame timing
 	int frameCounter, totalFrameCounter, readingCounter;
 	float frameTimer;
 	int frameSkipCount;
+	int hudFrames, hudTextureBinds; // for the log (see renderFrame)
 	
 	// camera
 	XAngle freecamAngle;
@@ -49,6 +64,13 @@ typedef enum {
 	XSeconds saveGameTimer;
 	NSString *currentMapFilename;
 	
+	// map loading
+	GMapLoader *mapLoader;
+	GMapLoadStage mapLoadStage;
+	int mapLoadTeamIndex;
+	NSMutableArray *preloadRequests; // media requested from the map's manifest, held until loading is done
+	id<GMapLoadingDelegate> mapLoadingDelegate;
+	
 @public
 	// menu system
 	MMenu *menu;
@@ -63,6 +85,7 @@ typedef enum {
 	
 	// map
 	BOOL mapIsLoaded;
+	XMapBundle *mapBundle;
 	XScene *scene;
 	XCamera *camera;
 	XSkyBox *sky;
@@ -79,7 +102,7 @@ typedef enum {
 	NSMutableArray *outpostList;
 	NSMutableArray *tankList, *removeTankList;
 	GBulletPool *bulletGroup;
-	NSMutableArray *particlesPool;
+	XParticleManager *particleManager;
 	
 	// game
 	GWinStatus winStatus;
@@ -109,11 +132,18 @@ typedef enum {
 }
 
 @property(assign) BOOL tutorialMode;
+@property(readonly) float mapLoadProgress;
+@property(assign) id<GMapLoadingDelegate> mapLoadingDelegate;
 
 -(id)init;
 -(void)dealloc;
 
 -(void)loadMap:(NSString*)filename;
+
+// asynchronous loading: after beginLoadingMap, call continueLoadingMap once per frame (on the
+// render thread) until it returns YES; mapIsLoaded is NO afterwards if loading failed
+-(void)beginLoadingMap:(NSString*)filename;
+-(BOOL)continueLoadingMap:(XSeconds)timeBudget;
 -(void)unloadMap;
 
 -(void)saveGame;
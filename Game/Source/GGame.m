@@ -2,7 +2,10 @@
 
 #import "GGame.h"
 #import "XScript.h"
+#import "XMapBundle.h"
+#import "XResourceLoader.h"
 #import "XParticleSystem.h"
+#import "XParticleManager.h"
 #import "GTeam.h"
 #import "GTank.h"
 #import "GOutpost.h"
@@ -13,13 +16,37 @@
 #import "GSoundPool.h"
 #import "MMenu.h"
 #import "GBMusicTrack.h"
+#import "GMapManifest.h"
 #import "AppDelegate.h"
+#import <libkern/OSAtomic.h>
+
+// dead (unreferenced) media is freed least recently used first once a media group holds more than this
+#define MEDIA_MEMORY_BUDGET (24 * 1024 * 1024)
+
+// time per frame spent finishing (uploading) media loaded in the background
+#define MEDIA_REQUEST_FRAME_BUDGET 0.002f
+
+// particles live at once, and the screen area they may cover (in full screens), for this device; maps
+// can scale both with "particle_budget <scale>" (see XParticleBudget)
+#define PARTICLE_BUDGET_MAX_PARTICLES 1536
+#define PARTICLE_BUDGET_MAX_FILL 8.0f
 
 GGame *gGame = nil; //GGame singleton
 
 
+@interface GGame (private)
+
+-(void)requestMapMedia:(NSString*)filename;
+-(void)runMapLoadStage;
+-(void)loadTeamFromScript:(XScriptNode*)teamNode;
+
+@end
+
+
 @implementation GGame
 
+@synthesize mapLoadingDelegate;
+
 -(id)init
 {
 	if ((self = [super init])) {
@@ -31,10 +58,18 @@ GGame *gGame = nil; //GGame singleton
 		srand(time(NULL));
 		srand(rand());
 		
+#ifdef DEBUG
+		// count draw calls, uploads and state changes for the log (see renderFrame)
+		xglSetRenderDevice(xglRecordingDevice(xglGLESDevice()));
+#endif
+		
 		soundPool = [[GSoundPool alloc] init];
 		
 		commonMedia = [[XMediaGroup alloc] init];
+		[commonMedia addTextureAtlas:@"Media/HUD/hud.atlas"]; // HUD icons share one texture
 		mapMedia = [[XMediaGroup alloc] init];
+		commonMedia.memoryBudget = MEDIA_MEMORY_BUDGET;
+		mapMedia.memoryBudget = MEDIA_MEMORY_BUDGET;
 		
 		accel_sync.x = 0; accel_sync.y = 0; accel_sync.z = 0;
 		accel_lock = [[NSLock alloc] init];
@@ -48,7 +83,6 @@ GGame *gGame = nil; //GGame singleton
 		tankList = [[NSMutableArray alloc] initWithCapacity:10];
 		removeTankList = [[NSMutableArray alloc] initWithCapacity:5];
 		outpostList = [[NSMutableArray alloc] initWithCapacity:5];
-		particlesPool = [[NSMutableArray alloc] initWithCapacity:20];
 		
 		mapIsLoaded = NO;
 	}
@@ -61,7 +95,6 @@ GGame *gGame = nil; //GGame singleton
 	[tankList release];
 	[removeTankList release];
 	[outpostList release];
-	[particlesPool release];
 	
 	[accel_lock release];
 	[[UIAccelerometer sharedAccelerometer] setDelegate:nil];
@@ -260,6 +293,14 @@ GGame *gGame = nil; //GGame singleton
 }
 
 -(void)loadMap:(NSString*)filename
+{
+	// synchronous loading, with no frame time budget
+	[self beginLoadingMap:filename];
+	while (![self continueLoadingMap:1000])
+		[NSThread sleepForTimeInterval:0.001];
+}
+
+-(void)beginLoadingMap:(NSString*)filename
 {
 	if (mapIsLoaded)
 		[self unloadMap];
@@ -281,199 +322,319 @@ GGame *gGame = nil; //GGame singleton
 	paused = NO;
 	mapMode = NO;
 	
-	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
-	XScriptNode *scriptFile = [[XScriptNode alloc] initWithFile:filename]; assert(scriptFile);
-	XScriptNode *root = [scriptFile getSubnodeByName:@"map"]; assert(root);
+	// keep pooled internal particle buffers in memory even when no particles are rendered
+	[XParticleSystem retainPooledBuffers];
+	particleManager = [[XParticleManager alloc] initWithScene:scene slots:XPARTICLE_MANAGER_DEFAULT_SLOTS];
+	XParticleBudget particleBudget = particleManager.budget;
+	particleBudget.maxLiveParticles = PARTICLE_BUDGET_MAX_PARTICLES;
+	particleBudget.maxFill = PARTICLE_BUDGET_MAX_FILL;
+	particleManager.budget = particleBudget;
 	
-	NSString *mapFolder = [@"Media/" stringByAppendingString:[[root getSubnodeByName:@"media_folder"] getValue:0]];
-	NSString *detailMapFile = [@"Media/Common/Textures/" stringByAppendingPathComponent:[[root getSubnodeByName:@"detail_map"] getValue:0]];
-	srand([mapFolder hash]);
+	// CPU stages run on a worker thread, and GL resources are created by continueLoadingMap
+	mapLoader = [[GMapLoader alloc] initWithMap:filename];
+	[mapLoader start];
+	mapLoadStage = MapLoad_Preparing;
+	mapLoadTeamIndex = 0;
 	
-	// load terrain
-	terrain = [[XTerrain alloc] initWithHeightmap:[mapFolder stringByAppendingString:@"heightmap.png"] skirtSize:3.0];
-	[terrain setTextureMap:[mapFolder stringByAppendingPathComponent:@"texturemap.png"] usingMedia:mapMedia];
-	[terrain setDetailMap:detailMapFile usingMedia:mapMedia];
-//	terrain.lodRange = 1500;
-	terrain.lodRange = 3000;
-	terrain->boundingBox.min.x = -512;
-	terrain->boundingBox.min.z = -512;
-	terrain->boundingBox.max.x = 512;
-	terrain->boundingBox.max.z = 512;
-	terrain->boundingBox.min.y = 0;
+	// meanwhile the media the map uses is read and decoded in the background, and the load stages pick it up as they go
+	[self requestMapMedia:filename];
+}
+
+-(void)requestMapMedia:(NSString*)filename
+{
+	GMapManifest *manifest = [[GMapManifest alloc] initWithMap:filename];
+	preloadRequests = [[NSMutableArray alloc] initWithCapacity:manifest.entries.count];
+	for (GManifestEntry *entry in manifest.entries) {
+		Class resourceType = NSClassFromString(entry.typeName);
+		if (resourceType == nil) {
+			NSLog(@"Error preloading \"%@\": Unknown resource type \"%@\".", entry.filename, entry.typeName);
+			continue;
+		}
+		XMediaGroup *media = (entry.media == GManifestMedia_Common) ? commonMedia : mapMedia;
+		XResourceRequest *request = [media newRequestForResource:resourceType fromFile:entry.filename];
+		[preloadRequests addObject:request];
+		[request release];
+	}
+#ifdef DEBUG
+	NSLog(@"Preloading %d resources (%llu KB) for map \"%@\"", manifest.entries.count, manifest.totalFileSize / 1024, filename);
+#endif
+	[manifest release];
+}
+
+-(BOOL)continueLoadingMap:(XSeconds)timeBudget
+{
+	if (mapLoader == nil)
+		return YES;
 	
-	XScriptNode *hrNode = [root getSubnodeByName:@"height_range"];
-	if (hrNode)
-		terrain->boundingBox.max.y = [hrNode getValueF:0];
-	else
-		terrain->boundingBox.max.y = 50;
+	// run as many render thread stages as fit in the time budget (but always at least one)
+	CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+	do {
+		if (mapLoadStage == MapLoad_Preparing) {
+			if (!mapLoader.prepared) {
+				// upload whatever media is ready while waiting for the terrain
+				XSeconds remainingTime = timeBudget - (CFAbsoluteTimeGetCurrent() - startTime);
+				[mapMedia finishRequestsWithTimeBudget:remainingTime];
+				[commonMedia finishRequestsWithTimeBudget:remainingTime];
+				break;
+			}
+			// pairs with the barrier the worker thread issues before setting "prepared", so none of
+			// the loader's results are read before it's seen
+			OSMemoryBarrier();
+			if (mapLoader.failed) {
+				NSLog(@"Error loading map \"%@\": Loading aborted.", currentMapFilename);
+				[self unloadMap];
+				[mapLoadingDelegate mapLoadingProgressed:1];
+				return YES;
+			}
+		}
+		NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+		[self runMapLoadStage];
+		[autoreleasePool release];
+	} while (mapLoadStage != MapLoad_Done && (CFAbsoluteTimeGetCurrent() - startTime) < timeBudget);
+	
+	[mapLoadingDelegate mapLoadingProgressed:self.mapLoadProgress];
 	
-	[terrain notifyBoundsChanged];
-	terrain.scene = scene;
+	if (mapLoadStage == MapLoad_Done) {
+		[mapLoader release];
+		mapLoader = nil;
+		[preloadRequests release]; // (everything loaded is now retained by whatever uses it)
+		preloadRequests = nil;
+#ifdef XSCENE_BENCHMARK
+		[commonMedia logLookupBenchmark];
+		[mapMedia logLookupBenchmark];
+		[XMesh logLoadBenchmarkForFolder:@"Media/Tanks"];
+#endif
+		return YES;
+	}
+	return NO;
+}
+
+-(float)mapLoadProgress
+{
+	if (mapLoader == nil)
+		return 1;
+	if (mapLoadStage == MapLoad_Preparing)
+		return mapLoader.progress;
+	// the worker thread's stages account for the first half of the progress
+	return 0.5f + 0.5f * ((float)mapLoadStage / (float)MapLoad_Done);
+}
+
+-(void)runMapLoadStage
+{
+	XScriptNode *root = [mapLoader->scriptFile getSubnodeByName:@"map"];
+	NSString *mapFolder = mapLoader->mapFolder;
 	
-	// load trees
-	XScriptNode *node = [root getSubnodeByName:@"trees"];
-	if (node) {
-		NSString *billboardFile = [@"Media/Common/Trees/" stringByAppendingString:[node getValue:1]];
-		XTexture *tex = [XTexture mediaRetainFile:billboardFile usingMedia:mapMedia];
-		if (tex) {
-			glBindTexture(GL_TEXTURE_2D, tex.glTexture);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glBindTexture(GL_TEXTURE_2D, 0);
+	switch (mapLoadStage) {
+		case MapLoad_Preparing:
+		case MapLoad_Terrain: {
+			mapBundle = [mapLoader->mapBundle retain];
+			srand((unsigned int)ResourceTable_hashString([mapFolder UTF8String])); // (the same on every device)
 			
-			treeSystem = [[XTreeSystem alloc] init];
-			treeSystem->boundingBox = terrain->boundingBox;
-			[treeSystem notifyBoundsChanged];
+			// load terrain (its height data stays owned by the bundle / loader)
+			id terrainDataOwner = mapBundle ? (id)mapBundle : (id)mapLoader;
+			terrain = [[XTerrain alloc] initWithTerrainData:&mapLoader->terrainData owner:terrainDataOwner];
+			[mapLoader discardChunkVertexes];
+			
+			NSString *detailMapFile = [@"Media/Common/Textures/" stringByAppendingPathComponent:[[root getSubnodeByName:@"detail_map"] getValue:0]];
+			[terrain setTextureMap:[mapFolder stringByAppendingPathComponent:@"texturemap.png"] usingMedia:mapMedia];
+			[terrain setDetailMap:detailMapFile usingMedia:mapMedia];
+		//	terrain.lodRange = 1500;
+			terrain.lodRange = 3000;
+			terrain->boundingBox.min.x = -512;
+			terrain->boundingBox.min.z = -512;
+			terrain->boundingBox.max.x = 512;
+			terrain->boundingBox.max.z = 512;
+			terrain->boundingBox.min.y = 0;
+			
+			XScriptNode *hrNode = [root getSubnodeByName:@"height_range"];
+			if (hrNode)
+				terrain->boundingBox.max.y = [hrNode getValueF:0];
+			else
+				terrain->boundingBox.max.y = 50;
+			
+			[terrain notifyBoundsChanged];
+			terrain.scene = scene;
+			
+			// maps with heavier fighting can raise the particle budget (or lower it)
+			XScriptNode *pbNode = [root getSubnodeByName:@"particle_budget"];
+			if (pbNode && [pbNode getValueF:0] > 0) {
+				XParticleBudget particleBudget = particleManager.budget;
+				particleBudget.maxLiveParticles = (int)(PARTICLE_BUDGET_MAX_PARTICLES * [pbNode getValueF:0]);
+				particleBudget.maxFill = PARTICLE_BUDGET_MAX_FILL * [pbNode getValueF:0];
+				particleManager.budget = particleBudget;
+			}
+			mapLoadStage = MapLoad_Trees;
+			break; }
+			
+		case MapLoad_Trees: {
+			// load trees
+			XScriptNode *node = [root getSubnodeByName:@"trees"];
+			if (node) {
+				NSString *billboardFile = [@"Media/Common/Trees/" stringByAppendingString:[node getValue:1]];
+				XTexture *tex = [XTexture mediaRetainFile:billboardFile usingMedia:mapMedia];
+				if (tex) {
+					glBindTexture(GL_TEXTURE_2D, tex.glTexture);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+					glBindTexture(GL_TEXTURE_2D, 0);
+					
+					treeSystem = [[XTreeSystem alloc] init];
+					treeSystem->boundingBox = terrain->boundingBox;
+					[treeSystem notifyBoundsChanged];
 
-			treeSystem.terrain = terrain;
-			treeSystem.scene = scene;
-			treeSystem.texture = tex;
-			[tex mediaRelease];
-		
-			treeCount = [node getValueI:0];
-			treeArray = malloc(sizeof(XTreeInstance) * treeCount);
-			XScalarRect area;
-			float width = terrain->boundingBox.max.x - terrain->boundingBox.min.x;
-			float height = terrain->boundingBox.max.z - terrain->boundingBox.min.z;
-			area.left = terrain->boundingBox.min.x + width * 0.1f; area.right = terrain->boundingBox.max.x - width * 0.1f;
-			area.top = terrain->boundingBox.min.z + height * 0.1f; area.bottom = terrain->boundingBox.max.z - height * 0.1f;
+					treeSystem.terrain = terrain;
+					treeSystem.scene = scene;
+					treeSystem.texture = tex;
+					[tex mediaRelease];
+				
+					// take over the trees populated by the loader
+					treeArray = mapLoader->treeArray;
+					treeCount = mapLoader->treeCount;
+					mapLoader->treeArray = NULL;
+					mapLoader->treeCount = 0;
+					
+					[treeSystem setTreesArrayPointer:treeArray treeCount:treeCount];
+					[treeSystem updateAllTrees];
+				}
+			}
+			mapLoadStage = MapLoad_Clutter;
+			break; }
 			
-			int seed = [[node getSubnodeByName:@"seed"] getValueI:0];
-			srand([mapFolder hash] + seed);
+		case MapLoad_Clutter: {
+			// load clutter
+			XScriptNode *node = [root getSubnodeByName:@"clutter"];
+			if (node) {
+				int clutterQuads = [node getValueI:0] * 5; // multiplier is a hack to "scale up" graphics for retina (each instance draws two crossed quads)
+				NSString *atlasFile = [@"Media/Common/Clutter/" stringByAppendingString:[node getValue:1]];
+				XTexture *tex = [XTexture mediaRetainFile:atlasFile usingMedia:mapMedia];
+				if (tex) {
+					glBindTexture(GL_TEXTURE_2D, tex.glTexture);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+					glBindTexture(GL_TEXTURE_2D, 0);
+					
+					clutter = [[XClutterSystem alloc] initWithSize:clutterQuads];
+					clutter.terrain = terrain;
+					clutter.scene = scene;
+					clutter.atlasTexture = tex;
+					[tex mediaRelease];
+					
+					[clutter loadClutterTypesFromScript:node];
+				}
+			}
+			mapLoadStage = MapLoad_Sky;
+			break; }
 			
-			float minSize = 8, maxSize = 12;
-			XScriptNode *snode = [node getSubnodeByName:@"size"];
-			if (snode) {
-				minSize = [snode getValueF:0];
-				maxSize = [snode getValueF:1];
+		case MapLoad_Sky: {
+			// load sky
+			NSString *skyboxName = [[root getSubnodeByName:@"sky_box"] getValue:0];
+			NSString *skyboxPath = [@"Media/Common/Skyboxes/" stringByAppendingPathComponent:skyboxName];
+			sky = [[XSkyBox alloc] initFromFolder:skyboxPath filePrefix:@"sky" fileExtension:@"jpg" usingMedia:mapMedia];
+			sky.scene = scene;
+			
+			srand(time(NULL));
+			mapLoadStage = MapLoad_Teams;
+			break; }
+			
+		case MapLoad_Teams: {
+			// load teams defined in map file (one per stage)
+			NSArray *teamNodes = [root subnodesWithName:@"team"];
+			if (mapLoadTeamIndex < teamNodes.count) {
+				XScriptNode *teamNode = [teamNodes objectAtIndex:mapLoadTeamIndex++];
+				[self loadTeamFromScript:teamNode];
 			}
+			if (mapLoadTeamIndex >= teamNodes.count)
+				mapLoadStage = MapLoad_Objects;
+			break; }
 			
-			TreeSystem_populateTreeArrayProcedurally(treeArray, treeCount, minSize, maxSize, area);
+		case MapLoad_Objects: {
+			// spawn tanks initially
+			for (GTeam *team in teamList) {
+				[team frameUpdate:team.reinforcementInterval*1.5f];
+			}
 			
-			[treeSystem setTreesArrayPointer:treeArray treeCount:treeCount];
-			XIntRect region;
-			region.left = 0; region.right = TREE_BATCH_GRID_SIZE;
-			region.top = 0; region.bottom = TREE_BATCH_GRID_SIZE;
-			[treeSystem updateTreesRegion:region];
-		}
-	}
-	
-	// load clutter
-	node = [root getSubnodeByName:@"clutter"];
-	if (node) {
-		int clutterQuads = [node getValueI:0] * 10; // multiplier is a hack to "scale up" graphics for retina
-		NSString *atlasFile = [@"Media/Common/Clutter/" stringByAppendingString:[node getValue:1]];
-		XTexture *tex = [XTexture mediaRetainFile:atlasFile usingMedia:mapMedia];
-		if (tex) {
-			glBindTexture(GL_TEXTURE_2D, tex.glTexture);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glBindTexture(GL_TEXTURE_2D, 0);
+			// set up the player's controls
+			playerController = [[GTankPlayerController alloc] init];
 			
-			clutter = [[XClutterSystem alloc] initWithSize:clutterQuads];
-			clutter.terrain = terrain;
-			clutter.scene = scene;
-			clutter.atlasTexture = tex;
-			[tex mediaRelease];
+			// prepare bullets
+			static XResourceHandle bulletTypeHandle;
+			if (bulletTypeHandle.resourceID == 0)
+				bulletTypeHandle = xResourceHandle([GBulletType class], @"Media/Common/Effects/bullet.png");
+			GBulletType *bulletType = [GBulletType mediaRetainHandle:&bulletTypeHandle usingMedia:commonMedia];
+			bulletGroup = [[GBulletPool alloc] initWithType:bulletType capacity:40];
+			[bulletType mediaRelease];
 			
-			[clutter loadClutterTypesFromScript:node];
-		}
+			// load HUD
+			hud = [[GHUD alloc] init];
+			map = [[GMap alloc] init];
+			mapMode = YES;
+			mapLoadStage = MapLoad_Done;
+			break; }
+			
+		case MapLoad_Done:
+			break;
 	}
-	
-	// load sky
-	NSString *skyboxName = [[root getSubnodeByName:@"sky_box"] getValue:0];
-	NSString *skyboxPath = [@"Media/Common/Skyboxes/" stringByAppendingPathComponent:skyboxName];
-	sky = [[XSkyBox alloc] initFromFolder:skyboxPath filePrefix:@"sky" fileExtension:@"jpg" usingMedia:mapMedia];
-	sky.scene = scene;
-	
-	// load teams defined in map file
-	srand(time(NULL));
-	NSArray *teamNodes = [root subnodesWithName:@"team"];
-	for (XScriptNode *teamNode in teamNodes) {
-		// load team
-		GTeam *team = nil;
-		XMesh *neutralFlagpole = nil;
-		if ([teamNode getValue:0] == nil || [[teamNode getValue:0] isEqual:@"neutral"]) {
-			team = nil;
-			NSString *flagpoleFile = [@"Media/" stringByAppendingString:[[teamNode getSubnodeByName:@"pole_mesh"] getValue:0]];
-			neutralFlagpole = [XMesh mediaRetainFile:flagpoleFile usingMedia:commonMedia];
-		} else {
-			NSString *teamFile = [@"Media/" stringByAppendingString:[teamNode getValue:0]];
-			team = [[GTeam alloc] initWithFile:teamFile];
-			[teamList addObject:team];
-			[team release];
+}
+
+-(void)loadTeamFromScript:(XScriptNode*)teamNode
+{
+	// load team
+	GTeam *team = nil;
+	XMesh *neutralFlagpole = nil;
+	if ([teamNode getValue:0] == nil || [[teamNode getValue:0] isEqual:@"neutral"]) {
+		team = nil;
+		NSString *flagpoleFile = [@"Media/" stringByAppendingString:[[teamNode getSubnodeByName:@"pole_mesh"] getValue:0]];
+		neutralFlagpole = [XMesh mediaRetainFile:flagpoleFile usingMedia:commonMedia];
+	} else {
+		NSString *teamFile = [@"Media/" stringByAppendingString:[teamNode getValue:0]];
+		team = [[GTeam alloc] initWithFile:teamFile];
+		[teamList addObject:team];
+		[team release];
+	}
+	if ([[teamNode getValue:1] isEqual:@"player_team"])
+		playerTeam = team;
+	if (team) {
+		team.maxTanks = [[teamNode getSubnodeByName:@"tank_limit"] getValueI:0];
+		if (team.maxTanks == 0) {
+			team.maxTanks = 1;
+			NSLog(@"ERROR! tank_limit must be specified in map file for each team");
 		}
-		if ([[teamNode getValue:1] isEqual:@"player_team"])
-			playerTeam = team;
-		if (team) {
-			team.maxTanks = [[teamNode getSubnodeByName:@"tank_limit"] getValueI:0];
-			if (team.maxTanks == 0) {
-				team.maxTanks = 1;
-				NSLog(@"ERROR! tank_limit must be specified in map file for each team");
-			}
-			XScriptNode *node = [teamNode getSubnodeByName:@"reinforcement_interval"];
-			if (node)
-				team.reinforcementInterval = [node getValueF:0];
-			node = [teamNode getSubnodeByName:@"tanks_per_reinforcement"];
-			if (node)
-				team.numTanksPerReinforcement = [node getValueI:0];			
-			NSString *aiSkillStr = [[teamNode getSubnodeByName:@"ai_skill"] getValue:0];
-			if  (aiSkillStr) {
-				if ([aiSkillStr isEqualToString:@"rookie"])
-					team.aiSkill = AISkill_Rookie;
-				else if ([aiSkillStr isEqualToString:@"average"])
-					team.aiSkill = AISkill_Average;
-				else if ([aiSkillStr isEqualToString:@"expert"])
-					team.aiSkill = AISkill_Expert;
-				else if ([aiSkillStr isEqualToString:@"flawless"])
-					team.aiSkill = AISkill_Flawless;
-				else {
-					NSLog(@"Warning: AI skill level specified in map file for team \"%@\" is invalid.", [teamNode getValue:0]);
-				}
-			} else {
-				NSLog(@"Warning: AI skill level not specified in map file for team \"%@\".", [teamNode getValue:0]);
+		XScriptNode *node = [teamNode getSubnodeByName:@"reinforcement_interval"];
+		if (node)
+			team.reinforcementInterval = [node getValueF:0];
+		node = [teamNode getSubnodeByName:@"tanks_per_reinforcement"];
+		if (node)
+			team.numTanksPerReinforcement = [node getValueI:0];			
+		NSString *aiSkillStr = [[teamNode getSubnodeByName:@"ai_skill"] getValue:0];
+		if  (aiSkillStr) {
+			if ([aiSkillStr isEqualToString:@"rookie"])
+				team.aiSkill = AISkill_Rookie;
+			else if ([aiSkillStr isEqualToString:@"average"])
+				team.aiSkill = AISkill_Average;
+			else if ([aiSkillStr isEqualToString:@"expert"])
+				team.aiSkill = AISkill_Expert;
+			else if ([aiSkillStr isEqualToString:@"flawless"])
+				team.aiSkill = AISkill_Flawless;
+			else {
+				NSLog(@"Warning: AI skill level specified in map file for team \"%@\" is invalid.", [teamNode getValue:0]);
 			}
-		}		
-		// load team's outposts
-		NSArray *outpostNodes = [teamNode subnodesWithName:@"outpost"];
-		for (XScriptNode *outpostNode in outpostNodes) {
-			XVector2 pos;
-			pos.x = [outpostNode getValueF:0] - 512.0f;
-			pos.y = [outpostNode getValueF:1] - 512.0f;
-			GOutpost *outpost = [[GOutpost alloc] initAt:pos withFlagPole:neutralFlagpole];
-			outpost.owningTeam = team;
-			
-			[outpostList addObject:outpost];
-			[outpost release];
+		} else {
+			NSLog(@"Warning: AI skill level not specified in map file for team \"%@\".", [teamNode getValue:0]);
 		}
-		[neutralFlagpole mediaRelease];
-	}
-	// spawn tanks initially
-	for (GTeam *team in teamList) {
-		[team frameUpdate:team.reinforcementInterval*1.5f];
+	}		
+	// load team's outposts
+	NSArray *outpostNodes = [teamNode subnodesWithName:@"outpost"];
+	for (XScriptNode *outpostNode in outpostNodes) {
+		XVector2 pos;
+		pos.x = [outpostNode getValueF:0] - 512.0f;
+		pos.y = [outpostNode getValueF:1] - 512.0f;
+		GOutpost *outpost = [[GOutpost alloc] initAt:pos withFlagPole:neutralFlagpole];
+		outpost.owningTeam = team;
+		
+		[outpostList addObject:outpost];
+		[outpost release];
 	}
-	
-	// set up the player's controls
-	playerController = [[GTankPlayerController alloc] init];
-	
-	// prepare bullets
-	GBulletType *bulletType = [GBulletType mediaRetainFile:@"Media/Common/Effects/bullet.png" usingMedia:commonMedia];
-	bulletGroup = [[GBulletPool alloc] initWithType:bulletType capacity:40];
-	[bulletType mediaRelease];
-	
-	[scriptFile release];
-	[autoreleasePool release];
-	
-	// keep pooled internal particle buffers in memory even when no particles are rendered
-	[XParticleSystem retainPooledBuffers];
-	
-	// load HUD
-	hud = [[GHUD alloc] init];
-	map = [[GMap alloc] init];
-	mapMode = YES;
-	
-	// save game initially
-	[self saveGame];
+	[neutralFlagpole mediaRelease];
 }
 
 -(void)unloadMap
@@ -505,6 +666,17 @@ GGame *gGame = nil; //GGame singleton
 		return;
 	mapIsLoaded = NO;
 	
+	// stop loading (the loader's worker thread finishes on its own)
+	if (mapLoader) {
+		[mapLoader cancel];
+		[mapLoader release];
+		mapLoader = nil;
+	}
+	for (XResourceRequest *request in preloadRequests)
+		[request cancel];
+	[preloadRequests release];
+	preloadRequests = nil;
+	
 	[currentMapFilename release];
 	currentMapFilename = nil;
 	
@@ -520,13 +692,14 @@ GGame *gGame = nil; //GGame singleton
 
 	// nodes must be removed from the scene to be released, otherwise the
 	// scene will keep them alive.
-	for (XParticleSystem *particles in particlesPool)
-		particles.scene = nil;
-	[particlesPool removeAllObjects];
+	[particleManager removeAll];
+	[particleManager release];
+	particleManager = nil;
 	
 	[teamList removeAllObjects];
 	[outpostList removeAllObjects];
 	[bulletGroup release];
+	bulletGroup = nil;
 	
 	terrain.scene = nil;
 	[terrain release];
@@ -548,29 +721,43 @@ GGame *gGame = nil; //GGame singleton
 		treeSystem = nil;
 	}
 	if (treeArray) {
-		free(treeArray);
+		if (treeArray != [mapBundle trees])
+			free(treeArray);
 		treeArray = nil;
 		treeCount = 0;
 	}
 	
+	// (must be released after everything that uses its mapped data)
+	[mapBundle release];
+	mapBundle = nil;
+	
 	[mapMedia freeDeadResourcesNow];
 	
 	// dump pooled internal particle buffers
 	[XParticleSystem releasePooledBuffers];
 	
 	[hud release];
+	hud = nil;
 	[map release];
+	map = nil;
 }
 
 -(void)renderFrame:(XGameTime)gameTime
 {
 	// free memory if possible
 	if (lowMemory) {
+		size_t residentBefore = commonMedia.memoryStats.totalBytes + mapMedia.memoryStats.totalBytes;
 		[commonMedia freeDeadResourcesNow];
 		[mapMedia freeDeadResourcesNow];
+		size_t residentAfter = commonMedia.memoryStats.totalBytes + mapMedia.memoryStats.totalBytes;
+		NSLog(@"Freed %lu KB of unused media (%lu KB still in use)", (unsigned long)((residentBefore - residentAfter) / 1024), (unsigned long)(residentAfter / 1024));
 		lowMemory = NO;
 	}
 	
+	// finish media loaded in the background
+	[commonMedia finishRequestsWithTimeBudget:MEDIA_REQUEST_FRAME_BUDGET];
+	[mapMedia finishRequestsWithTimeBudget:MEDIA_REQUEST_FRAME_BUDGET];
+	
 	// capture input state
 	if ([accel_lock tryLock]) {
 		acceleration = accel_sync;
@@ -592,6 +779,61 @@ GGame *gGame = nil; //GGame singleton
 		frameCounter = 0;
 		frameTimer = gameTime.totalTime;
 		NSLog(@"(%d)  FPS: %d  Total frames: %d", ++readingCounter, FPS, totalFrameCounter);
+#ifdef DEBUG
+		XSceneStats sceneStats = scene.stats;
+		if (sceneStats.frames > 0) {
+			int frames = sceneStats.frames;
+			NSLog(@"      Culling (per frame): %d nodes, %d tree nodes visited, %d tested, %d visible",
+				  sceneStats.nodeCount / frames, sceneStats.treeNodesVisited / frames, sceneStats.nodesTested / frames, sceneStats.nodesVisible / frames);
+			NSLog(@"      Batching (per frame): %d batches drawing %d nodes, %d vertexes transformed",
+				  sceneStats.batches / frames, sceneStats.batchedNodes / frames, sceneStats.batchedVertexes / frames);
+#ifdef XSCENE_BENCHMARK
+			NSLog(@"      Culling time (per frame): tree %.3f ms, flat loop %.3f ms",
+				  sceneStats.treeCullTime * 1000.0 / frames, sceneStats.flatCullTime * 1000.0 / frames);
+			NSLog(@"      Batch transform time (per frame): %.3f ms", sceneStats.batchTransformTime * 1000.0 / frames);
+#endif
+		}
+		XRenderStats render = xglGetRenderStats();
+		if (FPS > 0) {
+			NSLog(@"      Rendering (per frame): %d draws, %d triangles, %d state changes (%d redundant skipped), %d texture binds, %d buffer binds, %d matrix ops, %d uploads (%d KB)",
+				  render.drawCalls / FPS, render.triangles / FPS, render.stateChanges / FPS, xglGetSkippedStateChanges() / FPS, render.textureBinds / FPS, render.bufferBinds / FPS,
+				  render.matrixOps / FPS, (render.bufferUploads + render.textureUploads) / FPS, (render.bufferUploadBytes + render.textureUploadBytes) / (FPS * 1024));
+		}
+		if (hudFrames > 0)
+			NSLog(@"      HUD (per frame): %.1f texture binds", (float)hudTextureBinds / hudFrames);
+		XMediaMemoryStats common = commonMedia.memoryStats, map = mapMedia.memoryStats;
+		NSLog(@"      Media: %d KB textures, %d KB meshes, %d KB other (%d KB unused, %d resources, %d evicted)",
+			  (int)(common.bytes[XResourceMemory_Texture] + map.bytes[XResourceMemory_Texture]) / 1024,
+			  (int)(common.bytes[XResourceMemory_Mesh] + map.bytes[XResourceMemory_Mesh]) / 1024,
+			  (int)(common.bytes[XResourceMemory_Other] + map.bytes[XResourceMemory_Other]) / 1024,
+			  (int)(common.deadBytes + map.deadBytes) / 1024, common.resources + map.resources, common.evictions + map.evictions);
+		hudFrames = 0;
+		hudTextureBinds = 0;
+		if (particleManager && particleManager.stats.frames > 0) {
+			XParticleStats particleStats = particleManager.stats;
+			int frames = particleStats.frames;
+			NSLog(@"      Particles (per frame): %d live (peak %d), %d systems, %.2f screens fill",
+				  particleStats.liveParticles / frames, particleStats.peakLiveParticles, particleStats.activeSystems / frames, particleStats.fill / frames);
+			NSLog(@"      Particle spawns: %d requested, %d spawned (%d downgraded, %d trimmed), %d merged, %d dropped",
+				  particleStats.spawnRequests, particleStats.spawned, particleStats.downgraded, particleStats.trimmed, particleStats.merged, particleStats.dropped);
+		}
+		if (treeSystem && treeSystem.stats.frames > 0) {
+			XTreeStats treeStats = treeSystem.stats;
+			int frames = treeStats.frames;
+			NSLog(@"      Trees (per frame): near %d batches / %d trees / %d vertexes, mid %d / %d / %d (%d generated), far %d / %d / %d",
+				  treeStats.batches[XTreeLOD_Near] / frames, treeStats.trees[XTreeLOD_Near] / frames, treeStats.vertexes[XTreeLOD_Near] / frames,
+				  treeStats.batches[XTreeLOD_Mid] / frames, treeStats.trees[XTreeLOD_Mid] / frames, treeStats.vertexes[XTreeLOD_Mid] / frames, treeStats.generatedVertexes / frames,
+				  treeStats.batches[XTreeLOD_Far] / frames, treeStats.trees[XTreeLOD_Far] / frames, treeStats.vertexes[XTreeLOD_Far] / frames);
+#ifdef XSCENE_BENCHMARK
+			NSLog(@"      Tree impostor time (per frame): %.3f ms", treeStats.impostorTime * 1000.0 / frames);
+#endif
+		}
+#endif
+		[scene resetStats];
+		[particleManager resetStats];
+		[treeSystem resetStats];
+		xglResetRenderStats();
+		xglResetStateCacheStats();
 	}
 	++frameCounter;
 	++totalFrameCounter;
@@ -625,15 +867,7 @@ GGame *gGame = nil; //GGame singleton
 		
 		[bulletGroup frameUpdate:gameTime.deltaTime];
 		
-		for (int i = 0; i < particlesPool.count; ++i) {
-			XParticleSystem *particles = [particlesPool objectAtIndex:i];
-			[particles updateAnimation:gameTime.deltaTime];
-			if (particles.isAnimating == NO) {
-				particles.scene = nil;
-				[particlesPool removeObjectAtIndex:i];
-				--i;
-			}
-		}
+		[particleManager frameUpdate:gameTime.deltaTime];
 		
 		// update win status
 		++frameSkipCount;
@@ -819,7 +1053,14 @@ GGame *gGame = nil; //GGame singleton
 	
 	if (!mapMode) {
 		// render the hud
+#ifdef DEBUG
+		int textureBinds = xglGetRenderStats().textureBinds;
+#endif
 		[hud draw:gameTime.deltaTime];
+#ifdef DEBUG
+		hudTextureBinds += xglGetRenderStats().textureBinds - textureBinds;
+		++hudFrames;
+#endif
 		paused = NO;
 	} else {	
 		// render the map
@@ -900,8 +1141,8 @@ GGame *gGame = nil; //GGame singleton
 
 -(void)saveGame
 {
-	// dont save if in menu mode or a map isn't loaded
-	if (menuMode || !mapIsLoaded)
+	// dont save if in menu mode or a map isn't (fully) loaded
+	if (menuMode || !mapIsLoaded || mapLoader)
 		return;
 	
 	NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
@@ -0,0 +1,53 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XTerrainGeometry.h"
+#import "XTreePlacement.h"
+@class XScriptNode;
+@class XMapBundle;
+
+// Receives map loading progress (always on the render thread), see -[GGame beginLoadingMap:]
+@protocol GMapLoadingDelegate
+
+-(void)mapLoadingProgressed:(float)progress;
+
+@end
+
+
+// GMapLoader performs the CPU-only stages of loading a map on a worker thread: opening the
+// map bundle (or parsing the map script), decoding the heightmap and shadow map, building terrain
+// chunk vertexes and populating trees. Nothing here touches GL, so the results are handed to
+// GGame which creates all GL resources on the render thread, a few stages per frame.
+@interface GMapLoader : NSObject {
+	NSString *mapFilename;
+	volatile BOOL prepared, failed, cancelled;
+	volatile float progress;
+
+	// data owned by the loader (when not mapped from a bundle)
+	float *heights;
+	unsigned char *shadowMap;
+	XTerrainVertex *chunkVertexes;
+
+@public
+	// results, valid once "prepared" is set
+	XMapBundle *mapBundle;
+	XScriptNode *scriptFile;
+	NSString *mapFolder;
+	XTerrainData terrainData;
+	XTreeInstance *treeArray; // (malloc'd unless it points into the map bundle)
+	int treeCount;
+}
+
+@property(readonly) BOOL prepared;
+@property(readonly) BOOL failed;
+@property(readonly) float progress;
+
+-(id)initWithMap:(NSString*)filename;
+-(void)dealloc;
+
+-(void)start;
+-(void)cancel;
+
+// frees the terrain chunk vertexes once they have been uploaded
+-(void)discardChunkVertexes;
+
+@end
@@ -0,0 +1,186 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "GMapLoader.h"
+#import "XScript.h"
+#import "XMapBundle.h"
+#import "XResourceTable.h"
+#import "XTerrain.h"
+#import <libkern/OSAtomic.h>
+
+
+@interface GMapLoader (private)
+
+-(void)prepareMap;
+-(BOOL)prepareTerrain;
+-(void)prepareTrees:(XScriptNode*)root;
+
+@end
+
+
+@implementation GMapLoader
+
+@synthesize prepared, failed, progress;
+
+-(id)initWithMap:(NSString*)filename
+{
+	if ((self = [super init])) {
+		mapFilename = [filename copy];
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	if (treeArray && treeArray != [mapBundle trees])
+		free(treeArray);
+	if (heights)
+		free(heights);
+	if (shadowMap)
+		free(shadowMap);
+	[self discardChunkVertexes];
+	[mapBundle release];
+	[scriptFile release];
+	[mapFolder release];
+	[mapFilename release];
+	[super dealloc];
+}
+
+-(void)start
+{
+	// (the thread retains the loader until it's done, so it's safe to release a loader while it's working)
+	[NSThread detachNewThreadSelector:@selector(prepareMap) toTarget:self withObject:nil];
+}
+
+-(void)cancel
+{
+	cancelled = YES;
+}
+
+-(void)discardChunkVertexes
+{
+	if (chunkVertexes) {
+		free(chunkVertexes);
+		chunkVertexes = NULL;
+	}
+	terrainData.chunkVertexes = NULL;
+}
+
+-(void)prepareMap
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+
+	// use the pre-processed map bundle if one was built for this map (see MapPacker),
+	// otherwise everything is loaded from the map's source files
+	mapBundle = [[XMapBundle alloc] initWithMap:mapFilename];
+	if (mapBundle)
+		scriptFile = [mapBundle newScriptRoot];
+	else
+		scriptFile = [[XScriptNode alloc] initWithFile:mapFilename];
+	XScriptNode *root = [scriptFile getSubnodeByName:@"map"];
+	NSString *mediaFolder = [[root getSubnodeByName:@"media_folder"] getValue:0];
+	if (!root || !mediaFolder) {
+		NSLog(@"Error loading map \"%@\": Invalid map script", mapFilename);
+		failed = YES;
+	}
+	progress = 0.1f;
+
+	if (!failed && !cancelled) {
+		mapFolder = [[@"Media/" stringByAppendingString:mediaFolder] retain];
+		if (![self prepareTerrain])
+			failed = YES;
+	}
+	if (!failed && !cancelled)
+		[self prepareTrees:root];
+	progress = 0.5f;
+
+	// make sure all results are visible to the render thread before it sees "prepared"
+	OSMemoryBarrier();
+	prepared = YES;
+
+	[autoreleasePool release];
+}
+
+-(BOOL)prepareTerrain
+{
+	if (mapBundle) {
+		terrainData = [mapBundle terrainData];
+		return YES;
+	}
+
+	int terrainRes;
+	heights = [XTerrain newHeightDataFromFile:[mapFolder stringByAppendingString:@"heightmap.png"] resolution:&terrainRes];
+	if (!heights)
+		return NO;
+	progress = 0.25f;
+	if (cancelled)
+		return NO;
+
+	int shadowMapRes = 0;
+	shadowMap = [XTerrain newShadowMapFromFile:[mapFolder stringByAppendingPathComponent:@"texturemap.png"] maxResolution:terrainRes resolution:&shadowMapRes];
+	progress = 0.35f;
+	if (cancelled)
+		return NO;
+
+	// build all chunk meshes, so only the GL upload is left for the render thread
+	int chunkTileRes = (terrainRes-1) / TERRAIN_CHUNK_GRID_SIZE;
+	int chunkVertexCount = TerrainGeometry_chunkVertexCount(chunkTileRes);
+	float skirtHeight = TerrainGeometry_skirtHeight(terrainRes, 3.0f);
+	chunkVertexes = (XTerrainVertex*)malloc(TERRAIN_CHUNK_GRID_SIZE * TERRAIN_CHUNK_GRID_SIZE * chunkVertexCount * sizeof(XTerrainVertex));
+	for (int y = 0; y < TERRAIN_CHUNK_GRID_SIZE; ++y) {
+		for (int x = 0; x < TERRAIN_CHUNK_GRID_SIZE; ++x) {
+			XIntRect region;
+			region.left = chunkTileRes * x;
+			region.top = chunkTileRes * y;
+			region.right = chunkTileRes * (x+1);
+			region.bottom = chunkTileRes * (y+1);
+			XTerrainVertex *vertexes = chunkVertexes + (y * TERRAIN_CHUNK_GRID_SIZE + x) * chunkVertexCount;
+			TerrainGeometry_buildChunkVertexes(vertexes, heights, terrainRes, region, chunkTileRes, skirtHeight);
+		}
+	}
+	progress = 0.45f;
+
+	terrainData.terrainRes = terrainRes;
+	terrainData.skirtHeight = skirtHeight;
+	terrainData.heights = heights;
+	terrainData.shadowMap = shadowMap;
+	terrainData.shadowMapRes = shadowMapRes;
+	terrainData.chunkVertexes = chunkVertexes;
+	return YES;
+}
+
+-(void)prepareTrees:(XScriptNode*)root
+{
+	XScriptNode *node = [root getSubnodeByName:@"trees"];
+	if (!node)
+		return;
+
+	treeCount = [node getValueI:0];
+	if (mapBundle && mapBundle.treeCount == treeCount) {
+		// baked trees are used directly from the bundle
+		treeArray = (XTreeInstance*)[mapBundle trees];
+		return;
+	}
+
+	// (GGame always places the terrain at [-512,512] on the X/Z axes)
+	treeArray = malloc(sizeof(XTreeInstance) * treeCount);
+	XScalarRect area;
+	float width = 1024, height = 1024;
+	area.left = -512 + width * 0.1f; area.right = 512 - width * 0.1f;
+	area.top = -512 + height * 0.1f; area.bottom = 512 - height * 0.1f;
+
+	XTreePlacementParams params;
+	memset(&params, 0, sizeof(params));
+	params.area = area;
+	params.minTreeSize = 8; params.maxTreeSize = 12;
+	XScriptNode *snode = [node getSubnodeByName:@"size"];
+	if (snode) {
+		params.minTreeSize = [snode getValueF:0];
+		params.maxTreeSize = [snode getValueF:1];
+	}
+	params.seed = (unsigned int)ResourceTable_hashString([mapFolder UTF8String]) + [[node getSubnodeByName:@"seed"] getValueI:0];
+	params.threadCount = 2;
+
+	treeCount = TreePlacement_populatePoissonDisk(treeArray, treeCount, &params);
+}
+
+@end
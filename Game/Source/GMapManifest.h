@@ -0,0 +1,55 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// GMapManifest lists the media a map will load, found by walking its script graph the same way GGame,
+// GTeam, GTank and XParticleEffect do (map -> teams -> tanks -> meshes, textures and effects -> effect
+// textures), so that everything can be requested from the media groups up front and loaded in parallel
+// instead of being discovered one file at a time (see -[GGame beginLoadingMap:]).
+//
+// Entries are in dependency order (textures before the effects which use them) with duplicates removed.
+// Textures embedded in meshes and sounds (which are loaded once by GSoundPool) are not listed, and are
+// still loaded on demand.
+//
+// Only Foundation and XScript are used, so the ManifestScanner tool builds this file as well.
+
+typedef enum {
+	GManifestMedia_Map = 0,	// gGame->mapMedia
+	GManifestMedia_Common	// gGame->commonMedia
+} GManifestMedia;
+
+
+@interface GManifestEntry : NSObject {
+	NSString *typeName;
+	NSString *filename;
+	GManifestMedia media;
+}
+
+@property(readonly) NSString *typeName; //(the XResource subclass' name)
+@property(readonly) NSString *filename;
+@property(readonly) GManifestMedia media;
+
+-(id)initWithType:(NSString*)type fromFile:(NSString*)file media:(GManifestMedia)mediaGroup;
+-(void)dealloc;
+
+@end
+
+
+@interface GMapManifest : NSObject {
+	NSString *mediaRoot;
+	NSMutableArray *entries;
+	NSMutableSet *entryKeys;
+}
+
+@property(readonly) NSArray *entries;
+
+// filenames are relative to the app bundle (e.g. "Media/Maps/level1.map")
+-(id)initWithMap:(NSString*)filename;
+// or to the given folder, for use outside the app (root should contain "Media")
+-(id)initWithMap:(NSString*)filename mediaRoot:(NSString*)root;
+-(void)dealloc;
+
+// the size of the file the device loads for an entry (e.g. a texture's .pvr or .xtex when shipped)
+-(unsigned long long)fileSizeOfEntry:(GManifestEntry*)entry;
+-(unsigned long long)totalFileSize;
+
+@end
+
@@ -0,0 +1,281 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "GMapManifest.h"
+#import "XScript.h"
+
+
+@implementation GManifestEntry
+
+@synthesize typeName, filename, media;
+
+-(id)initWithType:(NSString*)type fromFile:(NSString*)file media:(GManifestMedia)mediaGroup
+{
+	if ((self = [super init])) {
+		typeName = [type copy];
+		filename = [file copy];
+		media = mediaGroup;
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	[typeName release];
+	[filename release];
+	[super dealloc];
+}
+
+@end
+
+
+@interface GMapManifest (private)
+
+-(XScriptNode*)newScript:(NSString*)file;
+-(BOOL)alreadyScanned:(NSString*)file;
+-(void)addType:(NSString*)type fromFile:(NSString*)file media:(GManifestMedia)media;
+-(void)scanMap:(NSString*)filename;
+-(void)scanTeam:(NSString*)filename;
+-(void)scanTank:(NSString*)filename textures:(NSArray*)textureNodes;
+-(void)scanEffect:(NSString*)filename;
+
+@end
+
+
+@implementation GMapManifest
+
+@synthesize entries;
+
+-(id)initWithMap:(NSString*)filename
+{
+	return [self initWithMap:filename mediaRoot:nil];
+}
+
+-(id)initWithMap:(NSString*)filename mediaRoot:(NSString*)root
+{
+	if ((self = [super init])) {
+		if (root == nil)
+			root = [[NSBundle mainBundle] resourcePath];
+		mediaRoot = [root copy];
+		entries = [[NSMutableArray alloc] init];
+		entryKeys = [[NSMutableSet alloc] init];
+
+		NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+		[self scanMap:filename];
+		[autoreleasePool release];
+
+		// (only needed while scanning)
+		[entryKeys release];
+		entryKeys = nil;
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	[entryKeys release];
+	[entries release];
+	[mediaRoot release];
+	[super dealloc];
+}
+
+-(unsigned long long)fileSizeOfEntry:(GManifestEntry*)entry
+{
+	NSFileManager *fileManager = [NSFileManager defaultManager];
+	NSString *path = [mediaRoot stringByAppendingPathComponent:entry.filename];
+
+	// textures load "[file].pvr" first on devices with PVRTC, then a cooked "[file].xtex" (see loadMipFrames in XTexture.m)
+	if ([entry.typeName isEqualToString:@"XTexture"] || [entry.typeName isEqualToString:@"XTextureNomip"]) {
+		NSString *compressedPath = [path stringByAppendingPathExtension:@"pvr"];
+		NSString *cookedPath = [path stringByAppendingPathExtension:@"xtex"];
+		if ([fileManager fileExistsAtPath:compressedPath])
+			path = compressedPath;
+		else if ([fileManager fileExistsAtPath:cookedPath])
+			path = cookedPath;
+	}
+
+	NSDictionary *attributes = [fileManager attributesOfItemAtPath:path error:NULL];
+	return (attributes != nil) ? [attributes fileSize] : 0;
+}
+
+-(unsigned long long)totalFileSize
+{
+	unsigned long long total = 0;
+	for (GManifestEntry *entry in entries)
+		total += [self fileSizeOfEntry:entry];
+	return total;
+}
+
+@end
+
+
+@implementation GMapManifest (private)
+
+-(XScriptNode*)newScript:(NSString*)file
+{
+	return [[XScriptNode alloc] initWithPath:[mediaRoot stringByAppendingPathComponent:file]];
+}
+
+-(BOOL)alreadyScanned:(NSString*)file
+{
+	// (effects are shared by most tanks, so each is only read once)
+	NSString *key = [@"script:" stringByAppendingString:file];
+	if ([entryKeys containsObject:key])
+		return YES;
+	[entryKeys addObject:key];
+	return NO;
+}
+
+-(void)addType:(NSString*)type fromFile:(NSString*)file media:(GManifestMedia)media
+{
+	if (file == nil)
+		return;
+	NSString *key = [NSString stringWithFormat:@"%d:%@::%@", media, file, type];
+	if ([entryKeys containsObject:key])
+		return;
+	[entryKeys addObject:key];
+
+	GManifestEntry *entry = [[GManifestEntry alloc] initWithType:type fromFile:file media:media];
+	[entries addObject:entry];
+	[entry release];
+}
+
+// (the paths below must be built exactly as the loading code builds them, since resources are looked up by filename)
+
+-(void)scanMap:(NSString*)filename
+{
+	XScriptNode *script = [self newScript:filename];
+	XScriptNode *root = [script getSubnodeByName:@"map"];
+	NSString *mediaFolder = [[root getSubnodeByName:@"media_folder"] getValue:0];
+	if (!root || !mediaFolder) {
+		NSLog(@"Error scanning map \"%@\": Map definition or media_folder not found.", filename);
+		[script release];
+		return;
+	}
+	NSString *mapFolder = [@"Media/" stringByAppendingString:mediaFolder];
+
+	// terrain, trees, clutter and sky (see -[GGame runMapLoadStage])
+	[self addType:@"XTexture" fromFile:[mapFolder stringByAppendingPathComponent:@"texturemap.png"] media:GManifestMedia_Map];
+	NSString *detailMap = [[root getSubnodeByName:@"detail_map"] getValue:0];
+	if (detailMap)
+		[self addType:@"XTexture" fromFile:[@"Media/Common/Textures/" stringByAppendingPathComponent:detailMap] media:GManifestMedia_Map];
+
+	NSString *treeTexture = [[root getSubnodeByName:@"trees"] getValue:1];
+	if (treeTexture)
+		[self addType:@"XTexture" fromFile:[@"Media/Common/Trees/" stringByAppendingString:treeTexture] media:GManifestMedia_Map];
+	NSString *clutterTexture = [[root getSubnodeByName:@"clutter"] getValue:1];
+	if (clutterTexture)
+		[self addType:@"XTexture" fromFile:[@"Media/Common/Clutter/" stringByAppendingString:clutterTexture] media:GManifestMedia_Map];
+
+	NSString *skyboxName = [[root getSubnodeByName:@"sky_box"] getValue:0];
+	if (skyboxName) {
+		NSString *skyboxPath = [@"Media/Common/Skyboxes/" stringByAppendingPathComponent:skyboxName];
+		NSString *faces[5] = { @"top", @"left", @"right", @"front", @"back" };
+		for (int i = 0; i < 5; ++i)
+			[self addType:@"XTexture" fromFile:[NSString stringWithFormat:@"%@/sky_%@.jpg", skyboxPath, faces[i]] media:GManifestMedia_Map];
+	}
+
+	// teams (see -[GGame loadTeamFromScript:])
+	for (XScriptNode *teamNode in [root subnodesWithName:@"team"]) {
+		if ([teamNode getValue:0] == nil || [[teamNode getValue:0] isEqual:@"neutral"]) {
+			NSString *flagpole = [[teamNode getSubnodeByName:@"pole_mesh"] getValue:0];
+			if (flagpole)
+				[self addType:@"XMesh" fromFile:[@"Media/" stringByAppendingString:flagpole] media:GManifestMedia_Common];
+		} else {
+			[self scanTeam:[@"Media/" stringByAppendingString:[teamNode getValue:0]]];
+		}
+	}
+
+	// bullets
+	[self addType:@"XTexture" fromFile:@"Media/Common/Effects/bullet.png" media:GManifestMedia_Common];
+	[self addType:@"GBulletType" fromFile:@"Media/Common/Effects/bullet.png" media:GManifestMedia_Common];
+
+	[script release];
+}
+
+-(void)scanTeam:(NSString*)filename
+{
+	XScriptNode *script = [self newScript:filename];
+	XScriptNode *root = [script getSubnodeByName:@"team"];
+	if (!root) {
+		NSLog(@"Error scanning team \"%@\": Team definition not found.", filename);
+		[script release];
+		return;
+	}
+
+	// tanks (see -[GTeam initWithFile:])
+	for (XScriptNode *tankNode in [root subnodesWithName:@"tank"])
+		[self scanTank:[@"Media/" stringByAppendingString:[tankNode getValue:0]] textures:[tankNode subnodesWithName:@"texture"]];
+
+	// outpost flag
+	XScriptNode *node = [root getSubnodeByName:@"flag"];
+	if (node) {
+		NSString *flagPole = [[node getSubnodeByName:@"pole_mesh"] getValue:0];
+		NSString *flag = [[node getSubnodeByName:@"flag_mesh"] getValue:0];
+		NSString *texture = [[node getSubnodeByName:@"texture"] getValue:0];
+		if (texture)
+			[self addType:@"XTexture" fromFile:[@"Media/" stringByAppendingString:texture] media:GManifestMedia_Map];
+		if (flagPole)
+			[self addType:@"XMesh" fromFile:[@"Media/" stringByAppendingString:flagPole] media:GManifestMedia_Common];
+		if (flag)
+			[self addType:@"XMesh" fromFile:[@"Media/" stringByAppendingString:flag] media:GManifestMedia_Common];
+	}
+
+	[script release];
+}
+
+-(void)scanTank:(NSString*)filename textures:(NSArray*)textureNodes
+{
+	XScriptNode *script = [self newScript:filename];
+	XScriptNode *root = [script getSubnodeByName:@"tank"];
+	NSString *mediaFolder = [[root getSubnodeByName:@"media_folder"] getValue:0];
+	if (!root || !mediaFolder) {
+		NSLog(@"Error scanning tank \"%@\": Tank definition or media_folder not found.", filename);
+		[script release];
+		return;
+	}
+	mediaFolder = [@"Media/" stringByAppendingString:mediaFolder];
+
+	// models and textures (see -[GTank initWithFile:] and -[GTank setUnloadedTextures:])
+	[self addType:@"XTexture" fromFile:[mediaFolder stringByAppendingString:@"icon.tga"] media:GManifestMedia_Map];
+	for (XScriptNode *node in textureNodes)
+		[self addType:@"XTexture" fromFile:[mediaFolder stringByAppendingString:[node getValue:0]] media:GManifestMedia_Map];
+	NSString *meshes[4] = { @"body.xmesh", @"turret.xmesh", @"barrel.xmesh", @"shadow.xmesh" };
+	for (int i = 0; i < 4; ++i)
+		[self addType:@"XMesh" fromFile:[mediaFolder stringByAppendingString:meshes[i]] media:GManifestMedia_Map];
+
+	// effects
+	XScriptNode *gunNode = [root getSubnodeByName:@"gun"];
+	XScriptNode *groundImpactNode = [gunNode getSubnodeByName:@"ground_impact_effect"];
+	for (XScriptNode *node in groundImpactNode.subnodes)
+		[self scanEffect:[@"Media/" stringByAppendingString:[node getValue:0]]];
+	for (XScriptNode *node in [gunNode subnodesWithName:@"tank_impact_effect"])
+		[self scanEffect:[@"Media/" stringByAppendingString:[node getValue:0]]];
+	for (XScriptNode *node in [root subnodesWithName:@"explosion_effect"])
+		[self scanEffect:[@"Media/" stringByAppendingString:[node getValue:0]]];
+
+	[script release];
+}
+
+-(void)scanEffect:(NSString*)filename
+{
+	if ([self alreadyScanned:filename])
+		return;
+	XScriptNode *script = [self newScript:filename];
+	XScriptNode *root = [script getSubnodeByName:@"effect"];
+	if (!root) {
+		NSLog(@"Error scanning particle effect \"%@\": Effect definition not found.", filename);
+		[script release];
+		return;
+	}
+
+	// (see -[XParticleEffect initWithFile:usingMedia:])
+	NSString *texture = [[root getSubnodeByName:@"texture"] getValue:0];
+	if (texture)
+		[self addType:@"XTexture" fromFile:[[filename stringByDeletingLastPathComponent] stringByAppendingPathComponent:texture] media:GManifestMedia_Map];
+	[self addType:@"XParticleEffect" fromFile:filename media:GManifestMedia_Map];
+
+	[script release];
+}
+
+@end
+
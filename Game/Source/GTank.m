@@ -10,7 +10,7 @@
 #import "GOutpost.h"
 #import "GSoundPool.h"
 #import "XParticleEffect.h"
-#import "XParticleSystem.h"
+#import "XParticleManager.h"
 #import "XTexture.h"
 #import "XTextureNomip.h"
 #import "GTankPlayerController.h"
@@ -397,13 +397,7 @@
 		
 		if (bullet.originator) {
 			for (int i = 0; i < numTankImpactEffects; ++i) {
-				XParticleSystem *particles = [[XParticleSystem alloc] initWithEffect:bullet.originator->tankImpactEffects[i]];
-				particles->position = hitPoint;
-				[particles notifyTransformsChanged];
-				[particles beginAnimation];
-				particles.scene = gGame->scene;
-				[gGame->particlesPool addObject:particles];
-				[particles release];
+				[gGame->particleManager spawnEffect:bullet.originator->tankImpactEffects[i] at:&hitPoint shade:1];
 			}
 		}
 	}
@@ -416,13 +410,7 @@
 	
 	// add explosion effect
 	for (int i = 0; i < numExplosionEffects; ++i) {
-		XParticleSystem *particles = [[XParticleSystem alloc] initWithEffect:explosionEffects[i]];
-		particles->position = *body.globalPosition;
-		[particles notifyTransformsChanged];
-		[particles beginAnimation];
-		particles.scene = gGame->scene;
-		[gGame->particlesPool addObject:particles];
-		[particles release];	
+		[gGame->particleManager spawnEffect:explosionEffects[i] at:body.globalPosition shade:1];
 	}
 	
 	// sound effect
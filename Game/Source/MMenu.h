@@ -4,8 +4,11 @@
 #import "XTime.h"
 #import "XTexture.h"
 #import "XScript.h"
+#import "GMapLoader.h"
 @class GBMusicTrack;
 
+#define MENU_LOADING_FRAME_BUDGET 0.010 // seconds per frame spent creating map resources while loading
+
 typedef enum
 {
 	Menu_Main,
@@ -17,7 +20,7 @@ typedef enum
 	Menu_LoadingSaveGame
 } MenuState;
 
-@interface MMenu : NSObject {
+@interface MMenu : NSObject <GMapLoadingDelegate> {
 	int frameSkip;
 	BOOL contentLoaded;
 	
@@ -34,6 +37,8 @@ typedef enum
 	XTexture *selectedLevelPreview;
 	NSString *selectedLevelFile;
 	int loadingCountdown, imageLoadCounter;
+	BOOL mapLoadingStarted;
+	float loadingProgress;
 	
 	XSeconds calibrationTimer;
 	XAngle calibrationAngle;
@@ -60,6 +65,7 @@ typedef enum
 -(void)notifyReturnedToMenu;
 
 -(void)renderFrame:(XGameTime)gameTime;
+-(void)renderLoadingProgress:(XGameTime)gameTime;
 
 -(void)saveMenuState;
 -(void)loadMenuState;
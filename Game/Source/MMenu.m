@@ -156,6 +156,28 @@
 	frameSkip = 1000;
 }
 
+-(void)mapLoadingProgressed:(float)progress
+{
+	loadingProgress = progress;
+}
+
+-(void)renderLoadingProgress:(XGameTime)gameTime
+{
+	XIntRect bar;
+	bar.left = 90; bar.right = 390;
+	bar.top = 290; bar.bottom = 296;
+	
+	x2D_setTexture(nil);
+	XColor background = { 0, 0, 0, 0.5f };
+	x2D_drawRectColored(&bar, &background);
+	
+	// pulse the filled part of the bar so the screen is visibly alive while loading
+	bar.right = bar.left + (int)((bar.right - bar.left) * xSaturate(loadingProgress));
+	XScalar pulse = 0.75f + 0.25f * xSin(gameTime.totalTime * 6.0f);
+	XColor fill = { pulse, pulse, pulse, 1 };
+	x2D_drawRectColored(&bar, &fill);
+}
+
 -(void)notifyReturnedToMenu
 {
 	saveStateSoon = YES;
@@ -278,24 +300,39 @@
 			x2D_setTexture(loadingMenu);
 			x2D_drawRect(&rect);
 			
-			++loadingCountdown;
-			if (loadingCountdown >= 3) {
-				[self saveMenuState];
-				if (selectedLevel == 0)
-					gGame.tutorialMode = YES;
-				else
-					gGame.tutorialMode = NO;
-				loadingCountdown = 0;
-				gGame->menuMode = NO;
+			if (!mapLoadingStarted) {
+				++loadingCountdown;
+				if (loadingCountdown >= 3) {
+					[self saveMenuState];
+					if (selectedLevel == 0)
+						gGame.tutorialMode = YES;
+					else
+						gGame.tutorialMode = NO;
+					loadingCountdown = 0;
+					loadingProgress = 0;
+					mapLoadingStarted = YES;
+					
+					// the map loads in the background while the loading screen keeps animating
+					gGame.mapLoadingDelegate = self;
+					[gGame beginLoadingMap:selectedLevelFile];
+				}
+			}
+			else if ([gGame continueLoadingMap:MENU_LOADING_FRAME_BUDGET]) {
+				gGame.mapLoadingDelegate = nil;
+				mapLoadingStarted = NO;
 				currentMenu = Menu_LevelSelection;
-				
-				[gGame loadMap:selectedLevelFile];
-
-				if (selectedLevel == 5 || selectedLevel == 8 || selectedLevel == 20)
-					gGame->cheat1 = YES;
-
-				[self unloadContent];
+				if (gGame->mapIsLoaded) {
+					gGame->menuMode = NO;
+					[gGame saveGame];
+					
+					if (selectedLevel == 5 || selectedLevel == 8 || selectedLevel == 20)
+						gGame->cheat1 = YES;
+					
+					[self unloadContent];
+				}
 			}
+			if (mapLoadingStarted)
+				[self renderLoadingProgress:gameTime];
 			break;
 			
 		case Menu_LoadingSaveGame:
@@ -6,6 +6,10 @@
 
 XIntRect viewPort;
 
+// region of the bound texture to draw from (less than the whole texture for textures packed into an atlas)
+static XScalarRect textureRegion = { 0, 0, 1, 1 };
+static BOOL textureRegionIsFull = YES;
+
 void x2D_begin()
 {
 	glMatrixMode(GL_PROJECTION);
@@ -17,9 +21,9 @@ void x2D_begin()
 	glPushMatrix();
 	glLoadIdentity();
 	
-	glDisable(GL_LIGHTING);
-	glDisable(GL_CULL_FACE);
-	glDepthMask(FALSE);
+	xglDisable(GL_LIGHTING);
+	xglDisable(GL_CULL_FACE);
+	xglDepthMask(FALSE);
 	glDepthFunc(GL_ALWAYS);
 	
 	XMaterial mat;
@@ -27,7 +31,7 @@ void x2D_begin()
 	mat.specular.red = 0; mat.specular.green = 0; mat.specular.blue = 0; mat.specular.alpha = 0;
 	mat.diffuse = mat.specular;
 	
-	glDisable(GL_FOG);
+	xglDisable(GL_FOG);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
@@ -39,47 +43,51 @@ void x2D_begin()
 
 void x2D_end()
 {
-	glDisableClientState(GL_COLOR_ARRAY);
+	xglDisableClientState(GL_COLOR_ARRAY);
 
 	glMatrixMode(GL_PROJECTION);
 	glPopMatrix();   
 	glMatrixMode(GL_MODELVIEW);
 	glPopMatrix();	
 	
-	glEnable(GL_LIGHTING);
-	glEnable(GL_CULL_FACE);
-	glDepthMask(TRUE);
+	xglEnable(GL_LIGHTING);
+	xglEnable(GL_CULL_FACE);
+	xglDepthMask(TRUE);
 	glDepthFunc(GL_LESS);
 	
-	glEnable(GL_FOG);
+	xglEnable(GL_FOG);
 	xglNotifyTextureBindingsChanged();
 	xglNotifyMeshBindingsChanged();
 }
 
 void x2D_enableTransparency()
 {
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	xglEnable(GL_BLEND);
+	xglBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 void x2D_disableTransparency()
 {
-	glDisable(GL_BLEND);
+	xglDisable(GL_BLEND);
 }
 
 void x2D_setTexture(XTexture *texture)
 {
 	if (texture) {
+		textureRegion = texture.region;
+		textureRegionIsFull = (textureRegion.left == 0 && textureRegion.top == 0 && textureRegion.right == 1 && textureRegion.bottom == 1);
 		if (xglCheckBindTextures(texture.glTexture, 0)) {
-			glActiveTexture(GL_TEXTURE0);
+			xglActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, texture.glTexture);
-			glEnable(GL_TEXTURE_2D);
+			xglEnable(GL_TEXTURE_2D);
 		}
 	} else {
+		textureRegion = (XScalarRect){ 0, 0, 1, 1 };
+		textureRegionIsFull = YES;
 		if (xglCheckBindTextures(0, 0)) {
-			glActiveTexture(GL_TEXTURE0);
+			xglActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, 0);
-			glDisable(GL_TEXTURE_2D);
+			xglDisable(GL_TEXTURE_2D);
 		}
 	}
 }
@@ -89,6 +97,27 @@ static const unsigned char texCoords[] = {
 	0,1, 1,1,
 };
 
+// sets the texture coordinates for the given part of the current texture (0,0,1,1 being all of it)
+static void setTexCoords(const XScalarRect *crop, float *uvs)
+{
+	if (crop == NULL && textureRegionIsFull) {
+		glTexCoordPointer(2, GL_BYTE, 0, texCoords);
+		return;
+	}
+	XScalarRect r = crop ? *crop : (XScalarRect){ 0, 0, 1, 1 };
+	XScalar width = textureRegion.right - textureRegion.left;
+	XScalar height = textureRegion.bottom - textureRegion.top;
+	r.left = textureRegion.left + width * r.left;
+	r.right = textureRegion.left + width * r.right;
+	r.top = textureRegion.top + height * r.top;
+	r.bottom = textureRegion.top + height * r.bottom;
+	uvs[0*2] = r.left; uvs[0*2+1] = r.top;
+	uvs[1*2] = r.right; uvs[1*2+1] = r.top;
+	uvs[2*2] = r.left; uvs[2*2+1] = r.bottom;
+	uvs[3*2] = r.right; uvs[3*2+1] = r.bottom;
+	glTexCoordPointer(2, GL_FLOAT, 0, uvs);
+}
+
 void x2D_drawRect(XIntRect *area)
 {
 	// position
@@ -100,9 +129,10 @@ void x2D_drawRect(XIntRect *area)
 	
 	// render
 	glVertexPointer(2, GL_FLOAT, 0, positions);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glTexCoordPointer(2, GL_BYTE, 0, texCoords);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	float uvs[4*2];
+	setTexCoords(NULL, uvs);
+	xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
@@ -125,13 +155,14 @@ void x2D_drawRectColored(XIntRect *area, XColor *color)
 	
 	// render
 	glVertexPointer(2, GL_FLOAT, 0, positions);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glTexCoordPointer(2, GL_BYTE, 0, texCoords);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	float uvs[4*2];
+	setTexCoords(NULL, uvs);
+	xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	glColorPointer(4, GL_UNSIGNED_BYTE, 0, colors);
-	glEnableClientState(GL_COLOR_ARRAY);
+	xglEnableClientState(GL_COLOR_ARRAY);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glDisableClientState(GL_COLOR_ARRAY);
+	xglDisableClientState(GL_COLOR_ARRAY);
 }
 
 void x2D_drawRectRotated(XIntRect *area, XAngle rotation)
@@ -157,9 +188,10 @@ void x2D_drawRectRotated(XIntRect *area, XAngle rotation)
 	
 	// render
 	glVertexPointer(2, GL_FLOAT, 0, positions);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glTexCoordPointer(2, GL_BYTE, 0, texCoords);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	float uvs[4*2];
+	setTexCoords(NULL, uvs);
+	xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
@@ -194,13 +226,14 @@ void x2D_drawRectColoredRotated(XIntRect *area, XColor *color, XAngle rotation)
 	
 	// render
 	glVertexPointer(2, GL_FLOAT, 0, positions);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glTexCoordPointer(2, GL_BYTE, 0, texCoords);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	float uvs[4*2];
+	setTexCoords(NULL, uvs);
+	xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	glColorPointer(4, GL_UNSIGNED_BYTE, 0, colors);
-	glEnableClientState(GL_COLOR_ARRAY);
+	xglEnableClientState(GL_COLOR_ARRAY);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glDisableClientState(GL_COLOR_ARRAY);
+	xglDisableClientState(GL_COLOR_ARRAY);
 }
 
 
@@ -222,18 +255,13 @@ void x2D_drawRectCropped(XIntRect *area, XScalarRect *region)
 	positions[2*2+1] = 480-area2.left; positions[2*2] = 320-area2.bottom;
 	positions[3*2+1] = 480-area2.right; positions[3*2] = 320-area2.bottom;
 
-	// uvs
-	float uvs[4*2];
-	uvs[0*2] = region->left; uvs[0*2+1] = region->top;
-	uvs[1*2] = region->right; uvs[1*2+1] = region->top;
-	uvs[2*2] = region->left; uvs[2*2+1] = region->bottom;
-	uvs[3*2] = region->right; uvs[3*2+1] = region->bottom;
 	
 	// render
 	glVertexPointer(2, GL_FLOAT, 0, positions);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glTexCoordPointer(2, GL_FLOAT, 0, uvs);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	float uvs[4*2];
+	setTexCoords(region, uvs);
+	xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
@@ -255,12 +283,6 @@ void x2D_drawRectCroppedColored(XIntRect *area, XScalarRect *region, XColor *col
 	positions[2*2+1] = 480-area2.left; positions[2*2] = 320-area2.bottom;
 	positions[3*2+1] = 480-area2.right; positions[3*2] = 320-area2.bottom;
 	
-	// uvs
-	float uvs[4*2];
-	uvs[0*2] = region->left; uvs[0*2+1] = region->top;
-	uvs[1*2] = region->right; uvs[1*2+1] = region->top;
-	uvs[2*2] = region->left; uvs[2*2+1] = region->bottom;
-	uvs[3*2] = region->right; uvs[3*2+1] = region->bottom;
 	
 	// color
 	XColorBytes colors[4];
@@ -272,13 +294,14 @@ void x2D_drawRectCroppedColored(XIntRect *area, XScalarRect *region, XColor *col
 	
 	// render
 	glVertexPointer(2, GL_FLOAT, 0, positions);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glTexCoordPointer(2, GL_FLOAT, 0, uvs);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	float uvs[4*2];
+	setTexCoords(region, uvs);
+	xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	glColorPointer(4, GL_UNSIGNED_BYTE, 0, colors);
-	glEnableClientState(GL_COLOR_ARRAY);
+	xglEnableClientState(GL_COLOR_ARRAY);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glDisableClientState(GL_COLOR_ARRAY);
+	xglDisableClientState(GL_COLOR_ARRAY);
 }
 
 
@@ -0,0 +1,46 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMath.h"
+
+// XBoundingVolumeTree is a dynamic AABB tree used by XScene for hierarchical frustum culling.
+// Every leaf ("proxy") stores a fattened copy of an object's world-space box, so small movements
+// don't change the tree at all; when an object leaves its fat box, its leaf is removed and
+// re-inserted using a surface area heuristic, and the tree is rebalanced with AVL-style rotations.
+//
+// Culling walks the tree from the root, rejecting whole subtrees that are outside the frustum and
+// accepting whole subtrees that are fully inside it without testing them further.
+
+#define XBVTREE_NULL_NODE (-1)
+
+typedef struct {
+	XBoundingBox box;	// fattened bounds (leaves), or union of children
+	void *userData;
+	int parent;			// (next free node when on the free list)
+	int child1, child2;
+	int height;			// 0 for leaves, -1 when free
+} XBoundingVolumeTreeNode;
+
+typedef struct {
+	XBoundingVolumeTreeNode *nodes;
+	int nodeCapacity, nodeCount;
+	int root, freeList;
+	XScalar margin;
+	int *stack;
+	int stackCapacity;
+} XBoundingVolumeTree;
+
+// called for every leaf that may be visible; "fullyInside" is set when the leaf's fat box lies
+// completely within the frustum, in which case no further visibility test is necessary
+typedef void (*XBoundingVolumeTreeVisitor)(void *userData, BOOL fullyInside, void *context);
+
+void BoundingVolumeTree_init(XBoundingVolumeTree *tree, XScalar margin);
+void BoundingVolumeTree_free(XBoundingVolumeTree *tree);
+
+int BoundingVolumeTree_insert(XBoundingVolumeTree *tree, const XBoundingBox *box, void *userData);
+void BoundingVolumeTree_remove(XBoundingVolumeTree *tree, int proxy);
+BOOL BoundingVolumeTree_move(XBoundingVolumeTree *tree, int proxy, const XBoundingBox *box); //returns YES if the tree changed
+
+// visits every leaf intersecting the 6 (inward facing, normalized) frustum planes, and returns
+// the number of tree nodes that were tested
+int BoundingVolumeTree_queryFrustum(XBoundingVolumeTree *tree, const XVector4 *planes, XBoundingVolumeTreeVisitor visitor, void *context);
+
@@ -0,0 +1,391 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XBoundingVolumeTree.h"
+#import <stdlib.h>
+#import <string.h>
+
+#define ALL_PLANES_MASK 0x3F
+
+
+static inline XBoundingBox BoundingVolumeTree_union(const XBoundingBox *a, const XBoundingBox *b)
+{
+	XBoundingBox r;
+	r.min.x = (a->min.x < b->min.x) ? a->min.x : b->min.x;
+	r.min.y = (a->min.y < b->min.y) ? a->min.y : b->min.y;
+	r.min.z = (a->min.z < b->min.z) ? a->min.z : b->min.z;
+	r.max.x = (a->max.x > b->max.x) ? a->max.x : b->max.x;
+	r.max.y = (a->max.y > b->max.y) ? a->max.y : b->max.y;
+	r.max.z = (a->max.z > b->max.z) ? a->max.z : b->max.z;
+	return r;
+}
+
+static inline XScalar BoundingVolumeTree_surfaceArea(const XBoundingBox *box)
+{
+	XScalar dx = box->max.x - box->min.x;
+	XScalar dy = box->max.y - box->min.y;
+	XScalar dz = box->max.z - box->min.z;
+	return 2.0f * (dx*dy + dy*dz + dz*dx);
+}
+
+static inline BOOL BoundingVolumeTree_contains(const XBoundingBox *outer, const XBoundingBox *inner)
+{
+	return outer->min.x <= inner->min.x && outer->min.y <= inner->min.y && outer->min.z <= inner->min.z
+		&& outer->max.x >= inner->max.x && outer->max.y >= inner->max.y && outer->max.z >= inner->max.z;
+}
+
+static inline int BoundingVolumeTree_max(int a, int b)
+{
+	return (a > b) ? a : b;
+}
+
+
+static int BoundingVolumeTree_allocateNode(XBoundingVolumeTree *tree)
+{
+	if (tree->freeList == XBVTREE_NULL_NODE) {
+		// grow the node pool, and put all the new nodes on the free list
+		int oldCapacity = tree->nodeCapacity;
+		tree->nodeCapacity = (oldCapacity > 0) ? oldCapacity * 2 : 64;
+		tree->nodes = realloc(tree->nodes, sizeof(XBoundingVolumeTreeNode) * tree->nodeCapacity);
+		for (int i = oldCapacity; i < tree->nodeCapacity; ++i) {
+			tree->nodes[i].parent = i + 1;
+			tree->nodes[i].height = -1;
+		}
+		tree->nodes[tree->nodeCapacity-1].parent = XBVTREE_NULL_NODE;
+		tree->freeList = oldCapacity;
+	}
+
+	int index = tree->freeList;
+	XBoundingVolumeTreeNode *node = &tree->nodes[index];
+	tree->freeList = node->parent;
+	node->parent = XBVTREE_NULL_NODE;
+	node->child1 = XBVTREE_NULL_NODE;
+	node->child2 = XBVTREE_NULL_NODE;
+	node->height = 0;
+	node->userData = NULL;
+	++tree->nodeCount;
+	return index;
+}
+
+static void BoundingVolumeTree_freeNode(XBoundingVolumeTree *tree, int index)
+{
+	tree->nodes[index].parent = tree->freeList;
+	tree->nodes[index].height = -1;
+	tree->freeList = index;
+	--tree->nodeCount;
+}
+
+// performs a left or right rotation if node A is imbalanced, and returns the new subtree root
+static int BoundingVolumeTree_balance(XBoundingVolumeTree *tree, int iA)
+{
+	XBoundingVolumeTreeNode *nodes = tree->nodes;
+	XBoundingVolumeTreeNode *A = &nodes[iA];
+	if (A->height < 2)
+		return iA;
+
+	int iB = A->child1, iC = A->child2;
+	XBoundingVolumeTreeNode *B = &nodes[iB];
+	XBoundingVolumeTreeNode *C = &nodes[iC];
+	int balance = C->height - B->height;
+
+	if (balance > 1) {
+		// rotate C up
+		int iF = C->child1, iG = C->child2;
+		XBoundingVolumeTreeNode *F = &nodes[iF];
+		XBoundingVolumeTreeNode *G = &nodes[iG];
+
+		C->child1 = iA;
+		C->parent = A->parent;
+		A->parent = iC;
+		if (C->parent != XBVTREE_NULL_NODE) {
+			if (nodes[C->parent].child1 == iA)
+				nodes[C->parent].child1 = iC;
+			else
+				nodes[C->parent].child2 = iC;
+		} else {
+			tree->root = iC;
+		}
+
+		if (F->height > G->height) {
+			C->child2 = iF;
+			A->child2 = iG;
+			G->parent = iA;
+			A->box = BoundingVolumeTree_union(&B->box, &G->box);
+			C->box = BoundingVolumeTree_union(&A->box, &F->box);
+			A->height = 1 + BoundingVolumeTree_max(B->height, G->height);
+			C->height = 1 + BoundingVolumeTree_max(A->height, F->height);
+		} else {
+			C->child2 = iG;
+			A->child2 = iF;
+			F->parent = iA;
+			A->box = BoundingVolumeTree_union(&B->box, &F->box);
+			C->box = BoundingVolumeTree_union(&A->box, &G->box);
+			A->height = 1 + BoundingVolumeTree_max(B->height, F->height);
+			C->height = 1 + BoundingVolumeTree_max(A->height, G->height);
+		}
+		return iC;
+	}
+
+	if (balance < -1) {
+		// rotate B up
+		int iD = B->child1, iE = B->child2;
+		XBoundingVolumeTreeNode *D = &nodes[iD];
+		XBoundingVolumeTreeNode *E = &nodes[iE];
+
+		B->child1 = iA;
+		B->parent = A->parent;
+		A->parent = iB;
+		if (B->parent != XBVTREE_NULL_NODE) {
+			if (nodes[B->parent].child1 == iA)
+				nodes[B->parent].child1 = iB;
+			else
+				nodes[B->parent].child2 = iB;
+		} else {
+			tree->root = iB;
+		}
+
+		if (D->height > E->height) {
+			B->child2 = iD;
+			A->child1 = iE;
+			E->parent = iA;
+			A->box = BoundingVolumeTree_union(&C->box, &E->box);
+			B->box = BoundingVolumeTree_union(&A->box, &D->box);
+			A->height = 1 + BoundingVolumeTree_max(C->height, E->height);
+			B->height = 1 + BoundingVolumeTree_max(A->height, D->height);
+		} else {
+			B->child2 = iE;
+			A->child1 = iD;
+			D->parent = iA;
+			A->box = BoundingVolumeTree_union(&C->box, &D->box);
+			B->box = BoundingVolumeTree_union(&A->box, &E->box);
+			A->height = 1 + BoundingVolumeTree_max(C->height, D->height);
+			B->height = 1 + BoundingVolumeTree_max(A->height, E->height);
+		}
+		return iB;
+	}
+
+	return iA;
+}
+
+// walks from a node to the root, rebalancing and refitting boxes along the way
+static void BoundingVolumeTree_refitAncestors(XBoundingVolumeTree *tree, int index)
+{
+	while (index != XBVTREE_NULL_NODE) {
+		index = BoundingVolumeTree_balance(tree, index);
+		XBoundingVolumeTreeNode *node = &tree->nodes[index];
+		XBoundingVolumeTreeNode *child1 = &tree->nodes[node->child1];
+		XBoundingVolumeTreeNode *child2 = &tree->nodes[node->child2];
+		node->height = 1 + BoundingVolumeTree_max(child1->height, child2->height);
+		node->box = BoundingVolumeTree_union(&child1->box, &child2->box);
+		index = node->parent;
+	}
+}
+
+static void BoundingVolumeTree_insertLeaf(XBoundingVolumeTree *tree, int leaf)
+{
+	XBoundingVolumeTreeNode *nodes = tree->nodes;
+	if (tree->root == XBVTREE_NULL_NODE) {
+		tree->root = leaf;
+		nodes[leaf].parent = XBVTREE_NULL_NODE;
+		return;
+	}
+
+	// find the best sibling for the new leaf (surface area heuristic)
+	XBoundingBox leafBox = nodes[leaf].box;
+	int index = tree->root;
+	while (nodes[index].height > 0) {
+		XBoundingVolumeTreeNode *node = &nodes[index];
+		XScalar area = BoundingVolumeTree_surfaceArea(&node->box);
+		XBoundingBox combinedBox = BoundingVolumeTree_union(&node->box, &leafBox);
+		XScalar combinedArea = BoundingVolumeTree_surfaceArea(&combinedBox);
+
+		// cost of creating a new parent for this node and the new leaf
+		XScalar cost = 2.0f * combinedArea;
+		// minimum cost of pushing the leaf further down the tree
+		XScalar inheritanceCost = 2.0f * (combinedArea - area);
+
+		XScalar childCost[2];
+		int childIndex[2] = { node->child1, node->child2 };
+		for (int c = 0; c < 2; ++c) {
+			XBoundingVolumeTreeNode *child = &nodes[childIndex[c]];
+			XBoundingBox box = BoundingVolumeTree_union(&leafBox, &child->box);
+			if (child->height == 0)
+				childCost[c] = BoundingVolumeTree_surfaceArea(&box) + inheritanceCost;
+			else
+				childCost[c] = BoundingVolumeTree_surfaceArea(&box) - BoundingVolumeTree_surfaceArea(&child->box) + inheritanceCost;
+		}
+
+		if (cost < childCost[0] && cost < childCost[1])
+			break;
+		index = (childCost[0] < childCost[1]) ? childIndex[0] : childIndex[1];
+	}
+	int sibling = index;
+
+	// create a new parent for the leaf and its sibling
+	int oldParent = nodes[sibling].parent;
+	int newParent = BoundingVolumeTree_allocateNode(tree);
+	nodes = tree->nodes; //(the node pool may have been reallocated)
+	nodes[newParent].parent = oldParent;
+	nodes[newParent].box = BoundingVolumeTree_union(&leafBox, &nodes[sibling].box);
+	nodes[newParent].height = nodes[sibling].height + 1;
+	nodes[newParent].child1 = sibling;
+	nodes[newParent].child2 = leaf;
+	nodes[sibling].parent = newParent;
+	nodes[leaf].parent = newParent;
+
+	if (oldParent != XBVTREE_NULL_NODE) {
+		if (nodes[oldParent].child1 == sibling)
+			nodes[oldParent].child1 = newParent;
+		else
+			nodes[oldParent].child2 = newParent;
+	} else {
+		tree->root = newParent;
+	}
+
+	BoundingVolumeTree_refitAncestors(tree, nodes[leaf].parent);
+}
+
+static void BoundingVolumeTree_removeLeaf(XBoundingVolumeTree *tree, int leaf)
+{
+	XBoundingVolumeTreeNode *nodes = tree->nodes;
+	if (leaf == tree->root) {
+		tree->root = XBVTREE_NULL_NODE;
+		return;
+	}
+
+	int parent = nodes[leaf].parent;
+	int grandParent = nodes[parent].parent;
+	int sibling = (nodes[parent].child1 == leaf) ? nodes[parent].child2 : nodes[parent].child1;
+
+	// replace the parent with the leaf's sibling
+	if (grandParent != XBVTREE_NULL_NODE) {
+		if (nodes[grandParent].child1 == parent)
+			nodes[grandParent].child1 = sibling;
+		else
+			nodes[grandParent].child2 = sibling;
+		nodes[sibling].parent = grandParent;
+		BoundingVolumeTree_freeNode(tree, parent);
+		BoundingVolumeTree_refitAncestors(tree, grandParent);
+	} else {
+		tree->root = sibling;
+		nodes[sibling].parent = XBVTREE_NULL_NODE;
+		BoundingVolumeTree_freeNode(tree, parent);
+	}
+}
+
+static XBoundingBox BoundingVolumeTree_fatten(XBoundingVolumeTree *tree, const XBoundingBox *box)
+{
+	XBoundingBox fat = *box;
+	fat.min.x -= tree->margin; fat.min.y -= tree->margin; fat.min.z -= tree->margin;
+	fat.max.x += tree->margin; fat.max.y += tree->margin; fat.max.z += tree->margin;
+	return fat;
+}
+
+
+void BoundingVolumeTree_init(XBoundingVolumeTree *tree, XScalar margin)
+{
+	memset(tree, 0, sizeof(XBoundingVolumeTree));
+	tree->root = XBVTREE_NULL_NODE;
+	tree->freeList = XBVTREE_NULL_NODE;
+	tree->margin = margin;
+}
+
+void BoundingVolumeTree_free(XBoundingVolumeTree *tree)
+{
+	free(tree->nodes);
+	free(tree->stack);
+	BoundingVolumeTree_init(tree, tree->margin);
+}
+
+int BoundingVolumeTree_insert(XBoundingVolumeTree *tree, const XBoundingBox *box, void *userData)
+{
+	int proxy = BoundingVolumeTree_allocateNode(tree);
+	tree->nodes[proxy].box = BoundingVolumeTree_fatten(tree, box);
+	tree->nodes[proxy].userData = userData;
+	BoundingVolumeTree_insertLeaf(tree, proxy);
+	return proxy;
+}
+
+void BoundingVolumeTree_remove(XBoundingVolumeTree *tree, int proxy)
+{
+	assert(proxy >= 0 && proxy < tree->nodeCapacity && tree->nodes[proxy].height == 0);
+	BoundingVolumeTree_removeLeaf(tree, proxy);
+	BoundingVolumeTree_freeNode(tree, proxy);
+}
+
+BOOL BoundingVolumeTree_move(XBoundingVolumeTree *tree, int proxy, const XBoundingBox *box)
+{
+	assert(proxy >= 0 && proxy < tree->nodeCapacity && tree->nodes[proxy].height == 0);
+	if (BoundingVolumeTree_contains(&tree->nodes[proxy].box, box))
+		return NO;
+
+	BoundingVolumeTree_removeLeaf(tree, proxy);
+	tree->nodes[proxy].box = BoundingVolumeTree_fatten(tree, box);
+	BoundingVolumeTree_insertLeaf(tree, proxy);
+	return YES;
+}
+
+int BoundingVolumeTree_queryFrustum(XBoundingVolumeTree *tree, const XVector4 *planes, XBoundingVolumeTreeVisitor visitor, void *context)
+{
+	if (tree->root == XBVTREE_NULL_NODE)
+		return 0;
+
+	// each stack entry is a node index and the mask of planes its box still straddles
+	// (boxes fully inside a plane have fully inside children, so that plane is skipped below them)
+	int visited = 0;
+	int stackSize = 0;
+	if (tree->stackCapacity < 64) {
+		tree->stackCapacity = 64;
+		tree->stack = realloc(tree->stack, sizeof(int) * 2 * tree->stackCapacity);
+	}
+	tree->stack[0] = tree->root;
+	tree->stack[1] = ALL_PLANES_MASK;
+	stackSize = 1;
+
+	while (stackSize > 0) {
+		--stackSize;
+		int index = tree->stack[stackSize*2];
+		int planeMask = tree->stack[stackSize*2+1];
+		const XBoundingVolumeTreeNode *node = &tree->nodes[index];
+		++visited;
+
+		if (planeMask) {
+			XVector3 center = xCenter_BoundingBox((XBoundingBox*)&node->box);
+			XVector3 extent = xSize_BoundingBox((XBoundingBox*)&node->box);
+			extent.x *= 0.5f; extent.y *= 0.5f; extent.z *= 0.5f;
+
+			BOOL outside = NO;
+			for (int p = 0; p < 6; ++p) {
+				if ((planeMask & (1 << p)) == 0)
+					continue;
+				const XVector4 *plane = &planes[p];
+				XScalar d = plane->x * center.x + plane->y * center.y + plane->z * center.z + plane->w;
+				XScalar r = xAbs(plane->x) * extent.x + xAbs(plane->y) * extent.y + xAbs(plane->z) * extent.z;
+				if (d < -r) {
+					outside = YES;
+					break;
+				}
+				if (d >= r)
+					planeMask &= ~(1 << p);
+			}
+			if (outside)
+				continue;
+		}
+
+		if (node->height == 0) {
+			visitor(node->userData, (planeMask == 0), context);
+		} else {
+			if (stackSize + 2 > tree->stackCapacity) {
+				tree->stackCapacity *= 2;
+				tree->stack = realloc(tree->stack, sizeof(int) * 2 * tree->stackCapacity);
+			}
+			tree->stack[stackSize*2] = node->child1;
+			tree->stack[stackSize*2+1] = planeMask;
+			++stackSize;
+			tree->stack[stackSize*2] = node->child2;
+			tree->stack[stackSize*2+1] = planeMask;
+			++stackSize;
+		}
+	}
+
+	return visited;
+}
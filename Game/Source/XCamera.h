@@ -1,6 +1,7 @@
 // Copyright © 2010 John Judnich. All rights reserved.
 
 #import "XMath.h"
+#import "XFrustumCulling.h"
 
 
 @interface XCamera : NSObject {
@@ -22,6 +23,8 @@
 -(BOOL)isVisibleBox:(XBoundingBox*)box;
 -(BOOL)isVisibleBox:(XBoundingBox*)box boxOffset:(XVector3*)pos boxRotation:(XMatrix3*)rot;
 -(BOOL)isVisibleBoxCorners:(XVector3*)cubeCorners;
+-(void)testBounds:(XCullingBoundsArray*)bounds; //batch test, fills bounds->visibleMask
+-(const XVector4*)frustumPlanes; //near, left, right, far, bottom, top (normalized, facing inward)
 
 -(XScalar)distanceTo:(XVector3*)point;
 -(XScalar)distanceSquaredTo:(XVector3*)point;
@@ -77,34 +77,41 @@
 
 -(BOOL)isVisibleBox:(XBoundingBox*)box
 {
-	XVector3 corners[8];
-	corners[0].x = box->min.x; corners[0].y = box->min.y; corners[0].z = box->min.z;
-	corners[1].x = box->max.x; corners[1].y = box->min.y; corners[1].z = box->min.z;
-	corners[2].x = box->min.x; corners[2].y = box->max.y; corners[2].z = box->min.z;
-	corners[3].x = box->max.x; corners[3].y = box->max.y; corners[3].z = box->min.z;
-	corners[4].x = box->min.x; corners[4].y = box->min.y; corners[4].z = box->max.z;
-	corners[5].x = box->max.x; corners[5].y = box->min.y; corners[5].z = box->max.z;
-	corners[6].x = box->min.x; corners[6].y = box->max.y; corners[6].z = box->max.z;
-	corners[7].x = box->max.x; corners[7].y = box->max.y; corners[7].z = box->max.z;
-	return [self isVisibleBoxCorners:corners];
+	XVector3 center = xCenter_BoundingBox(box);
+	XVector3 extent = xSize_BoundingBox(box);
+	extent.x *= 0.5f; extent.y *= 0.5f; extent.z *= 0.5f;
+	
+	// the box is not visible if it's entirely behind any single plane
+	for (int p = 0; p < 6; ++p) {
+		XVector4 *plane = &frustumPlanes[p];
+		XScalar d = plane->x * center.x + plane->y * center.y + plane->z * center.z + plane->w;
+		XScalar r = xAbs(plane->x) * extent.x + xAbs(plane->y) * extent.y + xAbs(plane->z) * extent.z;
+		if (d + r < 0)
+			return NO;
+	}
+	return YES;
 }
 
 -(BOOL)isVisibleBox:(XBoundingBox*)box boxOffset:(XVector3*)pos boxRotation:(XMatrix3*)rot
 {
-	XVector3 corners[8];
-	corners[0].x = box->min.x; corners[0].y = box->min.y; corners[0].z = box->min.z;
-	corners[1].x = box->max.x; corners[1].y = box->min.y; corners[1].z = box->min.z;
-	corners[2].x = box->min.x; corners[2].y = box->max.y; corners[2].z = box->min.z;
-	corners[3].x = box->max.x; corners[3].y = box->max.y; corners[3].z = box->min.z;
-	corners[4].x = box->min.x; corners[4].y = box->min.y; corners[4].z = box->max.z;
-	corners[5].x = box->max.x; corners[5].y = box->min.y; corners[5].z = box->max.z;
-	corners[6].x = box->min.x; corners[6].y = box->max.y; corners[6].z = box->max.z;
-	corners[7].x = box->max.x; corners[7].y = box->max.y; corners[7].z = box->max.z;
-	for (int i = 0; i < 8; ++i)
-		corners[i] = xMul_Vec3Mat3(&corners[i], rot);
-	for (int i = 0; i < 8; ++i)
-		xAdd_Vec3Vec3(&corners[i], pos);
-	return [self isVisibleBoxCorners:corners];
+	XVector3 center = xCenter_BoundingBox(box);
+	XVector3 halfSize = xSize_BoundingBox(box);
+	halfSize.x *= 0.5f; halfSize.y *= 0.5f; halfSize.z *= 0.5f;
+	center = xMul_Vec3Mat3(&center, rot);
+	xAdd_Vec3Vec3(&center, pos);
+	
+	// project the oriented box's half-extents onto each plane normal (this gives exactly the same
+	// result as testing all 8 transformed corners, without transforming them)
+	for (int p = 0; p < 6; ++p) {
+		XVector4 *plane = &frustumPlanes[p];
+		XScalar d = plane->x * center.x + plane->y * center.y + plane->z * center.z + plane->w;
+		XScalar r = halfSize.x * xAbs(plane->x * rot->m00 + plane->y * rot->m10 + plane->z * rot->m20)
+		          + halfSize.y * xAbs(plane->x * rot->m01 + plane->y * rot->m11 + plane->z * rot->m21)
+		          + halfSize.z * xAbs(plane->x * rot->m02 + plane->y * rot->m12 + plane->z * rot->m22);
+		if (d + r < 0)
+			return NO;
+	}
+	return YES;
 }
 
 -(BOOL)isVisibleBoxCorners:(XVector3*)cubeCorners
@@ -138,6 +145,16 @@
 	return YES;
 }
 
+-(void)testBounds:(XCullingBoundsArray*)bounds
+{
+	FrustumCulling_testBounds(frustumPlanes, bounds);
+}
+
+-(const XVector4*)frustumPlanes
+{
+	return frustumPlanes;
+}
+
 
 -(XScalar)distanceTo:(XVector3*)point
 {
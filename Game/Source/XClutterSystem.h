@@ -23,9 +23,12 @@ typedef struct {
 	XClutterType *type;
 	XVector3 position;
 	XScalar size, viewRange;
+	XAngle yaw;
 	float lightness;
 	float waveFreq, wavePhase, waveMag;
 	bool inSync, visible;
+	bool dirty; // set whenever the above changes, so the batch rewrites this instance's vertexes
+	unsigned char alpha; // (as last written to the vertex buffer)
 } XClutterInstance;
 
 
@@ -37,6 +40,46 @@ typedef struct {
 
 typedef GLushort XClutterIndex;
 
+// Every clutter instance is drawn as two vertical quads crossed at right angles (8 vertexes), with a
+// random yaw. Since this doesn't depend on the camera, the vertex buffer is persistent: only instances
+// which respawn, wrap around the view circle, or change fade level are rewritten and re-uploaded,
+// coalesced into ranges of nearby dirty instances.
+//
+// Fade levels are only recalculated once the camera has moved XCLUTTER_FADE_STEP of the shortest view
+// range (about a quarter of a fade level) since the last time, and then only for cells which overlap the
+// band where instances fade; cells wholly inside it (fully faded in) or beyond it (hidden) are skipped
+// unless they were just generated or crossed into another zone. A still camera does no per instance work.
+#define XCLUTTER_VERTEXES_PER_INSTANCE 8
+#define XCLUTTER_INDEXES_PER_INSTANCE 12
+#define XCLUTTER_DIRTY_RANGE_GAP 16 // dirty instances closer than this are uploaded as one range
+#define XCLUTTER_FADE_LEVELS 16
+#define XCLUTTER_FADE_STEP (1.0f / (4 * XCLUTTER_FADE_LEVELS))
+
+// Clutter is placed per world grid cell: a cell's instances are generated from a hash of the cell's
+// coordinates, so the same cell always gets the same clutter. The instance array is divided into
+// equal blocks, each holding one generated cell. Cells within XCLUTTER_RING_RADIUS cells of the
+// camera's cell are kept loaded, and a few spare blocks cache recently left cells (least recently
+// used ones are regenerated first). Nothing is done while the camera stays in the same cell.
+#define XCLUTTER_RING_RADIUS 3
+#define XCLUTTER_RING_CELLS ((XCLUTTER_RING_RADIUS*2+1) * (XCLUTTER_RING_RADIUS*2+1))
+#define XCLUTTER_SPARE_CELLS ((XCLUTTER_RING_RADIUS*2+1) * 2)
+
+typedef enum {
+	XClutterFadeZone_Unknown = 0,	// (just generated)
+	XClutterFadeZone_Inside,		// every instance fully faded in
+	XClutterFadeZone_Band,			// instances may be fading
+	XClutterFadeZone_Outside		// every instance hidden
+} XClutterFadeZone;
+
+typedef struct {
+	int x, z;
+	bool valid;
+	bool dirty; // some of this cell's instances are dirty
+	XClutterFadeZone fadeZone; // (as of the last fade update)
+	int visibleCount; // instances with nonzero alpha
+	unsigned int lastUsed;
+} XClutterCell;
+
 
 @class XClutterSystem;
 
@@ -71,8 +114,22 @@ typedef GLushort XClutterIndex;
 	int instanceCount;
 	float totalDensity;
 	float minHeight, maxHeight;
+	
+	XScalar cellSize;
+	int cameraCellX, cameraCellZ;
+	BOOL ringValid;
+	unsigned int ringStamp;
+	
+	XScalar fadeNear, fadeFar; // instances are fully faded in within fadeNear of the camera, and hidden beyond fadeFar
+	XVector2 fadeOrigin; // camera position as of the last fade update
+	BOOL fadeValid;
 @public
 	XClutterType clutterTypes[4];
+	
+	// (read by XClutterBatch when uploading)
+	XClutterCell cells[XCLUTTER_RING_CELLS + XCLUTTER_SPARE_CELLS];
+	int cellCount, instancesPerCell;
+	int visibleInstances;
 }
 
 @property(assign) XScene *scene;
@@ -11,6 +11,44 @@
 @interface XClutterSystem (private)
 
 -(void)frameUpdate;
+-(void)updateRing:(XCamera*)cam;
+-(void)updateFade:(XCamera*)cam;
+-(void)generateCell:(XClutterCell*)cell atX:(int)x z:(int)z;
+
+@end
+
+
+// deterministic per cell random numbers (xorshift, seeded from a hash of the cell coordinates)
+static inline uint32_t XClutter_hashCell(int x, int z)
+{
+	uint32_t h = ((uint32_t)x * 73856093u) ^ ((uint32_t)z * 19349663u);
+	h ^= h >> 16;
+	h *= 0x45d9f3bu;
+	h ^= h >> 16;
+	return h ? h : 1;
+}
+
+static inline float XClutter_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline float XClutter_rangeRand(uint32_t *state, float min, float max)
+{
+	return min + XClutter_rand(state) * (max - min);
+}
+
+
+@interface XClutterBatch (private)
+
+-(void)writeInstance:(XClutterInstance*)instance vertexes:(XClutterVertex*)vertexPtr;
+-(void)uploadInstances:(int)first to:(int)last;
+-(void)hideAllInstances;
 
 @end
 
@@ -31,11 +69,11 @@
 		instanceArray = instances;
 		instanceCount = quadCnt;
 		
-		indexCount = instanceCount * 6;
+		indexCount = instanceCount * XCLUTTER_INDEXES_PER_INSTANCE;
 		{
 			XClutterIndex *indexData = malloc(sizeof(XClutterIndex)*indexCount);
 			XClutterIndex *ptr = indexData;
-			for (GLushort i = 0; i < instanceCount; ++i) {
+			for (GLushort i = 0; i < instanceCount * 2; ++i) {
 				GLushort o = i * 4;
 				*ptr++ = 0+o; *ptr++ = 1+o; *ptr++ = 2+o;
 				*ptr++ = 1+o; *ptr++ = 2+o; *ptr++ = 3+o;
@@ -47,14 +85,17 @@
 			free(indexData);
 		}
 
-		vertexCount = instanceCount * 4;
+		// (all instances start out hidden, as degenerate quads)
+		vertexCount = instanceCount * XCLUTTER_VERTEXES_PER_INSTANCE;
 		{
-			clutterVertexBuffer = malloc(sizeof(XClutterVertex) * vertexCount);
+			clutterVertexBuffer = calloc(vertexCount, sizeof(XClutterVertex));
 			glGenBuffers(1, &glVertexBuffer);
 			glBindBuffer(GL_ARRAY_BUFFER, glVertexBuffer);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(XClutterVertex)*vertexCount, NULL, GL_DYNAMIC_DRAW);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(XClutterVertex)*vertexCount, clutterVertexBuffer, GL_DYNAMIC_DRAW);
 			glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
+		for (int i = 0; i < instanceCount; ++i)
+			instanceArray[i].alpha = 0;
 	}
 	return self;
 }
@@ -90,175 +131,189 @@
 	return (XMatrix3*)&xMatrix3_Identity;
 }
 
--(NSString*)getRenderGroupID
+-(XRenderSortKey)getRenderGroupKey
 {
-	return @"8_clutter";
+	return xRenderGroupKey(XRenderPass_Clutter, 0, 0, 0);
 }
 
 -(void)beginRenderGroup
 {	
-	glDisable(GL_LIGHTING);
-	glDisable(GL_CULL_FACE);
-	glDisableClientState(GL_NORMAL_ARRAY);
+	xglDisable(GL_LIGHTING);
+	xglDisable(GL_CULL_FACE);
+	xglDisableClientState(GL_NORMAL_ARRAY);
 
 	if (xglCheckBindTextures(atlasTexture.glTexture, 0)) {
-		glActiveTexture(GL_TEXTURE0);
+		xglActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, atlasTexture.glTexture);
-		glEnable(GL_TEXTURE_2D);
+		xglEnable(GL_TEXTURE_2D);
 	}
 
-	//glAlphaFunc(GL_GREATER, 0.75f);
-	//glEnable(GL_ALPHA_TEST);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDepthMask(FALSE);
+	//xglAlphaFunc(GL_GREATER, 0.75f);
+	//xglEnable(GL_ALPHA_TEST);
+	xglEnable(GL_BLEND);
+	xglBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	xglDepthMask(FALSE);
 }
 
 -(void)endRenderGroup
 {
-	glActiveTexture(GL_TEXTURE0);
+	xglActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	
-	glDisableClientState(GL_COLOR_ARRAY);
+	xglDisableClientState(GL_COLOR_ARRAY);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	
-	//glDisable(GL_ALPHA_TEST);
-	glDisable(GL_BLEND);
-	glDepthMask(TRUE);
+	//xglDisable(GL_ALPHA_TEST);
+	xglDisable(GL_BLEND);
+	xglDepthMask(TRUE);
 
-	glEnable(GL_LIGHTING);
-	glEnable(GL_CULL_FACE);
+	xglEnable(GL_LIGHTING);
+	xglEnable(GL_CULL_FACE);
 }
 
--(void)render:(XCamera*)cam
+-(void)writeInstance:(XClutterInstance*)instance vertexes:(XClutterVertex*)vertexPtr
 {
-	[system frameUpdate];
+	if (instance->alpha == 0) {
+		memset(vertexPtr, 0, sizeof(XClutterVertex) * XCLUTTER_VERTEXES_PER_INSTANCE);
+		return;
+	}
 	
-	// calculate vectors to face clutter billboards towards camera
-	XVector3 rightVector = xCrossProduct_Vec3(&cam->lookVector, &cam->upVector);
-	XVector3 upVector = xCrossProduct_Vec3(&rightVector, &cam->lookVector);
-	xNormalize_Vec3(&rightVector);
-	xNormalize_Vec3(&upVector);
+	// select image from atlas
+	XScalarRect texRect;
+	int typeID = instance->type->typeID;
+	if (typeID == 0 || typeID == 2) {
+		texRect.left = 0;
+		texRect.right = 0.5f;
+	} else {
+		texRect.left = 0.5f;
+		texRect.right = 1;
+	}
+	if (typeID == 0 || typeID == 1) {
+		texRect.top = 0;
+		texRect.bottom = 0.5f;
+	} else {
+		texRect.top = 0.5f;
+		texRect.bottom = 1;
+	}
+	if (instance->size < 0) {
+		float tmp = texRect.right;
+		texRect.right = texRect.left;
+		texRect.left = tmp;
+	}
+	
+	XVector3 pos = instance->position;
+	pos.y += (instance->type->yOffset) * instance->size;
+	
+	XScalar halfSize = xAbs(instance->size) * 0.5f;
+	XColorBytes color; color.alpha = instance->alpha;
+	color.red = color.green = color.blue = (unsigned char)(instance->lightness * (float)0xFF);
 	
-	// generate billboard vertex data
-	BOOL allInvisible = YES;
-	XClutterVertex *clutterVertexPtr = clutterVertexBuffer;
+	// two quads, along the instance's yaw and perpendicular to it
+	XScalar cos = xCos(instance->yaw) * halfSize;
+	XScalar sin = xSin(instance->yaw) * halfSize;
+	XScalar axes[2][2] = { { cos, sin }, { -sin, cos } };
+	for (int q = 0; q < 2; ++q) {
+		XScalar ax = axes[q][0], az = axes[q][1];
+		
+		// top-left corner
+		vertexPtr->position.x = pos.x - ax;
+		vertexPtr->position.y = pos.y + halfSize;
+		vertexPtr->position.z = pos.z - az;
+		vertexPtr->color = color;
+		vertexPtr->u = texRect.left;
+		vertexPtr->v = texRect.top;
+		++vertexPtr;
+		
+		// top-right corner
+		vertexPtr->position.x = pos.x + ax;
+		vertexPtr->position.y = pos.y + halfSize;
+		vertexPtr->position.z = pos.z + az;
+		vertexPtr->color = color;
+		vertexPtr->u = texRect.right;
+		vertexPtr->v = texRect.top;
+		++vertexPtr;
+		
+		// bottom-left corner
+		vertexPtr->position.x = pos.x - ax;
+		vertexPtr->position.y = pos.y - halfSize;
+		vertexPtr->position.z = pos.z - az;
+		vertexPtr->color = color;
+		vertexPtr->u = texRect.left;
+		vertexPtr->v = texRect.bottom;
+		++vertexPtr;
+		
+		// bottom-right corner
+		vertexPtr->position.x = pos.x + ax;
+		vertexPtr->position.y = pos.y - halfSize;
+		vertexPtr->position.z = pos.z + az;
+		vertexPtr->color = color;
+		vertexPtr->u = texRect.right;
+		vertexPtr->v = texRect.bottom;
+		++vertexPtr;
+	}
+}
+
+-(void)uploadInstances:(int)first to:(int)last
+{
+	size_t offset = first * XCLUTTER_VERTEXES_PER_INSTANCE;
+	size_t count = (last - first + 1) * XCLUTTER_VERTEXES_PER_INSTANCE;
+	glBufferSubData(GL_ARRAY_BUFFER, offset*sizeof(XClutterVertex), count*sizeof(XClutterVertex), &clutterVertexBuffer[offset]);
+}
+
+-(void)hideAllInstances
+{
 	for (int i = 0; i < instanceCount; ++i) {
-		XClutterInstance *instance = &instanceArray[i];
+		instanceArray[i].alpha = 0;
+		instanceArray[i].dirty = NO;
+	}
+	memset(clutterVertexBuffer, 0, sizeof(XClutterVertex)*vertexCount);
+	glBindBuffer(GL_ARRAY_BUFFER, glVertexBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(XClutterVertex)*vertexCount, clutterVertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+-(void)render:(XCamera*)cam
+{
+	[system frameUpdate];
+	
+	// rewrite instances which changed (including fading in and out) in the cells which have any, and upload them in ranges
+	glBindBuffer(GL_ARRAY_BUFFER, glVertexBuffer);
+	int rangeFirst = -1, rangeLast = -1;
+	for (int c = 0; c < system->cellCount; ++c) {
+		XClutterCell *cell = &system->cells[c];
+		if (!cell->dirty)
+			continue;
+		cell->dirty = NO;
 		
-		if (!instance->inSync || !instance->visible) {
-			// hidden for now
-			for (int i = 0; i < 4; ++i) {
-				clutterVertexPtr->position.x = 0; clutterVertexPtr->position.y = 0; clutterVertexPtr->position.z = 0;
-				clutterVertexPtr->color.red = 0; clutterVertexPtr->color.green = 0; clutterVertexPtr->color.blue = 0; clutterVertexPtr->color.alpha = 0;
-				clutterVertexPtr->u = 0; clutterVertexPtr->v = 0;
-				++clutterVertexPtr;
+		int first = c * system->instancesPerCell;
+		for (int i = first; i < first + system->instancesPerCell; ++i) {
+			XClutterInstance *instance = &instanceArray[i];
+			if (!instance->dirty)
+				continue;
+			instance->dirty = NO;
+			[self writeInstance:instance vertexes:&clutterVertexBuffer[i * XCLUTTER_VERTEXES_PER_INSTANCE]];
+			if (rangeFirst >= 0 && i - rangeLast > XCLUTTER_DIRTY_RANGE_GAP) {
+				[self uploadInstances:rangeFirst to:rangeLast];
+				rangeFirst = -1;
 			}
-		} else {
-			allInvisible = NO;
-			
-			// select image from atlas
-			XScalarRect texRect;
-			int typeID = instance->type->typeID;
-			if (typeID == 0 || typeID == 2) {
-				texRect.left = 0;
-				texRect.right = 0.5f;
-			} else {
-				texRect.left = 0.5f;
-				texRect.right = 1;
-			}
-			if (typeID == 0 || typeID == 1) {
-				texRect.top = 0;
-				texRect.bottom = 0.5f;
-			} else {
-				texRect.top = 0.5f;
-				texRect.bottom = 1;
-			}
-			if (instance->size < 0) {
-				float tmp = texRect.right;
-				texRect.right = texRect.left;
-				texRect.left = tmp;
-			}
-			
-			// update and generate clutter vertexes
-			XVector3 pos = instance->position;
-			pos.y += (instance->type->yOffset) * instance->size;
-			
-			XVector2 dVec;
-			dVec.x = pos.x - cam->origin.x;
-			dVec.y = pos.z - cam->origin.z;
-			XScalar camDist = xLength_Vec2(&dVec);
-			XScalar fadeIn = xSaturate((camDist / instance->viewRange) - 0.5f) * 2;
-			fadeIn = fadeIn * fadeIn;
-			fadeIn = (1 - fadeIn) * 0.9f;
-			
-			XScalar scale = xAbs(instance->size);
-			XAngle angle = 0;
-			XColorBytes color; color.alpha = 255.0f * fadeIn;
-			color.red = color.green = color.blue = (unsigned char)(instance->lightness * (float)0xFF);
-			
-			XScalar cos = xCos(angle) * scale * 0.5f;
-			XScalar sin = xSin(angle) * scale * 0.5f;
-			XScalar lx, ly;
-			
-			// top-left corner
-			lx = cos*(-1) - sin*(1);
-			ly = sin*(-1) + cos*(1);
-			clutterVertexPtr->position.x = pos.x + rightVector.x * lx + upVector.x * ly;
-			clutterVertexPtr->position.y = pos.y + rightVector.y * lx + upVector.y * ly;
-			clutterVertexPtr->position.z = pos.z + rightVector.z * lx + upVector.z * ly;
-			clutterVertexPtr->color = color;
-			clutterVertexPtr->u = texRect.left;
-			clutterVertexPtr->v = texRect.top;
-			++clutterVertexPtr;
-			
-			// top-right corner
-			lx = cos*(1) - sin*(1);
-			ly = sin*(1) + cos*(1);
-			clutterVertexPtr->position.x = pos.x + rightVector.x * lx + upVector.x * ly;
-			clutterVertexPtr->position.y = pos.y + rightVector.y * lx + upVector.y * ly;
-			clutterVertexPtr->position.z = pos.z + rightVector.z * lx + upVector.z * ly;
-			clutterVertexPtr->color = color;
-			clutterVertexPtr->u = texRect.right;
-			clutterVertexPtr->v = texRect.top;
-			++clutterVertexPtr;
-			
-			// bottom-left corner
-			lx = cos*(-1) - sin*(-1);
-			ly = sin*(-1) + cos*(-1);
-			clutterVertexPtr->position.x = pos.x + rightVector.x * lx + upVector.x * ly;
-			clutterVertexPtr->position.y = pos.y + rightVector.y * lx + upVector.y * ly;
-			clutterVertexPtr->position.z = pos.z + rightVector.z * lx + upVector.z * ly;
-			clutterVertexPtr->color = color;
-			clutterVertexPtr->u = texRect.left;
-			clutterVertexPtr->v = texRect.bottom;
-			++clutterVertexPtr;
-			
-			// bottom-right corner
-			lx = cos*(1) - sin*(-1);
-			ly = sin*(1) + cos*(-1);
-			clutterVertexPtr->position.x = pos.x + rightVector.x * lx + upVector.x * ly;
-			clutterVertexPtr->position.y = pos.y + rightVector.y * lx + upVector.y * ly;
-			clutterVertexPtr->position.z = pos.z + rightVector.z * lx + upVector.z * ly;
-			clutterVertexPtr->color = color;
-			clutterVertexPtr->u = texRect.right;
-			clutterVertexPtr->v = texRect.bottom;
-			++clutterVertexPtr;
+			if (rangeFirst < 0)
+				rangeFirst = i;
+			rangeLast = i;
 		}
 	}
+	if (rangeFirst >= 0)
+		[self uploadInstances:rangeFirst to:rangeLast];
 	
-	if (allInvisible)
+	if (system->visibleInstances == 0)
 		return;
 
-	// upload to vertex buffer and render
-	glBindBuffer(GL_ARRAY_BUFFER, glVertexBuffer);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, vertexCount*sizeof(XClutterVertex), clutterVertexBuffer); //upload data
-	glEnableClientState(GL_VERTEX_ARRAY);
+	// render
+	xglEnableClientState(GL_VERTEX_ARRAY);
 	glVertexPointer(3, GL_FLOAT, sizeof(XClutterVertex), (void*)offsetof(XClutterVertex,position));
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	glTexCoordPointer(2, GL_FLOAT, sizeof(XClutterVertex), (void*)offsetof(XClutterVertex,u));
-	glEnableClientState(GL_COLOR_ARRAY);
+	xglEnableClientState(GL_COLOR_ARRAY);
 	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(XClutterVertex), (void*)offsetof(XClutterVertex,color));
 	
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glIndexBuffer);
@@ -284,6 +339,7 @@
 		for (int i = 0; i < instanceCount; ++i) {
 			instanceArray[i].inSync = NO;
 			instanceArray[i].visible = NO;
+			instanceArray[i].dirty = NO;
 		}
 		for (int i = 0; i < 4; ++i)
 			clutterTypes[i].typeID = i;
@@ -403,118 +459,241 @@
 {
 	for (int i = 0; i < instanceCount; ++i)
 		instanceArray[i].inSync = NO;
+	[batch hideAllInstances];
+	visibleInstances = 0;
 	totalDensity = 0;
+	XScalar minViewRange = 0, maxViewRange = 0;
 	for (int i = 0; i < 4; ++i) {
 		clutterTypes[i].typeID = i;
 		totalDensity += clutterTypes[i].density;
+		if (clutterTypes[i].density > 0 && clutterTypes[i].maxViewRange > maxViewRange)
+			maxViewRange = clutterTypes[i].maxViewRange;
+		if (clutterTypes[i].density > 0 && (minViewRange <= 0 || clutterTypes[i].minViewRange < minViewRange))
+			minViewRange = clutterTypes[i].minViewRange;
+	}
+	
+	// divide the instances into one block per cell, sized so the ring covers the longest view range
+	if (maxViewRange <= 0)
+		maxViewRange = 100;
+	if (minViewRange <= 0 || minViewRange > maxViewRange)
+		minViewRange = maxViewRange;
+	fadeNear = minViewRange * 0.5f;
+	fadeFar = maxViewRange;
+	fadeValid = NO;
+	cellSize = maxViewRange / XCLUTTER_RING_RADIUS;
+	cellCount = XCLUTTER_RING_CELLS + XCLUTTER_SPARE_CELLS;
+	instancesPerCell = instanceCount / cellCount;
+	if (instancesPerCell < 1) {
+		instancesPerCell = 1;
+		cellCount = instanceCount;
+	}
+	for (int i = 0; i < cellCount; ++i) {
+		cells[i].valid = NO;
+		cells[i].dirty = NO;
+		cells[i].fadeZone = XClutterFadeZone_Unknown;
+		cells[i].visibleCount = 0;
+		cells[i].lastUsed = 0;
 	}
+	ringValid = NO;
+	ringStamp = 0;
 }
 
 -(void)frameUpdate
 {
-	if (batch.scene == nil)
+	if (batch.scene == nil || cellCount == 0 || totalDensity <= 0)
 		return;
 	XCamera *cam = batch.scene.camera;
-	XVector3 camPos = cam->origin;
+	[self updateRing:cam];
+	[self updateFade:cam];
+}
+
+-(void)updateRing:(XCamera*)cam
+{
+	int camX = (int)floorf(cam->origin.x / cellSize);
+	int camZ = (int)floorf(cam->origin.z / cellSize);
+	if (ringValid && camX == cameraCellX && camZ == cameraCellZ)
+		return;
+	cameraCellX = camX;
+	cameraCellZ = camZ;
+	ringValid = YES;
+	++ringStamp;
 	
-	for (int i = 0; i < instanceCount; ++i) {
-		XClutterInstance *instance = &instanceArray[i];
-		if (!instance->inSync) {
-			// choose a random clutter type, biased by their densities
-			float rand = xRangeRand(0, totalDensity);
-			float tD = 0;
-			XClutterType *clutterType = nil;
-			for (int j = 0; j < 4; ++j) {
-				tD += clutterTypes[j].density;
-				if (rand <= tD) {
-					clutterType = &clutterTypes[j];
+	// find which cells of the ring are already loaded
+	int missingX[XCLUTTER_RING_CELLS], missingZ[XCLUTTER_RING_CELLS];
+	int missingCount = 0;
+	for (int z = camZ - XCLUTTER_RING_RADIUS; z <= camZ + XCLUTTER_RING_RADIUS; ++z) {
+		for (int x = camX - XCLUTTER_RING_RADIUS; x <= camX + XCLUTTER_RING_RADIUS; ++x) {
+			BOOL found = NO;
+			for (int i = 0; i < cellCount; ++i) {
+				XClutterCell *cell = &cells[i];
+				if (cell->valid && cell->x == x && cell->z == z) {
+					cell->lastUsed = ringStamp;
+					found = YES;
 					break;
 				}
 			}
+			if (!found) {
+				missingX[missingCount] = x;
+				missingZ[missingCount] = z;
+				++missingCount;
+			}
+		}
+	}
+	
+	// generate the others into the least recently used blocks
+	for (int m = 0; m < missingCount; ++m) {
+		XClutterCell *oldest = nil;
+		for (int i = 0; i < cellCount; ++i) {
+			XClutterCell *cell = &cells[i];
+			if (cell->lastUsed != ringStamp && (oldest == nil || cell->lastUsed < oldest->lastUsed))
+				oldest = cell;
+		}
+		if (oldest == nil)
+			break;
+		[self generateCell:oldest atX:missingX[m] z:missingZ[m]];
+		oldest->lastUsed = ringStamp;
+	}
+}
+
+-(void)updateFade:(XCamera*)cam
+{
+	XVector2 camPos;
+	camPos.x = cam->origin.x;
+	camPos.y = cam->origin.z;
+	if (fadeValid) {
+		XVector2 moved;
+		moved.x = camPos.x - fadeOrigin.x;
+		moved.y = camPos.y - fadeOrigin.y;
+		XScalar step = fadeNear * 2 * XCLUTTER_FADE_STEP;
+		if (xLengthSquared_Vec2(&moved) < step * step)
+			return;
+	}
+	fadeValid = YES;
+	fadeOrigin = camPos;
+	
+	visibleInstances = 0;
+	for (int c = 0; c < cellCount; ++c) {
+		XClutterCell *cell = &cells[c];
+		if (!cell->valid)
+			continue;
+		
+		// which zone the cell is in, from its nearest and farthest points to the camera
+		XScalar left = cell->x * cellSize, top = cell->z * cellSize;
+		XVector2 nearVec, farVec;
+		nearVec.x = camPos.x - xClamp(camPos.x, left, left + cellSize);
+		nearVec.y = camPos.y - xClamp(camPos.y, top, top + cellSize);
+		farVec.x = MAX(xAbs(camPos.x - left), xAbs(camPos.x - (left + cellSize)));
+		farVec.y = MAX(xAbs(camPos.y - top), xAbs(camPos.y - (top + cellSize)));
+		XClutterFadeZone zone;
+		if (xLengthSquared_Vec2(&farVec) <= fadeNear * fadeNear)
+			zone = XClutterFadeZone_Inside;
+		else if (xLengthSquared_Vec2(&nearVec) >= fadeFar * fadeFar)
+			zone = XClutterFadeZone_Outside;
+		else
+			zone = XClutterFadeZone_Band;
+		if (zone != XClutterFadeZone_Band && zone == cell->fadeZone) {
+			visibleInstances += cell->visibleCount;
+			continue;
+		}
+		cell->fadeZone = zone;
+		
+		cell->visibleCount = 0;
+		int first = c * instancesPerCell;
+		for (int i = first; i < first + instancesPerCell; ++i) {
+			XClutterInstance *instance = &instanceArray[i];
 			
-			// misc. initialization
-			instance->inSync = YES;
-			instance->type = clutterType;
-			instance->size = xRangeRand(clutterType->minSize, clutterType->maxSize);
-			if (xRand() < 0.5f)
-				instance->size = -instance->size; //negative size = mirrored UVs
-			instance->viewRange = xRangeRand(clutterType->minViewRange, clutterType->maxViewRange);
-			
-			// random clustered position within the view range 
-			XScalar distSq = 0;
-			XScalar maxDistSq = instance->viewRange * instance->viewRange;
-			BOOL cluster = NO;
-			if (xRand() < 0.7f)
-				cluster = YES;
-			if (cluster) {
-				XClutterInstance *clusterPoint = nil;
-				for (int j = i-1; j >= 0; --j) {
-					if (instanceArray[j].type == clutterType) {
-						clusterPoint = &instanceArray[j];
-						break;
-					}
-				}
-				if (!clusterPoint)
-					cluster = NO;
-				else {
-					int safetyCount = 0;
-					do {
-						instance->position.x = clusterPoint->position.x + xRangeRand(-instance->viewRange * 0.1f, instance->viewRange * 0.1f);
-						instance->position.z = clusterPoint->position.z + xRangeRand(-instance->viewRange * 0.1f, instance->viewRange * 0.1f);
-						XVector2 dVec;
-						dVec.x = instance->position.x - camPos.x;
-						dVec.y = instance->position.z - camPos.z;
-						distSq = dVec.x * dVec.x + dVec.y * dVec.y;
-						if (++safetyCount > 200) break;
-					} while (distSq > maxDistSq);
-				}
+			unsigned char alpha = 0;
+			if (instance->inSync && instance->visible) {
+				XVector2 dVec;
+				dVec.x = instance->position.x - camPos.x;
+				dVec.y = instance->position.z - camPos.y;
+				XScalar camDist = xLength_Vec2(&dVec);
+				XScalar fadeIn = xSaturate((camDist / instance->viewRange) - 0.5f) * 2;
+				fadeIn = fadeIn * fadeIn;
+				fadeIn = (1 - fadeIn) * 0.9f;
+				int level = (int)(fadeIn * XCLUTTER_FADE_LEVELS + 0.5f);
+				alpha = (unsigned char)(level * 255 / XCLUTTER_FADE_LEVELS);
 			}
-			if (!cluster) {
-				int safetyCount = 0;
-				do {
-					instance->position.x = xRangeRand(-instance->viewRange, instance->viewRange);
-					instance->position.z = xRangeRand(-instance->viewRange, instance->viewRange);
-					distSq = instance->position.x * instance->position.x + instance->position.z * instance->position.z;
-					if (++safetyCount > 200) break;
-				} while (distSq > maxDistSq);
-				instance->position.x += camPos.x;
-				instance->position.z += camPos.z;
+			if (alpha != instance->alpha) {
+				instance->alpha = alpha;
+				instance->dirty = YES;
 			}
-			instance->position.y = 0;
-			XTerrainIntersection intersect = [terrain intersectTerrainVerticallyAt:&instance->position];
-			instance->position.y = intersect.point.y;
-			
-			// color to specified variation, modulated by terrain light map
-			float lightness = xRangeRand(clutterType->minLightness, clutterType->maxLightness);
-			instance->lightness = lightness * xSaturate([terrain sampleTerrainLightmapAt:&instance->position] * 3);
+			if (instance->dirty)
+				cell->dirty = YES;
+			if (alpha != 0)
+				++cell->visibleCount;
 		}
-		else {
-			// wrap clutter instances around viewing circle
-			XVector2 dVec;
-			dVec.x = instance->position.x - camPos.x;
-			dVec.y = instance->position.z - camPos.z;
-			XScalar dist = xNormalize_Vec2(&dVec);
-			if (dist > instance->viewRange) {
-				if (dist < instance->viewRange * 1.5f) {
-					dist = 2 * instance->viewRange - dist;
-					dVec.x = -dVec.x * dist;
-					dVec.y = -dVec.y * dist;
-					instance->position.x = camPos.x + dVec.x;
-					instance->position.z = camPos.z + dVec.y;
-					XTerrainIntersection intersect = [terrain intersectTerrainVerticallyAt:&instance->position];
-					instance->position.y = intersect.point.y;
-					float lightness = xRangeRand(instance->type->minLightness, instance->type->maxLightness);
-					instance->lightness = lightness * [terrain sampleTerrainLightmapAt:&instance->position];
-				} else {
-					instance->inSync = NO;
+		visibleInstances += cell->visibleCount;
+	}
+}
+
+-(void)generateCell:(XClutterCell*)cell atX:(int)x z:(int)z
+{
+	cell->x = x;
+	cell->z = z;
+	cell->valid = YES;
+	cell->dirty = YES;
+	cell->fadeZone = XClutterFadeZone_Unknown;
+	fadeValid = NO;
+	
+	uint32_t random = XClutter_hashCell(x, z);
+	XScalar cellLeft = x * cellSize, cellTop = z * cellSize;
+	XScalar terrainHeight = terrain->boundingBox.max.y - terrain->boundingBox.min.y;
+	
+	int first = (int)(cell - cells) * instancesPerCell;
+	for (int i = first; i < first + instancesPerCell; ++i) {
+		XClutterInstance *instance = &instanceArray[i];
+		
+		// choose a clutter type, biased by their densities
+		float rand = XClutter_rangeRand(&random, 0, totalDensity);
+		float tD = 0;
+		XClutterType *clutterType = &clutterTypes[0];
+		for (int j = 0; j < 4; ++j) {
+			tD += clutterTypes[j].density;
+			if (rand <= tD && clutterTypes[j].density > 0) {
+				clutterType = &clutterTypes[j];
+				break;
+			}
+		}
+		
+		// misc. initialization
+		instance->inSync = YES;
+		instance->dirty = YES;
+		instance->type = clutterType;
+		instance->size = XClutter_rangeRand(&random, clutterType->minSize, clutterType->maxSize);
+		if (XClutter_rand(&random) < 0.5f)
+			instance->size = -instance->size; //negative size = mirrored UVs
+		instance->viewRange = XClutter_rangeRand(&random, clutterType->minViewRange, clutterType->maxViewRange);
+		instance->yaw = XClutter_rangeRand(&random, 0, HALF_PI);
+		
+		// position within the cell, often clustered around the previous instance of the same type
+		XClutterInstance *clusterPoint = nil;
+		if (XClutter_rand(&random) < 0.7f) {
+			for (int j = i-1; j >= first; --j) {
+				if (instanceArray[j].type == clutterType) {
+					clusterPoint = &instanceArray[j];
+					break;
 				}
 			}
 		}
-		XScalar relY = (instance->position.y - terrain->boundingBox.min.y) / (terrain->boundingBox.max.y - terrain->boundingBox.min.y);
-		if (relY >= minHeight && relY <= maxHeight)
-			instance->visible = YES;
-		else
-			instance->visible = NO;
+		if (clusterPoint) {
+			XScalar spread = cellSize * 0.1f;
+			instance->position.x = xClamp(clusterPoint->position.x + XClutter_rangeRand(&random, -spread, spread), cellLeft, cellLeft + cellSize);
+			instance->position.z = xClamp(clusterPoint->position.z + XClutter_rangeRand(&random, -spread, spread), cellTop, cellTop + cellSize);
+		} else {
+			instance->position.x = cellLeft + XClutter_rand(&random) * cellSize;
+			instance->position.z = cellTop + XClutter_rand(&random) * cellSize;
+		}
+		instance->position.y = 0;
+		XTerrainIntersection intersect = [terrain intersectTerrainVerticallyAt:&instance->position];
+		instance->position.y = intersect.point.y;
+		
+		// color to specified variation, modulated by terrain light map
+		float lightness = XClutter_rangeRand(&random, clutterType->minLightness, clutterType->maxLightness);
+		instance->lightness = lightness * xSaturate([terrain sampleTerrainLightmapAt:&instance->position] * 3);
+		
+		XScalar relY = (instance->position.y - terrain->boundingBox.min.y) / terrainHeight;
+		instance->visible = (relY >= minHeight && relY <= maxHeight);
 	}
 }
 
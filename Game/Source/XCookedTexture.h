@@ -0,0 +1,38 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import <stdint.h>
+
+// A cooked texture (".xtex") holds a complete mip chain already converted to the pixel format it's
+// uploaded in, so XTexture can read it in one go and hand each level straight to glTexImage2D with no
+// decoding, conversion or copying. 16 bit pixels are stored exactly as GL unpacks them (little endian
+// shorts, R in the high bits), rows top to bottom as the TGA/UIImage loaders produce them.
+//
+// Cooked textures are built offline with TextureCooker, and are looked up next to their source image
+// (e.g. "HUD/arrow.tga" -> "HUD/arrow.tga.xtex"). The layout below is shared by the game and the cooker,
+// so any change to it must bump XCOOKEDTEXTURE_VERSION.
+
+#define XCOOKEDTEXTURE_MAGIC 0x58455458 // "XTEX"
+#define XCOOKEDTEXTURE_VERSION 1
+#define XCOOKEDTEXTURE_MAX_LEVELS 16
+#define XCOOKEDTEXTURE_LEVEL_ALIGNMENT 16
+
+typedef enum {
+	XCookedTextureFormat_RGB565 = 0,
+	XCookedTextureFormat_RGBA4444,
+	XCookedTextureFormat_RGBA8888,
+	XCookedTextureFormat_Count
+} XCookedTextureFormat;
+
+typedef struct {
+	uint32_t offset, size;	// (from the start of the file)
+} XCookedTextureLevel;
+
+typedef struct {
+	uint32_t magic, version;
+	uint32_t width, height;		// of level 0
+	uint32_t format;			// XCookedTextureFormat
+	uint32_t levelCount;		// 1 means the cooker made no mips (GL generates them, as for uncompressed files)
+	uint32_t reserved[2];
+	XCookedTextureLevel levels[XCOOKEDTEXTURE_MAX_LEVELS];
+} XCookedTextureHeader;
+
@@ -0,0 +1,33 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMath.h"
+#import <stdint.h>
+
+// Batch frustum culling over packed (structure of arrays) world space bounds. Each entry is a box
+// center and half-extent; an entry is culled when it lies entirely behind any frustum plane, which is
+// tested as (n.c + w) + (|n.x|*e.x + |n.y|*e.y + |n.z|*e.z) < 0. Entries are processed 4 at a time
+// with NEON (device) or SSE (simulator), with a scalar fallback for everything else, and the results
+// are written as a visibility bitmask (bit i of visibleMask[i/32] is set if entry i is visible).
+
+typedef struct {
+	float *centerX, *centerY, *centerZ;
+	float *extentX, *extentY, *extentZ;
+	void **userData;
+	uint32_t *visibleMask;
+	int count, capacity;
+} XCullingBoundsArray;
+
+void CullingBoundsArray_init(XCullingBoundsArray *bounds);
+void CullingBoundsArray_free(XCullingBoundsArray *bounds);
+static inline void CullingBoundsArray_clear(XCullingBoundsArray *bounds) { bounds->count = 0; }
+void CullingBoundsArray_add(XCullingBoundsArray *bounds, const XBoundingBox *box, void *userData);
+static inline BOOL CullingBoundsArray_isVisible(const XCullingBoundsArray *bounds, int index) { return (bounds->visibleMask[index >> 5] >> (index & 31)) & 1; }
+
+// fills bounds->visibleMask for all entries, testing against 6 normalized, inward facing planes
+void FrustumCulling_testBounds(const XVector4 *planes, XCullingBoundsArray *bounds);
+// the same test without SIMD (what the SIMD kernels are checked against; see FrustumBench)
+void FrustumCulling_testBoundsScalar(const XVector4 *planes, XCullingBoundsArray *bounds);
+
+// computes the center and half-extent of the world space AABB enclosing a rotated and translated box
+void FrustumCulling_transformBox(const XBoundingBox *box, const XVector3 *pos, const XMatrix3 *rot, XVector3 *center, XVector3 *extent);
+
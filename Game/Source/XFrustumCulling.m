@@ -0,0 +1,159 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XFrustumCulling.h"
+#import <stdlib.h>
+#import <string.h>
+
+#if defined(__ARM_NEON__)
+#import <arm_neon.h>
+#define FRUSTUMCULLING_NEON
+#elif defined(__SSE__)
+#import <xmmintrin.h>
+#define FRUSTUMCULLING_SSE
+#endif
+
+
+void CullingBoundsArray_init(XCullingBoundsArray *bounds)
+{
+	memset(bounds, 0, sizeof(XCullingBoundsArray));
+}
+
+void CullingBoundsArray_free(XCullingBoundsArray *bounds)
+{
+	free(bounds->centerX); free(bounds->centerY); free(bounds->centerZ);
+	free(bounds->extentX); free(bounds->extentY); free(bounds->extentZ);
+	free(bounds->userData);
+	free(bounds->visibleMask);
+	CullingBoundsArray_init(bounds);
+}
+
+void CullingBoundsArray_add(XCullingBoundsArray *bounds, const XBoundingBox *box, void *userData)
+{
+	if (bounds->count >= bounds->capacity) {
+		int size = (bounds->capacity > 0) ? bounds->capacity * 2 : 128;
+		bounds->centerX = realloc(bounds->centerX, sizeof(float) * size);
+		bounds->centerY = realloc(bounds->centerY, sizeof(float) * size);
+		bounds->centerZ = realloc(bounds->centerZ, sizeof(float) * size);
+		bounds->extentX = realloc(bounds->extentX, sizeof(float) * size);
+		bounds->extentY = realloc(bounds->extentY, sizeof(float) * size);
+		bounds->extentZ = realloc(bounds->extentZ, sizeof(float) * size);
+		bounds->userData = realloc(bounds->userData, sizeof(void*) * size);
+		bounds->visibleMask = realloc(bounds->visibleMask, sizeof(uint32_t) * (size / 32));
+		bounds->capacity = size;
+	}
+	int i = bounds->count++;
+	bounds->centerX[i] = (box->min.x + box->max.x) * 0.5f;
+	bounds->centerY[i] = (box->min.y + box->max.y) * 0.5f;
+	bounds->centerZ[i] = (box->min.z + box->max.z) * 0.5f;
+	bounds->extentX[i] = (box->max.x - box->min.x) * 0.5f;
+	bounds->extentY[i] = (box->max.y - box->min.y) * 0.5f;
+	bounds->extentZ[i] = (box->max.z - box->min.z) * 0.5f;
+	bounds->userData[i] = userData;
+}
+
+// tests entries first..count-1, setting their bits (which must already be clear)
+static void FrustumCulling_testRangeScalar(const XVector4 *planes, XCullingBoundsArray *bounds, int first)
+{
+	const float *cx = bounds->centerX, *cy = bounds->centerY, *cz = bounds->centerZ;
+	const float *ex = bounds->extentX, *ey = bounds->extentY, *ez = bounds->extentZ;
+	uint32_t *mask = bounds->visibleMask;
+	for (int i = first; i < bounds->count; ++i) {
+		BOOL visible = YES;
+		for (int p = 0; p < 6; ++p) {
+			const XVector4 *plane = &planes[p];
+			XScalar d = plane->x * cx[i] + plane->y * cy[i] + plane->z * cz[i] + plane->w;
+			XScalar r = xAbs(plane->x) * ex[i] + xAbs(plane->y) * ey[i] + xAbs(plane->z) * ez[i];
+			if (d + r < 0) {
+				visible = NO;
+				break;
+			}
+		}
+		if (visible)
+			mask[i >> 5] |= 1u << (i & 31);
+	}
+}
+
+void FrustumCulling_testBounds(const XVector4 *planes, XCullingBoundsArray *bounds)
+{
+	int count = bounds->count;
+	uint32_t *mask = bounds->visibleMask;
+	if (count == 0)
+		return;
+	memset(mask, 0, sizeof(uint32_t) * ((count + 31) / 32));
+
+	const float *cx = bounds->centerX, *cy = bounds->centerY, *cz = bounds->centerZ;
+	const float *ex = bounds->extentX, *ey = bounds->extentY, *ez = bounds->extentZ;
+	int i = 0;
+
+#if defined(FRUSTUMCULLING_NEON)
+	const uint32_t bitValues[4] = { 1, 2, 4, 8 };
+	uint32x4_t bitSelect = vld1q_u32(bitValues);
+	float32x4_t zero = vdupq_n_f32(0);
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t vcx = vld1q_f32(cx + i), vcy = vld1q_f32(cy + i), vcz = vld1q_f32(cz + i);
+		float32x4_t vex = vld1q_f32(ex + i), vey = vld1q_f32(ey + i), vez = vld1q_f32(ez + i);
+		uint32x4_t visible = vdupq_n_u32(0xFFFFFFFF);
+		for (int p = 0; p < 6; ++p) {
+			const XVector4 *plane = &planes[p];
+			float32x4_t sum = vdupq_n_f32(plane->w);
+			sum = vmlaq_n_f32(sum, vcx, plane->x);
+			sum = vmlaq_n_f32(sum, vcy, plane->y);
+			sum = vmlaq_n_f32(sum, vcz, plane->z);
+			sum = vmlaq_n_f32(sum, vex, xAbs(plane->x));
+			sum = vmlaq_n_f32(sum, vey, xAbs(plane->y));
+			sum = vmlaq_n_f32(sum, vez, xAbs(plane->z));
+			visible = vandq_u32(visible, vcgeq_f32(sum, zero));
+		}
+		uint32x4_t bits = vandq_u32(visible, bitSelect);
+		uint32x2_t pairs = vorr_u32(vget_low_u32(bits), vget_high_u32(bits));
+		uint32_t nibble = vget_lane_u32(pairs, 0) | vget_lane_u32(pairs, 1);
+		mask[i >> 5] |= nibble << (i & 31);
+	}
+#elif defined(FRUSTUMCULLING_SSE)
+	__m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4) {
+		__m128 vcx = _mm_loadu_ps(cx + i), vcy = _mm_loadu_ps(cy + i), vcz = _mm_loadu_ps(cz + i);
+		__m128 vex = _mm_loadu_ps(ex + i), vey = _mm_loadu_ps(ey + i), vez = _mm_loadu_ps(ez + i);
+		__m128 visible = _mm_cmpeq_ps(zero, zero);
+		for (int p = 0; p < 6; ++p) {
+			const XVector4 *plane = &planes[p];
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vcx, _mm_set1_ps(plane->x)), _mm_mul_ps(vcy, _mm_set1_ps(plane->y))),
+								  _mm_add_ps(_mm_mul_ps(vcz, _mm_set1_ps(plane->z)), _mm_set1_ps(plane->w)));
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vex, _mm_set1_ps(xAbs(plane->x))), _mm_mul_ps(vey, _mm_set1_ps(xAbs(plane->y)))),
+								  _mm_mul_ps(vez, _mm_set1_ps(xAbs(plane->z))));
+			visible = _mm_and_ps(visible, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+		}
+		uint32_t nibble = (uint32_t)_mm_movemask_ps(visible);
+		mask[i >> 5] |= nibble << (i & 31);
+	}
+#endif
+
+	// scalar fallback (and the remaining entries after the SIMD loop)
+	FrustumCulling_testRangeScalar(planes, bounds, i);
+}
+
+void FrustumCulling_testBoundsScalar(const XVector4 *planes, XCullingBoundsArray *bounds)
+{
+	if (bounds->count == 0)
+		return;
+	memset(bounds->visibleMask, 0, sizeof(uint32_t) * ((bounds->count + 31) / 32));
+	FrustumCulling_testRangeScalar(planes, bounds, 0);
+}
+
+void FrustumCulling_transformBox(const XBoundingBox *box, const XVector3 *pos, const XMatrix3 *rot, XVector3 *center, XVector3 *extent)
+{
+	XVector3 localCenter, halfSize;
+	localCenter.x = (box->min.x + box->max.x) * 0.5f;
+	localCenter.y = (box->min.y + box->max.y) * 0.5f;
+	localCenter.z = (box->min.z + box->max.z) * 0.5f;
+	halfSize.x = (box->max.x - box->min.x) * 0.5f;
+	halfSize.y = (box->max.y - box->min.y) * 0.5f;
+	halfSize.z = (box->max.z - box->min.z) * 0.5f;
+
+	center->x = rot->m00 * localCenter.x + rot->m01 * localCenter.y + rot->m02 * localCenter.z + pos->x;
+	center->y = rot->m10 * localCenter.x + rot->m11 * localCenter.y + rot->m12 * localCenter.z + pos->y;
+	center->z = rot->m20 * localCenter.x + rot->m21 * localCenter.y + rot->m22 * localCenter.z + pos->z;
+	extent->x = xAbs(rot->m00) * halfSize.x + xAbs(rot->m01) * halfSize.y + xAbs(rot->m02) * halfSize.z;
+	extent->y = xAbs(rot->m10) * halfSize.x + xAbs(rot->m11) * halfSize.y + xAbs(rot->m12) * halfSize.z;
+	extent->z = xAbs(rot->m20) * halfSize.x + xAbs(rot->m21) * halfSize.y + xAbs(rot->m22) * halfSize.z;
+}
@@ -3,6 +3,7 @@
 #import <OpenGLES/EAGL.h>
 #import <OpenGLES/ES1/gl.h>
 #import <OpenGLES/ES1/glext.h>
+#import "XRenderDevice.h"
 #import "XMath.h"
 
 #if !defined(DEBUG) && ! defined(NDEBUG)
@@ -31,6 +32,28 @@ BOOL xglCheckBindTexture1(GLuint glTexture);
 void xglNotifyMeshBindingsChanged();
 void xglNotifyTextureBindingsChanged();
 
+// Cached render state. These functions only call OpenGL when the requested state differs from the
+// state last set through them, and count the calls they skip. Like the bindings above, the cache is
+// only reliable if all changes to this state go through these functions (call xglNotifyStateChanged
+// after changing any of it directly). Capabilities other than lighting, culling, fog, blending,
+// alpha / depth testing and GL_TEXTURE_2D (on texture units 0 and 1) aren't cached.
+void xglEnable(GLenum cap);
+void xglDisable(GLenum cap);
+void xglEnableClientState(GLenum array);
+void xglDisableClientState(GLenum array);
+void xglActiveTexture(GLenum texture);
+void xglClientActiveTexture(GLenum texture);
+void xglBlendFunc(GLenum sfactor, GLenum dfactor);
+void xglDepthMask(GLboolean flag);
+void xglAlphaFunc(GLenum func, GLclampf ref);
+void xglTexEnvf(GLenum target, GLenum pname, GLfloat param);
+void xglNotifyStateChanged();
+
+// number of redundant state changes skipped by the cache (including xglSetMaterial and
+// xglSetMaterialEmission), accumulated until xglResetStateCacheStats() is called
+int xglGetSkippedStateChanges();
+void xglResetStateCacheStats();
+
 // Misc. helper types and functions
 typedef enum {
 	XBlend_None,
@@ -39,10 +62,6 @@ typedef enum {
 	XBlend_Alpha
 } XBlendMode;
 
-typedef struct {
-	unsigned char red, green, blue, alpha;
-} XColorBytes;
-
 typedef struct {
 	float red, green, blue, alpha;
 } XColor;
@@ -100,7 +119,8 @@ typedef struct {
 	float shininess;	
 } XMaterial;
 
-void xglSetMaterial(XMaterial *mat);
+void xglSetMaterial(XMaterial *mat); //(cached, see above)
+void xglSetMaterialEmission(XColor *emission); //(cached)
 XMaterial xglGetDefaultMaterial();
 
 BOOL xCheckExtensionSupported(const char *extensionName);
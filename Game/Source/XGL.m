@@ -8,6 +8,43 @@ GLuint boundVertexBuffer = 0;
 GLuint boundTexture0 = 0;
 GLuint boundTexture1 = 0;
 
+// cached state (-1 where unknown)
+typedef enum {
+	XGLCap_Lighting,
+	XGLCap_CullFace,
+	XGLCap_Fog,
+	XGLCap_Blend,
+	XGLCap_AlphaTest,
+	XGLCap_DepthTest,
+	XGLCap_Texture2D_0,
+	XGLCap_Texture2D_1,
+	XGLCap_Count
+} XGLCap;
+
+typedef enum {
+	XGLArray_Vertex,
+	XGLArray_Normal,
+	XGLArray_Color,
+	XGLArray_TexCoord_0,
+	XGLArray_TexCoord_1,
+	XGLArray_Count
+} XGLArray;
+
+#define XGL_TEXTURE_UNITS 2
+
+static signed char capStates[XGLCap_Count];
+static signed char arrayStates[XGLArray_Count];
+static int activeTextureUnit, clientActiveTextureUnit;
+static GLenum blendSrcFactor, blendDestFactor;
+static int depthMask;
+static GLenum alphaTestFunc;
+static GLclampf alphaTestRef;
+static GLfloat textureEnvModes[XGL_TEXTURE_UNITS], textureLodBiases[XGL_TEXTURE_UNITS];
+static XMaterial currentMaterial;
+static XColor currentEmission;
+static BOOL stateCacheValid = NO, materialValid, emissionValid;
+static int skippedStateChanges = 0;
+
 
 BOOL xglCheckBindMesh(GLuint glVertexBuff, GLuint glIndexBuff)
 {
@@ -56,14 +93,230 @@ void xglNotifyTextureBindingsChanged()
 	boundTexture1 = -1;
 }
 
+void xglNotifyStateChanged()
+{
+	memset(capStates, -1, sizeof(capStates));
+	memset(arrayStates, -1, sizeof(arrayStates));
+	activeTextureUnit = -1;
+	clientActiveTextureUnit = -1;
+	blendSrcFactor = blendDestFactor = (GLenum)-1;
+	depthMask = -1;
+	alphaTestFunc = (GLenum)-1;
+	for (int i = 0; i < XGL_TEXTURE_UNITS; ++i)
+		textureEnvModes[i] = textureLodBiases[i] = NAN; //(never equal to anything)
+	materialValid = NO;
+	emissionValid = NO;
+	stateCacheValid = YES;
+}
+
+static inline void xglCheckStateCache()
+{
+	if (!stateCacheValid)
+		xglNotifyStateChanged();
+}
+
+static int xglCapIndex(GLenum cap)
+{
+	switch (cap) {
+		case GL_LIGHTING: return XGLCap_Lighting;
+		case GL_CULL_FACE: return XGLCap_CullFace;
+		case GL_FOG: return XGLCap_Fog;
+		case GL_BLEND: return XGLCap_Blend;
+		case GL_ALPHA_TEST: return XGLCap_AlphaTest;
+		case GL_DEPTH_TEST: return XGLCap_DepthTest;
+		case GL_TEXTURE_2D:
+			if (activeTextureUnit < 0) return -1;
+			return XGLCap_Texture2D_0 + activeTextureUnit;
+		default: return -1;
+	}
+}
+
+static int xglArrayIndex(GLenum array)
+{
+	switch (array) {
+		case GL_VERTEX_ARRAY: return XGLArray_Vertex;
+		case GL_NORMAL_ARRAY: return XGLArray_Normal;
+		case GL_COLOR_ARRAY: return XGLArray_Color;
+		case GL_TEXTURE_COORD_ARRAY:
+			if (clientActiveTextureUnit < 0) return -1;
+			return XGLArray_TexCoord_0 + clientActiveTextureUnit;
+		default: return -1;
+	}
+}
+
+void xglEnable(GLenum cap)
+{
+	xglCheckStateCache();
+	int index = xglCapIndex(cap);
+	if (index >= 0) {
+		if (capStates[index] == 1) {
+			++skippedStateChanges;
+			return;
+		}
+		capStates[index] = 1;
+	}
+	glEnable(cap);
+}
+
+void xglDisable(GLenum cap)
+{
+	xglCheckStateCache();
+	int index = xglCapIndex(cap);
+	if (index >= 0) {
+		if (capStates[index] == 0) {
+			++skippedStateChanges;
+			return;
+		}
+		capStates[index] = 0;
+	}
+	glDisable(cap);
+}
+
+void xglEnableClientState(GLenum array)
+{
+	xglCheckStateCache();
+	int index = xglArrayIndex(array);
+	if (index >= 0) {
+		if (arrayStates[index] == 1) {
+			++skippedStateChanges;
+			return;
+		}
+		arrayStates[index] = 1;
+	}
+	glEnableClientState(array);
+}
+
+void xglDisableClientState(GLenum array)
+{
+	xglCheckStateCache();
+	int index = xglArrayIndex(array);
+	if (index >= 0) {
+		if (arrayStates[index] == 0) {
+			++skippedStateChanges;
+			return;
+		}
+		arrayStates[index] = 0;
+	}
+	glDisableClientState(array);
+}
+
+void xglActiveTexture(GLenum texture)
+{
+	xglCheckStateCache();
+	int unit = texture - GL_TEXTURE0;
+	if (unit == activeTextureUnit) {
+		++skippedStateChanges;
+		return;
+	}
+	activeTextureUnit = (unit >= 0 && unit < XGL_TEXTURE_UNITS) ? unit : -1;
+	glActiveTexture(texture);
+}
+
+void xglClientActiveTexture(GLenum texture)
+{
+	xglCheckStateCache();
+	int unit = texture - GL_TEXTURE0;
+	if (unit == clientActiveTextureUnit) {
+		++skippedStateChanges;
+		return;
+	}
+	clientActiveTextureUnit = (unit >= 0 && unit < XGL_TEXTURE_UNITS) ? unit : -1;
+	glClientActiveTexture(texture);
+}
+
+void xglBlendFunc(GLenum sfactor, GLenum dfactor)
+{
+	xglCheckStateCache();
+	if (sfactor == blendSrcFactor && dfactor == blendDestFactor) {
+		++skippedStateChanges;
+		return;
+	}
+	blendSrcFactor = sfactor;
+	blendDestFactor = dfactor;
+	glBlendFunc(sfactor, dfactor);
+}
+
+void xglDepthMask(GLboolean flag)
+{
+	xglCheckStateCache();
+	int mask = flag ? 1 : 0;
+	if (mask == depthMask) {
+		++skippedStateChanges;
+		return;
+	}
+	depthMask = mask;
+	glDepthMask(flag);
+}
+
+void xglAlphaFunc(GLenum func, GLclampf ref)
+{
+	xglCheckStateCache();
+	if (func == alphaTestFunc && ref == alphaTestRef) {
+		++skippedStateChanges;
+		return;
+	}
+	alphaTestFunc = func;
+	alphaTestRef = ref;
+	glAlphaFunc(func, ref);
+}
+
+void xglTexEnvf(GLenum target, GLenum pname, GLfloat param)
+{
+	xglCheckStateCache();
+	GLfloat *cached = NULL;
+	if (activeTextureUnit >= 0) {
+		if (target == GL_TEXTURE_ENV && pname == GL_TEXTURE_ENV_MODE)
+			cached = &textureEnvModes[activeTextureUnit];
+		else if (target == GL_TEXTURE_FILTER_CONTROL_EXT && pname == GL_TEXTURE_LOD_BIAS_EXT)
+			cached = &textureLodBiases[activeTextureUnit];
+	}
+	if (cached) {
+		if (*cached == param) {
+			++skippedStateChanges;
+			return;
+		}
+		*cached = param;
+	}
+	glTexEnvf(target, pname, param);
+}
+
+int xglGetSkippedStateChanges()
+{
+	return skippedStateChanges;
+}
+
+void xglResetStateCacheStats()
+{
+	skippedStateChanges = 0;
+}
+
 void xglSetMaterial(XMaterial *mat)
 {
+	xglCheckStateCache();
+	if (materialValid && memcmp(mat, &currentMaterial, sizeof(XMaterial)) == 0) {
+		++skippedStateChanges;
+		return;
+	}
+	currentMaterial = *mat;
+	materialValid = YES;
 	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, (float*)&mat->diffuse);
 	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, (float*)&mat->ambient);
 	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, (float*)&mat->specular);
 	glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, mat->shininess);
 }
 
+void xglSetMaterialEmission(XColor *emission)
+{
+	xglCheckStateCache();
+	if (emissionValid && memcmp(emission, &currentEmission, sizeof(XColor)) == 0) {
+		++skippedStateChanges;
+		return;
+	}
+	currentEmission = *emission;
+	emissionValid = YES;
+	glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, (float*)emission);
+}
+
 XMaterial xglGetDefaultMaterial()
 {
 	XMaterial mat;
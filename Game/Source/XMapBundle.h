@@ -0,0 +1,81 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMath.h"
+#import "XTerrainGeometry.h"
+#import "XTreePlacement.h"
+#import <stdint.h>
+@class XScriptNode;
+
+// A map bundle (".xmap") is a single pre-processed file holding everything loadMap needs from a
+// map's folder: the parsed map script, terrain heights, terrain shadow map, baked tree instances
+// and ready-to-upload terrain chunk vertexes. The file is memory mapped and its sections are used
+// in place, so loading a bundle involves no image decoding, no parsing and no per-vertex work.
+//
+// Bundles are built offline with MapPacker, and are looked up next to the map script
+// (e.g. "Media/Maps/level1.map" -> "Media/Maps/level1.map.xmap"). The layout below is shared
+// by the game and the packer, so any change to it must bump XMAPBUNDLE_VERSION.
+
+#define XMAPBUNDLE_MAGIC 0x50414D58 // "XMAP"
+#define XMAPBUNDLE_VERSION 1
+#define XMAPBUNDLE_SECTION_ALIGNMENT 16
+
+typedef enum {
+	XMapBundleSection_ScriptNodes,		// XMapBundleScriptNode[], in pre-order (children follow their parent)
+	XMapBundleSection_ScriptValues,		// uint32_t[] string offsets, referenced by script nodes
+	XMapBundleSection_ScriptStrings,	// null terminated UTF-8 strings
+	XMapBundleSection_Heights,			// float[terrainRes*terrainRes], normalized [0,1]
+	XMapBundleSection_ShadowMap,		// unsigned char[shadowMapRes*shadowMapRes]
+	XMapBundleSection_Trees,			// XTreeInstance[treeCount]
+	XMapBundleSection_TerrainVertexes,	// XTerrainVertex[chunkVertexCount] per chunk, row-major over the chunk grid
+	XMapBundleSection_Count
+} XMapBundleSectionType;
+
+typedef struct {
+	uint32_t offset, size;
+} XMapBundleSection;
+
+typedef struct {
+	uint32_t magic, version;
+	uint32_t terrainRes, chunkGridSize, chunkTileRes, chunkVertexCount;
+	uint32_t shadowMapRes, treeCount;
+	float skirtHeight;
+	uint32_t reserved[3];
+	XMapBundleSection sections[XMapBundleSection_Count];
+} XMapBundleHeader;
+
+typedef struct {
+	uint32_t name;			// string offset
+	uint32_t firstValue;	// index into the values section
+	uint32_t valueCount;
+	uint32_t subnodeCount;
+} XMapBundleScriptNode;
+
+
+@interface XMapBundle : NSObject {
+	void *mapping;
+	size_t mappingSize;
+	const XMapBundleHeader *header;
+}
+
+@property(readonly) int terrainRes;
+@property(readonly) int chunkTileRes;
+@property(readonly) int shadowMapRes;
+@property(readonly) int treeCount;
+@property(readonly) float skirtHeight;
+
++(BOOL)bundleExistsForMap:(NSString*)mapFilename;
+-(id)initWithMap:(NSString*)mapFilename;
+-(id)initWithPath:(NSString*)path;
+-(void)dealloc;
+
+// returns a new (retained) script tree, equivalent to [[XScriptNode alloc] initWithFile:] on the map script
+-(XScriptNode*)newScriptRoot;
+
+// all of these point directly into the mapped file, and are valid as long as the bundle is alive
+-(const float*)heights;
+-(const unsigned char*)shadowMap;
+-(const XTreeInstance*)trees;
+-(const XTerrainVertex*)chunkVertexesAtX:(int)x Y:(int)y;
+-(XTerrainData)terrainData;
+
+@end
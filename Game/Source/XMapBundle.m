@@ -0,0 +1,236 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMapBundle.h"
+#import "XScript.h"
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+
+@interface XMapBundle (private)
+
++(NSString*)_pathForMap:(NSString*)mapFilename;
+-(const void*)sectionData:(XMapBundleSectionType)section;
+-(BOOL)validateHeader;
+-(XScriptNode*)newScriptNode:(const XMapBundleScriptNode**)nodePtr;
+
+@end
+
+
+@implementation XMapBundle
+
++(NSString*)_pathForMap:(NSString*)mapFilename
+{
+	NSString *bundleFile = [mapFilename stringByAppendingString:@".xmap"];
+	NSString *directory = [bundleFile stringByDeletingLastPathComponent];
+	NSString *fileN = [bundleFile lastPathComponent];
+	return [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
+}
+
++(BOOL)bundleExistsForMap:(NSString*)mapFilename
+{
+	return ([XMapBundle _pathForMap:mapFilename] != nil);
+}
+
+-(id)initWithMap:(NSString*)mapFilename
+{
+	NSString *path = [XMapBundle _pathForMap:mapFilename];
+	if (path == nil) {
+		[self release];
+		return nil;
+	}
+	return [self initWithPath:path];
+}
+
+-(id)initWithPath:(NSString*)path
+{
+	if ((self = [super init])) {
+		int fd = open([path fileSystemRepresentation], O_RDONLY);
+		if (fd < 0) {
+			NSLog(@"Error loading map bundle \"%@\": File not found", path);
+			[self release];
+			return nil;
+		}
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0 || fileStat.st_size < sizeof(XMapBundleHeader)) {
+			NSLog(@"Error loading map bundle \"%@\": File is truncated", path);
+			close(fd);
+			[self release];
+			return nil;
+		}
+		mappingSize = fileStat.st_size;
+		mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED) {
+			NSLog(@"Error loading map bundle \"%@\": Could not map file into memory", path);
+			mapping = NULL;
+			[self release];
+			return nil;
+		}
+		header = (const XMapBundleHeader*)mapping;
+		if (![self validateHeader]) {
+			NSLog(@"Error loading map bundle \"%@\": Invalid or outdated bundle (rebuild it with MapPacker)", path);
+			[self release];
+			return nil;
+		}
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	if (mapping)
+		munmap(mapping, mappingSize);
+	[super dealloc];
+}
+
+-(BOOL)validateHeader
+{
+	if (header->magic != XMAPBUNDLE_MAGIC || header->version != XMAPBUNDLE_VERSION)
+		return NO;
+	if (header->chunkGridSize != TERRAIN_CHUNK_GRID_SIZE || header->chunkTileRes * TERRAIN_CHUNK_GRID_SIZE != header->terrainRes - 1)
+		return NO;
+	if (header->chunkVertexCount != TerrainGeometry_chunkVertexCount(header->chunkTileRes))
+		return NO;
+
+	// every section must lie within the file
+	for (int i = 0; i < XMapBundleSection_Count; ++i) {
+		const XMapBundleSection *section = &header->sections[i];
+		if (section->offset > mappingSize || section->size > mappingSize - section->offset)
+			return NO;
+		if (section->offset % XMAPBUNDLE_SECTION_ALIGNMENT != 0)
+			return NO;
+	}
+
+	// and must be large enough for the data described by the header
+	size_t terrainSize = header->terrainRes * header->terrainRes;
+	size_t chunkCount = TERRAIN_CHUNK_GRID_SIZE * TERRAIN_CHUNK_GRID_SIZE;
+	if (header->sections[XMapBundleSection_Heights].size < terrainSize * sizeof(float))
+		return NO;
+	if (header->sections[XMapBundleSection_ShadowMap].size < header->shadowMapRes * header->shadowMapRes)
+		return NO;
+	if (header->sections[XMapBundleSection_Trees].size < header->treeCount * sizeof(XTreeInstance))
+		return NO;
+	if (header->sections[XMapBundleSection_TerrainVertexes].size < chunkCount * header->chunkVertexCount * sizeof(XTerrainVertex))
+		return NO;
+	if (header->sections[XMapBundleSection_ScriptNodes].size < sizeof(XMapBundleScriptNode))
+		return NO;
+
+	// string pool must be terminated, so a corrupted offset can never read past the end
+	const XMapBundleSection *strings = &header->sections[XMapBundleSection_ScriptStrings];
+	if (strings->size == 0 || ((const char*)mapping)[strings->offset + strings->size - 1] != '\0')
+		return NO;
+
+	return YES;
+}
+
+-(const void*)sectionData:(XMapBundleSectionType)section
+{
+	return (const char*)mapping + header->sections[section].offset;
+}
+
+-(int)terrainRes
+{
+	return header->terrainRes;
+}
+
+-(int)chunkTileRes
+{
+	return header->chunkTileRes;
+}
+
+-(int)shadowMapRes
+{
+	return header->shadowMapRes;
+}
+
+-(int)treeCount
+{
+	return header->treeCount;
+}
+
+-(float)skirtHeight
+{
+	return header->skirtHeight;
+}
+
+-(const float*)heights
+{
+	return (const float*)[self sectionData:XMapBundleSection_Heights];
+}
+
+-(const unsigned char*)shadowMap
+{
+	if (header->shadowMapRes == 0)
+		return NULL;
+	return (const unsigned char*)[self sectionData:XMapBundleSection_ShadowMap];
+}
+
+-(const XTreeInstance*)trees
+{
+	if (header->treeCount == 0)
+		return NULL;
+	return (const XTreeInstance*)[self sectionData:XMapBundleSection_Trees];
+}
+
+-(const XTerrainVertex*)chunkVertexesAtX:(int)x Y:(int)y
+{
+	assert(x >= 0 && x < TERRAIN_CHUNK_GRID_SIZE && y >= 0 && y < TERRAIN_CHUNK_GRID_SIZE);
+	const XTerrainVertex *vertexes = (const XTerrainVertex*)[self sectionData:XMapBundleSection_TerrainVertexes];
+	return vertexes + (y * TERRAIN_CHUNK_GRID_SIZE + x) * header->chunkVertexCount;
+}
+
+-(XTerrainData)terrainData
+{
+	XTerrainData data;
+	data.terrainRes = header->terrainRes;
+	data.skirtHeight = header->skirtHeight;
+	data.heights = [self heights];
+	data.shadowMap = [self shadowMap];
+	data.shadowMapRes = header->shadowMapRes;
+	data.chunkVertexes = [self chunkVertexesAtX:0 Y:0];
+	return data;
+}
+
+-(XScriptNode*)newScriptRoot
+{
+	const XMapBundleScriptNode *node = (const XMapBundleScriptNode*)[self sectionData:XMapBundleSection_ScriptNodes];
+	return [self newScriptNode:&node];
+}
+
+-(XScriptNode*)newScriptNode:(const XMapBundleScriptNode**)nodePtr
+{
+	const XMapBundleScriptNode *nodesEnd = (const XMapBundleScriptNode*)((const char*)[self sectionData:XMapBundleSection_ScriptNodes] + header->sections[XMapBundleSection_ScriptNodes].size);
+	const uint32_t *values = (const uint32_t*)[self sectionData:XMapBundleSection_ScriptValues];
+	uint32_t valueTotal = header->sections[XMapBundleSection_ScriptValues].size / sizeof(uint32_t);
+	const char *strings = (const char*)[self sectionData:XMapBundleSection_ScriptStrings];
+	uint32_t stringsSize = header->sections[XMapBundleSection_ScriptStrings].size;
+
+	const XMapBundleScriptNode *node = *nodePtr;
+	if (node >= nodesEnd || node->name >= stringsSize || node->firstValue > valueTotal || node->valueCount > valueTotal - node->firstValue) {
+		NSLog(@"Error loading map bundle: Corrupted script data");
+		return nil;
+	}
+	++(*nodePtr);
+
+	XScriptNode *scriptNode = [[XScriptNode alloc] initWithName:[NSString stringWithUTF8String:&strings[node->name]]];
+	for (uint32_t i = 0; i < node->valueCount; ++i) {
+		uint32_t str = values[node->firstValue + i];
+		if (str >= stringsSize)
+			str = stringsSize - 1; // (empty string)
+		[scriptNode.values addObject:[NSString stringWithUTF8String:&strings[str]]];
+	}
+	for (uint32_t i = 0; i < node->subnodeCount; ++i) {
+		XScriptNode *subnode = [self newScriptNode:nodePtr];
+		if (subnode == nil) {
+			[scriptNode release];
+			return nil;
+		}
+		[scriptNode addSubnode:subnode];
+		[subnode release];
+	}
+	return scriptNode;
+}
+
+@end
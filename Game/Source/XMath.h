@@ -48,6 +48,10 @@ typedef struct {
 	XVector3 max;
 } XBoundingBox;
 
+typedef struct {
+	unsigned char red, green, blue, alpha;
+} XColorBytes; //(vertex colors; here rather than in XGL.h so GL-free code can build vertexes too)
+
 
 static const XVector2 xVector2_Zero = { 0, 0 };
 static const XVector3 xVector3_Zero = { 0, 0, 0 };
@@ -1,7 +1,37 @@
 // Copyright © 2010 John Judnich. All rights reserved.
 
 #import "XTime.h"
+#import "XMath.h"
+#import "XResourceTable.h"
 @class XResource;
+@class XResourceRequest;
+
+typedef enum {
+	XResourceMemory_Texture = 0,
+	XResourceMemory_Mesh,
+	XResourceMemory_Other,
+	XResourceMemory_Count
+} XResourceMemoryType;
+
+// Resources are identified by a 64 bit hash of their filename and type (see XResourceTable.h). Code which
+// retains the same resource repeatedly can compute its handle once and use mediaRetainHandle, which then
+// costs a single table probe instead of hashing the filename each time.
+typedef struct {
+	XResourceID resourceID;
+	Class resourceType;
+	NSString *filename; // (not retained; use a constant string, or keep it alive for as long as the handle)
+} XResourceHandle;
+
+XResourceID xResourceID(NSString *filename, Class resourceType);
+XResourceHandle xResourceHandle(Class resourceType, NSString *filename);
+
+typedef struct {
+	size_t bytes[XResourceMemory_Count]; // resident bytes (GL objects and heap copies) by resource type
+	size_t totalBytes;
+	size_t deadBytes; // (part of totalBytes held by unreferenced resources, which can be freed at any time)
+	int resources, deadResources;
+	int evictions; // dead resources freed to stay within the memory budget
+} XMediaMemoryStats;
 
 
 // XMediaGroup automatically loads and unloads XResource-derived objects for you, with automated pooling where
@@ -45,42 +75,99 @@
 // prevent resources that are loaded and unloaded intermittently from being dealloced too often. When something
 // like a new game level is loaded however, always call freeDeadResourcesNow first to flush the previous level
 // from memory to ensure that enough memory is availible for the new level.
+//
+// Texture atlases (built offline by AtlasPacker) can be added with addTextureAtlas. After that, any texture
+// listed in the atlas loads as a region of the shared atlas texture instead of from its own file, so 2D
+// drawing can switch between those textures without rebinding. Callers don't need to know about it.
+//
+// Each resource reports how many bytes it holds (see XResource memorySize), and the group keeps a running
+// total which memoryStats reports (updated when the resource is added, and again when a request for it
+// completes, or on resourceMemoryChanged). If a memoryBudget is set, loading a resource which takes the group over
+// budget frees dead resources right away, least recently used first, until it's back within budget (live
+// resources are never freed, so the budget may still be exceeded). freeDeadResourcesToBudget does the same
+// on demand, e.g. to shed a predictable amount of memory on low memory warnings.
+//
+// Resources can also be loaded in the background with newRequestForResource, which returns at once with an
+// XResourceRequest (see XResourceLoader.h) while worker threads read and decode the file. The GL side of
+// loading is left to finishRequestsWithTimeBudget, which should be called once per frame on the render
+// thread. retainResource on a file which is still being requested waits for that request instead of
+// loading the file again, and a second request for it joins the first. All GL calls go through the
+// current render device, so with xglNullDevice() requests load (without uploading anything) even without
+// a GL context (see LoaderCheck).
 @interface XMediaGroup : NSObject {
-	NSMutableDictionary *resourceList;
+	XResourceTable resourceTable;
+	NSMutableArray *pendingRequests;
+	XMediaMemoryStats memoryStats;
+	size_t memoryBudget;
+	int loadDepth;
+	NSMutableDictionary *atlasImages; // texture filename -> atlas image filename
+	NSMutableDictionary *atlasRegions; // texture filename -> NSValue of XScalarRect (in atlas UVs)
 	XTimer *_timer;
 	XResource *_nowIniting;
 }
 
 @property(readonly) XResource *_nowIniting;
 @property(readonly) XTimer *_timer;
+@property(readonly) XMediaMemoryStats memoryStats;
+@property(assign) size_t memoryBudget; //in bytes; 0 (the default) means no budget
 
 -(id)init;
 -(void)dealloc;
 
 -(XResource*)retainResource:(Class)resourceType fromFile:(NSString*)filename;
+-(XResource*)retainResource:(Class)resourceType fromFile:(NSString*)filename preparedData:(id)data; //data from the type's newPreparedDataForFile (or nil)
+-(XResource*)retainResourceWithHandle:(const XResourceHandle*)handle;
 -(void)releaseResource:(XResource*)resource; //note that resources aren't actually unloaded until freeDeadResources___ is called
 
 -(void)freeDeadResourcesNow;
 -(void)freeDeadResourcesWithTimeout:(float)timeoutSeconds;
+-(void)freeDeadResourcesToBudget:(size_t)budgetBytes; //frees least recently used dead resources until within the budget
+-(void)resourceMemoryChanged:(XResource*)resource; //updates the memory stats after a loaded resource's memorySize changed
+
+-(XResourceRequest*)newRequestForResource:(Class)resourceType fromFile:(NSString*)filename; //(returns a retained request)
+-(XResource*)finishRequestNow:(XResourceRequest*)request; //waits for the request to be prepared and finishes it
+-(int)finishRequestsWithTimeBudget:(XSeconds)timeBudget; //finishes prepared requests (at least one); returns how many are left
+
+-(void)logLookupBenchmark; //times looking up every loaded resource by key string (the old way), by filename hash and by handle
+
+-(BOOL)addTextureAtlas:(NSString*)atlasFile; //add before retaining any of the atlas' textures
+-(NSString*)atlasImageForFile:(NSString*)filename region:(XScalarRect*)region; //nil if the file isn't in an atlas
 
 @end
 
 
 @interface XResource : NSObject {
 	XMediaGroup *mediaGroup;
-	NSString *resourceKey;
+	NSString *resourceKey; //(for diagnostics; resources are looked up by resourceID)
 @public
+	XResourceID resourceID;
+	size_t memorySize; //set by subclasses while loading, to the bytes they hold (GL objects included)
+	XResourceMemoryType memoryType;
 	signed int _refCount;
 	float _lastZeroRefTime;
+	size_t _countedMemorySize; //(memorySize as the group last counted it)
 }
 
 @property(readonly) NSString *resourceKey;
+@property(readonly) XResourceID resourceID;
 @property(readonly) XMediaGroup *mediaGroup;
+@property(readonly) size_t memorySize;
+@property(readonly) XResourceMemoryType memoryType;
 
 -(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media;
+-(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media preparedData:(id)data; //by default, calls initWithFile:usingMedia:
 -(void)dealloc;
 
+// Resource types which can do the CPU-only part of loading (file reading, decoding) on a worker thread
+// override these. prepareForAsyncLoading is called on the render thread before files of the type are
+// prepared (e.g. to query GL capabilities); newPreparedDataForFile is then called on a worker thread, and
+// whatever it returns is passed to initWithFile:usingMedia:preparedData: on the render thread. By default
+// nothing is prepared, and the whole resource is loaded on the render thread.
++(void)prepareForAsyncLoading;
++(id)newPreparedDataForFile:(NSString*)filename usingMedia:(XMediaGroup*)media;
+
 +(id)mediaRetainFile:(NSString*)filename usingMedia:(XMediaGroup*)media; //equivelent to calling [myMediaGroup:retainResource:]
++(id)mediaRetainHandle:(const XResourceHandle*)handle usingMedia:(XMediaGroup*)media; //equivelent to calling [myMediaGroup:retainResourceWithHandle:]
 -(void)mediaRetain; //equivelent to (and more efficient than) calling [myMediaGroup retainResource:] for the same resource again
 -(void)mediaRelease; //equivelent to (and more efficient than) calling [myMediaGroup releaseResource:] for this resource
 
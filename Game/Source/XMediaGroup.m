@@ -2,16 +2,52 @@
 
 #import "XMediaGroup.h"
 #import "XMath.h"
+#import "XScript.h"
+#import "XResourceLoader.h"
+#import <objc/runtime.h>
+
+
+XResourceID xResourceID(NSString *filename, Class resourceType)
+{
+	// hashes the filename's bytes in place when possible, so no key string is built
+	char buffer[512];
+	const char *file = CFStringGetCStringPtr((CFStringRef)filename, kCFStringEncodingUTF8);
+	if (file == NULL)
+		file = [filename getCString:buffer maxLength:sizeof(buffer) encoding:NSUTF8StringEncoding] ? buffer : [filename UTF8String];
+	return ResourceTable_hash(file, class_getName(resourceType));
+}
+
+XResourceHandle xResourceHandle(Class resourceType, NSString *filename)
+{
+	XResourceHandle handle;
+	handle.resourceID = xResourceID(filename, resourceType);
+	handle.resourceType = resourceType;
+	handle.filename = filename;
+	return handle;
+}
+
+
+@interface XMediaGroup (private)
+
+-(void)removeResource:(XResource*)resource;
+-(XResourceRequest*)pendingRequestForID:(XResourceID)resourceID;
+-(void)finishPendingRequest:(XResourceRequest*)request;
+-(NSArray*)allResources;
+
+@end
 
 
 @implementation XMediaGroup
 
-@synthesize _timer, _nowIniting;
+@synthesize _timer, _nowIniting, memoryBudget;
 
 -(id)init
 {
 	if ((self = [super init])) {
-		resourceList = [[NSMutableDictionary alloc] init];
+		ResourceTable_init(&resourceTable);
+		pendingRequests = [[NSMutableArray alloc] init];
+		atlasImages = [[NSMutableDictionary alloc] init];
+		atlasRegions = [[NSMutableDictionary alloc] init];
 		_timer = [[XTimer alloc] init];
 		_nowIniting = nil;
 	}
@@ -20,15 +56,26 @@
 
 -(void)dealloc
 {
+	// workers may still be reading from this group for pending requests
+	for (XResourceRequest *request in pendingRequests) {
+		[request cancel];
+		if (request.joinedRequest)
+			continue; // (never queued)
+		if (![[XResourceLoader sharedLoader] dequeueRequest:request])
+			[[XResourceLoader sharedLoader] waitUntilPrepared:request];
+	}
+	[pendingRequests release];
+	
+	NSArray *resources = [self allResources];
 	int unfreed = 0;
-	for (XResource *resource in [resourceList objectEnumerator]) {
+	for (XResource *resource in resources) {
 		if (resource->_refCount != 0)
 			++unfreed;
 	}
 	if (unfreed > 0) {
 		NSLog(@"-- XMediaGroup Warning --");
 		NSLog(@"Possible memory leak / premature deallocation! XMediaGroup was released while it still contains %d unreleased resources:", unfreed);
-		for (XResource *resource in [resourceList objectEnumerator]) {
+		for (XResource *resource in resources) {
 			if (resource->_refCount != 0) {
 				NSLog(@"XResource-%@; _refCount = %d; resourceKey = \"%@\";", [resource description], resource->_refCount, resource.resourceKey);
 			}
@@ -37,29 +84,50 @@
 	}
 	[self freeDeadResourcesNow];
 	
-	[resourceList removeAllObjects];
-	[resourceList release];
+	for (XResource *resource in [self allResources])
+		[self removeResource:resource];
+	ResourceTable_free(&resourceTable);
+	[atlasImages release];
+	[atlasRegions release];
 	[_timer release];
 	[super dealloc];
 }
 
 -(XResource*)retainResource:(Class)resourceType fromFile:(NSString*)filename;
 {
-	NSString *resourceKey = [[NSString alloc] initWithFormat:@"%@::%@", filename, NSStringFromClass(resourceType)];
-	XResource *resource = [resourceList valueForKey:resourceKey];
+	return [self retainResource:resourceType fromFile:filename preparedData:nil];
+}
+
+-(XResource*)retainResource:(Class)resourceType fromFile:(NSString*)filename preparedData:(id)data
+{
+	XResourceID resourceID = xResourceID(filename, resourceType);
+	XResource *resource = ResourceTable_find(&resourceTable, resourceID);
+	if (resource == nil && data == nil && pendingRequests.count > 0) {
+		// if the resource is being loaded in the background, finish that rather than loading it twice
+		XResourceRequest *request = [self pendingRequestForID:resourceID];
+		if (request) {
+			[self finishRequestNow:request];
+			resource = ResourceTable_find(&resourceTable, resourceID);
+		}
+	}
 	if (resource == nil) {
 		// attempt to load the resource
 		resource = [resourceType alloc];
 		_nowIniting = resource; //XResource checks this when initializing to ensure the user doesn't manually init to a resource group
-		XResource *tmp = [resource initWithFile:filename usingMedia:self];
+		++loadDepth;
+		XResource *tmp = data ? [resource initWithFile:filename usingMedia:self preparedData:data] : [resource initWithFile:filename usingMedia:self];
+		--loadDepth;
 		if (tmp == nil)
 			[resource dealloc];
 		resource = tmp;
 		
 		// if sucessfully loaded, add to the list of tracked resources
 		if (resource) {
-			[resourceList setObject:resource forKey:resourceKey];
-			[resource release];
+			assert(resource->resourceID == resourceID);
+			ResourceTable_insert(&resourceTable, resourceID, resource); // (the table keeps the alloc reference)
+			resource->_countedMemorySize = resource->memorySize;
+			memoryStats.bytes[resource->memoryType] += resource->memorySize;
+			memoryStats.totalBytes += resource->memorySize;
 		}
 	}
 	_nowIniting = resource; //XResource checks this when retaining from _refCount == 0
@@ -69,14 +137,28 @@
 		[resource mediaRetain];
 	};
 	_nowIniting = nil;
-	[resourceKey release];
+	
+	// (only once the outermost load is done, since resources may load others while initializing)
+	if (memoryBudget > 0 && memoryStats.totalBytes > memoryBudget && loadDepth == 0)
+		[self freeDeadResourcesToBudget:memoryBudget];
+	return resource;
+}
+
+-(XResource*)retainResourceWithHandle:(const XResourceHandle*)handle
+{
+	XResource *resource = ResourceTable_find(&resourceTable, handle->resourceID);
+	if (resource == nil)
+		return [self retainResource:handle->resourceType fromFile:handle->filename];
+	_nowIniting = resource; //(see retainResource)
+	[resource mediaRetain];
+	_nowIniting = nil;
 	return resource;
 }
 
 -(void)releaseResource:(XResource*)resource
 {
 	if (resource == nil) return;
-	resource = [resourceList valueForKey:resource.resourceKey];
+	resource = ResourceTable_find(&resourceTable, resource.resourceID);
 	if (resource != nil) {
 		[resource mediaRelease];
 	} else {
@@ -87,18 +169,119 @@
 	}
 }
 
+-(XResourceRequest*)newRequestForResource:(Class)resourceType fromFile:(NSString*)filename
+{
+	XResourceID resourceID = xResourceID(filename, resourceType);
+	XResourceRequest *request = [[XResourceRequest alloc] initWithType:resourceType fromFile:filename resourceID:resourceID usingMedia:self];
+	if (ResourceTable_find(&resourceTable, resourceID)) {
+		// already loaded
+		[request finishWithResource:[self retainResource:resourceType fromFile:filename]];
+	} else {
+		XResourceRequest *loadingRequest = [self pendingRequestForID:resourceID];
+		if (loadingRequest) {
+			// already being loaded, so share that request's resource rather than reading the file again
+			[request joinRequest:loadingRequest];
+		} else {
+			[resourceType prepareForAsyncLoading];
+			[[XResourceLoader sharedLoader] enqueueRequest:request];
+		}
+		[pendingRequests addObject:request];
+	}
+	return request;
+}
+
+-(XResource*)finishRequestNow:(XResourceRequest*)request
+{
+	if (request.joinedRequest) {
+		// (finishes this one too)
+		[self finishRequestNow:request.joinedRequest];
+		return request.resource;
+	}
+	if (request.state == XResourceRequest_Queued) {
+		// prepare it here if no worker has got to it yet
+		if ([[XResourceLoader sharedLoader] dequeueRequest:request])
+			[request prepare];
+		else
+			[[XResourceLoader sharedLoader] waitUntilPrepared:request];
+	}
+	if (request.state == XResourceRequest_Prepared)
+		[self finishPendingRequest:request];
+	return request.resource;
+}
+
+-(int)finishRequestsWithTimeBudget:(XSeconds)timeBudget
+{
+	// finish as many prepared requests as fit in the time budget (but always at least one), oldest first
+	CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+	NSUInteger i = 0;
+	while (i < pendingRequests.count) {
+		XResourceRequest *request = [pendingRequests objectAtIndex:i];
+		if (request.state != XResourceRequest_Prepared) {
+			++i;
+			continue;
+		}
+		[self finishPendingRequest:request]; // (requests which joined it come later in the list)
+		if (CFAbsoluteTimeGetCurrent() - startTime >= timeBudget)
+			break;
+	}
+	return pendingRequests.count;
+}
+
+-(XResourceRequest*)pendingRequestForID:(XResourceID)resourceID
+{
+	// (the request actually loading the resource, not one which joined it)
+	for (XResourceRequest *request in pendingRequests) {
+		if (request.resourceID == resourceID && !request.joinedRequest && !request.cancelled)
+			return request;
+	}
+	return nil;
+}
+
+-(void)finishPendingRequest:(XResourceRequest*)request
+{
+	[request retain];
+	[pendingRequests removeObjectIdenticalTo:request];
+	[request finish];
+	if (request.resource)
+		[self resourceMemoryChanged:request.resource];
+	
+	// finish the requests which joined this one, now that its resource is loaded
+	NSUInteger i = 0;
+	while (i < pendingRequests.count) {
+		XResourceRequest *joined = [pendingRequests objectAtIndex:i];
+		if (joined.joinedRequest != request) {
+			++i;
+			continue;
+		}
+		[joined retain];
+		[pendingRequests removeObjectAtIndex:i];
+		[joined finish];
+		[joined release];
+	}
+	[request release];
+}
+
+-(NSArray*)allResources
+{
+	// (a snapshot, so resources can be removed while going through it)
+	NSMutableArray *resources = [NSMutableArray arrayWithCapacity:resourceTable.count];
+	for (unsigned int i = 0; i < resourceTable.capacity; ++i) {
+		if (resourceTable.entries[i].resourceID)
+			[resources addObject:(XResource*)resourceTable.entries[i].resource];
+	}
+	return resources;
+}
+
 -(void)freeDeadResourcesNow
 {
-	if (resourceList.count > 0) {
+	if (resourceTable.count > 0) {
 		BOOL freed;
 		do {
 			freed = NO;
 			NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
-			NSArray *resourceList_tmp = [[resourceList objectEnumerator] allObjects];
-			for (XResource *resource in resourceList_tmp) {
+			for (XResource *resource in [self allResources]) {
 				if (resource->_refCount <= 0) {
-					assert(resource.resourceKey);
-					[resourceList removeObjectForKey:resource.resourceKey];
+					[self removeResource:resource];
 					freed = YES;
 				}
 			}
@@ -113,17 +296,15 @@
 {
 	// iterate twice in case a resource frees a resource
 	for (int i = 0; i < 2; ++i) {
-		if (resourceList.count > 0) {
+		if (resourceTable.count > 0) {
 			NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
 			[_timer captureTime];
 			float timeNow = _timer.time.totalTime;
-			NSArray *resourceList_tmp = [[resourceList objectEnumerator] allObjects];
-			for (XResource *resource in resourceList_tmp) {
+			for (XResource *resource in [self allResources]) {
 				if (resource->_refCount <= 0) {
-					assert(resource.resourceKey);
 					float timeSinceZeroRef = xAbs(timeNow - resource->_lastZeroRefTime);
 					if (timeSinceZeroRef >= timeoutSeconds) {
-						[resourceList removeObjectForKey:resource.resourceKey];
+						[self removeResource:resource];
 					}
 				}
 			}
@@ -132,12 +313,178 @@
 	}
 }
 
+static NSInteger compareLastZeroRefTime(id a, id b, void *context)
+{
+	float timeA = ((XResource*)a)->_lastZeroRefTime, timeB = ((XResource*)b)->_lastZeroRefTime;
+	if (timeA < timeB)
+		return NSOrderedAscending;
+	return (timeA > timeB) ? NSOrderedDescending : NSOrderedSame;
+}
+
+-(void)freeDeadResourcesToBudget:(size_t)budgetBytes
+{
+	// repeats while anything is freed, since freeing a resource may release others
+	BOOL freed = YES;
+	while (freed && memoryStats.totalBytes > budgetBytes) {
+		freed = NO;
+		NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+		NSMutableArray *deadList = [NSMutableArray array];
+		for (XResource *resource in [self allResources]) {
+			if (resource->_refCount <= 0)
+				[deadList addObject:resource];
+		}
+		[deadList sortUsingFunction:compareLastZeroRefTime context:NULL];
+		for (XResource *resource in deadList) {
+			if (memoryStats.totalBytes <= budgetBytes)
+				break;
+			[self removeResource:resource];
+			++memoryStats.evictions;
+			freed = YES;
+		}
+		[autoreleasePool release];
+	}
+}
+
+-(void)resourceMemoryChanged:(XResource*)resource
+{
+	if (resource->memorySize == resource->_countedMemorySize)
+		return;
+	memoryStats.bytes[resource->memoryType] += resource->memorySize - resource->_countedMemorySize;
+	memoryStats.totalBytes += resource->memorySize - resource->_countedMemorySize;
+	resource->_countedMemorySize = resource->memorySize;
+	if (memoryBudget > 0 && memoryStats.totalBytes > memoryBudget && loadDepth == 0)
+		[self freeDeadResourcesToBudget:memoryBudget];
+}
+
+-(XMediaMemoryStats)memoryStats
+{
+	XMediaMemoryStats stats = memoryStats;
+	stats.resources = resourceTable.count;
+	stats.deadResources = 0;
+	stats.deadBytes = 0;
+	for (unsigned int i = 0; i < resourceTable.capacity; ++i) {
+		XResource *resource = resourceTable.entries[i].resource;
+		if (resource && resource->_refCount <= 0) {
+			++stats.deadResources;
+			stats.deadBytes += resource->_countedMemorySize;
+		}
+	}
+	return stats;
+}
+
+-(void)removeResource:(XResource*)resource
+{
+	memoryStats.bytes[resource->memoryType] -= resource->_countedMemorySize;
+	memoryStats.totalBytes -= resource->_countedMemorySize;
+	if (ResourceTable_remove(&resourceTable, resource->resourceID) == resource)
+		[resource release];
+}
+
+-(void)logLookupBenchmark
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+	NSArray *resources = [self allResources];
+	int count = resources.count;
+	if (count == 0) {
+		[autoreleasePool release];
+		return;
+	}
+	
+	// rebuild the old string keyed dictionary for comparison
+	NSMutableDictionary *dictionary = [NSMutableDictionary dictionaryWithCapacity:count];
+	NSMutableArray *filenames = [NSMutableArray arrayWithCapacity:count];
+	XResourceHandle *handles = malloc(sizeof(XResourceHandle) * count);
+	for (int i = 0; i < count; ++i) {
+		XResource *resource = [resources objectAtIndex:i];
+		NSRange separator = [resource.resourceKey rangeOfString:@"::" options:NSBackwardsSearch];
+		NSString *filename = [resource.resourceKey substringToIndex:separator.location];
+		[filenames addObject:filename];
+		[dictionary setObject:resource forKey:resource.resourceKey];
+		handles[i] = xResourceHandle([resource class], filename);
+	}
+	
+	const int rounds = 200;
+	int found[3] = { 0, 0, 0 };
+	CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < count; ++i) {
+			NSString *key = [[NSString alloc] initWithFormat:@"%@::%@", [filenames objectAtIndex:i], NSStringFromClass(handles[i].resourceType)];
+			if ([dictionary objectForKey:key])
+				++found[0];
+			[key release];
+		}
+	}
+	CFTimeInterval keyTime = CFAbsoluteTimeGetCurrent() - startTime;
+	startTime = CFAbsoluteTimeGetCurrent();
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < count; ++i) {
+			if (ResourceTable_find(&resourceTable, xResourceID([filenames objectAtIndex:i], handles[i].resourceType)))
+				++found[1];
+		}
+	}
+	CFTimeInterval hashTime = CFAbsoluteTimeGetCurrent() - startTime;
+	startTime = CFAbsoluteTimeGetCurrent();
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < count; ++i) {
+			if (ResourceTable_find(&resourceTable, handles[i].resourceID))
+				++found[2];
+		}
+	}
+	CFTimeInterval handleTime = CFAbsoluteTimeGetCurrent() - startTime;
+	
+	double lookups = (double)rounds * count;
+	NSLog(@"Resource lookups (%d resources, %d/%d/%d found): key string %.3f us, filename hash %.3f us, cached handle %.3f us",
+		  count, found[0] / rounds, found[1] / rounds, found[2] / rounds,
+		  keyTime * 1e6 / lookups, hashTime * 1e6 / lookups, handleTime * 1e6 / lookups);
+	free(handles);
+	[autoreleasePool release];
+}
+
+-(BOOL)addTextureAtlas:(NSString*)atlasFile
+{
+	// see AtlasPacker for the format; regions are given in pixels, and stored here as UVs
+	XScriptNode *root = [[XScriptNode alloc] initWithFile:atlasFile];
+	if (root == nil)
+		return NO;
+	BOOL ok = NO;
+	XScriptNode *atlas = [root getSubnodeByName:@"atlas"];
+	XScriptNode *size = [atlas getSubnodeByName:@"size"];
+	if (atlas && size && atlas.valueCount >= 1 && size.valueCount >= 2 && [size getValueI:0] > 0 && [size getValueI:1] > 0) {
+		NSString *imageFile = [atlas getValue:0];
+		XScalar invWidth = 1.0f / [size getValueI:0], invHeight = 1.0f / [size getValueI:1];
+		for (XScriptNode *texture in [atlas subnodesWithName:@"texture"]) {
+			if (texture.valueCount < 5)
+				continue;
+			XScalarRect region;
+			region.left = [texture getValueI:1] * invWidth;
+			region.top = [texture getValueI:2] * invHeight;
+			region.right = [texture getValueI:3] * invWidth;
+			region.bottom = [texture getValueI:4] * invHeight;
+			[atlasImages setObject:imageFile forKey:[texture getValue:0]];
+			[atlasRegions setObject:[NSValue valueWithBytes:&region objCType:@encode(XScalarRect)] forKey:[texture getValue:0]];
+		}
+		ok = YES;
+	} else {
+		NSLog(@"Error reading texture atlas \"%@\": Missing atlas image or size.", atlasFile);
+	}
+	[root release];
+	return ok;
+}
+
+-(NSString*)atlasImageForFile:(NSString*)filename region:(XScalarRect*)region
+{
+	NSString *imageFile = [atlasImages objectForKey:filename];
+	if (imageFile && region)
+		[[atlasRegions objectForKey:filename] getValue:region];
+	return imageFile;
+}
+
 @end
 
 
 @implementation XResource
 
-@synthesize resourceKey, mediaGroup;
+@synthesize resourceKey, resourceID, mediaGroup, memorySize, memoryType;
 
 -(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media
 {
@@ -147,12 +494,29 @@
 			return nil;
 		}
 		mediaGroup = media;
+		memorySize = 0;
+		memoryType = XResourceMemory_Other;
 		assert(filename);
 		resourceKey = [[NSString alloc] initWithFormat:@"%@::%@", filename, NSStringFromClass([self class])];
+		resourceID = xResourceID(filename, [self class]);
 	}
 	return self;
 }
 
+-(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media preparedData:(id)data
+{
+	return [self initWithFile:filename usingMedia:media];
+}
+
++(void)prepareForAsyncLoading
+{
+}
+
++(id)newPreparedDataForFile:(NSString*)filename usingMedia:(XMediaGroup*)media
+{
+	return nil;
+}
+
 -(id)init
 {
 	NSLog(@"ERROR IN RESOURCE INIT METHOD! [super initWithFile:usingMedia:] must be called from XResource subclass init functions.");
@@ -171,6 +535,12 @@
 	return [media retainResource:[self class] fromFile:filename];
 }
 
++(id)mediaRetainHandle:(const XResourceHandle*)handle usingMedia:(XMediaGroup*)media
+{
+	assert(handle->resourceType == [self class]);
+	return [media retainResourceWithHandle:handle];
+}
+
 -(void)mediaRetain
 {
 #ifdef DEBUG
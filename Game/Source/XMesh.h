@@ -2,26 +2,24 @@
 
 #import "XMediaGroup.h"
 #import "XMath.h"
+#import "XMeshVertex.h"
 @class XSubMesh;
 
-typedef struct {
-	XVector3 position;
-	XVector3 normal;
-	XVector2 texcoord;
-} XMeshVertex;
-
-typedef unsigned short XMeshIndex;
-
 
+// Meshes are loaded from ".xmesh" files written by MeshConverter (see XMeshFile.h for the format).
 @interface XMesh : XResource {
 	NSArray *subMeshes;
+	int fileVersion;
 }
 
 @property(readonly) NSArray *subMeshes;
+@property(readonly) int fileVersion; //the .xmesh format version the mesh was loaded from
 
 -(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media;
 -(void)dealloc;
 
++(void)logLoadBenchmarkForFolder:(NSString*)folder; //loads every .xmesh under the folder (e.g. "Media/Tanks") and logs the load times, and for version 2 files how long each reader takes on the same data
+
 @end
 
 
@@ -32,12 +30,16 @@ typedef unsigned short XMeshIndex;
 	size_t glVertexCount;
 	size_t glIndexCount;
 	XBoundingBox boundingBox;
+	XMeshVertex *batchVertexes;
+	XMeshIndex *batchIndexes;
 }
 
 @property(readonly) unsigned int glVertexBuffer, glIndexBuffer;
 @property(readonly) size_t glVertexCount, glIndexCount;
 @property(readonly) NSString *name, *defaultTextureFilename;
 @property(readonly) XBoundingBox boundingBox;
+@property(readonly) XMeshVertex *batchVertexes; //(NULL unless the submesh is small enough to be batched)
+@property(readonly) XMeshIndex *batchIndexes;
 
 -(id)initWithName:(NSString*)subMeshName defaultTexture:(NSString*)filename
 	vertexBuffer:(unsigned int)vBuff vertexCount:(size_t)vCount
@@ -45,4 +47,7 @@ typedef unsigned short XMeshIndex;
 	boundingBox:(XBoundingBox)bBox;
 -(void)dealloc;
 
+// hands over malloc'd copies of the submesh geometry (freed by the submesh) for dynamic batching
+-(void)keepBatchVertexes:(XMeshVertex*)vertexes indexes:(XMeshIndex*)indexes;
+
 @end
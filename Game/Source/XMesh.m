@@ -1,97 +1,98 @@
 // Copyright © 2010 John Judnich. All rights reserved.
 
 #import "XMesh.h"
+#import "XMeshFile.h"
+#import "XMeshBatch.h"
 #import "XMath.h"
 #import "XGL.h"
 #import <stdio.h>
 
 
+// reads from an in-memory mesh file, failing (without reading) past its end
+static BOOL readBytes(const unsigned char **cursor, const unsigned char *end, void *dest, size_t size)
+{
+	if ((size_t)(end - *cursor) < size)
+		return NO;
+	memcpy(dest, *cursor, size);
+	*cursor += size;
+	return YES;
+}
+
+
+@interface XMesh (private)
+
++(NSData*)newMappedFile:(NSString*)filename;
++(NSData*)newVersion1DataFromBlob:(NSData*)fileData;
+-(NSMutableArray*)newSubMeshesFromBlob:(NSData*)fileData directory:(NSString*)directory;
+-(NSMutableArray*)newSubMeshesFromStream:(NSData*)fileData directory:(NSString*)directory filename:(NSString*)filename;
+-(XSubMesh*)newSubMeshNamed:(NSString*)name defaultTexture:(NSString*)textureFile boundingBox:(XBoundingBox)box
+	vertexes:(const void*)vertexes vertexCount:(unsigned int)vCount
+	indexes:(const void*)indexes indexCount:(unsigned int)iCount;
+
+@end
+
+
 @implementation XMesh
 
-@synthesize subMeshes;
+@synthesize subMeshes, fileVersion;
+
++(NSData*)newMappedFile:(NSString*)filename
+{
+	NSString *directory = [filename stringByDeletingLastPathComponent];
+	NSString *fileN = [filename lastPathComponent];
+	NSString *sourcePath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
+	return sourcePath ? [[NSData alloc] initWithContentsOfMappedFile:sourcePath] : nil;
+}
+
++(id)newPreparedDataForFile:(NSString*)filename usingMedia:(XMediaGroup*)media
+{
+	// the file is mapped on a worker thread, and its pages faulted in here so the render thread doesn't wait on them
+	NSData *fileData = [XMesh newMappedFile:filename];
+	const volatile unsigned char *bytes = fileData.bytes;
+	for (NSUInteger i = 0; i < fileData.length; i += 4096)
+		(void)bytes[i];
+	return fileData;
+}
 
 -(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media
+{
+	return [self initWithFile:filename usingMedia:media preparedData:nil];
+}
+
+-(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media preparedData:(id)data
 {
 	if ((self = [super initWithFile:filename usingMedia:media])) {
-		// open file
+		// map the whole file (unless a worker thread already did)
 		NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
 		NSString *directory = [filename stringByDeletingLastPathComponent];
-		NSString *fileN = [filename lastPathComponent];
-		NSString *sourcePath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
-		FILE *file = fopen([sourcePath UTF8String], "rb");
-		if (file == NULL) {
+		NSData *fileData = data;
+		if (fileData == nil)
+			fileData = [[XMesh newMappedFile:filename] autorelease];
+		if (fileData == nil) {
 			[autoreleasePool release];
 			NSLog(@"Error reading mesh file %@: File not found", filename);
 			return nil;
 		}
 		
-		// read submesh count
-		unsigned int subMeshCount = 0;
-		fread(&subMeshCount, sizeof(unsigned int), 1, file);
+		memoryType = XResourceMemory_Mesh;
 		
-		// read submeshes
-		XSubMesh **subMeshArray = malloc(sizeof(XSubMesh*) * subMeshCount);
-		char strBuff[256];
-		for (unsigned int i = 0; i < subMeshCount; ++i) {
-			// submesh name
-			unsigned int nameLen = 0;
-			fread(&nameLen, sizeof(unsigned int), 1, file);
-			fread(strBuff, sizeof(char), nameLen, file);
-			strBuff[nameLen] = '\0';
-			NSString *name = [NSString stringWithUTF8String:strBuff];
-			
-			// submesh texture file
-			unsigned int texturefileLen = 0;
-			fread(&texturefileLen, sizeof(unsigned int), 1, file);
-			fread(strBuff, sizeof(char), texturefileLen, file);
-			strBuff[texturefileLen] = '\0';
-			NSString *textureFile = nil;
-			if (strlen(strBuff) > 0)
-				textureFile = [directory stringByAppendingPathComponent:[NSString stringWithUTF8String:strBuff]];
-			else
-				textureFile = @"";
-			
-			// bounding box
-			XBoundingBox box;
-			fread(&box, sizeof(XBoundingBox), 1, file);
-			
-			// vertex buffer
-			unsigned int vCount = 0;
-			unsigned int vBuff = 0;
-			fread(&vCount, sizeof(unsigned int), 1, file);
-			XMeshVertex *vBuffArray = malloc(sizeof(XMeshVertex) * vCount);
-			fread(vBuffArray, sizeof(XMeshVertex), vCount, file);
-			glGenBuffers(1, &vBuff);
-			glBindBuffer(GL_ARRAY_BUFFER, vBuff);
-			glBufferData(GL_ARRAY_BUFFER, vCount * sizeof(XMeshVertex), vBuffArray, GL_STATIC_DRAW);
-			glBindBuffer(GL_ARRAY_BUFFER, 0);			
-			free(vBuffArray);
-			
-			// index buffer
-			unsigned int iCount = 0;
-			unsigned int iBuff = 0;
-			fread(&iCount, sizeof(unsigned int), 1, file);
-			XMeshIndex *iBuffArray = malloc(sizeof(XMeshIndex) * iCount);
-			fread(iBuffArray, sizeof(XMeshIndex), iCount, file);
-			glGenBuffers(1, &iBuff);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuff);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, iCount * sizeof(XMeshIndex), iBuffArray, GL_STATIC_DRAW);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);			
-			free(iBuffArray);
-			
-			XSubMesh *subMesh = [[XSubMesh alloc] initWithName:name defaultTexture:textureFile
-								vertexBuffer:vBuff vertexCount:vCount
-								indexBuffer:iBuff indexCount:iCount
-								boundingBox:box];
-			subMeshArray[i] = subMesh;
+		// version 2 files start with a header (see XMeshFile.h), version 1 files with their submesh count
+		uint32_t magic = 0;
+		if (fileData.length >= sizeof(uint32_t))
+			memcpy(&magic, fileData.bytes, sizeof(uint32_t));
+		if (magic == XMESHFILE_MAGIC) {
+			fileVersion = XMESHFILE_VERSION;
+			subMeshes = [self newSubMeshesFromBlob:fileData directory:directory];
+			if (subMeshes == nil) {
+				[autoreleasePool release];
+				NSLog(@"Error reading mesh file %@: Invalid or unsupported file (convert it again with MeshConverter)", filename);
+				return nil;
+			}
+		} else {
+			fileVersion = 1;
+			subMeshes = [self newSubMeshesFromStream:fileData directory:directory filename:filename];
 		}
-		subMeshes = [[NSArray alloc] initWithObjects:subMeshArray count:subMeshCount];
-		for (unsigned int i = 0; i < subMeshCount; ++i)
-			[subMeshArray[i] release];
-		free(subMeshArray);
 		
-		// close file
-		fclose(file);
 		[autoreleasePool release];
 	}
 	return self;
@@ -103,6 +104,254 @@
 	[super dealloc];
 }
 
+-(NSMutableArray*)newSubMeshesFromBlob:(NSData*)fileData directory:(NSString*)directory
+{
+	// everything is used in place, so first make sure every table and section lies within the file
+	const unsigned char *base = fileData.bytes;
+	size_t fileSize = fileData.length;
+	if (fileSize < sizeof(XMeshFileHeader) || ((uintptr_t)base % XMESHFILE_SECTION_ALIGNMENT) != 0)
+		return nil;
+	const XMeshFileHeader *header = (const XMeshFileHeader*)base;
+	if (header->version != XMESHFILE_VERSION || header->vertexSize != sizeof(XMeshVertex) || header->indexSize != sizeof(XMeshIndex))
+		return nil;
+	const XMeshFileSection *sections[4] = { &header->subMeshes, &header->strings, &header->vertexes, &header->indexes };
+	for (int i = 0; i < 4; ++i) {
+		if (sections[i]->offset > fileSize || sections[i]->size > fileSize - sections[i]->offset)
+			return nil;
+		if (sections[i]->offset % XMESHFILE_SECTION_ALIGNMENT != 0)
+			return nil;
+	}
+	if (header->subMeshes.size / sizeof(XMeshFileSubMesh) < header->subMeshCount)
+		return nil;
+	const char *strings = (const char*)(base + header->strings.offset);
+	if (header->strings.size == 0 || strings[header->strings.size - 1] != '\0')
+		return nil;
+	
+	const XMeshFileSubMesh *fileSubMeshes = (const XMeshFileSubMesh*)(base + header->subMeshes.offset);
+	const XMeshVertex *vertexes = (const XMeshVertex*)(base + header->vertexes.offset);
+	const XMeshIndex *indexes = (const XMeshIndex*)(base + header->indexes.offset);
+	uint64_t totalVertexes = header->vertexes.size / sizeof(XMeshVertex);
+	uint64_t totalIndexes = header->indexes.size / sizeof(XMeshIndex);
+	for (uint32_t i = 0; i < header->subMeshCount; ++i) {
+		const XMeshFileSubMesh *s = &fileSubMeshes[i];
+		if (s->name >= header->strings.size || s->textureFile >= header->strings.size)
+			return nil;
+		if ((uint64_t)s->firstVertex + s->vertexCount > totalVertexes || (uint64_t)s->firstIndex + s->indexCount > totalIndexes)
+			return nil;
+	}
+	
+	NSMutableArray *subMeshList = [[NSMutableArray alloc] initWithCapacity:header->subMeshCount];
+	for (uint32_t i = 0; i < header->subMeshCount; ++i) {
+		const XMeshFileSubMesh *s = &fileSubMeshes[i];
+		NSString *name = [NSString stringWithUTF8String:strings + s->name];
+		NSString *textureFile = @"";
+		if (strings[s->textureFile] != '\0')
+			textureFile = [directory stringByAppendingPathComponent:[NSString stringWithUTF8String:strings + s->textureFile]];
+		XBoundingBox box;
+		memcpy(&box, s->boundingBox, sizeof(XBoundingBox));
+		
+		XSubMesh *subMesh = [self newSubMeshNamed:name defaultTexture:textureFile boundingBox:box
+								vertexes:vertexes + s->firstVertex vertexCount:s->vertexCount
+								indexes:indexes + s->firstIndex indexCount:s->indexCount];
+		[subMeshList addObject:subMesh];
+		[subMesh release];
+	}
+	return subMeshList;
+}
+
+-(NSMutableArray*)newSubMeshesFromStream:(NSData*)fileData directory:(NSString*)directory filename:(NSString*)filename
+{
+	const unsigned char *cursor = fileData.bytes, *end = cursor + fileData.length;
+	
+	// read submesh count
+	unsigned int subMeshCount = 0;
+	readBytes(&cursor, end, &subMeshCount, sizeof(unsigned int));
+	
+	// read submeshes
+	NSMutableArray *subMeshList = [[NSMutableArray alloc] initWithCapacity:subMeshCount];
+	char strBuff[256];
+	BOOL truncated = NO;
+	for (unsigned int i = 0; i < subMeshCount && !truncated; ++i) {
+		// submesh name
+		unsigned int nameLen = 0;
+		readBytes(&cursor, end, &nameLen, sizeof(unsigned int));
+		if (nameLen >= sizeof(strBuff) || !readBytes(&cursor, end, strBuff, nameLen)) {
+			truncated = YES;
+			break;
+		}
+		strBuff[nameLen] = '\0';
+		NSString *name = [NSString stringWithUTF8String:strBuff];
+		
+		// submesh texture file
+		unsigned int texturefileLen = 0;
+		readBytes(&cursor, end, &texturefileLen, sizeof(unsigned int));
+		if (texturefileLen >= sizeof(strBuff) || !readBytes(&cursor, end, strBuff, texturefileLen)) {
+			truncated = YES;
+			break;
+		}
+		strBuff[texturefileLen] = '\0';
+		NSString *textureFile = nil;
+		if (strlen(strBuff) > 0)
+			textureFile = [directory stringByAppendingPathComponent:[NSString stringWithUTF8String:strBuff]];
+		else
+			textureFile = @"";
+		
+		// bounding box
+		XBoundingBox box;
+		unsigned int vCount = 0, iCount = 0;
+		if (!readBytes(&cursor, end, &box, sizeof(XBoundingBox)) || !readBytes(&cursor, end, &vCount, sizeof(unsigned int)) ||
+			(size_t)(end - cursor) < vCount * sizeof(XMeshVertex) + sizeof(unsigned int)) {
+			truncated = YES;
+			break;
+		}
+		
+		// vertexes and indexes are uploaded straight from the file data (which may be unaligned here)
+		const unsigned char *vertexes = cursor;
+		cursor += vCount * sizeof(XMeshVertex);
+		readBytes(&cursor, end, &iCount, sizeof(unsigned int));
+		if ((size_t)(end - cursor) < iCount * sizeof(XMeshIndex)) {
+			truncated = YES;
+			break;
+		}
+		const unsigned char *indexes = cursor;
+		cursor += iCount * sizeof(XMeshIndex);
+		
+		XSubMesh *subMesh = [self newSubMeshNamed:name defaultTexture:textureFile boundingBox:box
+								vertexes:vertexes vertexCount:vCount indexes:indexes indexCount:iCount];
+		[subMeshList addObject:subMesh];
+		[subMesh release];
+	}
+	if (truncated)
+		NSLog(@"Warning: Mesh file %@ is truncated; only %d of %d submeshes were loaded.", filename, subMeshList.count, subMeshCount);
+	return subMeshList;
+}
+
++(NSData*)newVersion1DataFromBlob:(NSData*)fileData
+{
+	// (the blob must already have loaded, so it isn't validated again here)
+	const unsigned char *base = fileData.bytes;
+	const XMeshFileHeader *header = (const XMeshFileHeader*)base;
+	const XMeshFileSubMesh *fileSubMeshes = (const XMeshFileSubMesh*)(base + header->subMeshes.offset);
+	const char *strings = (const char*)(base + header->strings.offset);
+	const unsigned char *vertexes = base + header->vertexes.offset;
+	const unsigned char *indexes = base + header->indexes.offset;
+	
+	NSMutableData *stream = [[NSMutableData alloc] initWithCapacity:fileData.length];
+	unsigned int count = header->subMeshCount;
+	[stream appendBytes:&count length:sizeof(unsigned int)];
+	for (uint32_t i = 0; i < header->subMeshCount; ++i) {
+		const XMeshFileSubMesh *s = &fileSubMeshes[i];
+		const char *texts[2] = { strings + s->name, strings + s->textureFile };
+		for (int j = 0; j < 2; ++j) {
+			unsigned int len = strlen(texts[j]);
+			[stream appendBytes:&len length:sizeof(unsigned int)];
+			[stream appendBytes:texts[j] length:len];
+		}
+		[stream appendBytes:s->boundingBox length:sizeof(XBoundingBox)];
+		count = s->vertexCount;
+		[stream appendBytes:&count length:sizeof(unsigned int)];
+		[stream appendBytes:vertexes + s->firstVertex * sizeof(XMeshVertex) length:s->vertexCount * sizeof(XMeshVertex)];
+		count = s->indexCount;
+		[stream appendBytes:&count length:sizeof(unsigned int)];
+		[stream appendBytes:indexes + s->firstIndex * sizeof(XMeshIndex) length:s->indexCount * sizeof(XMeshIndex)];
+	}
+	return stream;
+}
+
+-(XSubMesh*)newSubMeshNamed:(NSString*)name defaultTexture:(NSString*)textureFile boundingBox:(XBoundingBox)box
+	vertexes:(const void*)vertexes vertexCount:(unsigned int)vCount
+	indexes:(const void*)indexes indexCount:(unsigned int)iCount
+{
+	// vertex buffer
+	unsigned int vBuff = 0;
+	glGenBuffers(1, &vBuff);
+	glBindBuffer(GL_ARRAY_BUFFER, vBuff);
+	glBufferData(GL_ARRAY_BUFFER, vCount * sizeof(XMeshVertex), vertexes, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	// index buffer
+	unsigned int iBuff = 0;
+	glGenBuffers(1, &iBuff);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuff);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, iCount * sizeof(XMeshIndex), indexes, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	
+	XSubMesh *subMesh = [[XSubMesh alloc] initWithName:name defaultTexture:textureFile
+						vertexBuffer:vBuff vertexCount:vCount
+						indexBuffer:iBuff indexCount:iCount
+						boundingBox:box];
+	
+	// small submeshes keep a copy of their geometry in memory for dynamic batching (see XMeshBatch.h)
+	memorySize += vCount * sizeof(XMeshVertex) + iCount * sizeof(XMeshIndex);
+	if (vCount <= XMESH_BATCH_MAX_SUBMESH_VERTEXES) {
+		XMeshVertex *batchVertexes = malloc(sizeof(XMeshVertex) * vCount);
+		XMeshIndex *batchIndexes = malloc(sizeof(XMeshIndex) * iCount);
+		memcpy(batchVertexes, vertexes, sizeof(XMeshVertex) * vCount);
+		memcpy(batchIndexes, indexes, sizeof(XMeshIndex) * iCount);
+		[subMesh keepBatchVertexes:batchVertexes indexes:batchIndexes];
+		memorySize += vCount * sizeof(XMeshVertex) + iCount * sizeof(XMeshIndex);
+	}
+	return subMesh;
+}
+
++(void)logLoadBenchmarkForFolder:(NSString*)folder
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+	NSString *folderPath = [[[NSBundle mainBundle] resourcePath] stringByAppendingPathComponent:folder];
+	NSDirectoryEnumerator *enumerator = [[NSFileManager defaultManager] enumeratorAtPath:folderPath];
+	
+	// each mesh is loaded into a media group of its own, so nothing is already loaded
+	XMediaGroup *media = [[XMediaGroup alloc] init];
+	int meshCount = 0, comparedCount = 0;
+	CFTimeInterval totalTime = 0, totalBlobTime = 0, totalStreamTime = 0;
+	for (NSString *file in enumerator) {
+		if (![[file pathExtension] isEqualToString:@"xmesh"])
+			continue;
+		NSString *filename = [folder stringByAppendingPathComponent:file];
+		CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+		XMesh *mesh = [XMesh mediaRetainFile:filename usingMedia:media];
+		CFTimeInterval loadTime = CFAbsoluteTimeGetCurrent() - startTime;
+		if (mesh) {
+			NSLog(@"Mesh load: %@ (version %d, %d submeshes): %.3f ms", filename, mesh.fileVersion, mesh.subMeshes.count, loadTime * 1000);
+			totalTime += loadTime;
+			++meshCount;
+		}
+		
+		// compare both readers on the same geometry: the version 2 file as mapped, and its version 1 equivalent
+		// (built in memory beforehand, so the version 1 time doesn't even include reading the file)
+		if (mesh && mesh.fileVersion == XMESHFILE_VERSION) {
+			NSString *directory = [filename stringByDeletingLastPathComponent];
+			size_t meshMemorySize = mesh->memorySize;
+			NSData *blob = [XMesh newMappedFile:filename];
+			NSData *stream = [XMesh newVersion1DataFromBlob:blob];
+			
+			startTime = CFAbsoluteTimeGetCurrent();
+			NSMutableArray *list = [mesh newSubMeshesFromBlob:blob directory:directory];
+			CFTimeInterval blobTime = CFAbsoluteTimeGetCurrent() - startTime;
+			[list release];
+			startTime = CFAbsoluteTimeGetCurrent();
+			list = [mesh newSubMeshesFromStream:stream directory:directory filename:filename];
+			CFTimeInterval streamTime = CFAbsoluteTimeGetCurrent() - startTime;
+			[list release];
+			
+			NSLog(@"Mesh load: %@ read as version 2: %.3f ms, as version 1: %.3f ms", filename, blobTime * 1000, streamTime * 1000);
+			totalBlobTime += blobTime;
+			totalStreamTime += streamTime;
+			++comparedCount;
+			[stream release];
+			[blob release];
+			mesh->memorySize = meshMemorySize;
+		}
+		[mesh mediaRelease];
+		[media freeDeadResourcesNow];
+	}
+	NSLog(@"Mesh load: %d meshes in %.3f ms", meshCount, totalTime * 1000);
+	if (comparedCount > 0)
+		NSLog(@"Mesh load: %d meshes read as version 2 in %.3f ms, as version 1 in %.3f ms", comparedCount, totalBlobTime * 1000, totalStreamTime * 1000);
+	[media release];
+	[autoreleasePool release];
+}
+
 @end
 
 
@@ -112,6 +361,7 @@
 @synthesize glVertexCount, glIndexCount;
 @synthesize name, defaultTextureFilename;
 @synthesize boundingBox;
+@synthesize batchVertexes, batchIndexes;
 
 -(id)initWithName:(NSString*)subMeshName defaultTexture:(NSString*)filename
 	vertexBuffer:(unsigned int)vBuff vertexCount:(size_t)vCount
@@ -132,8 +382,18 @@
 	return self;
 }
 
+-(void)keepBatchVertexes:(XMeshVertex*)vertexes indexes:(XMeshIndex*)indexes
+{
+	free(batchVertexes);
+	free(batchIndexes);
+	batchVertexes = vertexes;
+	batchIndexes = indexes;
+}
+
 -(void)dealloc
 {
+	free(batchVertexes);
+	free(batchIndexes);
 	if (glVertexBuffer)
 		glDeleteBuffers(1, &glVertexBuffer);
 	if (glIndexBuffer)
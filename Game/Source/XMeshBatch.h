@@ -0,0 +1,43 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMeshVertex.h"
+
+// Small submeshes which are drawn many times per frame (tank bodies, turrets, barrels, shadows)
+// are dynamically batched: consecutive visible instances of a submesh sharing the same texture and
+// material are transformed to world space on the CPU, written into one streaming vertex buffer,
+// and drawn with a single glDrawElements call instead of one per instance.
+//
+// Only submeshes up to XMESH_BATCH_MAX_SUBMESH_VERTEXES keep a CPU copy of their vertexes and
+// indexes for this (see XSubMesh.batchVertexes), and XScene owns one XMeshBatchBuffer which all
+// batches stream through (see -[XNode renderBatch:count:buffer:]).
+
+#define XMESH_BATCH_MAX_SUBMESH_VERTEXES 256
+#define XMESH_BATCH_BUFFER_VERTEXES 8192
+#define XMESH_BATCH_BUFFER_INDEXES 16384
+
+typedef struct {
+	unsigned int glVertexBuffer, glIndexBuffer;
+	XMeshVertex *vertexes;
+	XMeshIndex *indexes;
+
+	// counters, accumulated until reset by the owner
+	int batchCount;			// batched draw calls
+	int batchedInstances;	// instances drawn by them
+	int transformedVertexes;
+	double transformTime;	// (only measured with XSCENE_BENCHMARK defined, see XScene.h)
+} XMeshBatchBuffer;
+
+void MeshBatchBuffer_create(XMeshBatchBuffer *buffer);
+void MeshBatchBuffer_destroy(XMeshBatchBuffer *buffer);
+void MeshBatchBuffer_resetStats(XMeshBatchBuffer *buffer);
+
+// writes count vertexes transformed by (rot, pos) into dest; positions are rotated and translated,
+// normals only rotated (rot must be orthonormal), and texcoords copied
+void MeshBatch_transformVertexes(XMeshVertex *dest, const XMeshVertex *src, int count, const XMatrix3 *rot, const XVector3 *pos);
+
+// the same without NEON/SSE (what MeshBatch_transformVertexes does on other processors; see MeshBatchBench)
+void MeshBatch_transformVertexesScalar(XMeshVertex *dest, const XMeshVertex *src, int count, const XMatrix3 *rot, const XVector3 *pos);
+
+// writes count indexes into dest with baseVertex added to each
+void MeshBatch_offsetIndexes(XMeshIndex *dest, const XMeshIndex *src, int count, XMeshIndex baseVertex);
+
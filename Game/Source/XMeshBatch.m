@@ -0,0 +1,118 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMeshBatch.h"
+#import "XRenderDevice.h"
+#import <stdlib.h>
+#import <string.h>
+
+#if defined(__ARM_NEON__)
+#import <arm_neon.h>
+#define MESHBATCH_NEON
+#elif defined(__SSE__)
+#import <xmmintrin.h>
+#define MESHBATCH_SSE
+#endif
+
+
+void MeshBatchBuffer_create(XMeshBatchBuffer *buffer)
+{
+	memset(buffer, 0, sizeof(XMeshBatchBuffer));
+	buffer->vertexes = malloc(sizeof(XMeshVertex) * XMESH_BATCH_BUFFER_VERTEXES);
+	buffer->indexes = malloc(sizeof(XMeshIndex) * XMESH_BATCH_BUFFER_INDEXES);
+	glGenBuffers(1, &buffer->glVertexBuffer);
+	glGenBuffers(1, &buffer->glIndexBuffer);
+}
+
+void MeshBatchBuffer_destroy(XMeshBatchBuffer *buffer)
+{
+	if (buffer->glVertexBuffer)
+		glDeleteBuffers(1, &buffer->glVertexBuffer);
+	if (buffer->glIndexBuffer)
+		glDeleteBuffers(1, &buffer->glIndexBuffer);
+	free(buffer->vertexes);
+	free(buffer->indexes);
+	memset(buffer, 0, sizeof(XMeshBatchBuffer));
+}
+
+void MeshBatchBuffer_resetStats(XMeshBatchBuffer *buffer)
+{
+	buffer->batchCount = 0;
+	buffer->batchedInstances = 0;
+	buffer->transformedVertexes = 0;
+	buffer->transformTime = 0;
+}
+
+void MeshBatch_transformVertexesScalar(XMeshVertex *dest, const XMeshVertex *src, int count, const XMatrix3 *rot, const XVector3 *pos)
+{
+	for (int i = 0; i < count; ++i) {
+		const XVector3 *p = &src[i].position;
+		const XVector3 *n = &src[i].normal;
+		XMeshVertex *d = &dest[i];
+		d->position.x = rot->m00 * p->x + rot->m01 * p->y + rot->m02 * p->z + pos->x;
+		d->position.y = rot->m10 * p->x + rot->m11 * p->y + rot->m12 * p->z + pos->y;
+		d->position.z = rot->m20 * p->x + rot->m21 * p->y + rot->m22 * p->z + pos->z;
+		d->normal.x = rot->m00 * n->x + rot->m01 * n->y + rot->m02 * n->z;
+		d->normal.y = rot->m10 * n->x + rot->m11 * n->y + rot->m12 * n->z;
+		d->normal.z = rot->m20 * n->x + rot->m21 * n->y + rot->m22 * n->z;
+		d->texcoord = src[i].texcoord;
+	}
+}
+
+void MeshBatch_transformVertexes(XMeshVertex *dest, const XMeshVertex *src, int count, const XMatrix3 *rot, const XVector3 *pos)
+{
+#if defined(MESHBATCH_NEON) || defined(MESHBATCH_SSE)
+	// rotation columns padded to 4 floats (XMatrix3 is stored column major)
+	const float columns[12] = {
+		rot->m00, rot->m10, rot->m20, 0,
+		rot->m01, rot->m11, rot->m21, 0,
+		rot->m02, rot->m12, rot->m22, 0
+	};
+	const float translation[4] = { pos->x, pos->y, pos->z, 0 };
+
+	// each 4-wide store spills one float into the next field, so the position is stored first, then
+	// the normal (overwriting the spill), then the texcoord
+#if defined(MESHBATCH_NEON)
+	float32x4_t c0 = vld1q_f32(&columns[0]);
+	float32x4_t c1 = vld1q_f32(&columns[4]);
+	float32x4_t c2 = vld1q_f32(&columns[8]);
+	float32x4_t t = vld1q_f32(translation);
+	for (int i = 0; i < count; ++i) {
+		const float *s = (const float*)&src[i];
+		float *d = (float*)&dest[i];
+		float32x4_t p = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(t, c0, s[0]), c1, s[1]), c2, s[2]);
+		float32x4_t n = vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(c0, s[3]), c1, s[4]), c2, s[5]);
+		vst1q_f32(d, p);
+		vst1q_f32(d + 3, n);
+		d[6] = s[6];
+		d[7] = s[7];
+	}
+#else
+	__m128 c0 = _mm_loadu_ps(&columns[0]);
+	__m128 c1 = _mm_loadu_ps(&columns[4]);
+	__m128 c2 = _mm_loadu_ps(&columns[8]);
+	__m128 t = _mm_loadu_ps(translation);
+	for (int i = 0; i < count; ++i) {
+		const float *s = (const float*)&src[i];
+		float *d = (float*)&dest[i];
+		__m128 p = _mm_add_ps(_mm_add_ps(t, _mm_mul_ps(c0, _mm_set1_ps(s[0]))),
+							  _mm_add_ps(_mm_mul_ps(c1, _mm_set1_ps(s[1])), _mm_mul_ps(c2, _mm_set1_ps(s[2]))));
+		__m128 n = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(s[3])),
+							  _mm_add_ps(_mm_mul_ps(c1, _mm_set1_ps(s[4])), _mm_mul_ps(c2, _mm_set1_ps(s[5]))));
+		_mm_storeu_ps(d, p);
+		_mm_storeu_ps(d + 3, n);
+		d[6] = s[6];
+		d[7] = s[7];
+	}
+#endif
+
+#else
+	MeshBatch_transformVertexesScalar(dest, src, count, rot, pos);
+#endif
+}
+
+void MeshBatch_offsetIndexes(XMeshIndex *dest, const XMeshIndex *src, int count, XMeshIndex baseVertex)
+{
+	for (int i = 0; i < count; ++i)
+		dest[i] = src[i] + baseVertex;
+}
+
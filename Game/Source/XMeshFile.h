@@ -0,0 +1,42 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import <stdint.h>
+
+// A version 2 mesh file (".xmesh") is a single blob laid out exactly as XMesh uses it: a header, a table
+// of submeshes, a string table and one contiguous section each of vertexes and indexes. XMesh memory maps
+// the file and hands each submesh's vertexes and indexes straight to glBufferData, with no parsing, no
+// intermediate buffers and no allocation per submesh.
+//
+// MeshConverter writes this format (and upgrades a version 1 .xmesh given as its input). Version 1 files (a submesh count followed by length-prefixed names,
+// bounding boxes and arrays, one submesh after another) still load, and are told apart by the magic number
+// (a version 1 file starts with its submesh count). The layout below is shared by the game and the
+// converter, so any change to it must bump XMESHFILE_VERSION.
+
+#define XMESHFILE_MAGIC 0x48534D58 // "XMSH"
+#define XMESHFILE_VERSION 2
+#define XMESHFILE_SECTION_ALIGNMENT 16
+
+typedef struct {
+	uint32_t offset, size;	// (from the start of the file)
+} XMeshFileSection;
+
+typedef struct {
+	uint32_t magic, version;
+	uint32_t subMeshCount;
+	uint32_t vertexSize;		// sizeof(XMeshVertex): position, normal, texcoord (8 floats)
+	uint32_t indexSize;			// sizeof(XMeshIndex)
+	uint32_t reserved[3];
+	XMeshFileSection subMeshes;	// XMeshFileSubMesh[subMeshCount]
+	XMeshFileSection strings;	// null terminated UTF-8 strings
+	XMeshFileSection vertexes;	// every submesh's vertexes, in submesh order
+	XMeshFileSection indexes;	// every submesh's indexes (relative to the submesh's first vertex), in submesh order
+} XMeshFileHeader;
+
+typedef struct {
+	uint32_t name;				// string offset
+	uint32_t textureFile;		// string offset ("" for none; relative to the mesh file's folder)
+	float boundingBox[6];		// an XBoundingBox (min x y z, max x y z)
+	uint32_t firstVertex, vertexCount;
+	uint32_t firstIndex, indexCount;
+} XMeshFileSubMesh;
+
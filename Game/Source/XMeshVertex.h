@@ -0,0 +1,14 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMath.h"
+
+// The vertex and index layout of every mesh, as stored in .xmesh files (see XMeshFile.h), uploaded to
+// vertex buffers, and transformed by XMeshBatch. Kept apart from XMesh.h so plain C code can use it.
+
+typedef struct {
+	XVector3 position;
+	XVector3 normal;
+	XVector2 texcoord;
+} XMeshVertex;
+
+typedef unsigned short XMeshIndex;
@@ -30,7 +30,6 @@
 	XModel *model;
 	XSubMesh *subMesh;
 	XTexture *texture;
-	NSString *renderGroupID;
 }
 
 @property(retain) XTexture *texture;
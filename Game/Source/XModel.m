@@ -111,7 +111,7 @@
 
 @interface XSubModel (private)
 
--(void)updateRenderGroupID;
+-(void)bindMesh;
 
 @end
 
@@ -134,8 +134,6 @@
 		else
 			texture = [XTexture mediaRetainFile:(sMesh.defaultTextureFilename) usingMedia:media];
 		
-		[self updateRenderGroupID];
-		
 		boundingBox = subMesh.boundingBox;
 		[self notifyBoundsChanged];
 	}
@@ -150,7 +148,6 @@
 		[subMesh retain];
 		texture = copySubModel->texture;
 		[texture mediaRetain];
-		[self updateRenderGroupID];
 		
 		boundingBox = subMesh.boundingBox;
 		[self notifyBoundsChanged];
@@ -162,7 +159,6 @@
 {
 	[texture mediaRelease];
 	[subMesh release];
-	[renderGroupID release];
 	[super dealloc];
 }
 
@@ -172,7 +168,7 @@
 		[texture mediaRelease];
 		texture = tex;
 		[texture mediaRetain];
-		[self updateRenderGroupID];
+		[self notifyRenderGroupChanged];
 	}
 }
 
@@ -181,38 +177,32 @@
 	return texture;
 }
 
--(void)updateRenderGroupID
-{
-	NSMutableString *tmpRenderGroupID = [NSMutableString stringWithString:@"1_model_"];
-	[tmpRenderGroupID appendString:[NSString stringWithFormat:@"%d", (int)texture]];
-	[tmpRenderGroupID appendString:@"::"];
-	[tmpRenderGroupID appendString:[NSString stringWithFormat:@"%d", (int)subMesh]];
-	if (renderGroupID) [renderGroupID release];
-	renderGroupID = [[NSString alloc] initWithString:tmpRenderGroupID];
-	[self notifyRenderGroupChanged];
-}
-
--(NSString*)getRenderGroupID
+-(XRenderSortKey)getRenderGroupKey
 {
-	return renderGroupID;
+	return xRenderGroupKey(XRenderPass_Models, 0, texture.glTexture, subMesh.glVertexBuffer);
 }
 
 -(void)beginRenderGroup
 {
 	if (texture) {
 		if (xglCheckBindTextures(texture.glTexture, 0)) {
-			glActiveTexture(GL_TEXTURE0);
+			xglActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, texture.glTexture);
-			glEnable(GL_TEXTURE_2D);
+			xglEnable(GL_TEXTURE_2D);
 		}
 	} else {
 		if (xglCheckBindTextures(0, 0)) {
-			glActiveTexture(GL_TEXTURE0);
+			xglActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, 0);
-			glDisable(GL_TEXTURE_2D);
+			xglDisable(GL_TEXTURE_2D);
 		}
 	}
 	
+	[self bindMesh];
+}
+
+-(void)bindMesh
+{
 	if (xglCheckBindMesh(subMesh.glVertexBuffer, subMesh.glIndexBuffer)) {
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subMesh.glIndexBuffer);
 		glBindBuffer(GL_ARRAY_BUFFER, subMesh.glVertexBuffer);
@@ -220,16 +210,79 @@
 		glNormalPointer(GL_FLOAT, sizeof(XMeshVertex), (void*)offsetof(XMeshVertex,normal));
 		glTexCoordPointer(2, GL_FLOAT, sizeof(XMeshVertex), (void*)offsetof(XMeshVertex,texcoord));
 		
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glEnableClientState(GL_NORMAL_ARRAY);
-		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		xglEnableClientState(GL_VERTEX_ARRAY);
+		xglEnableClientState(GL_NORMAL_ARRAY);
+		xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	}
 }
 
 -(void)render:(XCamera*)cam
 {
+	[self bindMesh]; //(a batch may have been drawn since the group began)
 	xglSetMaterial(&model->material);
 	glDrawElements(GL_TRIANGLES, subMesh.glIndexCount, GL_UNSIGNED_SHORT, (void*)0);
 }
 
+-(int)renderBatch:(XNode**)nodes count:(int)count buffer:(XMeshBatchBuffer*)buffer camera:(XCamera*)cam
+{
+	XMeshVertex *vertexes = subMesh.batchVertexes;
+	int vertexCount = (int)subMesh.glVertexCount;
+	int indexCount = (int)subMesh.glIndexCount;
+	if (vertexes == NULL || vertexCount == 0 || indexCount == 0)
+		return 0;
+	int maxInstances = XMESH_BATCH_BUFFER_VERTEXES / vertexCount;
+	if (maxInstances > XMESH_BATCH_BUFFER_INDEXES / indexCount)
+		maxInstances = XMESH_BATCH_BUFFER_INDEXES / indexCount;
+	
+	// batch the following instances of this submesh which have an identical material
+	int instanceCount = 1;
+	while (instanceCount < count && instanceCount < maxInstances) {
+		XSubModel *other = (XSubModel*)nodes[instanceCount];
+		if ([other class] != [XSubModel class] || other->subMesh != subMesh
+			|| memcmp(&other->model->material, &model->material, sizeof(XMaterial)) != 0)
+			break;
+		++instanceCount;
+	}
+	if (instanceCount < 2)
+		return 0;
+	
+	// transform the instances to world space
+#ifdef XSCENE_BENCHMARK
+	CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+#endif
+	XMeshIndex *indexes = subMesh.batchIndexes;
+	for (int i = 0; i < instanceCount; ++i) {
+		XNode *node = nodes[i];
+		MeshBatch_transformVertexes(&buffer->vertexes[i * vertexCount], vertexes, vertexCount, node.globalRotation, node.globalPosition);
+		MeshBatch_offsetIndexes(&buffer->indexes[i * indexCount], indexes, indexCount, (XMeshIndex)(i * vertexCount));
+	}
+#ifdef XSCENE_BENCHMARK
+	buffer->transformTime += CFAbsoluteTimeGetCurrent() - startTime;
+#endif
+	
+	// stream them through the batch buffers; respecifying the whole buffer orphans its previous
+	// contents, so the driver doesn't have to wait for earlier batches to be drawn
+	if (xglCheckBindMesh(buffer->glVertexBuffer, buffer->glIndexBuffer)) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer->glIndexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer->glVertexBuffer);
+		glVertexPointer(3, GL_FLOAT, sizeof(XMeshVertex), (void*)offsetof(XMeshVertex,position));
+		glNormalPointer(GL_FLOAT, sizeof(XMeshVertex), (void*)offsetof(XMeshVertex,normal));
+		glTexCoordPointer(2, GL_FLOAT, sizeof(XMeshVertex), (void*)offsetof(XMeshVertex,texcoord));
+		
+		xglEnableClientState(GL_VERTEX_ARRAY);
+		xglEnableClientState(GL_NORMAL_ARRAY);
+		xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+	glBufferData(GL_ARRAY_BUFFER, instanceCount * vertexCount * sizeof(XMeshVertex), buffer->vertexes, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, instanceCount * indexCount * sizeof(XMeshIndex), buffer->indexes, GL_DYNAMIC_DRAW);
+	
+	xglSetMaterial(&model->material);
+	glDrawElements(GL_TRIANGLES, instanceCount * indexCount, GL_UNSIGNED_SHORT, (void*)0);
+	
+	++buffer->batchCount;
+	buffer->batchedInstances += instanceCount;
+	buffer->transformedVertexes += instanceCount * vertexCount;
+	return instanceCount;
+}
+
 @end
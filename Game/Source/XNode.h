@@ -1,6 +1,8 @@
 // Copyright © 2010 John Judnich. All rights reserved.
 
 #import "XMath.h"
+#import "XRenderQueue.h"
+#import "XMeshBatch.h"
 @class XScene;
 @class XCamera;
 
@@ -21,6 +23,14 @@
 	XMatrix3 globalRotation;
 	BOOL globalTransformsOutdated;
 	XScalar boundingRadius;
+
+@public
+	// (maintained by XScene for culling and render order)
+	int sceneIndex;
+	int sceneProxy;
+	XBoundingBox sceneBounds; //(world space)
+	BOOL sceneProxyMoved;
+	XRenderSortKey sceneRenderGroupKey;
 }
 
 @property(assign) XNode *parent;
@@ -46,9 +56,15 @@
 -(void)notifyBoundsChanged;
 -(void)notifyRenderGroupChanged;
 
--(NSString*)getRenderGroupID; //render groups are rendered in alphabetical order
+-(XRenderSortKey)getRenderGroupKey; //render groups are rendered in order of their keys (see XRenderQueue.h)
 -(void)beginRenderGroup;
 -(void)endRenderGroup;
 -(void)render:(XCamera*)cam;
 
+// Called by XScene with the visible nodes following this one in the same render group (nodes[0] is
+// this node). Nodes which can draw several instances at once (with only the view matrix loaded into
+// GL_MODELVIEW, and their own world transforms applied on the CPU) render as many of nodes as they
+// can, and return how many they rendered. Returning less than 2 renders this node normally instead.
+-(int)renderBatch:(XNode**)nodes count:(int)count buffer:(XMeshBatchBuffer*)buffer camera:(XCamera*)cam;
+
 @end
@@ -8,6 +8,8 @@
 
 -(void)addNode:(XNode*)entity;
 -(void)removeNode:(XNode*)entity;
+-(void)notifyNodeMoved:(XNode*)entity;
+-(void)notifyNodeRenderGroupChanged:(XNode*)entity;
 
 @end
 
@@ -100,6 +102,8 @@
 -(void)notifyTransformsChanged
 {
 	globalTransformsOutdated = YES;
+	if (scene && !sceneProxyMoved)
+		[scene notifyNodeMoved:self];
 	if (children) {
 		for (XNode *node in children)
 			[node notifyTransformsChanged];
@@ -109,14 +113,13 @@
 -(void)notifyBoundsChanged
 {
 	[self updateBounds];
+	if (scene && !sceneProxyMoved)
+		[scene notifyNodeMoved:self];
 }
 
 -(void)notifyRenderGroupChanged
 {
-	if (scene) {
-		[scene removeNode:self];
-		[scene addNode:self];
-	}
+	[scene notifyNodeRenderGroupChanged:self];
 }
 
 -(XVector3*)globalPosition
@@ -166,9 +169,9 @@
 		boundingRadius = xSqrt(radius2Sq);
 }
 
--(NSString*)getRenderGroupID
+-(XRenderSortKey)getRenderGroupKey
 {
-	return @"_default_";
+	return xRenderGroupKey(XRenderPass_Default, 0, 0, 0);
 }
 
 -(void)beginRenderGroup
@@ -183,5 +186,10 @@
 {
 }
 
+-(int)renderBatch:(XNode**)nodes count:(int)count buffer:(XMeshBatchBuffer*)buffer camera:(XCamera*)cam
+{
+	return 0;
+}
+
 
 @end
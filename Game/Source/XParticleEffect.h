@@ -24,6 +24,7 @@ typedef struct {
 @interface XParticleEffect : XResource {
 @public
 	int totalParticlesToEmit;
+	XScalar totalParticleArea; //sum of the particles' average start areas (used to estimate fill rate)
 	XParticleEmissionData *emissionArray;
 	int numEmissions;
 	XTexture *texture;
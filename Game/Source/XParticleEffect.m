@@ -44,6 +44,7 @@
 		NSArray *emissionNodes = [root subnodesWithName:@"emit"];
 		numEmissions = emissionNodes.count;
 		emissionArray = malloc(sizeof(XParticleEmissionData) * numEmissions);
+		memorySize = sizeof(XParticleEmissionData) * numEmissions;
 		// reset all emissions data to defaults
 		{
 			XParticleEmissionData d;
@@ -68,6 +69,7 @@
 		// parse emissions
 		int i = 0;
 		totalParticlesToEmit = 0;
+		totalParticleArea = 0;
 		for (XScriptNode *emissionNode in emissionNodes) {
 			// parse emission definition
 			XParticleEmissionData *emData = &emissionArray[i++];
@@ -143,6 +145,8 @@
 			}
 			// update total number of particles
 			totalParticlesToEmit += emData->emitCount;
+			XScalar averageScale = (emData->minScale + emData->maxScale) * 0.5f;
+			totalParticleArea += emData->emitCount * averageScale * averageScale;
 		}
 		[script release];
 	}
@@ -0,0 +1,62 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMath.h"
+#import <stdint.h>
+#import <string.h>
+
+// Particle simulation and billboard expansion over packed (structure of arrays) particle state.
+// Particles are evaluated 4 at a time with NEON (device) or SSE (simulator), with a scalar fallback
+// for everything else: position, scale, rotation (from a sin/cos table) and alpha are computed for
+// each particle at the given time, and the 4 camera facing corners of every particle still alive
+// are written out packed together, so dead particles cost nothing to draw.
+
+// vertex format of expanded particles (color is RGBA bytes in memory order, for GL_UNSIGNED_BYTE)
+typedef struct {
+	XVector3 position;
+	uint32_t color;
+} XParticleVertex;
+
+typedef struct {
+	float *startX, *startY, *startZ;
+	float *velocityX, *velocityY, *velocityZ;
+	float *gravity;
+	float *startAngle, *rotateSpeed;
+	float *scale, *scaleSpeed;
+	float *startAlpha, *endAlpha;
+	float *life, *invLife;
+	uint32_t *color;	// RGB bytes (alpha is computed every frame), see xParticleColor()
+	int count, capacity;
+} XParticleArray;
+
+// packs a particle color (alpha is left zero, and filled in by the kernel)
+static inline uint32_t xParticleColor(uint8_t red, uint8_t green, uint8_t blue)
+{
+	uint8_t bytes[4] = { red, green, blue, 0 };
+	uint32_t color;
+	memcpy(&color, bytes, sizeof(color));
+	return color;
+}
+
+void ParticleArray_init(XParticleArray *particles, int capacity);
+void ParticleArray_free(XParticleArray *particles);
+
+// lays the arrays out in caller owned memory of ParticleArray_storageSize(capacity) bytes instead
+// (don't call ParticleArray_free on these)
+size_t ParticleArray_storageSize(int capacity);
+void ParticleArray_initWithStorage(XParticleArray *particles, void *storage, int capacity);
+
+// writes 4 billboard vertexes (top-left, top-right, bottom-left, bottom-right) for each particle still
+// alive at the given time, offset by 'offset', and returns how many particles were written. The local
+// space bounds of the live particles (their positions +/- half their start scale) are written to bounds.
+int ParticleKernel_expandBillboards(const XParticleArray *particles, float time, const XVector3 *offset,
+	const XVector3 *rightVector, const XVector3 *upVector, XParticleVertex *dest, XBoundingBox *bounds);
+// the same without SIMD (what the SIMD kernels are checked against; see ParticleBench)
+int ParticleKernel_expandBillboardsScalar(const XParticleArray *particles, float time, const XVector3 *offset,
+	const XVector3 *rightVector, const XVector3 *upVector, XParticleVertex *dest, XBoundingBox *bounds);
+
+// the number of particles still alive at the given time (without simulating them)
+int ParticleKernel_countLive(const XParticleArray *particles, float time);
+
+// table based sin/cos (1024 entries per turn), accurate to about 0.003
+void ParticleKernel_sinCos(float angle, float *sinResult, float *cosResult);
+
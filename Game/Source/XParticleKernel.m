@@ -0,0 +1,296 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XParticleKernel.h"
+#import <stdlib.h>
+
+#if defined(__ARM_NEON__)
+#import <arm_neon.h>
+#define PARTICLEKERNEL_NEON
+#elif defined(__SSE__)
+#import <xmmintrin.h>
+#define PARTICLEKERNEL_SSE
+#endif
+
+#define SINTABLE_SIZE 1024
+#define SINTABLE_MASK (SINTABLE_SIZE - 1)
+
+static float sinTable[SINTABLE_SIZE];
+static BOOL sinTableReady = NO;
+
+// (particle colors are stored little endian, so alpha is the high byte)
+#define ALPHA_SHIFT 24
+
+
+static void ParticleKernel_initSinTable()
+{
+	if (sinTableReady)
+		return;
+	for (int i = 0; i < SINTABLE_SIZE; ++i)
+		sinTable[i] = sinf(i * (float)TWO_PI / SINTABLE_SIZE);
+	sinTableReady = YES;
+}
+
+void ParticleKernel_sinCos(float angle, float *sinResult, float *cosResult)
+{
+	float f = angle * (SINTABLE_SIZE / (float)TWO_PI);
+	int index = (int)(f + ((f >= 0) ? 0.5f : -0.5f));
+	*sinResult = sinTable[index & SINTABLE_MASK];
+	*cosResult = sinTable[(index + SINTABLE_SIZE/4) & SINTABLE_MASK];
+}
+
+
+void ParticleArray_init(XParticleArray *particles, int capacity)
+{
+	ParticleArray_initWithStorage(particles, malloc(ParticleArray_storageSize(capacity)), capacity);
+}
+
+size_t ParticleArray_storageSize(int capacity)
+{
+	const int floatFields = 15;
+	return (sizeof(float) * floatFields + sizeof(uint32_t)) * capacity;
+}
+
+void ParticleArray_initWithStorage(XParticleArray *particles, void *storage, int capacity)
+{
+	ParticleKernel_initSinTable();
+
+	// all fields share one allocation
+	float *data = storage;
+	particles->startX = data; data += capacity;
+	particles->startY = data; data += capacity;
+	particles->startZ = data; data += capacity;
+	particles->velocityX = data; data += capacity;
+	particles->velocityY = data; data += capacity;
+	particles->velocityZ = data; data += capacity;
+	particles->gravity = data; data += capacity;
+	particles->startAngle = data; data += capacity;
+	particles->rotateSpeed = data; data += capacity;
+	particles->scale = data; data += capacity;
+	particles->scaleSpeed = data; data += capacity;
+	particles->startAlpha = data; data += capacity;
+	particles->endAlpha = data; data += capacity;
+	particles->life = data; data += capacity;
+	particles->invLife = data; data += capacity;
+	particles->color = (uint32_t*)data;
+	particles->count = 0;
+	particles->capacity = capacity;
+}
+
+void ParticleArray_free(XParticleArray *particles)
+{
+	free(particles->startX);
+	memset(particles, 0, sizeof(XParticleArray));
+}
+
+
+static inline void ParticleKernel_growBounds(XBoundingBox *bounds, float x, float y, float z, float halfSize)
+{
+	if (x - halfSize < bounds->min.x) bounds->min.x = x - halfSize;
+	if (x + halfSize > bounds->max.x) bounds->max.x = x + halfSize;
+	if (y - halfSize < bounds->min.y) bounds->min.y = y - halfSize;
+	if (y + halfSize > bounds->max.y) bounds->max.y = y + halfSize;
+	if (z - halfSize < bounds->min.z) bounds->min.z = z - halfSize;
+	if (z + halfSize > bounds->max.z) bounds->max.z = z + halfSize;
+}
+
+static inline void ParticleKernel_writeVertex(XParticleVertex *vertex, float x, float y, float z, uint32_t color)
+{
+	vertex->position.x = x;
+	vertex->position.y = y;
+	vertex->position.z = z;
+	vertex->color = color;
+}
+
+// expands one particle (which must be alive), returning the next vertex to write
+static XParticleVertex *ParticleKernel_expandOne(const XParticleArray *p, int i, float time, float halfTimeSquared, const XVector3 *offset,
+	const XVector3 *right, const XVector3 *up, XParticleVertex *dest, XBoundingBox *bounds)
+{
+	float x = p->startX[i] + p->velocityX[i] * time;
+	float y = p->startY[i] + p->velocityY[i] * time + p->gravity[i] * halfTimeSquared;
+	float z = p->startZ[i] + p->velocityZ[i] * time;
+	ParticleKernel_growBounds(bounds, x, y, z, p->scale[i] * 0.5f);
+	x += offset->x; y += offset->y; z += offset->z;
+
+	float halfScale = (p->scale[i] + p->scaleSpeed[i] * time) * 0.5f;
+	float sin, cos;
+	ParticleKernel_sinCos(p->startAngle[i] + p->rotateSpeed[i] * time, &sin, &cos);
+	float c = cos * halfScale, s = sin * halfScale;
+
+	float u = xSaturate(time * p->invLife[i]);
+	float usq = (1 - u*u) * xSaturate(u * 20);
+	float alpha = p->endAlpha[i] + (p->startAlpha[i] - p->endAlpha[i]) * usq;
+	uint32_t color = p->color[i] | ((uint32_t)(alpha * 0xFF) << ALPHA_SHIFT);
+
+	// corners are position -/+ A +/- B, where A and B are the rotated right / up half vectors
+	float ax = right->x * c + up->x * s, ay = right->y * c + up->y * s, az = right->z * c + up->z * s;
+	float bx = up->x * c - right->x * s, by = up->y * c - right->y * s, bz = up->z * c - right->z * s;
+	ParticleKernel_writeVertex(dest++, x - ax + bx, y - ay + by, z - az + bz, color);
+	ParticleKernel_writeVertex(dest++, x + ax + bx, y + ay + by, z + az + bz, color);
+	ParticleKernel_writeVertex(dest++, x - ax - bx, y - ay - by, z - az - bz, color);
+	ParticleKernel_writeVertex(dest++, x + ax - bx, y + ay - by, z + az - bz, color);
+	return dest;
+}
+
+
+#if defined(PARTICLEKERNEL_NEON) || defined(PARTICLEKERNEL_SSE)
+
+#if defined(PARTICLEKERNEL_NEON)
+typedef float32x4_t XVec4;
+#define vecLoad(p) vld1q_f32(p)
+#define vecStore(p, a) vst1q_f32(p, a)
+#define vecSet(x) vdupq_n_f32(x)
+#define vecAdd(a, b) vaddq_f32(a, b)
+#define vecSub(a, b) vsubq_f32(a, b)
+#define vecMul(a, b) vmulq_f32(a, b)
+#define vecMin(a, b) vminq_f32(a, b)
+#define vecMax(a, b) vmaxq_f32(a, b)
+#define vecSelectLess(a, b, x, y) vbslq_f32(vcltq_f32(a, b), x, y) //(a < b) ? x : y
+#else
+typedef __m128 XVec4;
+#define vecLoad(p) _mm_loadu_ps(p)
+#define vecStore(p, a) _mm_storeu_ps(p, a)
+#define vecSet(x) _mm_set1_ps(x)
+#define vecAdd(a, b) _mm_add_ps(a, b)
+#define vecSub(a, b) _mm_sub_ps(a, b)
+#define vecMul(a, b) _mm_mul_ps(a, b)
+#define vecMin(a, b) _mm_min_ps(a, b)
+#define vecMax(a, b) _mm_max_ps(a, b)
+static inline __m128 vecSelectLess(__m128 a, __m128 b, __m128 x, __m128 y)
+{
+	__m128 mask = _mm_cmplt_ps(a, b);
+	return _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, y));
+}
+#endif
+
+int ParticleKernel_expandBillboards(const XParticleArray *p, float time, const XVector3 *offset,
+	const XVector3 *rightVector, const XVector3 *upVector, XParticleVertex *dest, XBoundingBox *bounds)
+{
+	bounds->min.x = INFINITY; bounds->min.y = INFINITY; bounds->min.z = INFINITY;
+	bounds->max.x = -INFINITY; bounds->max.y = -INFINITY; bounds->max.z = -INFINITY;
+	XParticleVertex *start = dest;
+	float halfTimeSquared = 0.5f * time * time;
+
+	XVec4 t = vecSet(time), ht2 = vecSet(halfTimeSquared), half = vecSet(0.5f);
+	XVec4 zero = vecSet(0), one = vecSet(1), twenty = vecSet(20), byteScale = vecSet(0xFF);
+	XVec4 inf = vecSet(INFINITY), negInf = vecSet(-INFINITY);
+	XVec4 rx = vecSet(rightVector->x), ry = vecSet(rightVector->y), rz = vecSet(rightVector->z);
+	XVec4 ux = vecSet(upVector->x), uy = vecSet(upVector->y), uz = vecSet(upVector->z);
+	XVec4 ox = vecSet(offset->x), oy = vecSet(offset->y), oz = vecSet(offset->z);
+	XVec4 minX = inf, minY = inf, minZ = inf, maxX = negInf, maxY = negInf, maxZ = negInf;
+
+	int groupCount = p->count & ~3;
+	for (int i = 0; i < groupCount; i += 4) {
+		XVec4 life = vecLoad(&p->life[i]);
+		int liveMask = (time < p->life[i]) | ((time < p->life[i+1]) << 1) | ((time < p->life[i+2]) << 2) | ((time < p->life[i+3]) << 3);
+		if (liveMask == 0)
+			continue;
+
+		// positions, and bounds of live particles
+		XVec4 x = vecAdd(vecLoad(&p->startX[i]), vecMul(vecLoad(&p->velocityX[i]), t));
+		XVec4 y = vecAdd(vecAdd(vecLoad(&p->startY[i]), vecMul(vecLoad(&p->velocityY[i]), t)), vecMul(vecLoad(&p->gravity[i]), ht2));
+		XVec4 z = vecAdd(vecLoad(&p->startZ[i]), vecMul(vecLoad(&p->velocityZ[i]), t));
+		XVec4 startScale = vecLoad(&p->scale[i]);
+		XVec4 halfStartScale = vecMul(startScale, half);
+		minX = vecMin(minX, vecSelectLess(t, life, vecSub(x, halfStartScale), inf));
+		minY = vecMin(minY, vecSelectLess(t, life, vecSub(y, halfStartScale), inf));
+		minZ = vecMin(minZ, vecSelectLess(t, life, vecSub(z, halfStartScale), inf));
+		maxX = vecMax(maxX, vecSelectLess(t, life, vecAdd(x, halfStartScale), negInf));
+		maxY = vecMax(maxY, vecSelectLess(t, life, vecAdd(y, halfStartScale), negInf));
+		maxZ = vecMax(maxZ, vecSelectLess(t, life, vecAdd(z, halfStartScale), negInf));
+		x = vecAdd(x, ox); y = vecAdd(y, oy); z = vecAdd(z, oz);
+
+		// rotation (table lookups are scalar)
+		float angles[4], sins[4], coss[4];
+		vecStore(angles, vecAdd(vecLoad(&p->startAngle[i]), vecMul(vecLoad(&p->rotateSpeed[i]), t)));
+		for (int k = 0; k < 4; ++k)
+			ParticleKernel_sinCos(angles[k], &sins[k], &coss[k]);
+		XVec4 halfScale = vecMul(vecAdd(startScale, vecMul(vecLoad(&p->scaleSpeed[i]), t)), half);
+		XVec4 c = vecMul(vecLoad(coss), halfScale);
+		XVec4 s = vecMul(vecLoad(sins), halfScale);
+
+		// alpha
+		XVec4 u = vecMin(vecMax(vecMul(t, vecLoad(&p->invLife[i])), zero), one);
+		XVec4 usq = vecMul(vecSub(one, vecMul(u, u)), vecMin(vecMax(vecMul(u, twenty), zero), one));
+		XVec4 endAlpha = vecLoad(&p->endAlpha[i]);
+		XVec4 alpha = vecAdd(endAlpha, vecMul(vecSub(vecLoad(&p->startAlpha[i]), endAlpha), usq));
+		float alphas[4];
+		vecStore(alphas, vecMul(alpha, byteScale));
+
+		// corners (position -/+ A +/- B)
+		XVec4 ax = vecAdd(vecMul(rx, c), vecMul(ux, s));
+		XVec4 ay = vecAdd(vecMul(ry, c), vecMul(uy, s));
+		XVec4 az = vecAdd(vecMul(rz, c), vecMul(uz, s));
+		XVec4 bx = vecSub(vecMul(ux, c), vecMul(rx, s));
+		XVec4 by = vecSub(vecMul(uy, c), vecMul(ry, s));
+		XVec4 bz = vecSub(vecMul(uz, c), vecMul(rz, s));
+		XVec4 nx = vecSub(x, ax), ny = vecSub(y, ay), nz = vecSub(z, az);
+		XVec4 px = vecAdd(x, ax), py = vecAdd(y, ay), pz = vecAdd(z, az);
+		float corners[4][3][4];
+		vecStore(corners[0][0], vecAdd(nx, bx)); vecStore(corners[0][1], vecAdd(ny, by)); vecStore(corners[0][2], vecAdd(nz, bz));
+		vecStore(corners[1][0], vecAdd(px, bx)); vecStore(corners[1][1], vecAdd(py, by)); vecStore(corners[1][2], vecAdd(pz, bz));
+		vecStore(corners[2][0], vecSub(nx, bx)); vecStore(corners[2][1], vecSub(ny, by)); vecStore(corners[2][2], vecSub(nz, bz));
+		vecStore(corners[3][0], vecSub(px, bx)); vecStore(corners[3][1], vecSub(py, by)); vecStore(corners[3][2], vecSub(pz, bz));
+
+		// write live particles only
+		for (int k = 0; k < 4; ++k) {
+			if (!(liveMask & (1 << k)))
+				continue;
+			uint32_t color = p->color[i+k] | ((uint32_t)alphas[k] << ALPHA_SHIFT);
+			for (int v = 0; v < 4; ++v)
+				ParticleKernel_writeVertex(dest++, corners[v][0][k], corners[v][1][k], corners[v][2][k], color);
+		}
+	}
+
+	// merge bounds lanes
+	float lanes[6][4];
+	vecStore(lanes[0], minX); vecStore(lanes[1], minY); vecStore(lanes[2], minZ);
+	vecStore(lanes[3], maxX); vecStore(lanes[4], maxY); vecStore(lanes[5], maxZ);
+	for (int k = 0; k < 4; ++k) {
+		if (lanes[0][k] < bounds->min.x) bounds->min.x = lanes[0][k];
+		if (lanes[1][k] < bounds->min.y) bounds->min.y = lanes[1][k];
+		if (lanes[2][k] < bounds->min.z) bounds->min.z = lanes[2][k];
+		if (lanes[3][k] > bounds->max.x) bounds->max.x = lanes[3][k];
+		if (lanes[4][k] > bounds->max.y) bounds->max.y = lanes[4][k];
+		if (lanes[5][k] > bounds->max.z) bounds->max.z = lanes[5][k];
+	}
+
+	// remaining particles
+	for (int i = groupCount; i < p->count; ++i) {
+		if (time < p->life[i])
+			dest = ParticleKernel_expandOne(p, i, time, halfTimeSquared, offset, rightVector, upVector, dest, bounds);
+	}
+	return (int)(dest - start) / 4;
+}
+
+#else
+
+int ParticleKernel_expandBillboards(const XParticleArray *p, float time, const XVector3 *offset,
+	const XVector3 *rightVector, const XVector3 *upVector, XParticleVertex *dest, XBoundingBox *bounds)
+{
+	return ParticleKernel_expandBillboardsScalar(p, time, offset, rightVector, upVector, dest, bounds);
+}
+
+#endif
+
+int ParticleKernel_expandBillboardsScalar(const XParticleArray *p, float time, const XVector3 *offset,
+	const XVector3 *rightVector, const XVector3 *upVector, XParticleVertex *dest, XBoundingBox *bounds)
+{
+	bounds->min.x = INFINITY; bounds->min.y = INFINITY; bounds->min.z = INFINITY;
+	bounds->max.x = -INFINITY; bounds->max.y = -INFINITY; bounds->max.z = -INFINITY;
+	XParticleVertex *start = dest;
+	float halfTimeSquared = 0.5f * time * time;
+	for (int i = 0; i < p->count; ++i) {
+		if (time < p->life[i])
+			dest = ParticleKernel_expandOne(p, i, time, halfTimeSquared, offset, rightVector, upVector, dest, bounds);
+	}
+	return (int)(dest - start) / 4;
+}
+
+int ParticleKernel_countLive(const XParticleArray *p, float time)
+{
+	int liveCount = 0;
+	for (int i = 0; i < p->count; ++i)
+		liveCount += (time < p->life[i]);
+	return liveCount;
+}
+
@@ -0,0 +1,88 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XParticleSystem.h"
+@class XCamera;
+
+// XParticleManager owns a fixed number of particle systems ("emitter slots") whose particles all live
+// in one preallocated arena. Spawning an effect claims a free slot and restarts it in place, so no
+// nodes or particle arrays are allocated while playing. Slots [0, activeCount) are the animating
+// ones; when a slot's effect finishes it is removed from the scene and swapped with the last active
+// slot.
+//
+// Spawns are also governed by a budget (see XParticleBudget) on the number of live particles and on
+// an estimate of the screen area they cover. A spawn that would exceed the budget is, in order of
+// preference: merged into a matching effect that just started nearby, downgraded to a lower detail
+// version of the effect, emitted with fewer particles, or dropped. Merging restarts the matching effect
+// with as many more of its particles as the budget allows (up to all of them); if it already emits
+// them all, or nothing more fits, the spawn is dropped instead.
+//
+// The default budget suits the slowest supported device; owners set their own (see GGame).
+
+#define XPARTICLE_MANAGER_DEFAULT_SLOTS 48
+
+typedef struct {
+	int maxLiveParticles;
+	float maxFill;				// estimated screen area covered by all live particles, in full screens
+	XScalar mergeRadius;		// spawns over budget within this distance of a matching effect...
+	XSeconds mergeTime;			// ...started no longer than this ago are merged into it
+	int minParticles;			// spawns which would have to be trimmed below this are dropped
+} XParticleBudget;
+
+// counters, accumulated every frame until reset by the owner
+typedef struct {
+	int frames;
+	int liveParticles;			// (summed over frames)
+	int activeSystems;			// (summed over frames)
+	float fill;					// (summed over frames)
+	int peakLiveParticles;
+	int spawnRequests;
+	int spawned;
+	int downgraded;				// spawned with a lower detail effect than requested
+	int trimmed;				// spawned with fewer particles than the effect emits
+	int merged;					// absorbed by a matching nearby effect (which was extended)
+	int dropped;				// not spawned at all (over budget, or no free slot)
+} XParticleStats;
+
+typedef struct {
+	XParticleEffect *effect;
+	int emittedParticles;
+	float emittedFill;			// fill estimate of all emitted particles
+	float emitFraction;			// of the effect's particles (below 1 if trimmed to the budget)
+	XSeconds age;				// (since first spawned; merging doesn't reset it)
+} XParticleSlotInfo;
+
+@interface XParticleManager : NSObject {
+	XScene *scene;
+	XParticleSystem **slots;
+	XParticleSlotInfo *slotInfo;
+	int slotCount, activeCount;
+	void *arena;
+	
+	XParticleBudget budget;
+	int liveParticles;
+	float liveFill;
+	XParticleStats stats;
+}
+
+@property(readonly) int slotCount;
+@property(readonly) int activeCount;
+@property(assign) XParticleBudget budget;
+@property(readonly) XParticleStats stats;
+
+-(id)initWithScene:(XScene*)scn slots:(int)count;
+-(void)dealloc;
+
+// Starts the given effect at a position. The returned system is owned by the manager and is only
+// valid until its animation ends; nil is returned if the spawn was dropped or merged.
+-(XParticleSystem*)spawnEffect:(XParticleEffect*)effect at:(XVector3*)position shade:(float)lightness;
+
+// Same as above, but with lodCount versions of the effect in decreasing level of detail. The first
+// is used if the budget allows, otherwise the governor picks a lower one.
+-(XParticleSystem*)spawnEffectLODs:(XParticleEffect**)lodEffects count:(int)lodCount at:(XVector3*)position shade:(float)lightness;
+
+-(void)frameUpdate:(XSeconds)deltaTime;
+-(void)removeAll;
+-(void)resetStats;
+
+@end
+
@@ -0,0 +1,258 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XParticleManager.h"
+#import "XScene.h"
+#import "XCamera.h"
+
+static const XParticleBudget defaultBudget = {
+	1536,	// maxLiveParticles
+	8.0f,	// maxFill
+	6.0f,	// mergeRadius
+	0.25f,	// mergeTime
+	4		// minParticles
+};
+
+
+@interface XParticleManager (private)
+
+-(void)freeSlot:(int)index;
+-(float)fillScaleAt:(XVector3*)position;
+-(BOOL)overBudgetWith:(XParticleEffect*)effect fillScale:(float)fillScale;
+-(BOOL)extendSlot:(int)index;
+
+@end
+
+
+@implementation XParticleManager
+
+@synthesize slotCount, activeCount, budget, stats;
+
+-(id)initWithScene:(XScene*)scn slots:(int)count
+{
+	if ((self = [super init])) {
+		scene = scn;
+		slotCount = count;
+		activeCount = 0;
+		budget = defaultBudget;
+		liveParticles = 0;
+		liveFill = 0;
+		memset(&stats, 0, sizeof(stats));
+		
+		// one arena holds the particles of every slot
+		size_t slotStorage = ParticleArray_storageSize(MAX_PARTICLES_PER_SYSTEM);
+		arena = malloc(slotStorage * slotCount);
+		slots = malloc(sizeof(XParticleSystem*) * slotCount);
+		slotInfo = calloc(slotCount, sizeof(XParticleSlotInfo));
+		for (int i = 0; i < slotCount; ++i)
+			slots[i] = [[XParticleSystem alloc] initWithParticleStorage:((char*)arena + slotStorage * i) capacity:MAX_PARTICLES_PER_SYSTEM];
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	[self removeAll];
+	for (int i = 0; i < slotCount; ++i)
+		[slots[i] release];
+	free(slots);
+	free(slotInfo);
+	free(arena);
+	[super dealloc];
+}
+
+-(XParticleSystem*)spawnEffect:(XParticleEffect*)effect at:(XVector3*)position shade:(float)lightness
+{
+	return [self spawnEffectLODs:&effect count:1 at:position shade:lightness];
+}
+
+-(XParticleSystem*)spawnEffectLODs:(XParticleEffect**)lodEffects count:(int)lodCount at:(XVector3*)position shade:(float)lightness
+{
+	++stats.spawnRequests;
+	float fillScale = [self fillScaleAt:position];
+	
+	int lod = 0;
+	XParticleEffect *effect = lodEffects[0];
+	BOOL overBudget = [self overBudgetWith:effect fillScale:fillScale];
+	if (overBudget) {
+		// merge into a matching effect which just started nearby
+		XScalar mergeRadiusSq = budget.mergeRadius * budget.mergeRadius;
+		for (int i = 0; i < activeCount; ++i) {
+			XParticleSlotInfo *info = &slotInfo[i];
+			if (info->age > budget.mergeTime)
+				continue;
+			XVector3 offset = *position;
+			xSub_Vec3Vec3(&offset, &slots[i]->position);
+			if (xLengthSquared_Vec3(&offset) > mergeRadiusSq)
+				continue;
+			for (int l = 0; l < lodCount; ++l) {
+				if (info->effect == lodEffects[l]) {
+					if ([self extendSlot:i])
+						++stats.merged;
+					else
+						++stats.dropped;
+					return nil;
+				}
+			}
+		}
+		
+		// try lower detail versions of the effect
+		while (overBudget && lod < lodCount - 1) {
+			effect = lodEffects[++lod];
+			overBudget = [self overBudgetWith:effect fillScale:fillScale];
+		}
+	}
+	
+	// emit only as many particles as still fit
+	float fraction = 1;
+	if (overBudget) {
+		float fit = (float)(budget.maxLiveParticles - liveParticles) / effect->totalParticlesToEmit;
+		float effectFill = effect->totalParticleArea * fillScale;
+		if (effectFill > 0) {
+			float fillFit = (budget.maxFill - liveFill) / effectFill;
+			if (fillFit < fit) fit = fillFit;
+		}
+		if (fit * effect->totalParticlesToEmit < budget.minParticles) {
+			++stats.dropped;
+			return nil;
+		}
+		fraction = fit;
+	}
+	
+	if (activeCount >= slotCount) {
+		++stats.dropped;
+		return nil;
+	}
+	int index = activeCount++;
+	XParticleSystem *particles = slots[index];
+	[particles setEffect:effect shade:lightness];
+	particles->position = *position;
+	[particles notifyTransformsChanged];
+	[particles beginAnimationWithEmitFraction:fraction];
+	particles.scene = scene;
+	
+	XParticleSlotInfo *info = &slotInfo[index];
+	info->effect = effect;
+	info->emittedParticles = particles.liveParticleCount;
+	info->emittedFill = effect->totalParticleArea * fillScale * fraction;
+	info->emitFraction = fraction;
+	info->age = 0;
+	liveParticles += info->emittedParticles;
+	liveFill += info->emittedFill;
+	
+	++stats.spawned;
+	if (lod > 0) ++stats.downgraded;
+	if (fraction < 1) ++stats.trimmed;
+	return particles;
+}
+
+-(void)frameUpdate:(XSeconds)deltaTime
+{
+	liveParticles = 0;
+	liveFill = 0;
+	for (int i = 0; i < activeCount; ++i) {
+		XParticleSystem *particles = slots[i];
+		[particles updateAnimation:deltaTime];
+		if (particles.isAnimating == NO) {
+			[self freeSlot:i];
+			--i;
+			continue;
+		}
+		
+		// (particles die off over time, so the fill estimate shrinks with the live count)
+		XParticleSlotInfo *info = &slotInfo[i];
+		info->age += deltaTime;
+		int live = particles.liveParticleCount;
+		liveParticles += live;
+		if (info->emittedParticles > 0)
+			liveFill += info->emittedFill * live / info->emittedParticles;
+	}
+	
+	++stats.frames;
+	stats.liveParticles += liveParticles;
+	stats.activeSystems += activeCount;
+	stats.fill += liveFill;
+	if (liveParticles > stats.peakLiveParticles)
+		stats.peakLiveParticles = liveParticles;
+}
+
+-(void)removeAll
+{
+	while (activeCount > 0)
+		[self freeSlot:activeCount - 1];
+	liveParticles = 0;
+	liveFill = 0;
+}
+
+-(void)resetStats
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+-(void)freeSlot:(int)index
+{
+	XParticleSystem *particles = slots[index];
+	[particles endAnimation];
+	particles.scene = nil;
+	
+	// swap with the last active slot
+	--activeCount;
+	slots[index] = slots[activeCount];
+	slots[activeCount] = particles;
+	XParticleSlotInfo info = slotInfo[index];
+	slotInfo[index] = slotInfo[activeCount];
+	slotInfo[activeCount] = info;
+}
+
+// returns the fraction of the screen covered by one unit of particle area at the given position
+-(float)fillScaleAt:(XVector3*)position
+{
+	XCamera *cam = scene.camera;
+	if (cam == nil)
+		return 0;
+	XScalar distance = [cam distanceTo:position];
+	if (distance < cam->nearClip) distance = cam->nearClip;
+	if (distance < 1) distance = 1;
+	XScalar screenHeight = 2 * distance * xTan(xDegToRad(cam->fov * 0.5f));
+	return 1.0f / (screenHeight * screenHeight * cam->aspectRatio);
+}
+
+// restarts a slot's effect with more of its particles, as many as fit in the budget; returns NO if
+// it already emits all of them, or too few more would fit
+-(BOOL)extendSlot:(int)index
+{
+	XParticleSlotInfo *info = &slotInfo[index];
+	XParticleEffect *effect = info->effect;
+	if (info->emitFraction >= 1 || effect->totalParticlesToEmit <= 0)
+		return NO;
+	
+	// (the slot's own particles are replaced, so only the rest of the live ones count against it)
+	XParticleSystem *particles = slots[index];
+	int otherParticles = liveParticles - particles.liveParticleCount;
+	float otherFill = liveFill - info->emittedFill * particles.liveParticleCount / MAX(info->emittedParticles, 1);
+	float fraction = (float)(budget.maxLiveParticles - otherParticles) / effect->totalParticlesToEmit;
+	float effectFill = info->emittedFill / info->emitFraction;
+	if (effectFill > 0) {
+		float fillFit = (budget.maxFill - otherFill) / effectFill;
+		if (fillFit < fraction) fraction = fillFit;
+	}
+	if (fraction > 1) fraction = 1;
+	if ((fraction - info->emitFraction) * effect->totalParticlesToEmit < budget.minParticles)
+		return NO;
+	
+	[particles beginAnimationWithEmitFraction:fraction];
+	info->emittedParticles = particles.liveParticleCount;
+	info->emittedFill = effectFill * fraction;
+	info->emitFraction = fraction;
+	liveParticles = otherParticles + info->emittedParticles;
+	liveFill = otherFill + info->emittedFill;
+	return YES;
+}
+
+-(BOOL)overBudgetWith:(XParticleEffect*)effect fillScale:(float)fillScale
+{
+	return (liveParticles + effect->totalParticlesToEmit > budget.maxLiveParticles)
+		|| (liveFill + effect->totalParticleArea * fillScale > budget.maxFill);
+}
+
+@end
+
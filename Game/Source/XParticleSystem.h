@@ -2,52 +2,31 @@
 
 #import "XNode.h"
 #import "XParticleEffect.h"
+#import "XParticleKernel.h"
 
 #define MAX_PARTICLES_PER_SYSTEM 128
 
 
-typedef struct {
-	GLuint glIndexBuffer;
-	size_t indexCount;
-	GLuint glVertexBuffer; 
-	GLuint glTexcoordBuffer;
-	size_t vertexCount;
-	id particleVertexBufferRef;
-} XParticleGeometryBuffer;
-
-typedef struct {
-	XVector3 startPosition;
-	XVector3 startVelocity;
-	XScalar gravity;
-	XAngle startAngle;
-	XAngle rotateSpeed;
-	XScalar scale;
-	XScalar scaleSpeed;
-	XColorBytes color;
-	float startAlpha, endAlpha;
-	XSeconds life;
-} XParticleInstance;
-
-
 @interface XParticleSystem : XNode {
 	id bufferPool;
 	XParticleEffect *effect;
 	float shade; // multiplied by color to shade the overall particle effect
-	XParticleGeometryBuffer buffers;
 	XSeconds particleTime;
 	BOOL animating;
-	XParticleInstance *particles;
-	NSString *resourceGroupID;
+	int liveParticleCount;
+	XParticleArray particles;
+	BOOL ownsParticles;
 @public
 	XVector3 addedVelocity;
 }
 
 @property(readonly) BOOL isAnimating;
+@property(readonly) int liveParticleCount; //(as of the last updateAnimation, whether drawn or not)
 
-// IMPORTANT: If you use XParticleSystem and there are periods where no particle systems are being rendered,
-// the system will deallocate pooled buffer sets, etc. that prevent memory fragmentation and optimize particle
-// system creation. To prevent this from happening, call [XParticleSystem retainPooledBuffers]; when initializing
-// your game/level, and [XParticleSystem releasePooledBuffers]; when destroying to dump the buffer pools.
+// IMPORTANT: If you use XParticleSystem and there are periods where no particle systems exist, the shared
+// geometry buffers all particle systems render through (see XParticleSystem.m) will be deallocated and later
+// recreated. To prevent this from happening, call [XParticleSystem retainPooledBuffers]; when initializing
+// your game/level, and [XParticleSystem releasePooledBuffers]; when destroying to dump the buffers.
 +(void)retainPooledBuffers;
 +(void)releasePooledBuffers;
 
@@ -55,7 +34,14 @@ typedef struct {
 -(id)initWithEffect:(XParticleEffect*)particleEffect andShade:(float)lightness;
 -(void)dealloc;
 
+// Creates a system with no effect, whose particles live in the given memory (which must hold
+// ParticleArray_storageSize(capacity) bytes and outlive the system). Used by XParticleManager to
+// recycle systems with -setEffect:shade: rather than allocating a new one per effect.
+-(id)initWithParticleStorage:(void*)storage capacity:(int)capacity;
+-(void)setEffect:(XParticleEffect*)particleEffect shade:(float)lightness;
+
 -(void)beginAnimation;
+-(void)beginAnimationWithEmitFraction:(float)fraction; //emits only this fraction of every emission's particles
 -(void)endAnimation;
 -(void)updateAnimation:(XSeconds)deltaTime;
 
@@ -5,70 +5,44 @@
 #import "XGL.h"
 #import "XCamera.h"
 #import "XTexture.h"
+#import "XParticleKernel.h"
 
 
 // ---------- Vertex / index buffer structs ----------
-
-typedef struct {
-	XVector3 position;
-	XColorBytes color;
-} XParticleVertex;
+// (particle vertexes are XParticleVertex, see XParticleKernel.h)
 
 typedef struct {
 	GLbyte u, v;
 } XParticleTexcoord;
 
-typedef GLubyte XParticleIndex;
-
-
-// ---------- Vertex/index buffer pooling ----------
-// Singleton class XParticleGeometryBufferPool manages pooling
-// and reuse of vertex and index buffers for particle systems.
+typedef GLushort XParticleIndex;
 
-@interface XParticleVertexBuffer : NSObject {
-@public
-	GLuint glVertexBuffer;
-	size_t vertexCount;
-}
--(id)initWithSize:(size_t)size;
--(void)dealloc;
-@end
+#define XPARTICLE_BATCH_MAX_PARTICLES (MAX_PARTICLES_PER_SYSTEM * 8)
+#define XPARTICLE_RING_VERTEXES (XPARTICLE_BATCH_MAX_PARTICLES * 4 * 4)
 
-@implementation XParticleVertexBuffer
 
--(id)initWithSize:(size_t)size
-{
-	if ((self = [super init])) {
-		vertexCount = size;
-		glGenBuffers(1, &glVertexBuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, glVertexBuffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(XParticleVertex)*vertexCount, NULL, GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-	}
-	return self;
-}
-
--(void)dealloc
-{
-	glDeleteBuffers(1, &glVertexBuffer);
-	[super dealloc];
-}
-
-@end
+// ---------- Shared particle geometry buffers ----------
+// Singleton class XParticleGeometryBufferPool owns the buffers all particle systems render through:
+// static index and texcoord buffers covering a full batch of quads, and a streaming vertex ring
+// buffer. Particle systems in the same render group (texture and blend mode) write their live
+// particles into one batch, which is appended to the ring and drawn with a single call. When the
+// ring fills up it is orphaned (respecified with glBufferData) and restarted at the beginning, so
+// the driver never has to wait for vertexes which are still being drawn.
 
 @interface XParticleGeometryBufferPool : NSObject {
-@private
+@public
 	GLuint sharedGLIndexBuffer;
-	size_t sharedIndexCount;
 	GLuint sharedGLTexcoordBuffer;
-	size_t sharedTexcoordCount;
-	NSMutableArray *unusedVertexBufferList;
+	GLuint ringGLVertexBuffer;
+	size_t ringOffset; //(in vertexes)
+	XParticleVertex *batchVertexes;
+	int batchParticleCount;
 }
 +(id)retainSingleton;
 -(id)init;
 -(void)dealloc;
--(XParticleGeometryBuffer)autoallocBufferWithSize:(size_t)particleCount;
--(void)autoreleaseBuffer:(XParticleGeometryBuffer*)buffer;
+-(XParticleVertex*)reserveBatchParticles:(int)particleCount;
+-(void)flushBatch;
 @end
 
 
@@ -90,42 +64,49 @@ XParticleGeometryBufferPool *g_XParticleGeometryBufferPool = nil;
 {
 	assert(!g_XParticleGeometryBufferPool);
 	if ((self = [super init])) {
-		sharedIndexCount = MAX_PARTICLES_PER_SYSTEM * 6;
+		size_t indexCount = XPARTICLE_BATCH_MAX_PARTICLES * 6;
 		{
-			XParticleIndex *indexData = malloc(sizeof(XParticleIndex)*sharedIndexCount);
+			XParticleIndex *indexData = malloc(sizeof(XParticleIndex)*indexCount);
 			XParticleIndex *ptr = indexData;
-			for (size_t i = 0; i < MAX_PARTICLES_PER_SYSTEM; ++i) {
+			for (size_t i = 0; i < XPARTICLE_BATCH_MAX_PARTICLES; ++i) {
 				size_t o = i * 4;
 				*ptr++ = 0+o; *ptr++ = 1+o; *ptr++ = 2+o;
 				*ptr++ = 1+o; *ptr++ = 2+o; *ptr++ = 3+o;
 			}
 			glGenBuffers(1, &sharedGLIndexBuffer);
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sharedGLIndexBuffer);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(XParticleIndex)*sharedIndexCount, indexData, GL_STATIC_DRAW);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(XParticleIndex)*indexCount, indexData, GL_STATIC_DRAW);
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 			free(indexData);
 		}
 		
-		sharedTexcoordCount = MAX_PARTICLES_PER_SYSTEM * 4;
+		size_t texcoordCount = XPARTICLE_BATCH_MAX_PARTICLES * 4;
 		{
-			XParticleTexcoord *texcoordData = malloc(sizeof(XParticleTexcoord)*sharedTexcoordCount);
+			XParticleTexcoord *texcoordData = malloc(sizeof(XParticleTexcoord)*texcoordCount);
 			XParticleTexcoord t00; t00.u = 0; t00.v = 0;
 			XParticleTexcoord t10; t10.u = 1; t10.v = 0;
 			XParticleTexcoord t01; t01.u = 0; t01.v = 1;
 			XParticleTexcoord t11; t11.u = 1; t11.v = 1;
 			XParticleTexcoord *ptr = texcoordData;
-			for (size_t i = 0; i < MAX_PARTICLES_PER_SYSTEM; ++i) {
+			for (size_t i = 0; i < XPARTICLE_BATCH_MAX_PARTICLES; ++i) {
 				*ptr++ = t00; *ptr++ = t10;
 				*ptr++ = t01; *ptr++ = t11;
 			}
 			glGenBuffers(1, &sharedGLTexcoordBuffer);
 			glBindBuffer(GL_ARRAY_BUFFER, sharedGLTexcoordBuffer);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(XParticleTexcoord)*sharedTexcoordCount, texcoordData, GL_STATIC_DRAW);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(XParticleTexcoord)*texcoordCount, texcoordData, GL_STATIC_DRAW);
 			glBindBuffer(GL_ARRAY_BUFFER, 0);
 			free(texcoordData);
 		}
-				
-		unusedVertexBufferList = [[NSMutableArray alloc] initWithCapacity:10];
+		
+		glGenBuffers(1, &ringGLVertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, ringGLVertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(XParticleVertex)*XPARTICLE_RING_VERTEXES, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		ringOffset = 0;
+		
+		batchVertexes = malloc(sizeof(XParticleVertex) * XPARTICLE_BATCH_MAX_PARTICLES * 4);
+		batchParticleCount = 0;
 	}
 	return self;
 }
@@ -134,55 +115,53 @@ XParticleGeometryBufferPool *g_XParticleGeometryBufferPool = nil;
 {
 	assert(g_XParticleGeometryBufferPool);
 	g_XParticleGeometryBufferPool = nil;
-	[unusedVertexBufferList removeAllObjects];
-	[unusedVertexBufferList release];
 	glDeleteBuffers(1, &sharedGLIndexBuffer);
 	glDeleteBuffers(1, &sharedGLTexcoordBuffer);
+	glDeleteBuffers(1, &ringGLVertexBuffer);
+	free(batchVertexes);
 	[super dealloc];
 }
 
--(XParticleGeometryBuffer)autoallocBufferWithSize:(size_t)particleCount
+// returns space for up to particleCount more particles in the current batch (drawing the batch first
+// if it's too full); add the number of particles actually written to batchParticleCount
+-(XParticleVertex*)reserveBatchParticles:(int)particleCount
 {
-	XParticleVertexBuffer *vertexBuff = nil;
-	int index = 0, matchingIndex = -1;
-	for (XParticleVertexBuffer *vBuff in unusedVertexBufferList) {
-		if (vBuff->vertexCount == particleCount * 4) {
-			matchingIndex = index;
-			break;
-		}
-		++index;
-	}
-	if (matchingIndex > -1) {
-		vertexBuff = [unusedVertexBufferList objectAtIndex:matchingIndex];
-		[vertexBuff retain];
-		[unusedVertexBufferList removeObjectAtIndex:matchingIndex];
-	}
-	else {
-		vertexBuff = [[XParticleVertexBuffer alloc] initWithSize:(particleCount * 4)];
-	}
-	
-	XParticleGeometryBuffer geomBuff;
-	if (particleCount * 6 > sharedIndexCount) {
-		#ifdef DEBUG
-		[NSException raise:@"Error autoalloc'ing particle geometry buffer" format:@"Too many particles requested. Increase MAX_PARTICLES_PER_SYSTEM."];
-		#endif
-		geomBuff.indexCount = sharedIndexCount;
-	} else {
-		geomBuff.indexCount = particleCount * 6;
-	}
-	geomBuff.glIndexBuffer = sharedGLIndexBuffer;
-	geomBuff.vertexCount = vertexBuff->vertexCount;
-	geomBuff.glVertexBuffer = vertexBuff->glVertexBuffer;
-	geomBuff.glTexcoordBuffer = sharedGLTexcoordBuffer;
-	geomBuff.particleVertexBufferRef = vertexBuff;
-	return geomBuff;
+	if (batchParticleCount + particleCount > XPARTICLE_BATCH_MAX_PARTICLES)
+		[self flushBatch];
+	return &batchVertexes[batchParticleCount * 4];
 }
 
--(void)autoreleaseBuffer:(XParticleGeometryBuffer*)buffer
+-(void)flushBatch
 {
-	XParticleVertexBuffer *vertexBuff = buffer->particleVertexBufferRef;
-	[unusedVertexBufferList addObject:vertexBuff];
-	[vertexBuff release];
+	if (batchParticleCount == 0)
+		return;
+	size_t vertexCount = batchParticleCount * 4;
+	
+	// append the batch to the ring buffer, orphaning it when full
+	glBindBuffer(GL_ARRAY_BUFFER, ringGLVertexBuffer);
+	if (ringOffset + vertexCount > XPARTICLE_RING_VERTEXES) {
+		glBufferData(GL_ARRAY_BUFFER, sizeof(XParticleVertex)*XPARTICLE_RING_VERTEXES, NULL, GL_DYNAMIC_DRAW);
+		ringOffset = 0;
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, ringOffset*sizeof(XParticleVertex), vertexCount*sizeof(XParticleVertex), batchVertexes);
+	size_t byteOffset = ringOffset * sizeof(XParticleVertex);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(XParticleVertex), (void*)(byteOffset + offsetof(XParticleVertex,position)));
+	xglEnableClientState(GL_COLOR_ARRAY);
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(XParticleVertex), (void*)(byteOffset + offsetof(XParticleVertex,color)));
+	
+	glBindBuffer(GL_ARRAY_BUFFER, sharedGLTexcoordBuffer);
+	xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_BYTE, sizeof(XParticleTexcoord), 0);
+	
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sharedGLIndexBuffer);
+	
+	// draw
+	glDrawElements(GL_TRIANGLES, batchParticleCount * 6, GL_UNSIGNED_SHORT, (void*)0);
+	
+	xglNotifyMeshBindingsChanged();
+	ringOffset += vertexCount;
+	batchParticleCount = 0;
 }
 
 @end
@@ -191,6 +170,13 @@ XParticleGeometryBufferPool *g_XParticleGeometryBufferPool = nil;
 
 // ---------- Particle system implementation ----------
 
+@interface XParticleSystem (private)
+
+-(int)writeParticles:(XParticleVertex*)particleVertexPtr offset:(XVector3*)offset rightVector:(XVector3*)rightVector upVector:(XVector3*)upVector;
+
+@end
+
+
 @implementation XParticleSystem
 
 +(void)retainPooledBuffers
@@ -208,16 +194,17 @@ XParticleGeometryBufferPool *g_XParticleGeometryBufferPool = nil;
 	if ((self = [super init])) {
 		effect = particleEffect;
 		[effect mediaRetain];
-		if (effect->texture) {
-			resourceGroupID = [[NSString alloc] initWithFormat:@"9_%@", effect->texture.resourceKey];
-		} else {
-			resourceGroupID = [[NSString alloc] initWithFormat:@"9_untextured"];
-		}
 		shade = 1;
-		particles = malloc(sizeof(XParticleInstance) * effect->totalParticlesToEmit);
+		ParticleArray_init(&particles, effect->totalParticlesToEmit);
+		ownsParticles = YES;
 		animating = NO;
 		bufferPool = [XParticleGeometryBufferPool retainSingleton];
-		buffers = [bufferPool autoallocBufferWithSize:effect->totalParticlesToEmit];
+		if (effect->totalParticlesToEmit > MAX_PARTICLES_PER_SYSTEM) {
+			#ifdef DEBUG
+			[NSException raise:@"Error creating particle system" format:@"Too many particles requested. Increase MAX_PARTICLES_PER_SYSTEM."];
+			#endif
+			NSLog(@"Warning: Particle effect emits too many particles (%d); only %d will be rendered", effect->totalParticlesToEmit, MAX_PARTICLES_PER_SYSTEM);
+		}
 	}
 	return self;
 }
@@ -230,22 +217,61 @@ XParticleGeometryBufferPool *g_XParticleGeometryBufferPool = nil;
 	return self;
 }
 
+-(id)initWithParticleStorage:(void*)storage capacity:(int)capacity
+{
+	if ((self = [super init])) {
+		effect = nil;
+		shade = 1;
+		ParticleArray_initWithStorage(&particles, storage, capacity);
+		ownsParticles = NO;
+		animating = NO;
+		bufferPool = [XParticleGeometryBufferPool retainSingleton];
+	}
+	return self;
+}
+
 -(void)dealloc
 {
-	[resourceGroupID release];
-	[bufferPool autoreleaseBuffer:&buffers];
 	[bufferPool release];
-	free(particles);
+	if (ownsParticles)
+		ParticleArray_free(&particles);
 	[effect mediaRelease];
 	[super dealloc];
 }
 
+-(void)setEffect:(XParticleEffect*)particleEffect shade:(float)lightness
+{
+	if (particleEffect != effect) {
+		[particleEffect mediaRetain];
+		[effect mediaRelease];
+		effect = particleEffect;
+		[self notifyRenderGroupChanged];
+	}
+	shade = lightness;
+	addedVelocity = xVector3_Zero;
+	animating = NO;
+	particles.count = 0;
+	liveParticleCount = 0;
+	if (effect->totalParticlesToEmit > particles.capacity)
+		NSLog(@"Warning: Particle effect emits too many particles (%d); only %d will be rendered", effect->totalParticlesToEmit, particles.capacity);
+}
+
 -(BOOL)isAnimating
 {
 	return animating;
 }
 
+-(int)liveParticleCount
+{
+	return liveParticleCount;
+}
+
 -(void)beginAnimation
+{
+	[self beginAnimationWithEmitFraction:1];
+}
+
+-(void)beginAnimationWithEmitFraction:(float)fraction
 {
 	animating = YES;
 	particleTime = 0;
@@ -258,50 +284,61 @@ XParticleGeometryBufferPool *g_XParticleGeometryBufferPool = nil;
 	boundingBox.max.x = -INFINITY; boundingBox.max.y = -INFINITY; boundingBox.max.z = -INFINITY;
 
 	// initialize particles from XParticleEffect values
+	XParticleArray *p = &particles;
 	int index = 0;
 	for (int em = 0; em < effect->numEmissions; ++em) {
 		XParticleEmissionData *emission = &effect->emissionArray[em];
-		for (int i = index; i < index + emission->emitCount; ++i) {
+		int emitCount = (fraction < 1) ? (int)ceilf(emission->emitCount * fraction) : emission->emitCount;
+		int end = index + emitCount;
+		if (end > p->capacity) end = p->capacity;
+		for (int i = index; i < end; ++i) {
 			// initialize particle data
-			XParticleInstance *particle = &particles[i];
-			particle->startPosition.x = xRangeRand(emission->emitBox.min.x, emission->emitBox.max.x);
-			particle->startPosition.y = xRangeRand(emission->emitBox.min.y, emission->emitBox.max.y);
-			particle->startPosition.z = xRangeRand(emission->emitBox.min.z, emission->emitBox.max.z);
-			particle->startPosition = xMul_Vec3Mat3(&particle->startPosition, &rot);
-			particle->startVelocity.x = xRangeRand(emission->minVelocity.x, emission->maxVelocity.x);
-			particle->startVelocity.y = xRangeRand(emission->minVelocity.y, emission->maxVelocity.y);
-			particle->startVelocity.z = xRangeRand(emission->minVelocity.z, emission->maxVelocity.z);
-			particle->startVelocity = xMul_Vec3Mat3(&particle->startVelocity, &rot);
-			xAdd_Vec3Vec3(&particle->startVelocity, &addedVelocity);
-			particle->gravity = xRangeRand(emission->minGravity, emission->maxGravity);
-			particle->startAngle = xRangeRand(emission->minAngle, emission->maxAngle);
-			particle->rotateSpeed = xRangeRand(emission->minRotateSpeed, emission->maxRotateSpeed);
-			particle->scale = xRangeRand(emission->minScale, emission->maxScale);
-			particle->scaleSpeed = xRangeRand(emission->minScaleSpeed, emission->maxScaleSpeed);
+			XVector3 vec;
+			vec.x = xRangeRand(emission->emitBox.min.x, emission->emitBox.max.x);
+			vec.y = xRangeRand(emission->emitBox.min.y, emission->emitBox.max.y);
+			vec.z = xRangeRand(emission->emitBox.min.z, emission->emitBox.max.z);
+			XVector3 startPosition = xMul_Vec3Mat3(&vec, &rot);
+			p->startX[i] = startPosition.x; p->startY[i] = startPosition.y; p->startZ[i] = startPosition.z;
+			vec.x = xRangeRand(emission->minVelocity.x, emission->maxVelocity.x);
+			vec.y = xRangeRand(emission->minVelocity.y, emission->maxVelocity.y);
+			vec.z = xRangeRand(emission->minVelocity.z, emission->maxVelocity.z);
+			XVector3 startVelocity = xMul_Vec3Mat3(&vec, &rot);
+			xAdd_Vec3Vec3(&startVelocity, &addedVelocity);
+			p->velocityX[i] = startVelocity.x; p->velocityY[i] = startVelocity.y; p->velocityZ[i] = startVelocity.z;
+			p->gravity[i] = xRangeRand(emission->minGravity, emission->maxGravity);
+			p->startAngle[i] = xRangeRand(emission->minAngle, emission->maxAngle);
+			p->rotateSpeed[i] = xRangeRand(emission->minRotateSpeed, emission->maxRotateSpeed);
+			XScalar scale = xRangeRand(emission->minScale, emission->maxScale);
+			p->scale[i] = scale;
+			p->scaleSpeed[i] = xRangeRand(emission->minScaleSpeed, emission->maxScaleSpeed);
 			float rnd = xRand();
-			particle->color.red = (emission->minColor.red * rnd + emission->maxColor.red * (1-rnd)) * shade;
-			particle->color.green = (emission->minColor.green * rnd + emission->maxColor.green * (1-rnd)) * shade;
-			particle->color.blue = (emission->minColor.blue * rnd + emission->maxColor.blue * (1-rnd)) * shade;
-			particle->startAlpha = emission->startAlpha;
-			particle->endAlpha = emission->endAlpha;
-			particle->life = xRangeRand(emission->minLife, emission->maxLife);
+			p->color[i] = xParticleColor((emission->minColor.red * rnd + emission->maxColor.red * (1-rnd)) * shade,
+										 (emission->minColor.green * rnd + emission->maxColor.green * (1-rnd)) * shade,
+										 (emission->minColor.blue * rnd + emission->maxColor.blue * (1-rnd)) * shade);
+			p->startAlpha[i] = emission->startAlpha;
+			p->endAlpha[i] = emission->endAlpha;
+			p->life[i] = xRangeRand(emission->minLife, emission->maxLife);
+			p->invLife[i] = 1.0f / p->life[i];
 			// update bounds
 			XScalar min, max;
-			min = particle->startPosition.x - particle->scale * 0.5f;
-			max = particle->startPosition.x + particle->scale * 0.5f;
+			min = startPosition.x - scale * 0.5f;
+			max = startPosition.x + scale * 0.5f;
 			if (min < boundingBox.min.x) boundingBox.min.x = min;
 			if (max > boundingBox.max.x) boundingBox.max.x = max;
-			min = particle->startPosition.y - particle->scale * 0.5f;
-			max = particle->startPosition.y + particle->scale * 0.5f;
+			min = startPosition.y - scale * 0.5f;
+			max = startPosition.y + scale * 0.5f;
 			if (min < boundingBox.min.y) boundingBox.min.y = min;
 			if (max > boundingBox.max.y) boundingBox.max.y = max;
-			min = particle->startPosition.z - particle->scale * 0.5f;
-			max = particle->startPosition.z + particle->scale * 0.5f;
+			min = startPosition.z - scale * 0.5f;
+			max = startPosition.z + scale * 0.5f;
 			if (min < boundingBox.min.z) boundingBox.min.z = min;
 			if (max > boundingBox.max.z) boundingBox.max.z = max;			
 		}
-		index += emission->emitCount;
+		index += emitCount;
 	}
+	p->count = (index < p->capacity) ? index : p->capacity;
+	if (p->count > MAX_PARTICLES_PER_SYSTEM) p->count = MAX_PARTICLES_PER_SYSTEM;
+	liveParticleCount = p->count;
 	[self notifyBoundsChanged];
 }
 
@@ -314,65 +351,74 @@ XParticleGeometryBufferPool *g_XParticleGeometryBufferPool = nil;
 {
 	if (animating) {
 		particleTime += deltaTime;
+		
+		// (counted and expired here rather than when drawn, so systems which are never visible still end,
+		// and the live count XParticleManager budgets with stays current)
+		liveParticleCount = ParticleKernel_countLive(&particles, particleTime);
+		if (liveParticleCount == 0)
+			animating = NO;
 	}
 }
 
--(NSString*)getRenderGroupID
+-(XRenderSortKey)getRenderGroupKey
 {
-	return resourceGroupID;
+	if (effect->texture)
+		return xRenderGroupKey(XRenderPass_Particles, effect->blendMode, effect->texture.glTexture, 0);
+	else
+		return xRenderGroupKey(XRenderPass_Particles, XBlend_None, 0, 0);
 }
 
 -(void)beginRenderGroup
 {
-	glDisable(GL_LIGHTING);
-	glDisable(GL_CULL_FACE);
-	glDisableClientState(GL_NORMAL_ARRAY);
+	xglDisable(GL_LIGHTING);
+	xglDisable(GL_CULL_FACE);
+	xglDisableClientState(GL_NORMAL_ARRAY);
 
 	if (effect->texture) {
 		if (xglCheckBindTextures(effect->texture.glTexture, 0)) {
-			glActiveTexture(GL_TEXTURE0);
+			xglActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, effect->texture.glTexture);
-			glEnable(GL_TEXTURE_2D);
+			xglEnable(GL_TEXTURE_2D);
 		}
 
 		switch (effect->blendMode) {
 			case XBlend_Modulative:
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_DST_COLOR, GL_ZERO);
+				xglEnable(GL_BLEND);
+				xglBlendFunc(GL_DST_COLOR, GL_ZERO);
 				break;
 			case XBlend_Additive:
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+				xglEnable(GL_BLEND);
+				xglBlendFunc(GL_SRC_ALPHA, GL_ONE);
 				break;
 			case XBlend_Alpha:
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				xglEnable(GL_BLEND);
+				xglBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 				break;
 			case XBlend_None:
 				break;
 		}
 		
-		glDepthMask(FALSE);
+		xglDepthMask(FALSE);
 	} else {
-		glActiveTexture(GL_TEXTURE0);
+		xglActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, 0);
-		glDisable(GL_TEXTURE_2D);
+		xglDisable(GL_TEXTURE_2D);
 	}
 }
 
 -(void)endRenderGroup
 {
-	glActiveTexture(GL_TEXTURE0);
+	xglActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	glDisableClientState(GL_COLOR_ARRAY);
+	xglDisableClientState(GL_COLOR_ARRAY);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-	glDisable(GL_BLEND);
-	glEnable(GL_LIGHTING);	
-	glEnable(GL_CULL_FACE);
-	glDepthMask(TRUE);
+	xglDisable(GL_BLEND);
+	xglEnable(GL_LIGHTING);	
+	xglEnable(GL_CULL_FACE);
+	xglDepthMask(TRUE);
 }
 
 -(XMatrix3*)globalRotation
@@ -380,134 +426,65 @@ XParticleGeometryBufferPool *g_XParticleGeometryBufferPool = nil;
 	return (XMatrix3*)&xMatrix3_Identity;	
 }
 
--(void)render:(XCamera*)cam
+// calculates vectors to face particles towards the camera
+static void XParticleSystem_billboardVectors(XCamera *cam, XVector3 *rightVector, XVector3 *upVector)
 {
-	if (!animating)
-		return;
-	
-	// calculate vectors to face particles towards camera
-	XVector3 rightVector = xCrossProduct_Vec3(&cam->lookVector, &cam->upVector);
-	XVector3 upVector = xCrossProduct_Vec3(&rightVector, &cam->lookVector);
-	xNormalize_Vec3(&rightVector);
-	xNormalize_Vec3(&upVector);
-	
-	// prepare to update bounding box
-	boundingBox.min.x = INFINITY; boundingBox.min.y = INFINITY; boundingBox.min.z = INFINITY;
-	boundingBox.max.x = -INFINITY; boundingBox.max.y = -INFINITY; boundingBox.max.z = -INFINITY;
-
-	// update particles dynamics
-	XParticleVertex particleVertexBuffer[MAX_PARTICLES_PER_SYSTEM * 4];
-	XParticleVertex *particleVertexPtr = particleVertexBuffer;
-	XSeconds halfParticleTimeSquared = 0.5f * particleTime * particleTime;
-	BOOL allDead = YES;
-	for (int i = 0; i < effect->totalParticlesToEmit; ++i) {
-		XParticleInstance *particle = &particles[i];
-
-		float unitLife = (particleTime / particle->life);
-		if (unitLife >= 1) {
-			// dead particle - collapse vertex
-			for (int i = 0; i < 4; ++i) {
-				particleVertexPtr->position.x = 0; particleVertexPtr->position.y = 0; particleVertexPtr->position.z = 0;
-				particleVertexPtr->color.red = 0; particleVertexPtr->color.green = 0; particleVertexPtr->color.blue = 0; particleVertexPtr->color.alpha = 0;
-				++particleVertexPtr;			
-			}
-		} else {
-			// update and generate particle vertexes
-			allDead = NO;
-			XVector3 pos;
-			pos.x = particle->startPosition.x + particle->startVelocity.x * particleTime;
-			pos.y = particle->startPosition.y + particle->startVelocity.y * particleTime + particle->gravity * halfParticleTimeSquared;
-			pos.z = particle->startPosition.z + particle->startVelocity.z * particleTime;
-			XScalar scale = particle->scale + particle->scaleSpeed * particleTime;
-			XAngle angle = particle->startAngle + particle->rotateSpeed * particleTime;
-			XColorBytes color = particle->color;
-			float usq = xSaturate(unitLife);
-			usq = (1 - (usq*usq)) * xSaturate(usq * 20);
-			float alpha = particle->startAlpha * usq + particle->endAlpha * (1-usq);
-			color.alpha = alpha * 0xFF;
-
-			XScalar cos = xCos(angle) * scale * 0.5f;
-			XScalar sin = xSin(angle) * scale * 0.5f;
-			XScalar lx, ly;
-			
-			// top-left corner
-			lx = cos*(-1) - sin*(1);
-			ly = sin*(-1) + cos*(1);
-			particleVertexPtr->position.x = pos.x + rightVector.x * lx + upVector.x * ly;
-			particleVertexPtr->position.y = pos.y + rightVector.y * lx + upVector.y * ly;
-			particleVertexPtr->position.z = pos.z + rightVector.z * lx + upVector.z * ly;
-			particleVertexPtr->color = color;
-			++particleVertexPtr;
-			
-			// top-right corner
-			lx = cos*(1) - sin*(1);
-			ly = sin*(1) + cos*(1);
-			particleVertexPtr->position.x = pos.x + rightVector.x * lx + upVector.x * ly;
-			particleVertexPtr->position.y = pos.y + rightVector.y * lx + upVector.y * ly;
-			particleVertexPtr->position.z = pos.z + rightVector.z * lx + upVector.z * ly;
-			particleVertexPtr->color = color;
-			++particleVertexPtr;
-			
-			// bottom-left corner
-			lx = cos*(-1) - sin*(-1);
-			ly = sin*(-1) + cos*(-1);
-			particleVertexPtr->position.x = pos.x + rightVector.x * lx + upVector.x * ly;
-			particleVertexPtr->position.y = pos.y + rightVector.y * lx + upVector.y * ly;
-			particleVertexPtr->position.z = pos.z + rightVector.z * lx + upVector.z * ly;
-			particleVertexPtr->color = color;
-			++particleVertexPtr;
-			
-			// bottom-right corner
-			lx = cos*(1) - sin*(-1);
-			ly = sin*(1) + cos*(-1);
-			particleVertexPtr->position.x = pos.x + rightVector.x * lx + upVector.x * ly;
-			particleVertexPtr->position.y = pos.y + rightVector.y * lx + upVector.y * ly;
-			particleVertexPtr->position.z = pos.z + rightVector.z * lx + upVector.z * ly;
-			particleVertexPtr->color = color;
-			++particleVertexPtr;
+	*rightVector = xCrossProduct_Vec3(&cam->lookVector, &cam->upVector);
+	*upVector = xCrossProduct_Vec3(rightVector, &cam->lookVector);
+	xNormalize_Vec3(rightVector);
+	xNormalize_Vec3(upVector);
+}
 
-			// update bounds
-			XScalar min, max;
-			min = pos.x - particle->scale * 0.5f;
-			max = pos.x + particle->scale * 0.5f;
-			if (min < boundingBox.min.x) boundingBox.min.x = min;
-			if (max > boundingBox.max.x) boundingBox.max.x = max;
-			min = pos.y - particle->scale * 0.5f;
-			max = pos.y + particle->scale * 0.5f;
-			if (min < boundingBox.min.y) boundingBox.min.y = min;
-			if (max > boundingBox.max.y) boundingBox.max.y = max;
-			min = pos.z - particle->scale * 0.5f;
-			max = pos.z + particle->scale * 0.5f;
-			if (min < boundingBox.min.z) boundingBox.min.z = min;
-			if (max > boundingBox.max.z) boundingBox.max.z = max;
-		}
-	}
+-(int)writeParticles:(XParticleVertex*)particleVertexPtr offset:(XVector3*)offset rightVector:(XVector3*)rightVector upVector:(XVector3*)upVector
+{
+	// update particles dynamics, writing vertexes for live particles only
+	int liveCount = ParticleKernel_expandBillboards(&particles, particleTime, offset, rightVector, upVector, particleVertexPtr, &boundingBox);
 	[self notifyBoundsChanged];
 	
-	if (allDead) {
+	liveParticleCount = liveCount;
+	if (liveCount == 0)
 		animating = NO;
-		xglNotifyMeshBindingsChanged();
-		return;
-	}
+	return liveCount;
+}
 
-	// upload to particle system's vertex buffer and render
-	glBindBuffer(GL_ARRAY_BUFFER, buffers.glVertexBuffer);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, buffers.vertexCount*sizeof(XParticleVertex), &particleVertexBuffer); //upload data
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glVertexPointer(3, GL_FLOAT, sizeof(XParticleVertex), (void*)offsetof(XParticleVertex,position));
-	glEnableClientState(GL_COLOR_ARRAY);
-	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(XParticleVertex), (void*)offsetof(XParticleVertex,color));
+-(void)render:(XCamera*)cam
+{
+	if (!animating)
+		return;
 	
-	glBindBuffer(GL_ARRAY_BUFFER, buffers.glTexcoordBuffer);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-	glTexCoordPointer(2, GL_BYTE, sizeof(XParticleTexcoord), 0);
+	XVector3 rightVector, upVector;
+	XParticleSystem_billboardVectors(cam, &rightVector, &upVector);
 	
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.glIndexBuffer);
+	// (GL_MODELVIEW already includes this system's position)
+	XParticleGeometryBufferPool *pool = bufferPool;
+	XParticleVertex *vertexes = [pool reserveBatchParticles:MAX_PARTICLES_PER_SYSTEM];
+	pool->batchParticleCount += [self writeParticles:vertexes offset:(XVector3*)&xVector3_Zero rightVector:&rightVector upVector:&upVector];
+	[pool flushBatch];
+}
+
+-(int)renderBatch:(XNode**)nodes count:(int)count buffer:(XMeshBatchBuffer*)buffer camera:(XCamera*)cam
+{
+	// every particle system in this render group shares a texture and blend mode, so all their
+	// particles can be drawn together, in world space
+	int systemCount = 1;
+	while (systemCount < count && [nodes[systemCount] class] == [XParticleSystem class])
+		++systemCount;
+	if (systemCount < 2)
+		return 0;
 	
-	// draw
-	glDrawElements(GL_TRIANGLES, buffers.indexCount, GL_UNSIGNED_BYTE, (void*)0);
+	XVector3 rightVector, upVector;
+	XParticleSystem_billboardVectors(cam, &rightVector, &upVector);
 	
-	xglNotifyMeshBindingsChanged();
+	XParticleGeometryBufferPool *pool = bufferPool;
+	for (int i = 0; i < systemCount; ++i) {
+		XParticleSystem *system = (XParticleSystem*)nodes[i];
+		if (!system->animating)
+			continue;
+		XParticleVertex *vertexes = [pool reserveBatchParticles:MAX_PARTICLES_PER_SYSTEM];
+		pool->batchParticleCount += [system writeParticles:vertexes offset:system.globalPosition rightVector:&rightVector upVector:&upVector];
+	}
+	[pool flushBatch];
+	return systemCount;
 }
 
 @end
@@ -0,0 +1,157 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XGLTypes.h"
+
+// XRenderDevice is a table of the OpenGL ES entry points the engine renders with. Engine code keeps
+// calling the plain gl___ functions, but (through the macros at the bottom of this file, which every
+// file gets by importing XGL.h) those calls go through the current device, xglDevice:
+//
+//  - xglGLESDevice() calls straight into OpenGL ES (the default)
+//  - xglNullDevice() does nothing, and hands out fake object names, so rendering code can run
+//    without a GL context
+//  - xglRecordingDevice(target) counts draw calls, triangles, buffer/texture uploads, binds and
+//    other state changes into XRenderStats, then forwards each call to the target device
+//
+// Framebuffer setup (GLView) isn't routed through the device, and always talks to OpenGL directly.
+// Without OpenGL ES (no system headers, or built with XRENDERDEVICE_HEADLESS defined) only the null and
+// recording devices exist: xglGLESDevice() returns the null device, which is also the default.
+
+// Functions without return values which only change state are declared once here, as
+// F(deviceFunction, glFunction, parameters, arguments, statsCounter)
+#define XRENDERDEVICE_STATE_FUNCTIONS(F) \
+	F(enable, glEnable, (GLenum cap), (cap), stateChanges) \
+	F(disable, glDisable, (GLenum cap), (cap), stateChanges) \
+	F(enableClientState, glEnableClientState, (GLenum array), (array), stateChanges) \
+	F(disableClientState, glDisableClientState, (GLenum array), (array), stateChanges) \
+	F(activeTexture, glActiveTexture, (GLenum texture), (texture), stateChanges) \
+	F(clientActiveTexture, glClientActiveTexture, (GLenum texture), (texture), stateChanges) \
+	F(texParameteri, glTexParameteri, (GLenum target, GLenum pname, GLint param), (target, pname, param), stateChanges) \
+	F(texEnvf, glTexEnvf, (GLenum target, GLenum pname, GLfloat param), (target, pname, param), stateChanges) \
+	F(blendFunc, glBlendFunc, (GLenum sfactor, GLenum dfactor), (sfactor, dfactor), stateChanges) \
+	F(depthMask, glDepthMask, (GLboolean flag), (flag), stateChanges) \
+	F(depthFunc, glDepthFunc, (GLenum func), (func), stateChanges) \
+	F(alphaFunc, glAlphaFunc, (GLenum func, GLclampf ref), (func, ref), stateChanges) \
+	F(cullFace, glCullFace, (GLenum mode), (mode), stateChanges) \
+	F(shadeModel, glShadeModel, (GLenum mode), (mode), stateChanges) \
+	F(fogf, glFogf, (GLenum pname, GLfloat param), (pname, param), stateChanges) \
+	F(fogx, glFogx, (GLenum pname, GLfixed param), (pname, param), stateChanges) \
+	F(fogfv, glFogfv, (GLenum pname, const GLfloat *params), (pname, params), stateChanges) \
+	F(lightfv, glLightfv, (GLenum light, GLenum pname, const GLfloat *params), (light, pname, params), stateChanges) \
+	F(materialfv, glMaterialfv, (GLenum face, GLenum pname, const GLfloat *params), (face, pname, params), stateChanges) \
+	F(materialf, glMaterialf, (GLenum face, GLenum pname, GLfloat param), (face, pname, param), stateChanges) \
+	F(viewport, glViewport, (GLint x, GLint y, GLsizei width, GLsizei height), (x, y, width, height), stateChanges) \
+	F(clear, glClear, (GLbitfield mask), (mask), stateChanges) \
+	F(vertexPointer, glVertexPointer, (GLint size, GLenum type, GLsizei stride, const GLvoid *pointer), (size, type, stride, pointer), arrayPointers) \
+	F(normalPointer, glNormalPointer, (GLenum type, GLsizei stride, const GLvoid *pointer), (type, stride, pointer), arrayPointers) \
+	F(texCoordPointer, glTexCoordPointer, (GLint size, GLenum type, GLsizei stride, const GLvoid *pointer), (size, type, stride, pointer), arrayPointers) \
+	F(colorPointer, glColorPointer, (GLint size, GLenum type, GLsizei stride, const GLvoid *pointer), (size, type, stride, pointer), arrayPointers) \
+	F(bindTexture, glBindTexture, (GLenum target, GLuint texture), (target, texture), textureBinds) \
+	F(bindBuffer, glBindBuffer, (GLenum target, GLuint buffer), (target, buffer), bufferBinds) \
+	F(matrixMode, glMatrixMode, (GLenum mode), (mode), matrixOps) \
+	F(loadIdentity, glLoadIdentity, (void), (), matrixOps) \
+	F(loadMatrixf, glLoadMatrixf, (const GLfloat *m), (m), matrixOps) \
+	F(multMatrixf, glMultMatrixf, (const GLfloat *m), (m), matrixOps) \
+	F(pushMatrix, glPushMatrix, (void), (), matrixOps) \
+	F(popMatrix, glPopMatrix, (void), (), matrixOps) \
+	F(translatef, glTranslatef, (GLfloat x, GLfloat y, GLfloat z), (x, y, z), matrixOps) \
+	F(rotatef, glRotatef, (GLfloat angle, GLfloat x, GLfloat y, GLfloat z), (angle, x, y, z), matrixOps) \
+	F(scalef, glScalef, (GLfloat x, GLfloat y, GLfloat z), (x, y, z), matrixOps) \
+	F(orthof, glOrthof, (GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat zNear, GLfloat zFar), (left, right, bottom, top, zNear, zFar), matrixOps) \
+	F(deleteBuffers, glDeleteBuffers, (GLsizei n, const GLuint *buffers), (n, buffers), resourceCalls) \
+	F(deleteTextures, glDeleteTextures, (GLsizei n, const GLuint *textures), (n, textures), resourceCalls)
+
+#define XRENDERDEVICE_FIELD(name, glName, params, args, counter) void (*name) params;
+
+typedef struct {
+	const char *name;
+	XRENDERDEVICE_STATE_FUNCTIONS(XRENDERDEVICE_FIELD)
+	void (*genBuffers)(GLsizei n, GLuint *buffers);
+	void (*genTextures)(GLsizei n, GLuint *textures);
+	void (*bufferData)(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage);
+	void (*bufferSubData)(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data);
+	void (*texImage2D)(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels);
+	void (*compressedTexImage2D)(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data);
+	void (*drawArrays)(GLenum mode, GLint first, GLsizei count);
+	void (*drawElements)(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices);
+	GLenum (*getError)(void);
+	const GLubyte *(*getString)(GLenum name);
+} XRenderDevice;
+
+// Counters kept by the recording device, accumulated until xglResetRenderStats() is called
+typedef struct {
+	int drawCalls;
+	int triangles;
+	int bufferUploads, bufferUploadBytes;
+	int textureUploads, textureUploadBytes;
+	int stateChanges;	// enables, client states, blend/depth/fog/light/material state, etc.
+	int arrayPointers;	// gl___Pointer calls
+	int textureBinds, bufferBinds;
+	int matrixOps;
+	int resourceCalls;	// buffer/texture creation and deletion
+} XRenderStats;
+
+extern XRenderDevice *xglDevice;
+
+XRenderDevice *xglGLESDevice();
+XRenderDevice *xglNullDevice();
+XRenderDevice *xglRecordingDevice(XRenderDevice *target);
+void xglSetRenderDevice(XRenderDevice *device);
+
+XRenderStats xglGetRenderStats();
+void xglResetRenderStats();
+
+
+// route engine GL calls through the current device (XRenderDevice.m itself needs the real functions)
+#ifndef XRENDERDEVICE_IMPLEMENTATION
+#define glEnable(...) xglDevice->enable(__VA_ARGS__)
+#define glDisable(...) xglDevice->disable(__VA_ARGS__)
+#define glEnableClientState(...) xglDevice->enableClientState(__VA_ARGS__)
+#define glDisableClientState(...) xglDevice->disableClientState(__VA_ARGS__)
+#define glActiveTexture(...) xglDevice->activeTexture(__VA_ARGS__)
+#define glClientActiveTexture(...) xglDevice->clientActiveTexture(__VA_ARGS__)
+#define glTexParameteri(...) xglDevice->texParameteri(__VA_ARGS__)
+#define glTexEnvf(...) xglDevice->texEnvf(__VA_ARGS__)
+#define glBlendFunc(...) xglDevice->blendFunc(__VA_ARGS__)
+#define glDepthMask(...) xglDevice->depthMask(__VA_ARGS__)
+#define glDepthFunc(...) xglDevice->depthFunc(__VA_ARGS__)
+#define glAlphaFunc(...) xglDevice->alphaFunc(__VA_ARGS__)
+#define glCullFace(...) xglDevice->cullFace(__VA_ARGS__)
+#define glShadeModel(...) xglDevice->shadeModel(__VA_ARGS__)
+#define glFogf(...) xglDevice->fogf(__VA_ARGS__)
+#define glFogx(...) xglDevice->fogx(__VA_ARGS__)
+#define glFogfv(...) xglDevice->fogfv(__VA_ARGS__)
+#define glLightfv(...) xglDevice->lightfv(__VA_ARGS__)
+#define glMaterialfv(...) xglDevice->materialfv(__VA_ARGS__)
+#define glMaterialf(...) xglDevice->materialf(__VA_ARGS__)
+#define glViewport(...) xglDevice->viewport(__VA_ARGS__)
+#define glClear(...) xglDevice->clear(__VA_ARGS__)
+#define glVertexPointer(...) xglDevice->vertexPointer(__VA_ARGS__)
+#define glNormalPointer(...) xglDevice->normalPointer(__VA_ARGS__)
+#define glTexCoordPointer(...) xglDevice->texCoordPointer(__VA_ARGS__)
+#define glColorPointer(...) xglDevice->colorPointer(__VA_ARGS__)
+#define glBindTexture(...) xglDevice->bindTexture(__VA_ARGS__)
+#define glBindBuffer(...) xglDevice->bindBuffer(__VA_ARGS__)
+#define glMatrixMode(...) xglDevice->matrixMode(__VA_ARGS__)
+#define glLoadIdentity() xglDevice->loadIdentity()
+#define glLoadMatrixf(...) xglDevice->loadMatrixf(__VA_ARGS__)
+#define glMultMatrixf(...) xglDevice->multMatrixf(__VA_ARGS__)
+#define glPushMatrix() xglDevice->pushMatrix()
+#define glPopMatrix() xglDevice->popMatrix()
+#define glTranslatef(...) xglDevice->translatef(__VA_ARGS__)
+#define glRotatef(...) xglDevice->rotatef(__VA_ARGS__)
+#define glScalef(...) xglDevice->scalef(__VA_ARGS__)
+#define glOrthof(...) xglDevice->orthof(__VA_ARGS__)
+#define glDeleteBuffers(...) xglDevice->deleteBuffers(__VA_ARGS__)
+#define glDeleteTextures(...) xglDevice->deleteTextures(__VA_ARGS__)
+#define glGenBuffers(...) xglDevice->genBuffers(__VA_ARGS__)
+#define glGenTextures(...) xglDevice->genTextures(__VA_ARGS__)
+#define glBufferData(...) xglDevice->bufferData(__VA_ARGS__)
+#define glBufferSubData(...) xglDevice->bufferSubData(__VA_ARGS__)
+#define glTexImage2D(...) xglDevice->texImage2D(__VA_ARGS__)
+#define glCompressedTexImage2D(...) xglDevice->compressedTexImage2D(__VA_ARGS__)
+#define glDrawArrays(...) xglDevice->drawArrays(__VA_ARGS__)
+#define glDrawElements(...) xglDevice->drawElements(__VA_ARGS__)
+#define glGetError() xglDevice->getError()
+#define glGetString(...) xglDevice->getString(__VA_ARGS__)
+#endif
+
@@ -0,0 +1,236 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#define XRENDERDEVICE_IMPLEMENTATION
+#import "XRenderDevice.h"
+
+
+#if XGL_SYSTEM_HEADERS && !defined(XRENDERDEVICE_HEADLESS)
+#define XRENDERDEVICE_GLES
+#endif
+
+
+// ---- OpenGL ES device ----
+
+#if defined(XRENDERDEVICE_GLES)
+
+#define GLES_INIT(name, glName, params, args, counter) .name = glName,
+
+static XRenderDevice glesDevice = {
+	.name = "OpenGL ES",
+	XRENDERDEVICE_STATE_FUNCTIONS(GLES_INIT)
+	.genBuffers = glGenBuffers,
+	.genTextures = glGenTextures,
+	.bufferData = glBufferData,
+	.bufferSubData = glBufferSubData,
+	.texImage2D = glTexImage2D,
+	.compressedTexImage2D = glCompressedTexImage2D,
+	.drawArrays = glDrawArrays,
+	.drawElements = glDrawElements,
+	.getError = glGetError,
+	.getString = glGetString,
+};
+
+#endif
+
+
+// ---- Null device ----
+
+// (every null function ignores its parameters, so don't warn about them under -Wextra)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+#define NULL_FUNCTION(name, glName, params, args, counter) static void Null_##name params {}
+#define NULL_INIT(name, glName, params, args, counter) .name = Null_##name,
+
+XRENDERDEVICE_STATE_FUNCTIONS(NULL_FUNCTION)
+
+static GLuint nullObjectCounter = 0;
+
+static void Null_genObjects(GLsizei n, GLuint *names)
+{
+	for (int i = 0; i < n; ++i)
+		names[i] = ++nullObjectCounter;
+}
+
+static void Null_bufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage) {}
+static void Null_bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data) {}
+static void Null_texImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels) {}
+static void Null_compressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data) {}
+static void Null_drawArrays(GLenum mode, GLint first, GLsizei count) {}
+static void Null_drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices) {}
+static GLenum Null_getError() { return GL_NO_ERROR; }
+static const GLubyte *Null_getString(GLenum name) { return (const GLubyte*)""; }
+
+#pragma GCC diagnostic pop
+
+static XRenderDevice nullDevice = {
+	.name = "Null",
+	XRENDERDEVICE_STATE_FUNCTIONS(NULL_INIT)
+	.genBuffers = Null_genObjects,
+	.genTextures = Null_genObjects,
+	.bufferData = Null_bufferData,
+	.bufferSubData = Null_bufferSubData,
+	.texImage2D = Null_texImage2D,
+	.compressedTexImage2D = Null_compressedTexImage2D,
+	.drawArrays = Null_drawArrays,
+	.drawElements = Null_drawElements,
+	.getError = Null_getError,
+	.getString = Null_getString,
+};
+
+XRenderDevice *xglNullDevice()
+{
+	return &nullDevice;
+}
+
+
+// ---- Current device ----
+
+#if defined(XRENDERDEVICE_GLES)
+XRenderDevice *xglDevice = &glesDevice;
+#else
+XRenderDevice *xglDevice = &nullDevice;
+#endif
+
+XRenderDevice *xglGLESDevice()
+{
+#if defined(XRENDERDEVICE_GLES)
+	return &glesDevice;
+#else
+	return &nullDevice; //(there's no OpenGL ES to call in headless builds)
+#endif
+}
+
+void xglSetRenderDevice(XRenderDevice *device)
+{
+	xglDevice = device;
+}
+
+
+// ---- Recording device ----
+
+static XRenderDevice *recordingTarget = NULL;
+static XRenderStats recordedStats;
+
+#define RECORD_FUNCTION(name, glName, params, args, counter) static void Record_##name params { ++recordedStats.counter; recordingTarget->name args; }
+#define RECORD_INIT(name, glName, params, args, counter) .name = Record_##name,
+
+XRENDERDEVICE_STATE_FUNCTIONS(RECORD_FUNCTION)
+
+static int Record_primitiveCount(GLenum mode, GLsizei count)
+{
+	switch (mode) {
+		case GL_TRIANGLES: return count / 3;
+		case GL_TRIANGLE_STRIP:
+		case GL_TRIANGLE_FAN: return (count > 2) ? (count - 2) : 0;
+		default: return 0;
+	}
+}
+
+static int Record_bytesPerPixel(GLenum format, GLenum type)
+{
+	if (type == GL_UNSIGNED_SHORT_5_6_5 || type == GL_UNSIGNED_SHORT_4_4_4_4 || type == GL_UNSIGNED_SHORT_5_5_5_1)
+		return 2;
+	switch (format) {
+		case GL_RGBA: return 4;
+		case GL_RGB: return 3;
+		case GL_LUMINANCE_ALPHA: return 2;
+		default: return 1;
+	}
+}
+
+static void Record_genBuffers(GLsizei n, GLuint *buffers)
+{
+	++recordedStats.resourceCalls;
+	recordingTarget->genBuffers(n, buffers);
+}
+
+static void Record_genTextures(GLsizei n, GLuint *textures)
+{
+	++recordedStats.resourceCalls;
+	recordingTarget->genTextures(n, textures);
+}
+
+static void Record_bufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage)
+{
+	++recordedStats.bufferUploads;
+	recordedStats.bufferUploadBytes += size;
+	recordingTarget->bufferData(target, size, data, usage);
+}
+
+static void Record_bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data)
+{
+	++recordedStats.bufferUploads;
+	recordedStats.bufferUploadBytes += size;
+	recordingTarget->bufferSubData(target, offset, size, data);
+}
+
+static void Record_texImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels)
+{
+	++recordedStats.textureUploads;
+	recordedStats.textureUploadBytes += width * height * Record_bytesPerPixel(format, type);
+	recordingTarget->texImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+static void Record_compressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data)
+{
+	++recordedStats.textureUploads;
+	recordedStats.textureUploadBytes += imageSize;
+	recordingTarget->compressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+}
+
+static void Record_drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	++recordedStats.drawCalls;
+	recordedStats.triangles += Record_primitiveCount(mode, count);
+	recordingTarget->drawArrays(mode, first, count);
+}
+
+static void Record_drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
+{
+	++recordedStats.drawCalls;
+	recordedStats.triangles += Record_primitiveCount(mode, count);
+	recordingTarget->drawElements(mode, count, type, indices);
+}
+
+static GLenum Record_getError()
+{
+	return recordingTarget->getError();
+}
+
+static const GLubyte *Record_getString(GLenum name)
+{
+	return recordingTarget->getString(name);
+}
+
+static XRenderDevice recordingDevice = {
+	.name = "Recording",
+	XRENDERDEVICE_STATE_FUNCTIONS(RECORD_INIT)
+	.genBuffers = Record_genBuffers,
+	.genTextures = Record_genTextures,
+	.bufferData = Record_bufferData,
+	.bufferSubData = Record_bufferSubData,
+	.texImage2D = Record_texImage2D,
+	.compressedTexImage2D = Record_compressedTexImage2D,
+	.drawArrays = Record_drawArrays,
+	.drawElements = Record_drawElements,
+	.getError = Record_getError,
+	.getString = Record_getString,
+};
+
+XRenderDevice *xglRecordingDevice(XRenderDevice *target)
+{
+	assert(target && target != &recordingDevice);
+	recordingTarget = target;
+	return &recordingDevice;
+}
+
+XRenderStats xglGetRenderStats()
+{
+	return recordedStats;
+}
+
+void xglResetRenderStats()
+{
+	memset(&recordedStats, 0, sizeof(XRenderStats));
+}
@@ -0,0 +1,62 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import <stdint.h>
+
+// Every visible node is drawn in the order of a 64-bit sort key, which packs (from most to least
+// significant) its render pass, blend mode, texture ID, mesh ID and quantized view depth:
+//
+//   [63..60 pass] [59..56 blend] [55..40 texture] [39..24 mesh] [23..16 unused] [15..0 depth]
+//
+// Everything above the depth bits identifies the node's render group; consecutive nodes with the
+// same group share one beginRenderGroup / endRenderGroup, so sorting by key groups all nodes that
+// share state together. XScene builds an XRenderQueue of visible nodes every frame, and radix sorts
+// it into a flat draw list.
+
+typedef uint64_t XRenderSortKey;
+
+// render passes, drawn in this order
+typedef enum {
+	XRenderPass_Bullets,
+	XRenderPass_Models,
+	XRenderPass_Trees,
+	XRenderPass_Terrain,
+	XRenderPass_Sky,
+	XRenderPass_Clutter,
+	XRenderPass_Particles,
+	XRenderPass_Default
+} XRenderPass;
+
+#define XRENDERKEY_PASS_SHIFT 60
+#define XRENDERKEY_BLEND_SHIFT 56
+#define XRENDERKEY_TEXTURE_SHIFT 40
+#define XRENDERKEY_MESH_SHIFT 24
+#define XRENDERKEY_DEPTH_MAX 0xFFFF
+#define XRENDERKEY_GROUP_MASK (~(XRenderSortKey)0xFFFFFF)
+
+// builds a render group key (with zero depth); GL object names are used as texture / mesh IDs
+static inline XRenderSortKey xRenderGroupKey(XRenderPass pass, unsigned int blendMode, unsigned int textureID, unsigned int meshID)
+{
+	return ((XRenderSortKey)(pass & 0xF) << XRENDERKEY_PASS_SHIFT)
+	     | ((XRenderSortKey)(blendMode & 0xF) << XRENDERKEY_BLEND_SHIFT)
+	     | ((XRenderSortKey)(textureID & 0xFFFF) << XRENDERKEY_TEXTURE_SHIFT)
+	     | ((XRenderSortKey)(meshID & 0xFFFF) << XRENDERKEY_MESH_SHIFT);
+}
+
+typedef struct {
+	XRenderSortKey key;
+	void *item;
+} XRenderQueueEntry;
+
+typedef struct {
+	XRenderQueueEntry *entries, *scratch;
+	int count, capacity;
+} XRenderQueue;
+
+void RenderQueue_init(XRenderQueue *queue);
+void RenderQueue_free(XRenderQueue *queue);
+static inline void RenderQueue_clear(XRenderQueue *queue) { queue->count = 0; }
+void RenderQueue_add(XRenderQueue *queue, XRenderSortKey key, void *item);
+
+// sorts entries by key (stable LSD radix sort, skipping bytes which are equal in all keys)
+void RenderQueue_sort(XRenderQueue *queue);
+
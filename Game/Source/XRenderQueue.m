@@ -0,0 +1,75 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XRenderQueue.h"
+#import <stdlib.h>
+#import <string.h>
+
+
+void RenderQueue_init(XRenderQueue *queue)
+{
+	memset(queue, 0, sizeof(XRenderQueue));
+}
+
+void RenderQueue_free(XRenderQueue *queue)
+{
+	free(queue->entries);
+	free(queue->scratch);
+	RenderQueue_init(queue);
+}
+
+void RenderQueue_add(XRenderQueue *queue, XRenderSortKey key, void *item)
+{
+	if (queue->count >= queue->capacity) {
+		int size = (queue->capacity > 0) ? queue->capacity * 2 : 256;
+		queue->entries = realloc(queue->entries, sizeof(XRenderQueueEntry) * size);
+		queue->scratch = realloc(queue->scratch, sizeof(XRenderQueueEntry) * size);
+		queue->capacity = size;
+	}
+	XRenderQueueEntry *entry = &queue->entries[queue->count++];
+	entry->key = key;
+	entry->item = item;
+}
+
+void RenderQueue_sort(XRenderQueue *queue)
+{
+	int count = queue->count;
+	if (count < 2)
+		return;
+
+	// build histograms for all 8 key bytes in one pass
+	static unsigned int histogram[8][256];
+	memset(histogram, 0, sizeof(histogram));
+	XRenderQueueEntry *src = queue->entries;
+	for (int i = 0; i < count; ++i) {
+		XRenderSortKey key = src[i].key;
+		for (int b = 0; b < 8; ++b)
+			++histogram[b][(key >> (b * 8)) & 0xFF];
+	}
+
+	XRenderQueueEntry *dest = queue->scratch;
+	for (int b = 0; b < 8; ++b) {
+		unsigned int *counts = histogram[b];
+		int shift = b * 8;
+
+		// skip this byte if all keys share it (e.g. unused bits, or a single render pass)
+		if (counts[(src[0].key >> shift) & 0xFF] == (unsigned int)count)
+			continue;
+
+		unsigned int offset = 0;
+		for (int d = 0; d < 256; ++d) {
+			unsigned int n = counts[d];
+			counts[d] = offset;
+			offset += n;
+		}
+		for (int i = 0; i < count; ++i)
+			dest[counts[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+		XRenderQueueEntry *tmp = src;
+		src = dest;
+		dest = tmp;
+	}
+
+	// keep the sorted entries in the "entries" array
+	queue->entries = src;
+	queue->scratch = dest;
+}
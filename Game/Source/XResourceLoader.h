@@ -0,0 +1,78 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMediaGroup.h"
+
+
+typedef enum {
+	XResourceRequest_Queued = 0,	// waiting for (or being prepared by) a worker thread
+	XResourceRequest_Prepared,		// file read and decoded, waiting for the render thread to finish it
+	XResourceRequest_Done,			// finished; "resource" is the loaded resource (nil if it failed to load)
+} XResourceRequestState;
+
+
+// XResourceRequest is the handle returned by -[XMediaGroup newRequestForResource:fromFile:]. The file is
+// read and decoded on one of XResourceLoader's worker threads (see +[XResource newPreparedDataForFile:usingMedia:]),
+// then the media group creates the resource from that data, GL uploads included, on the render thread
+// (see -[XMediaGroup finishRequestsWithTimeBudget:]).
+//
+// Once "done", the request holds a media reference to its resource for as long as the request exists,
+// so mediaRetain the resource if it needs to outlive the request. Cancelling a request drops that
+// reference, and keeps it from loading if it hasn't yet.
+//
+// A request for a resource which another request is already loading joins that request instead of
+// reading the file again: it finishes along with it, holding its own reference to the same resource.
+// (If the request it joined is cancelled, the joined one loads the resource when it finishes.)
+@interface XResourceRequest : NSObject {
+	Class resourceType;
+	NSString *filename;
+	XResourceID resourceID;
+	XMediaGroup *mediaGroup;
+	volatile XResourceRequestState state;
+	volatile BOOL cancelled;
+	id preparedData;
+	XResource *resource;
+	XResourceRequest *joinedRequest;
+}
+
+@property(readonly) Class resourceType;
+@property(readonly) NSString *filename;
+@property(readonly) XResourceID resourceID;
+@property(readonly) XResourceRequestState state;
+@property(readonly) BOOL done;
+@property(readonly) BOOL cancelled;
+@property(readonly) XResource *resource;
+@property(readonly) XResourceRequest *joinedRequest; //the earlier request this one shares a resource with (or nil)
+
+-(id)initWithType:(Class)type fromFile:(NSString*)file resourceID:(XResourceID)identifier usingMedia:(XMediaGroup*)media;
+-(void)dealloc;
+
+-(void)cancel;
+
+// used by XResourceLoader and XMediaGroup
+-(void)joinRequest:(XResourceRequest*)request; //instead of being queued, finishes along with the given request
+-(void)prepare; //(worker thread)
+-(void)finish; //(render thread)
+-(void)finishWithResource:(XResource*)loadedResource; //for resources which were already loaded (takes over a media reference)
+
+@end
+
+
+// XResourceLoader is the pool of worker threads which prepare requests, shared by all media groups.
+// Threads are started with the first request, and then wait for more.
+@interface XResourceLoader : NSObject {
+	NSCondition *queueCondition;
+	NSMutableArray *queue;
+	int threadCount;
+}
+
++(XResourceLoader*)sharedLoader;
+
+-(id)init;
+-(void)dealloc;
+
+-(void)enqueueRequest:(XResourceRequest*)request;
+-(BOOL)dequeueRequest:(XResourceRequest*)request; //NO if a worker has already started on it
+-(void)waitUntilPrepared:(XResourceRequest*)request;
+
+@end
+
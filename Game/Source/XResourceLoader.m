@@ -0,0 +1,180 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XResourceLoader.h"
+#import <libkern/OSAtomic.h>
+
+#define XRESOURCELOADER_THREADS 2
+
+
+@implementation XResourceRequest
+
+@synthesize resourceType, filename, resourceID, state, cancelled, resource, joinedRequest;
+
+-(id)initWithType:(Class)type fromFile:(NSString*)file resourceID:(XResourceID)identifier usingMedia:(XMediaGroup*)media
+{
+	if ((self = [super init])) {
+		resourceType = type;
+		filename = [file copy];
+		resourceID = identifier;
+		mediaGroup = media;
+		state = XResourceRequest_Queued;
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	[resource mediaRelease];
+	[joinedRequest release];
+	[preparedData release];
+	[filename release];
+	[super dealloc];
+}
+
+-(BOOL)done
+{
+	return (state == XResourceRequest_Done);
+}
+
+-(void)cancel
+{
+	cancelled = YES;
+	[resource mediaRelease];
+	resource = nil;
+}
+
+-(void)joinRequest:(XResourceRequest*)request
+{
+	joinedRequest = [request retain];
+}
+
+-(void)prepare
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+	if (!cancelled)
+		preparedData = [resourceType newPreparedDataForFile:filename usingMedia:mediaGroup];
+
+	// make sure the prepared data is visible to the render thread before it sees the new state
+	OSMemoryBarrier();
+	state = XResourceRequest_Prepared;
+	[autoreleasePool release];
+}
+
+-(void)finish
+{
+	if (joinedRequest) {
+		// (called once the joined request is done)
+		if (!cancelled) {
+			resource = joinedRequest.resource;
+			if (resource)
+				[resource mediaRetain];
+			else if (joinedRequest.cancelled)
+				resource = [mediaGroup retainResource:resourceType fromFile:filename];
+		}
+		[joinedRequest release];
+		joinedRequest = nil;
+	} else if (!cancelled) {
+		resource = [mediaGroup retainResource:resourceType fromFile:filename preparedData:preparedData];
+	}
+	[preparedData release];
+	preparedData = nil;
+	state = XResourceRequest_Done;
+}
+
+-(void)finishWithResource:(XResource*)loadedResource
+{
+	resource = loadedResource;
+	state = XResourceRequest_Done;
+}
+
+@end
+
+
+@interface XResourceLoader (private)
+
+-(void)workerThread;
+
+@end
+
+
+@implementation XResourceLoader
+
++(XResourceLoader*)sharedLoader
+{
+	static XResourceLoader *sharedLoader = nil;
+	if (sharedLoader == nil)
+		sharedLoader = [[XResourceLoader alloc] init];
+	return sharedLoader;
+}
+
+-(id)init
+{
+	if ((self = [super init])) {
+		queueCondition = [[NSCondition alloc] init];
+		queue = [[NSMutableArray alloc] init];
+		threadCount = 0;
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	// (the shared loader lives as long as the app, so the worker threads never outlive it)
+	[queue release];
+	[queueCondition release];
+	[super dealloc];
+}
+
+-(void)enqueueRequest:(XResourceRequest*)request
+{
+	[queueCondition lock];
+	[queue addObject:request];
+	if (threadCount < XRESOURCELOADER_THREADS) {
+		++threadCount;
+		[NSThread detachNewThreadSelector:@selector(workerThread) toTarget:self withObject:nil];
+	}
+	[queueCondition broadcast];
+	[queueCondition unlock];
+}
+
+-(BOOL)dequeueRequest:(XResourceRequest*)request
+{
+	[queueCondition lock];
+	NSUInteger index = [queue indexOfObjectIdenticalTo:request];
+	if (index != NSNotFound)
+		[queue removeObjectAtIndex:index];
+	[queueCondition unlock];
+	return (index != NSNotFound);
+}
+
+-(void)waitUntilPrepared:(XResourceRequest*)request
+{
+	[queueCondition lock];
+	while (request.state == XResourceRequest_Queued)
+		[queueCondition wait];
+	[queueCondition unlock];
+}
+
+-(void)workerThread
+{
+	[NSThread setThreadPriority:0.3];
+	for (;;) {
+		[queueCondition lock];
+		while (queue.count == 0)
+			[queueCondition wait];
+		XResourceRequest *request = [[queue objectAtIndex:0] retain];
+		[queue removeObjectAtIndex:0];
+		[queueCondition unlock];
+
+		[request prepare];
+
+		// wake up anyone waiting on this request
+		[queueCondition lock];
+		[queueCondition broadcast];
+		[queueCondition unlock];
+		[request release];
+	}
+}
+
+@end
+
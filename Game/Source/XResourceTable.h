@@ -0,0 +1,38 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import <stdint.h>
+
+// XResourceTable maps resource IDs to resources for XMediaGroup. A resource's ID is the 64 bit FNV-1a hash
+// of its key ("filename::ClassName"), so it can be computed without building the key string, or computed
+// once and cached (see XResourceHandle in XMediaGroup.h). The table is open addressed with linear probing,
+// so a lookup is usually a single probe of an array. Entries are removed by shifting the rest of their
+// probe run back, so there are no tombstones and lookups never slow down as resources come and go.
+
+
+typedef uint64_t XResourceID;
+
+typedef struct {
+	XResourceID resourceID; // (0 marks an empty slot; no key hashes to 0)
+	void *resource;
+} XResourceTableEntry;
+
+typedef struct {
+	XResourceTableEntry *entries;
+	unsigned int capacity; // (a power of two)
+	unsigned int count;
+} XResourceTable;
+
+// the ID of "filename::typeName", hashed straight from the two strings
+XResourceID ResourceTable_hash(const char *filename, const char *typeName);
+
+// the 64 bit FNV-1a hash of a string; unlike -[NSString hash], it's the same on every device and OS
+// version, so it can seed anything which must come out the same everywhere (e.g. tree placement)
+uint64_t ResourceTable_hashString(const char *str);
+
+void ResourceTable_init(XResourceTable *table);
+void ResourceTable_free(XResourceTable *table);
+
+void *ResourceTable_find(const XResourceTable *table, XResourceID resourceID); // NULL if not found
+void ResourceTable_insert(XResourceTable *table, XResourceID resourceID, void *resource); // (the ID must not be in the table)
+void *ResourceTable_remove(XResourceTable *table, XResourceID resourceID); // returns the removed resource, or NULL
+
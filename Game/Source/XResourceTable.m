@@ -0,0 +1,123 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XResourceTable.h"
+#import <stdlib.h>
+#import <string.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+#define RESOURCETABLE_MIN_CAPACITY 64
+
+
+static inline uint64_t fnv1a(uint64_t hash, const char *str)
+{
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+XResourceID ResourceTable_hash(const char *filename, const char *typeName)
+{
+	uint64_t hash = fnv1a(FNV_OFFSET_BASIS, filename);
+	hash = fnv1a(hash, "::");
+	hash = fnv1a(hash, typeName);
+	return hash ? hash : 1;
+}
+
+uint64_t ResourceTable_hashString(const char *str)
+{
+	return fnv1a(FNV_OFFSET_BASIS, str);
+}
+
+static inline unsigned int homeSlot(const XResourceTable *table, XResourceID resourceID)
+{
+	// (FNV's low bits are well mixed enough to index with directly)
+	return (unsigned int)resourceID & (table->capacity - 1);
+}
+
+void ResourceTable_init(XResourceTable *table)
+{
+	table->capacity = RESOURCETABLE_MIN_CAPACITY;
+	table->count = 0;
+	table->entries = calloc(table->capacity, sizeof(XResourceTableEntry));
+}
+
+void ResourceTable_free(XResourceTable *table)
+{
+	free(table->entries);
+	table->entries = NULL;
+	table->capacity = 0;
+	table->count = 0;
+}
+
+void *ResourceTable_find(const XResourceTable *table, XResourceID resourceID)
+{
+	unsigned int mask = table->capacity - 1;
+	for (unsigned int i = homeSlot(table, resourceID);; i = (i + 1) & mask) {
+		const XResourceTableEntry *entry = &table->entries[i];
+		if (entry->resourceID == resourceID)
+			return entry->resource;
+		if (entry->resourceID == 0)
+			return NULL;
+	}
+}
+
+static void grow(XResourceTable *table)
+{
+	XResourceTableEntry *oldEntries = table->entries;
+	unsigned int oldCapacity = table->capacity;
+	table->capacity *= 2;
+	table->entries = calloc(table->capacity, sizeof(XResourceTableEntry));
+	table->count = 0;
+	for (unsigned int i = 0; i < oldCapacity; ++i) {
+		if (oldEntries[i].resourceID)
+			ResourceTable_insert(table, oldEntries[i].resourceID, oldEntries[i].resource);
+	}
+	free(oldEntries);
+}
+
+void ResourceTable_insert(XResourceTable *table, XResourceID resourceID, void *resource)
+{
+	// kept at most half full, so probe runs stay short
+	if ((table->count + 1) * 2 > table->capacity)
+		grow(table);
+	unsigned int mask = table->capacity - 1;
+	unsigned int i = homeSlot(table, resourceID);
+	while (table->entries[i].resourceID != 0)
+		i = (i + 1) & mask;
+	table->entries[i].resourceID = resourceID;
+	table->entries[i].resource = resource;
+	++table->count;
+}
+
+void *ResourceTable_remove(XResourceTable *table, XResourceID resourceID)
+{
+	unsigned int mask = table->capacity - 1;
+	unsigned int i = homeSlot(table, resourceID);
+	while (table->entries[i].resourceID != resourceID) {
+		if (table->entries[i].resourceID == 0)
+			return NULL;
+		i = (i + 1) & mask;
+	}
+	void *resource = table->entries[i].resource;
+
+	// shift back any following entries of the run which could sit in the freed slot
+	unsigned int hole = i;
+	for (unsigned int j = (i + 1) & mask; table->entries[j].resourceID != 0; j = (j + 1) & mask) {
+		unsigned int home = homeSlot(table, table->entries[j].resourceID);
+		// (the entry at j may move to the hole unless its home lies cyclically in (hole, j])
+		int homeBetween = (hole <= j) ? (home > hole && home <= j) : (home > hole || home <= j);
+		if (!homeBetween) {
+			table->entries[hole] = table->entries[j];
+			hole = j;
+		}
+	}
+	table->entries[hole].resourceID = 0;
+	table->entries[hole].resource = NULL;
+	--table->count;
+	return resource;
+}
+
@@ -1,29 +1,64 @@
 // Copyright © 2010 John Judnich. All rights reserved.
 
 #import "XMath.h"
+#import "XBoundingVolumeTree.h"
+#import "XFrustumCulling.h"
+#import "XRenderQueue.h"
+#import "XMeshBatch.h"
 @class XNode;
 @class XCamera;
 
 
+// Uncomment to time culling (along with the old flat per-node culling loop, for comparison against
+// the culling tree) and batch vertex transforms every frame, in the log (see -[GGame renderFrame:])
+//#define XSCENE_BENCHMARK
+
+// Culling and batching counters, accumulated over frames until -resetStats is called
 typedef struct {
-	NSString *groupName;
-	NSMutableSet *nodes;
-} XRenderGroup;
+	int frames;
+	int nodeCount;			// nodes in the culling tree
+	int treeNodesVisited;	// tree nodes tested against the frustum
+	int nodesTested;		// nodes on the frustum boundary, batch tested individually
+	int nodesVisible;
+	int batches;			// dynamically batched draw calls (see XMeshBatch.h)
+	int batchedNodes;		// nodes drawn by them
+	int batchedVertexes;	// vertexes transformed on the CPU for them
+#ifdef XSCENE_BENCHMARK
+	double treeCullTime, flatCullTime;
+	double batchTransformTime;
+#endif
+} XSceneStats;
 
 
 // An XScene consists of an XCamera and a number of XNode instances. Simply set a
 // camera, add XNode-derived objects, and call [myScene render]; every frame. Internally,
 // the XScene class manages visibility, render order, fog, and other misc. OpenGL rendering
 // behaviors for optimal render efficiency.
+//
+// Visibility is determined with a dynamic bounding volume tree over all nodes in the scene.
+// Nodes report changes through notifyTransformsChanged / notifyBoundsChanged, and only those
+// nodes are refit before the next frame is culled. Visible nodes are then drawn in order of
+// their render sort keys (see XRenderQueue.h), and consecutive nodes in the same render group may
+// be drawn together in dynamic batches (see XMeshBatch.h).
 @interface XScene : NSObject {
-	XRenderGroup *renderGroupArray;
-	int renderGroupCount, renderGroupArraySize;
+	XNode **nodeArray;
+	int nodeCount, nodeArraySize;
+	XRenderQueue renderQueue;
+	XBoundingVolumeTree cullingTree;
+	XCullingBoundsArray pendingBounds;
+	XNode **movedNodeArray;
+	int movedNodeCount, movedNodeArraySize;
+	XNode **batchNodeArray;
+	int batchNodeArraySize;
+	XMeshBatchBuffer batchBuffer;
+	XSceneStats stats;
 	XCamera *camera;
 	XScalar fogRange;
 }
 
 @property(retain) XCamera *camera;
 @property(assign) XScalar fogRange;
+@property(readonly) XSceneStats stats;
 
 -(id)init;
 -(void)dealloc;
@@ -32,5 +67,6 @@ typedef struct {
 -(XCamera*)camera;
 
 -(void)render;
+-(void)resetStats;
 
 @end
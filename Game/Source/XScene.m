@@ -7,6 +7,7 @@
 #import "AppDelegate.h"
 
 #define FLOAT_EPSILON 0.000001f
+#define CULLING_TREE_MARGIN 2.0f //how far nodes can move before the culling tree must be updated
 
 const GLfloat lightDirection[] = {0.0, 0.707, -0.707, 0.0};
 
@@ -15,42 +16,116 @@ const GLfloat lightDirection[] = {0.0, 0.707, -0.707, 0.0};
 
 -(void)addNode:(XNode*)entity;
 -(void)removeNode:(XNode*)entity;
+-(void)notifyNodeMoved:(XNode*)entity;
+-(void)notifyNodeRenderGroupChanged:(XNode*)entity;
+-(void)updateCullingTree;
+-(void)cullNodes;
 
 @end
 
 
+typedef struct {
+	XVector3 cameraOrigin;
+	XScalar depthScale;
+	XRenderQueue *renderQueue;
+	XCullingBoundsArray *pendingBounds;
+	XSceneStats *stats;
+} XSceneCullContext;
+
+// computes a world space AABB enclosing the node's (transformed) bounds
+static XBoundingBox XScene_nodeWorldBounds(XNode *node)
+{
+	XBoundingBox box;
+	XVector3 *pos = node.globalPosition;
+	XVector3 center, extent;
+	if (node->useBoundingSphereOnly) {
+		center = *pos;
+		extent.x = extent.y = extent.z = node.boundingRadius;
+	} else {
+		FrustumCulling_transformBox(&node->boundingBox, pos, node.globalRotation, &center, &extent);
+	}
+	box.min.x = center.x - extent.x; box.min.y = center.y - extent.y; box.min.z = center.z - extent.z;
+	box.max.x = center.x + extent.x; box.max.y = center.y + extent.y; box.max.z = center.z + extent.z;
+	return box;
+}
+
+// queues a visible node for rendering, with its view depth added to its render group key
+static void XScene_queueNode(XNode *node, XSceneCullContext *cull)
+{
+	XVector3 center = xCenter_BoundingBox(&node->sceneBounds);
+	XScalar dx = center.x - cull->cameraOrigin.x;
+	XScalar dy = center.y - cull->cameraOrigin.y;
+	XScalar dz = center.z - cull->cameraOrigin.z;
+	XScalar depth = xSqrt(dx*dx + dy*dy + dz*dz) * cull->depthScale;
+	unsigned int quantizedDepth = (depth < XRENDERKEY_DEPTH_MAX) ? (unsigned int)depth : XRENDERKEY_DEPTH_MAX;
+	
+	// opaque groups are drawn front to back, blended groups back to front
+	XRenderSortKey key = node->sceneRenderGroupKey;
+	if (key & ((XRenderSortKey)0xF << XRENDERKEY_BLEND_SHIFT))
+		quantizedDepth = XRENDERKEY_DEPTH_MAX - quantizedDepth;
+	RenderQueue_add(cull->renderQueue, key | quantizedDepth, node);
+	++cull->stats->nodesVisible;
+}
+
+// culling tree visitor: nodes fully inside the frustum are visible, and the rest are batched
+// up to be tested individually
+static void XScene_cullNode(void *userData, BOOL fullyInside, void *context)
+{
+	XNode *node = (XNode*)userData;
+	XSceneCullContext *cull = (XSceneCullContext*)context;
+	if (node.boundingRadius <= FLOAT_EPSILON)
+		return;
+	if (fullyInside)
+		XScene_queueNode(node, cull);
+	else
+		CullingBoundsArray_add(cull->pendingBounds, &node->sceneBounds, node);
+}
+
+
 @implementation XScene
 
-@synthesize camera, fogRange;
+@synthesize camera, fogRange, stats;
 
 -(id)init
 {
 	if ((self = [super init])) {
-		renderGroupArraySize = 32;
-		renderGroupArray = malloc(sizeof(XRenderGroup) * renderGroupArraySize);
-		renderGroupCount = 0;
+		nodeArraySize = 64;
+		nodeArray = malloc(sizeof(XNode*) * nodeArraySize);
+		nodeCount = 0;
+		RenderQueue_init(&renderQueue);
+		
+		BoundingVolumeTree_init(&cullingTree, CULLING_TREE_MARGIN);
+		CullingBoundsArray_init(&pendingBounds);
+		movedNodeArraySize = 64;
+		movedNodeArray = malloc(sizeof(XNode*) * movedNodeArraySize);
+		movedNodeCount = 0;
+		batchNodeArraySize = 64;
+		batchNodeArray = malloc(sizeof(XNode*) * batchNodeArraySize);
+		MeshBatchBuffer_create(&batchBuffer);
+		[self resetStats];
 		
+		xglNotifyStateChanged();
 		glViewport(0, 0, screenHeight, screenWidth);
-		glEnable(GL_CULL_FACE);
+		xglEnable(GL_CULL_FACE);
 		glCullFace(GL_BACK);
 		glShadeModel(GL_SMOOTH);
-		glEnable(GL_DEPTH_TEST);
+		xglEnable(GL_DEPTH_TEST);
 
 		const GLfloat fullWhite[] = {1.0, 1.0, 1.0, 1.0};
-		glEnable(GL_LIGHTING);
-		glEnable(GL_LIGHT0);
+		xglEnable(GL_LIGHTING);
+		xglEnable(GL_LIGHT0);
 		glLightfv(GL_LIGHT0, GL_DIFFUSE, fullWhite);
 		glLightfv(GL_LIGHT0, GL_SPECULAR, fullWhite);
 		glLightfv(GL_LIGHT0, GL_AMBIENT, fullWhite);
 		
 		const GLfloat fogColor[] = {0.25, 0.5, 1.0, 1.0};
-		glEnable(GL_FOG);
+		xglEnable(GL_FOG);
 		glFogx(GL_FOG_MODE, GL_LINEAR);
 		glFogf(GL_FOG_START, 0.0);
 		glFogfv(GL_FOG_COLOR, fogColor);
 		fogRange = 1000;
 		
-		glTexEnvf(GL_TEXTURE_FILTER_CONTROL_EXT, GL_TEXTURE_LOD_BIAS_EXT, -0.5f);
+		xglTexEnvf(GL_TEXTURE_FILTER_CONTROL_EXT, GL_TEXTURE_LOD_BIAS_EXT, -0.5f);
 
 		XGL_ASSERT; //catch OpenGL errors
 	}
@@ -62,18 +137,20 @@ const GLfloat lightDirection[] = {0.0, 0.707, -0.707, 0.0};
 	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
 	self.camera = nil;
 	
-	if (renderGroupCount > 0) {
+	if (nodeCount > 0) {
 		NSLog(@"-- XScene Warning --");
-		NSLog(@"Warning: XScene was released while it contained %d render groups:", renderGroupCount);
-		for (int i = 0; i < renderGroupCount; ++i) {
-			XRenderGroup *group = &renderGroupArray[i];
-			NSLog(@"\"%@\" (contains %d nodes)", group->groupName, group->nodes.count);
-			[group->groupName release];
-			[group->nodes release];
-		}
+		NSLog(@"Warning: XScene was released while it contained %d nodes", nodeCount);
 		NSLog(@"------------------------");
+		for (int i = 0; i < nodeCount; ++i)
+			[nodeArray[i] release];
 	}
-	free(renderGroupArray);
+	free(nodeArray);
+	RenderQueue_free(&renderQueue);
+	free(movedNodeArray);
+	BoundingVolumeTree_free(&cullingTree);
+	CullingBoundsArray_free(&pendingBounds);
+	free(batchNodeArray);
+	MeshBatchBuffer_destroy(&batchBuffer);
 	
 	[autoreleasePool release];
 	XGL_ASSERT; //catch OpenGL errors
@@ -82,109 +159,137 @@ const GLfloat lightDirection[] = {0.0, 0.707, -0.707, 0.0};
 
 -(void)addNode:(XNode*)entity
 {
-	NSString *groupID = [entity getRenderGroupID];
-	assert(groupID);
+	if (nodeCount >= nodeArraySize) {
+		nodeArraySize = nodeArraySize + (nodeArraySize/2) + 1;
+		nodeArray = realloc(nodeArray, sizeof(XNode*) * nodeArraySize);
+	}
+	[entity retain];
+	entity->sceneIndex = nodeCount;
+	nodeArray[nodeCount++] = entity;
+	entity->sceneRenderGroupKey = [entity getRenderGroupKey];
 	
-	// binary search for render group in list
-	int start = 0, end = renderGroupCount-1, middle = 0;
-	XRenderGroup *group = nil;
-	while (end >= start) {
-		middle = (start + end) / 2;
-		XRenderGroup *groupDat = &renderGroupArray[middle];
-		NSComparisonResult cmp = [groupID compare:groupDat->groupName];
-		if (cmp == NSOrderedAscending)
-			end = middle-1;
-		else if (cmp == NSOrderedDescending)
-			start = middle+1;
-		else {
-			group = groupDat;
-			break;
-		}
+	// the node is inserted into the culling tree before the next frame is rendered
+	entity->sceneProxy = XBVTREE_NULL_NODE;
+	entity->sceneProxyMoved = NO;
+	[self notifyNodeMoved:entity];
+}
+
+-(void)removeNode:(XNode*)entity
+{
+	int index = entity->sceneIndex;
+	if (index < 0 || index >= nodeCount || nodeArray[index] != entity) {
+		NSLog(@"[XScene removeNode:] error: Node not found.");
+#ifdef DEBUG
+		[NSException raise:@"[XScene removeNode:] error" format:@"Node not found"];
+#endif
+		return;
 	}
-	// if not found, add render group to list
-	if (group == nil) {
-		NSComparisonResult cmp = [groupID compare:renderGroupArray[middle].groupName];
-		assert(cmp != NSOrderedSame);
-		int insertBeforeIndex = 0;
-		if (cmp == NSOrderedAscending) {
-			// groupID < closest group - insert before
-			insertBeforeIndex = middle;
-		}
-		else {
-			// groupID > middle closest - insert after
-			insertBeforeIndex = middle+1;
-		}
-		if (renderGroupCount == 0)
-			insertBeforeIndex = 0;
-		// shift array to make space for insertion
-		++renderGroupCount;
-		if (renderGroupCount > renderGroupArraySize) {
-			// resize array
-			int newSize = renderGroupArraySize + (renderGroupArraySize/2) + 1;
-			XRenderGroup *newArray = malloc(sizeof(XRenderGroup) * newSize);
-			memcpy(newArray, renderGroupArray, renderGroupArraySize);
-			free(renderGroupArray);
-			renderGroupArray = newArray;
-			renderGroupArraySize = newSize;			
-		}
-		for (int i = renderGroupCount-1; i > insertBeforeIndex; --i) {
-			renderGroupArray[i] = renderGroupArray[i-1];
+	
+	// remove node from culling tree
+	if (entity->sceneProxy != XBVTREE_NULL_NODE) {
+		BoundingVolumeTree_remove(&cullingTree, entity->sceneProxy);
+		entity->sceneProxy = XBVTREE_NULL_NODE;
+	}
+	if (entity->sceneProxyMoved) {
+		for (int i = 0; i < movedNodeCount; ++i) {
+			if (movedNodeArray[i] == entity) {
+				movedNodeArray[i] = movedNodeArray[--movedNodeCount];
+				break;
+			}
 		}
-		// insert group
-		XRenderGroup newGroup;
-		newGroup.groupName = groupID;
-		[newGroup.groupName retain];
-		newGroup.nodes = [[NSMutableSet alloc] init];
-		renderGroupArray[insertBeforeIndex] = newGroup;
-		group = &newGroup;
+		entity->sceneProxyMoved = NO;
 	}
 	
-	NSMutableSet *groupNodes = group->nodes;
-	[groupNodes addObject:entity];
+	// remove node from list (the last node takes its place)
+	XNode *lastNode = nodeArray[--nodeCount];
+	nodeArray[index] = lastNode;
+	lastNode->sceneIndex = index;
+	entity->sceneIndex = -1;
+	[entity release];
 }
 
--(void)removeNode:(XNode*)entity
+-(void)notifyNodeMoved:(XNode*)entity
+{
+	if (entity->sceneProxyMoved)
+		return;
+	if (movedNodeCount >= movedNodeArraySize) {
+		movedNodeArraySize = movedNodeArraySize + (movedNodeArraySize/2) + 1;
+		movedNodeArray = realloc(movedNodeArray, sizeof(XNode*) * movedNodeArraySize);
+	}
+	movedNodeArray[movedNodeCount++] = entity;
+	entity->sceneProxyMoved = YES;
+}
+
+-(void)notifyNodeRenderGroupChanged:(XNode*)entity
+{
+	entity->sceneRenderGroupKey = [entity getRenderGroupKey];
+}
+
+-(void)updateCullingTree
 {
-	NSString *groupID = [entity getRenderGroupID];
-	assert(groupID);
+	// refit only nodes that moved or changed bounds since the last frame
+	for (int i = 0; i < movedNodeCount; ++i) {
+		XNode *node = movedNodeArray[i];
+		node->sceneProxyMoved = NO;
+		node->sceneBounds = XScene_nodeWorldBounds(node);
+		if (node->sceneProxy == XBVTREE_NULL_NODE)
+			node->sceneProxy = BoundingVolumeTree_insert(&cullingTree, &node->sceneBounds, node);
+		else
+			BoundingVolumeTree_move(&cullingTree, node->sceneProxy, &node->sceneBounds);
+	}
+	movedNodeCount = 0;
+}
+
+-(void)cullNodes
+{
+	[self updateCullingTree];
 	
-	// binary search for render group in list
-	int start = 0, end = renderGroupCount-1, middle = 0;
-	XRenderGroup *group = nil;
-	while (end >= start) {
-		middle = (start + end) / 2;
-		XRenderGroup *groupDat = &renderGroupArray[middle];
-		NSComparisonResult cmp = [groupID compare:groupDat->groupName];
-		if (cmp == NSOrderedAscending)
-			end = middle-1;
-		else if (cmp == NSOrderedDescending)
-			start = middle+1;
-		else {
-			group = groupDat;
-			break;
-		}
+#ifdef XSCENE_BENCHMARK
+	CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+#endif
+	
+	XSceneCullContext cull;
+	cull.cameraOrigin = camera->origin;
+	cull.depthScale = XRENDERKEY_DEPTH_MAX / fogRange;
+	cull.renderQueue = &renderQueue;
+	cull.pendingBounds = &pendingBounds;
+	cull.stats = &stats;
+	RenderQueue_clear(&renderQueue);
+	CullingBoundsArray_clear(&pendingBounds);
+	stats.treeNodesVisited += BoundingVolumeTree_queryFrustum(&cullingTree, [camera frustumPlanes], XScene_cullNode, &cull);
+	
+	// test all nodes intersecting the frustum boundary in one batch
+	[camera testBounds:&pendingBounds];
+	for (int i = 0; i < pendingBounds.count; ++i) {
+		if (CullingBoundsArray_isVisible(&pendingBounds, i))
+			XScene_queueNode((XNode*)pendingBounds.userData[i], &cull);
 	}
-	// remove node from group
-	if (group != nil) {
-		NSMutableSet *groupNodes = group->nodes;
-		[groupNodes removeObject:entity];
-		// remove group if empty
-		if (groupNodes.count == 0) {
-			assert(&renderGroupArray[middle] == group);
-			[group->nodes release];
-			[group->groupName release];
-			for (int i = middle; i < renderGroupCount-1; ++i) {
-				renderGroupArray[i] = renderGroupArray[i+1];
+	stats.nodesTested += pendingBounds.count;
+	stats.nodeCount += nodeCount;
+	++stats.frames;
+	
+#ifdef XSCENE_BENCHMARK
+	// time the old flat loop over every node for comparison (its results are discarded)
+	CFTimeInterval treeEndTime = CFAbsoluteTimeGetCurrent();
+	int flatVisible = 0;
+	for (int i = 0; i < nodeCount; ++i) {
+		XNode *node = nodeArray[i];
+		if (node.boundingRadius > FLOAT_EPSILON) {
+			if ([camera isVisibleSphere:(node.globalPosition) radius:(node.boundingRadius)]) {
+				if (node->useBoundingSphereOnly || [camera isVisibleBox:(&node->boundingBox) boxOffset:(node.globalPosition) boxRotation:(node.globalRotation)])
+					++flatVisible;
 			}
-			--renderGroupCount;
 		}
 	}
-	else {
-		NSLog(@"[XScene removeNode:] error: Node not found.");
-#ifdef DEBUG
-		[NSException raise:@"[XScene removeNode:] error" format:@"Node not found"];
+	CFTimeInterval flatEndTime = CFAbsoluteTimeGetCurrent();
+	stats.treeCullTime += treeEndTime - startTime;
+	stats.flatCullTime += flatEndTime - treeEndTime;
 #endif
-	}
+}
+
+-(void)resetStats
+{
+	memset(&stats, 0, sizeof(XSceneStats));
 }
 
 -(void)setCamera:(XCamera*)cam
@@ -233,51 +338,75 @@ const GLfloat lightDirection[] = {0.0, 0.707, -0.707, 0.0};
 	
 	glMultMatrixf(xMatrix4ToArray(&camera->viewMatrix));
 	
+	// set up lighting (the light direction is transformed by the view matrix, so this only needs to
+	// be done once per frame, before any model matrix is applied)
+	glLightfv(GL_LIGHT0, GL_POSITION, lightDirection);
+	XColor emission = xColor_Black;
+	xglSetMaterialEmission(&emission);
+	
+	// find visible nodes, and sort them into draw order
+	[self cullNodes];
+	RenderQueue_sort(&renderQueue);
+	
 	// render all objects, sorted by groups
 	XMatrix4 rotMatrix;
-	for (int i = 0; i < renderGroupCount; ++i) {
-		NSMutableSet *groupNodes = renderGroupArray[i].nodes;
-		// render all objects in group
-		XNode *lastNode = nil;
-		for (XNode *node in groupNodes) {
-			// check visibility
-			BOOL visible = NO;
-			if (node.boundingRadius > FLOAT_EPSILON) {
-				if ([camera isVisibleSphere:(node.globalPosition) radius:(node.boundingRadius)]) {
-					if (node->useBoundingSphereOnly)
-						visible = YES;
-					else if ([camera isVisibleBox:(&node->boundingBox) boxOffset:(node.globalPosition) boxRotation:(node.globalRotation)])
-						visible = YES;
+	int i = 0;
+	while (i < renderQueue.count) {
+		// find the run of nodes in this render group
+		XRenderSortKey groupKey = renderQueue.entries[i].key & XRENDERKEY_GROUP_MASK;
+		int groupEnd = i + 1;
+		while (groupEnd < renderQueue.count && (renderQueue.entries[groupEnd].key & XRENDERKEY_GROUP_MASK) == groupKey)
+			++groupEnd;
+		int groupSize = groupEnd - i;
+		if (groupSize > batchNodeArraySize) {
+			batchNodeArraySize = groupSize + (groupSize/2) + 1;
+			batchNodeArray = realloc(batchNodeArray, sizeof(XNode*) * batchNodeArraySize);
+		}
+		for (int j = 0; j < groupSize; ++j)
+			batchNodeArray[j] = (XNode*)renderQueue.entries[i + j].item;
+		
+		[batchNodeArray[0] beginRenderGroup];
+		
+		int groupIndex = 0;
+		while (groupIndex < groupSize) {
+			XNode *node = batchNodeArray[groupIndex];
+			
+			// render as many nodes as possible in one batch, already transformed to world space
+			if (groupSize - groupIndex >= 2) {
+				int batched = [node renderBatch:&batchNodeArray[groupIndex] count:(groupSize - groupIndex) buffer:&batchBuffer camera:camera];
+				if (batched >= 2) {
+					groupIndex += batched;
+					continue;
 				}
 			}
-			if (visible) {
-				glPushMatrix(); //save view matrix
-				
-				// set up lighting
-				glLightfv(GL_LIGHT0, GL_POSITION, lightDirection);
-				const float emission[] = {0, 0, 0};
-				glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emission);
-				
-				// load model matrix (global rotation * position) into GL_MODELVIEW
-				XVector3 *globalPosition = node.globalPosition;
-				glTranslatef(globalPosition->x, globalPosition->y, globalPosition->z);
-				xBuildMatrix4FromMatrix3(&rotMatrix, node.globalRotation);
-				glMultMatrixf(xMatrix4ToArray(&rotMatrix));
-				
-				// render object
-				if (lastNode == nil)
-					[node beginRenderGroup];
-				[node render:camera];
-				lastNode = node;
-				
-				glPopMatrix(); //restore view matrix
-			}
+			
+			glPushMatrix(); //save view matrix
+			
+			// load model matrix (global rotation * position) into GL_MODELVIEW
+			XVector3 *globalPosition = node.globalPosition;
+			glTranslatef(globalPosition->x, globalPosition->y, globalPosition->z);
+			xBuildMatrix4FromMatrix3(&rotMatrix, node.globalRotation);
+			glMultMatrixf(xMatrix4ToArray(&rotMatrix));
+			
+			// render object
+			[node render:camera];
+			
+			glPopMatrix(); //restore view matrix
+			++groupIndex;
 		}
 		
-		// finalize group render
-		[lastNode endRenderGroup];
+		[batchNodeArray[groupSize - 1] endRenderGroup];
+		i = groupEnd;
 	}
 	
+	stats.batches += batchBuffer.batchCount;
+	stats.batchedNodes += batchBuffer.batchedInstances;
+	stats.batchedVertexes += batchBuffer.transformedVertexes;
+#ifdef XSCENE_BENCHMARK
+	stats.batchTransformTime += batchBuffer.transformTime;
+#endif
+	MeshBatchBuffer_resetStats(&batchBuffer);
+	
 	// catch OpenGL errors
 #ifdef DEBUG
 	GLenum err = glGetError();
@@ -16,6 +16,7 @@
 @property(readonly) int subnodeCount;
 
 -(id)initWithFile:(NSString*)filename;
+-(id)initWithPath:(NSString*)sourcePath;
 -(id)initWithName:(NSString*)nodeName;
 -(void)dealloc;
 
@@ -40,6 +40,19 @@ typedef enum
 @synthesize values, subnodes, parentNode;
 
 -(id)initWithFile:(NSString*)filename
+{
+	NSString *directory = [filename stringByDeletingLastPathComponent];
+	NSString *fileN = [filename lastPathComponent];
+	NSString *sourcePath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
+	if (sourcePath == nil) {
+		NSLog(@"Error reading script file \"%@\": File not found", filename);
+		[self release];
+		return nil;
+	}
+	return [self initWithPath:sourcePath];
+}
+
+-(id)initWithPath:(NSString*)sourcePath
 {
 	if ((self = [super init])) {
 		// init as root node
@@ -51,16 +64,13 @@ typedef enum
 
 		// open file and read the contents into memory
 		NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
-		NSString *directory = [filename stringByDeletingLastPathComponent];
-		NSString *fileN = [filename lastPathComponent];
-		NSString *sourcePath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
 		FILE *file = fopen([sourcePath UTF8String], "rb");
 		if (file == NULL) {
 			[values release];
 			[subnodes release];
 			[name release];
 			[autoreleasePool release];
-			NSLog(@"Error reading script file \"%@\": File not found", filename);
+			NSLog(@"Error reading script file \"%@\": File not found", sourcePath);
 			return nil;
 		}
 		fseek(file, 0, SEEK_END);
@@ -53,28 +53,28 @@
 	[super dealloc];
 }
 
--(NSString*)getRenderGroupID
+-(XRenderSortKey)getRenderGroupKey
 {
-	return @"3_sky";
+	return xRenderGroupKey(XRenderPass_Sky, 0, 0, 0);
 }
 
 -(void)beginRenderGroup
 {
-	glDisable(GL_LIGHTING);
-	glDisableClientState(GL_NORMAL_ARRAY);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glActiveTexture(GL_TEXTURE0);
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-	glDisable(GL_FOG);
+	xglDisable(GL_LIGHTING);
+	xglDisableClientState(GL_NORMAL_ARRAY);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	xglActiveTexture(GL_TEXTURE0);
+    xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglDisable(GL_FOG);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 -(void)endRenderGroup
 {
-	glEnable(GL_LIGHTING);
-	glEnableClientState(GL_NORMAL_ARRAY);
-	glEnable(GL_FOG);
+	xglEnable(GL_LIGHTING);
+	xglEnableClientState(GL_NORMAL_ARRAY);
+	xglEnable(GL_FOG);
 	xglNotifyTextureBindingsChanged();
 	xglNotifyMeshBindingsChanged();
 }
@@ -160,9 +160,9 @@
 		if ([cam isVisibleBox:&aabb]) {
 			glBindTexture(GL_TEXTURE_2D, faceTex[i].glTexture);
 			glVertexPointer(3, GL_FLOAT, 0, &facePositions[i * (3*4)]);
-			glEnableClientState(GL_VERTEX_ARRAY);
+			xglEnableClientState(GL_VERTEX_ARRAY);
 			glTexCoordPointer(2, GL_BYTE, 0, &faceTexcoords[i * (2*4)]);
-			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+			xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		}
 	}
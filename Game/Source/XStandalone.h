@@ -0,0 +1,28 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// Stands in for the app's prefix header (which brings in Foundation) when plain C engine modules such
+// as XMath, XFrustumCulling, XParticleKernel and XTreePlacement are built outside the app, by the
+// command line benchmarks. Pass it to the compiler with "-include Game/Source/XStandalone.h".
+// Only what those modules use from Foundation is defined here.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef __OBJC__
+typedef signed char BOOL;
+#define YES ((BOOL)1)
+#define NO ((BOOL)0)
+#define nil NULL
+#endif
+
+#ifndef ABS
+#define ABS(a) ((a) < 0 ? -(a) : (a))
+#endif
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
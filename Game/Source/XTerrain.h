@@ -2,13 +2,11 @@
 
 #import "XNode.h"
 #import "XGL.h"
+#import "XTerrainGeometry.h"
 @class XTerrainChunk;
 @class XTexture;
 @class XMediaGroup;
 
-#define TERRAIN_CHUNK_GRID_SIZE 8 //MUST be power-of-2 value
-#define TERRAIN_DETAIL_MAP_REPEATS_PER_CHUNK 8 //MUST be power-of-2 value
-
 typedef struct
 {
 	unsigned int glBuffer;
@@ -32,6 +30,8 @@ typedef struct
 	_TerrainIndexBuffer indexBuffers[16];
 	unsigned char *shadowMap;
 	int shadowMapRes;
+	id dataOwner;
+	BOOL shadowMapPrepared;
 @public
 	int indexBufferCount;
 	XScalar lodRange, skirtHeight;
@@ -46,10 +46,15 @@ typedef struct
 
 -(id)initWithHeightmap:(NSString*)heightmapFile skirtSize:(float)skirtSize;
 -(id)initWithSize:(int)terrainResolution skirtSize:(float)skirtSize;
+-(id)initWithTerrainData:(const XTerrainData*)data owner:(id)owner;
 -(void)dealloc;
 
 -(void)loadHeightDataFromImage:(CGImageRef)heightmapImage;
 
+// these only decode images (no GL calls), so they are safe to use from any thread
++(float*)newHeightDataFromFile:(NSString*)heightmapFile resolution:(int*)outRes;
++(unsigned char*)newShadowMapFromFile:(NSString*)textureMapFile maxResolution:(int)maxRes resolution:(int*)outRes;
+
 -(void)setTextureMap:(NSString*)file usingMedia:(XMediaGroup*)media;
 -(void)setDetailMap:(NSString*)file usingMedia:(XMediaGroup*)media;
 
@@ -68,6 +73,7 @@ typedef struct
 -(void)dealloc;
 
 -(void)loadHeightMesh:(float*)heightArray arrayWidth:(int)arrayWidth heightRegion:(XIntRect)region;
+-(void)loadVertexes:(const XTerrainVertex*)vertexes;
 -(void)unloadHeightMesh;
 
 -(void)render:(int)lod;
@@ -12,6 +12,7 @@
 
 -(void)renderRegion:(XIntRect)region;
 
+-(void)loadChunkMeshes;
 -(void)buildIndexBuffers;
 -(void)destroyIndexBuffers;
 -(_TerrainIndexBuffer)getIndexBufferForLOD:(int)lod;
@@ -25,33 +26,16 @@
 
 -(id)initWithHeightmap:(NSString*)heightmapFile skirtSize:(float)skirtSize
 {
-	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
-	
-	NSString *directory = [heightmapFile stringByDeletingLastPathComponent];
-	NSString *fileN = [heightmapFile lastPathComponent];
-	NSString *sourcePath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
-	
-	UIImage *img = [[UIImage alloc] initWithContentsOfFile:sourcePath];
-	CGImageRef heightmapImage = img.CGImage;
-	if (!heightmapImage) {
-		NSLog(@"Error initializing terrain: Could not load heightmap image file.");
-		[img release];
-		[autoreleasePool release];
+	int res;
+	float *heights = [XTerrain newHeightDataFromFile:heightmapFile resolution:&res];
+	if (!heights)
 		return nil;
+	if ((self = [self initWithSize:res skirtSize:skirtSize])) {
+		heightData = heights;
+		[self loadChunkMeshes];
+	} else {
+		free(heights);
 	}
-	size_t imageW = CGImageGetWidth(heightmapImage);
-	size_t imageH = CGImageGetHeight(heightmapImage);
-	if (imageW != imageH) {
-		NSLog(@"Error initializing terrain: Terrain heightmap must be square");
-		[img release];
-		[autoreleasePool release];
-		return nil;
-	}
-	if ((self = [self initWithSize:imageW skirtSize:skirtSize])) {
-		[self loadHeightDataFromImage:heightmapImage];
-	}
-	[img release];
-	[autoreleasePool release];
 	return self;
 }
 
@@ -76,13 +60,7 @@
 		[self notifyBoundsChanged];
 		
 		// calculate terrain-relative skirt height
-		XScalar width = boundingBox.max.x - boundingBox.min.x;
-		XScalar height = boundingBox.max.y - boundingBox.min.y;
-		XScalar depth = boundingBox.max.z - boundingBox.max.z;
-		XScalar size;
-		if (width > depth) size = width; else size = depth;
-		XScalar tileSize = (size / height) / terrainResolution;
-		skirtHeight = tileSize * skirtSize;
+		skirtHeight = TerrainGeometry_skirtHeight(terrainResolution, skirtSize);
 		
 		for (int y = 0; y < TERRAIN_CHUNK_GRID_SIZE; ++y) {
 			for (int x = 0; x < TERRAIN_CHUNK_GRID_SIZE; ++x) {
@@ -93,12 +71,34 @@
 	return self;
 }
 
+-(id)initWithTerrainData:(const XTerrainData*)data owner:(id)owner
+{
+	if ((self = [self initWithSize:data->terrainRes skirtSize:0])) {
+		// height and shadow data are used in place, and kept alive by retaining their owner
+		dataOwner = [owner retain];
+		skirtHeight = data->skirtHeight;
+		heightData = (float*)data->heights;
+		shadowMap = (unsigned char*)data->shadowMap;
+		shadowMapRes = data->shadowMapRes;
+		shadowMapPrepared = (shadowMap != NULL);
+		
+		for (int y = 0; y < TERRAIN_CHUNK_GRID_SIZE; ++y) {
+			for (int x = 0; x < TERRAIN_CHUNK_GRID_SIZE; ++x) {
+				const XTerrainVertex *vertexes = data->chunkVertexes + (y * TERRAIN_CHUNK_GRID_SIZE + x) * TerrainGeometry_chunkVertexCount(chunkTileRes);
+				[chunkGrid[x][y] loadVertexes:vertexes];
+			}
+		}
+	}
+	return self;
+}
+
 -(void)dealloc
 {
-	if (heightData)
+	if (heightData && !dataOwner)
 		free(heightData);
-	if (shadowMap)
+	if (shadowMap && !shadowMapPrepared)
 		free(shadowMap);
+	[dataOwner release];
 	for (int y = 0; y < TERRAIN_CHUNK_GRID_SIZE; ++y) {
 		for (int x = 0; x < TERRAIN_CHUNK_GRID_SIZE; ++x) {
 			[chunkGrid[x][y] release];
@@ -110,10 +110,100 @@
 	[super dealloc];
 }
 
+// draws an image into an 8-bit grayscale buffer of the given size (which must be freed by the caller)
+unsigned char *_decodeGrayscaleImage(CGImageRef image, int width, int height)
+{
+	unsigned char *data = (unsigned char*)malloc(width * height * sizeof(unsigned char));
+	CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceGray();
+	CGContextRef imageContext = CGBitmapContextCreate(data, width, height, 8, width * sizeof(char), colorSpace, kCGImageAlphaNone);
+	CGColorSpaceRelease(colorSpace);
+	if (imageContext == NULL) {
+		free(data);
+		return NULL;
+	}
+	CGContextDrawImage(imageContext, CGRectMake(0.0, 0.0, (CGFloat)width, (CGFloat)height), image);
+	CGContextRelease(imageContext);
+	return data;
+}
+
++(float*)newHeightDataFromFile:(NSString*)heightmapFile resolution:(int*)outRes
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+	
+	NSString *directory = [heightmapFile stringByDeletingLastPathComponent];
+	NSString *fileN = [heightmapFile lastPathComponent];
+	NSString *sourcePath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
+	
+	UIImage *img = [[UIImage alloc] initWithContentsOfFile:sourcePath];
+	CGImageRef heightmapImage = img.CGImage;
+	if (!heightmapImage) {
+		NSLog(@"Error initializing terrain: Could not load heightmap image file.");
+		[img release];
+		[autoreleasePool release];
+		return NULL;
+	}
+	size_t imageW = CGImageGetWidth(heightmapImage);
+	size_t imageH = CGImageGetHeight(heightmapImage);
+	if (imageW != imageH) {
+		NSLog(@"Error initializing terrain: Terrain heightmap must be square");
+		[img release];
+		[autoreleasePool release];
+		return NULL;
+	}
+	
+	float *heights = NULL;
+	unsigned char *imageData = _decodeGrayscaleImage(heightmapImage, imageW, imageH);
+	if (imageData) {
+		heights = (float*)malloc(imageW * imageH * sizeof(float));
+		for (int i = 0; i < imageW * imageH; ++i)
+			heights[i] = ((float)imageData[i] / 255.0f);
+		free(imageData);
+		*outRes = imageW;
+	} else {
+		NSLog(@"Error initializing terrain: Could not decode heightmap image");
+	}
+	
+	[img release];
+	[autoreleasePool release];
+	return heights;
+}
+
++(unsigned char*)newShadowMapFromFile:(NSString*)textureMapFile maxResolution:(int)maxRes resolution:(int*)outRes
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+	
+	NSString *directory = [textureMapFile stringByDeletingLastPathComponent];
+	NSString *fileN = [textureMapFile lastPathComponent];
+	NSString *sourcePath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
+	
+	unsigned char *data = NULL;
+	UIImage *img = [[UIImage alloc] initWithContentsOfFile:sourcePath];
+	CGImageRef shadowmapImage = img.CGImage;
+	if (shadowmapImage) {
+		size_t imageW = CGImageGetWidth(shadowmapImage);
+		size_t imageH = CGImageGetHeight(shadowmapImage);
+		assert(imageW == imageH);
+		int res = imageW;
+		if (maxRes < res)
+			res = maxRes;
+		data = _decodeGrayscaleImage(shadowmapImage, res, res);
+		if (data)
+			*outRes = res;
+		else
+			NSLog(@"Error loading image: Could not load terrain texture image for shadowmap generation");
+	} else {
+		NSLog(@"File not found: Could not load terrain texture image for shadowmap generation");
+	}
+	
+	[img release];
+	[autoreleasePool release];
+	return data;
+}
+
 -(void)loadHeightDataFromImage:(CGImageRef)heightmapImage
 {
 	// load height data
-	if (heightData)
+	if (heightData && !dataOwner)
 		free(heightData);
 	heightData = (float*)malloc(terrainRes * terrainRes * sizeof(float));
 	
@@ -122,27 +212,27 @@
 		size_t imageH = CGImageGetHeight(heightmapImage);
 		assert(imageW == terrainRes && imageH == terrainRes);
 		
-		GLubyte *textureData = (GLubyte*)malloc(imageW * imageH * sizeof(GLubyte));
-		CGContextRef imageContext = CGBitmapContextCreate(textureData, imageW, imageH, 8, imageW * sizeof(char), CGColorSpaceCreateDeviceGray(), kCGImageAlphaNone);	
-		
-		if (imageContext != NULL) {
-			CGContextDrawImage(imageContext, CGRectMake(0.0, 0.0, (CGFloat)imageW, (CGFloat)imageH), heightmapImage);
-			CGContextRelease(imageContext);
+		unsigned char *textureData = _decodeGrayscaleImage(heightmapImage, imageW, imageH);
+		if (textureData != NULL) {
 			for (int y = 0; y < imageH; ++y) {
 				for (int x = 0; x < imageW; ++x) {
 					float val = ((float)textureData[y*imageW+x] / 255.0f);
 					heightData[y*terrainRes + x] = val;
 				}
 			}
+			free(textureData);
 		} else {
 			[NSException raise:@"Error loading image" format:@"Could not load heightmap image"];
 		}
-		free(textureData);
 	} else {
 		[NSException raise:@"File not found" format:@"Could not find heightmap image file"];
 	}
 	
-	// load into chunk meshes
+	[self loadChunkMeshes];
+}
+
+-(void)loadChunkMeshes
+{
 	for (int y = 0; y < TERRAIN_CHUNK_GRID_SIZE; ++y) {
 		for (int x = 0; x < TERRAIN_CHUNK_GRID_SIZE; ++x) {
 			XTerrainChunk *chunk = chunkGrid[x][y];
@@ -273,39 +363,20 @@
 		// load texture
 		textureMap = [XTexture mediaRetainFile:file usingMedia:media];
 		
-		// load shadow map
-		NSString *directory = [file stringByDeletingLastPathComponent];
-		NSString *fileN = [file lastPathComponent];
-		NSString *sourcePath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
-		UIImage *img = [[UIImage alloc] initWithContentsOfFile:sourcePath];
-		CGImageRef shadowmapImage = img.CGImage;
-		if (shadowmapImage) {
-			size_t imageW = CGImageGetWidth(shadowmapImage);
-			size_t imageH = CGImageGetHeight(shadowmapImage);
-			assert(imageW == imageH);
-			shadowMapRes = imageW;
-			if (terrainRes < shadowMapRes)
-				shadowMapRes = terrainRes;
+		// load shadow map (unless it was already prepared with the height data)
+		if (!shadowMapPrepared) {
 			if (shadowMap)
 				free(shadowMap);
-			shadowMap = malloc(shadowMapRes * shadowMapRes * sizeof(unsigned char));
-		
-			CGContextRef imageContext = CGBitmapContextCreate(shadowMap, shadowMapRes, shadowMapRes, 8, shadowMapRes * sizeof(char), CGColorSpaceCreateDeviceGray(), kCGImageAlphaNone);	
-			
-			if (imageContext != NULL) {
-				CGContextDrawImage(imageContext, CGRectMake(0.0, 0.0, (CGFloat)shadowMapRes, (CGFloat)shadowMapRes), shadowmapImage);
-				CGContextRelease(imageContext);
-			} else {
-				[NSException raise:@"Error loading image" format:@"Could not load terrain texture image for shadowmap generation"];
-			}
-		} else {
-			[NSException raise:@"File not found" format:@"Could not load terrain texture image for shadowmap generation"];
+			shadowMap = [XTerrain newShadowMapFromFile:file maxResolution:terrainRes resolution:&shadowMapRes];
+			if (!shadowMap)
+				shadowMapRes = 0;
 		}
-		[img release];
 	} else {
 		textureMap = nil;
-		if (shadowMap)
+		if (shadowMap && !shadowMapPrepared)
 			free(shadowMap);
+		shadowMap = NULL;
+		shadowMapPrepared = NO;
 		shadowMapRes = 0;
 	}
 }
@@ -319,31 +390,31 @@
 		detailMap = nil;
 }
 
--(NSString*)getRenderGroupID
+-(XRenderSortKey)getRenderGroupKey
 {
-	return @"2_terrain";
+	return xRenderGroupKey(XRenderPass_Terrain, 0, 0, 0);
 }
 
 -(void)beginRenderGroup
 {
-	glDisable(GL_LIGHTING);
-	glDisableClientState(GL_NORMAL_ARRAY);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glClientActiveTexture(GL_TEXTURE0);
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-	glClientActiveTexture(GL_TEXTURE1);
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglDisable(GL_LIGHTING);
+	xglDisableClientState(GL_NORMAL_ARRAY);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	xglClientActiveTexture(GL_TEXTURE0);
+    xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglClientActiveTexture(GL_TEXTURE1);
+    xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
 	if (textureMap) {
-		glActiveTexture(GL_TEXTURE0);
+		xglActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, textureMap.glTexture);
-		glEnable(GL_TEXTURE_2D);
+		xglEnable(GL_TEXTURE_2D);
 	}
 
 	if (detailMap) {
-		glActiveTexture(GL_TEXTURE1);
+		xglActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, detailMap.glTexture);
-		glEnable(GL_TEXTURE_2D);
+		xglEnable(GL_TEXTURE_2D);
 	}
 	
 	xglSetMaterial(&material);
@@ -351,21 +422,21 @@
 
 -(void)endRenderGroup
 {
-	glEnable(GL_LIGHTING);
-	glEnableClientState(GL_NORMAL_ARRAY);
-	glDisableClientState(GL_VERTEX_ARRAY);
-	glClientActiveTexture(GL_TEXTURE1);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	glClientActiveTexture(GL_TEXTURE0);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglEnable(GL_LIGHTING);
+	xglEnableClientState(GL_NORMAL_ARRAY);
+	xglDisableClientState(GL_VERTEX_ARRAY);
+	xglClientActiveTexture(GL_TEXTURE1);
+    xglDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglClientActiveTexture(GL_TEXTURE0);
+    xglDisableClientState(GL_TEXTURE_COORD_ARRAY);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	if (textureMap) {
-		glActiveTexture(GL_TEXTURE0);
+		xglActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 	if (detailMap) {
-		glActiveTexture(GL_TEXTURE1);
+		xglActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 	xglNotifyTextureBindingsChanged();
@@ -620,89 +691,24 @@
 	[super dealloc];
 }
 
-typedef struct {
-	GLfloat position[3];
-	GLfloat uv[2], uvB[2];
-} VertexStruct;
-
 -(void)loadHeightMesh:(float*)heightArray arrayWidth:(int)arrayWidth heightRegion:(XIntRect)region
+{
+	int vertexCount = TerrainGeometry_chunkVertexCount(terrain.chunkTileRes);
+	XTerrainVertex *vertexes = (XTerrainVertex*)malloc(vertexCount * sizeof(XTerrainVertex));
+	TerrainGeometry_buildChunkVertexes(vertexes, heightArray, arrayWidth, region, terrain.chunkTileRes, terrain.skirtHeight);
+	[self loadVertexes:vertexes];
+	free(vertexes);
+}
+
+-(void)loadVertexes:(const XTerrainVertex*)vertexes
 {
 	[self unloadHeightMesh];
 	
-	int chunkTileRes = terrain.chunkTileRes;
-	int vertexCount = ((chunkTileRes+1)*(chunkTileRes+1) + (chunkTileRes+1)*4);
-	VertexStruct *vertexes = (VertexStruct*)malloc(vertexCount * sizeof(VertexStruct));
-	
-	assert((region.right - region.left) == chunkTileRes);
-	GLfloat uvStep = 1.0f / (arrayWidth-1);
-	GLfloat uvStepB = (float)TERRAIN_DETAIL_MAP_REPEATS_PER_CHUNK / terrain.chunkTileRes;
-	
-	//Main grid
-	VertexStruct *ptr = vertexes;
-	int yB = 0;
-	for (int y = region.top; y <= region.bottom; ++y) {
-		int xB = 0;
-		for (int x = region.left; x <= region.right; ++x) {
-			GLfloat height = heightArray[y*arrayWidth + x];
-			VertexStruct vertex;
-			vertex.uv[0] = uvStep * x;
-			vertex.uv[1] = uvStep * y;
-			vertex.uvB[0] = uvStepB * xB;
-			vertex.uvB[1] = uvStepB * yB;
-			vertex.position[0] = vertex.uv[0];
-			vertex.position[1] = height;
-			vertex.position[2] = vertex.uv[1];
-			*ptr++ = vertex;
-			++xB;
-		}
-		++yB;
-	}
-	//Top/bottom skirt
-	XScalar skirtHeight = terrain.skirtHeight;
-	yB = 0;
-	for (int y = region.top; y <= region.bottom; y+=chunkTileRes) {
-		int xB = 0;
-		for (int x = region.left; x <= region.right; ++x) {
-			GLfloat height = heightArray[y*arrayWidth + x];
-			VertexStruct vertex;
-			vertex.uv[0] = uvStep * x;
-			vertex.uv[1] = uvStep * y;
-			vertex.uvB[0] = uvStepB * xB;
-			vertex.uvB[1] = uvStepB * yB;
-			vertex.position[0] = vertex.uv[0];
-			vertex.position[1] = height-skirtHeight;
-			vertex.position[2] = vertex.uv[1];
-			*ptr++ = vertex;
-			++xB;
-		}
-		++yB;
-	}
-	//Left/right skirt
-	yB = 0;
-	for (int x = region.left; x <= region.right; x+=chunkTileRes) {
-		int xB = 0;
-		for (int y = region.top; y <= region.bottom; ++y) {
-			GLfloat height = heightArray[y*arrayWidth + x];
-			VertexStruct vertex;
-			vertex.uv[0] = uvStep * x;
-			vertex.uv[1] = uvStep * y;
-			vertex.uvB[0] = uvStepB * xB;
-			vertex.uvB[1] = uvStepB * yB;
-			vertex.position[0] = vertex.uv[0];
-			vertex.position[1] = height-skirtHeight;
-			vertex.position[2] = vertex.uv[1];
-			*ptr++ = vertex;
-			++xB;
-		}
-		++yB;
-	}
-	
+	int vertexCount = TerrainGeometry_chunkVertexCount(terrain.chunkTileRes);
 	glGenBuffers(1, &vertexBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(VertexStruct), vertexes, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(XTerrainVertex), vertexes, GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	
-	free(vertexes);
 }
 
 -(void)unloadHeightMesh
@@ -718,11 +724,11 @@ typedef struct {
 	_TerrainIndexBuffer indexBuff = [terrain getIndexBufferForLOD:lod];
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuff.glBuffer);	
 	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-	glVertexPointer(3, GL_FLOAT, sizeof(VertexStruct), (void*)offsetof(VertexStruct,position));
-	glClientActiveTexture(GL_TEXTURE0);
-	glTexCoordPointer(2, GL_FLOAT, sizeof(VertexStruct), (void*)offsetof(VertexStruct,uv));
-	glClientActiveTexture(GL_TEXTURE1);
-	glTexCoordPointer(2, GL_FLOAT, sizeof(VertexStruct), (void*)offsetof(VertexStruct,uvB));
+	glVertexPointer(3, GL_FLOAT, sizeof(XTerrainVertex), (void*)offsetof(XTerrainVertex,position));
+	xglClientActiveTexture(GL_TEXTURE0);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(XTerrainVertex), (void*)offsetof(XTerrainVertex,uv));
+	xglClientActiveTexture(GL_TEXTURE1);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(XTerrainVertex), (void*)offsetof(XTerrainVertex,uvB));
 	glDrawElements(GL_TRIANGLES, indexBuff.count, GL_UNSIGNED_SHORT, (void*)0);
 }
 
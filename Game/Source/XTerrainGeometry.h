@@ -0,0 +1,36 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMath.h"
+
+// terrain chunk geometry generation, kept free of GL dependencies so that MapPacker
+// can pre-build chunk vertex data offline with exactly the same layout used at runtime
+
+#define TERRAIN_CHUNK_GRID_SIZE 8 //MUST be power-of-2 value
+#define TERRAIN_DETAIL_MAP_REPEATS_PER_CHUNK 8 //MUST be power-of-2 value
+
+
+typedef struct {
+	float position[3];
+	float uv[2], uvB[2];
+} XTerrainVertex;
+
+// CPU-side terrain data, either mapped from a map bundle or prepared off the render thread (see GMapLoader)
+typedef struct {
+	int terrainRes;
+	float skirtHeight;
+	const float *heights;					// terrainRes x terrainRes, normalized [0,1]
+	const unsigned char *shadowMap;			// shadowMapRes x shadowMapRes (may be NULL)
+	int shadowMapRes;
+	const XTerrainVertex *chunkVertexes;	// TERRAIN_CHUNK_GRID_SIZE^2 chunks, row-major
+} XTerrainData;
+
+
+// number of vertexes in one chunk (main grid plus the four skirts)
+int TerrainGeometry_chunkVertexCount(int chunkTileRes);
+
+// skirt height (in normalized terrain units) for the given terrain resolution
+float TerrainGeometry_skirtHeight(int terrainRes, float skirtSize);
+
+// fills "vertexes" with TerrainGeometry_chunkVertexCount(chunkTileRes) vertexes for the given height region
+void TerrainGeometry_buildChunkVertexes(XTerrainVertex *vertexes, const float *heightArray, int arrayWidth, XIntRect region, int chunkTileRes, float skirtHeight);
+
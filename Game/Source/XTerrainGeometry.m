@@ -0,0 +1,85 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XTerrainGeometry.h"
+
+
+int TerrainGeometry_chunkVertexCount(int chunkTileRes)
+{
+	return ((chunkTileRes+1)*(chunkTileRes+1) + (chunkTileRes+1)*4);
+}
+
+float TerrainGeometry_skirtHeight(int terrainRes, float skirtSize)
+{
+	// terrains are always initialized with 1000x50x1000 bounds, so the skirt is relative to that
+	XScalar size = 1000.0f;
+	XScalar height = 50.0f;
+	XScalar tileSize = (size / height) / terrainRes;
+	return tileSize * skirtSize;
+}
+
+void TerrainGeometry_buildChunkVertexes(XTerrainVertex *vertexes, const float *heightArray, int arrayWidth, XIntRect region, int chunkTileRes, float skirtHeight)
+{
+	assert((region.right - region.left) == chunkTileRes);
+	float uvStep = 1.0f / (arrayWidth-1);
+	float uvStepB = (float)TERRAIN_DETAIL_MAP_REPEATS_PER_CHUNK / chunkTileRes;
+	
+	//Main grid
+	XTerrainVertex *ptr = vertexes;
+	int yB = 0;
+	for (int y = region.top; y <= region.bottom; ++y) {
+		int xB = 0;
+		for (int x = region.left; x <= region.right; ++x) {
+			float height = heightArray[y*arrayWidth + x];
+			XTerrainVertex vertex;
+			vertex.uv[0] = uvStep * x;
+			vertex.uv[1] = uvStep * y;
+			vertex.uvB[0] = uvStepB * xB;
+			vertex.uvB[1] = uvStepB * yB;
+			vertex.position[0] = vertex.uv[0];
+			vertex.position[1] = height;
+			vertex.position[2] = vertex.uv[1];
+			*ptr++ = vertex;
+			++xB;
+		}
+		++yB;
+	}
+	//Top/bottom skirt
+	yB = 0;
+	for (int y = region.top; y <= region.bottom; y+=chunkTileRes) {
+		int xB = 0;
+		for (int x = region.left; x <= region.right; ++x) {
+			float height = heightArray[y*arrayWidth + x];
+			XTerrainVertex vertex;
+			vertex.uv[0] = uvStep * x;
+			vertex.uv[1] = uvStep * y;
+			vertex.uvB[0] = uvStepB * xB;
+			vertex.uvB[1] = uvStepB * yB;
+			vertex.position[0] = vertex.uv[0];
+			vertex.position[1] = height-skirtHeight;
+			vertex.position[2] = vertex.uv[1];
+			*ptr++ = vertex;
+			++xB;
+		}
+		++yB;
+	}
+	//Left/right skirt
+	yB = 0;
+	for (int x = region.left; x <= region.right; x+=chunkTileRes) {
+		int xB = 0;
+		for (int y = region.top; y <= region.bottom; ++y) {
+			float height = heightArray[y*arrayWidth + x];
+			XTerrainVertex vertex;
+			vertex.uv[0] = uvStep * x;
+			vertex.uv[1] = uvStep * y;
+			vertex.uvB[0] = uvStepB * xB;
+			vertex.uvB[1] = uvStepB * yB;
+			vertex.position[0] = vertex.uv[0];
+			vertex.position[1] = height-skirtHeight;
+			vertex.position[2] = vertex.uv[1];
+			*ptr++ = vertex;
+			++xB;
+		}
+		++yB;
+	}
+}
+
@@ -33,9 +33,18 @@ typedef enum {
 // transparent areas), and also premultiplies when loading an image if it's not already
 // premultiplied. This is not desirable for 3D games, etc., so XTexture has it's own internal
 // TGA (and PVR) loading code that bypasses the SDK's premultiplications.
+//
+// Textures cooked offline by TextureCooker (".xtex", see XCookedTexture.h) are preferred over the
+// source images, since they carry ready made mips in their final pixel format.
+//
+// Textures listed in one of the media group's atlases (see -[XMediaGroup addTextureAtlas:]) don't load
+// their own file; they share the atlas' GL texture and cover only "region" of it, which X2D takes into
+// account when drawing. Anything else using glTexture directly should check the region.
 @interface XTexture : XResource {
 	unsigned int glTexture;
 	size_t __width, __height;
+	XTexture *atlas;
+	XScalarRect region;
 	XTextureColorFormat colorFormat;
 	XTextureByteFormat byteFormat;
 	NSMutableArray *imageMipFrames;
@@ -44,6 +53,7 @@ typedef enum {
 
 @property(readonly) unsigned int glTexture;
 @property(readonly) size_t width, height;
+@property(readonly) XScalarRect region; //UVs covered by this texture; 0,0,1,1 unless packed into an atlas
 
 -(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media;
 -(void)dealloc;
@@ -1,7 +1,10 @@
 // Copyright © 2010 John Judnich. All rights reserved.
 
 #import "XTexture.h"
+#import "XTextureNomip.h"
 #import "XGL.h"
+#import "XTextureDecoder.h"
+#import "XCookedTexture.h"
 #import <QuartzCore/QuartzCore.h>
 
 
@@ -15,11 +18,13 @@
 	int level;
 @private
 	size_t maxByteCount;
+	NSData *sourceData;
 }
 
 @property size_t maxByteCount;
 
 -(id)initWithByteCapacity:(size_t)dataSize;
+-(id)initWithBytesNoCopy:(unsigned char*)bytes count:(size_t)count ofData:(NSData*)data; //(retains data)
 -(void)dealloc;
 
 @end
@@ -39,9 +44,23 @@
 	return self;
 }
 
+-(id)initWithBytesNoCopy:(unsigned char*)bytes count:(size_t)count ofData:(NSData*)data
+{
+	if ((self = [super init])) {
+		width = 0; height = 0; level = 0;
+		byteData = bytes;
+		byteCount = count;
+		sourceData = [data retain];
+	}
+	return self;
+}
+
 -(void)dealloc
 {
-	free(byteData);
+	if (sourceData)
+		[sourceData release];
+	else
+		free(byteData);
 	[super dealloc];
 }
 
@@ -52,22 +71,89 @@
 
 -(void)loadMipFramesFromFile:(NSString*)filename;
 -(void)configureGLTextureParameters;
+-(BOOL)generatesMipmaps;
 
 @end
 
 
+static BOOL compressionSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+		supported = (xCheckExtensionSupported("GL_IMG_texture_compression_pvrtc") != 0);
+	return (supported == 1);
+}
+
+NSString *loadMipFrames(NSString *filename, NSMutableArray *imageMipFrames);
+
+
 @implementation XTexture
 
-@synthesize glTexture, width = __width, height = __height;
+@synthesize glTexture, width = __width, height = __height, region;
+
++(void)prepareForAsyncLoading
+{
+	// (checked here since worker threads have no GL context)
+	compressionSupported();
+}
+
++(id)newPreparedDataForFile:(NSString*)filename usingMedia:(XMediaGroup*)media
+{
+	// atlas textures have nothing to load
+	if ([media atlasImageForFile:filename region:NULL])
+		return nil;
+	
+	// returns the loaded mip frames, or the error message if loading failed
+	NSMutableArray *frames = [[NSMutableArray alloc] init];
+	NSString *error = loadMipFrames(filename, frames);
+	if (error) {
+		[frames release];
+		return [error copy];
+	}
+	return frames;
+}
 
 -(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media
+{
+	return [self initWithFile:filename usingMedia:media preparedData:nil];
+}
+
+-(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media preparedData:(id)data
 {
 	if ((self = [super initWithFile:filename usingMedia:media])) {
+		// if this texture was packed into an atlas, just share the atlas' texture
+		region.left = 0; region.top = 0;
+		region.right = 1; region.bottom = 1;
+		NSString *atlasImage = [media atlasImageForFile:filename region:&region];
+		memoryType = XResourceMemory_Texture;
+		if (atlasImage) {
+			// (the atlas accounts for the memory)
+			atlas = [XTextureNomip mediaRetainFile:atlasImage usingMedia:media];
+			if (atlas) {
+				glTexture = atlas->glTexture;
+				colorFormat = atlas->colorFormat;
+				byteFormat = atlas->byteFormat;
+				__width = (size_t)((region.right - region.left) * atlas->__width + 0.5f);
+				__height = (size_t)((region.bottom - region.top) * atlas->__height + 0.5f);
+				return self;
+			}
+			NSLog(@"Warning: Could not load atlas \"%@\" for image \"%@\"; loading the image by itself.", atlasImage, filename);
+			region.left = 0; region.top = 0;
+			region.right = 1; region.bottom = 1;
+		}
+		
 		NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
 		
-		// load image data into imageMipFrames array
-		imageMipFrames = [[NSMutableArray alloc] init];
-		[self loadMipFramesFromFile:filename];
+		// load image data into imageMipFrames array (unless it was already loaded by a worker thread)
+		if ([data isKindOfClass:[NSMutableArray class]]) {
+			imageMipFrames = [data retain];
+		} else {
+			imageMipFrames = [[NSMutableArray alloc] init];
+			if ([data isKindOfClass:[NSString class]])
+				errorMessage = data;
+			else
+				[self loadMipFramesFromFile:filename];
+		}
 		
 		// if sucessfully loaded..
 		if (imageMipFrames.count > 0) {
@@ -113,7 +199,10 @@
 								 mipFrame->width, mipFrame->height, 0,
 								 mipFrame->colorFormat, mipFrame->byteFormat, mipFrame->byteData);
 				}
+				memorySize += mipFrame->byteCount;
 			}
+			if ([self generatesMipmaps])
+				memorySize += memorySize / 3; // (the rest of the mip chain adds up to a third of the top level)
 			
 			glBindTexture(GL_TEXTURE_2D, 0);
 			xglNotifyTextureBindingsChanged();
@@ -144,6 +233,12 @@
 
 -(void)dealloc
 {
+	if (atlas) {
+		// (the GL texture belongs to the atlas)
+		[atlas mediaRelease];
+		atlas = nil;
+		glTexture = 0;
+	}
 	if (glTexture) {
 		glDeleteTextures(1, &glTexture);
 		glTexture = 0;
@@ -155,64 +250,141 @@
 {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	if (imageMipFrames.count == 1)
+	if ([self generatesMipmaps])
 		glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
 }
 
-NSString *loadCompressedPVR(NSString *filename, NSMutableArray *imageMipFrames);
+-(BOOL)generatesMipmaps
+{
+	// (GL builds the mips when only the top level was loaded)
+	return (imageMipFrames.count == 1);
+}
+
+NSString *loadCompressedPVR(NSString *filename, NSMutableArray *imageMipFrames, BOOL decode);
+NSString *loadCooked(NSString *filepath, NSMutableArray *imageMipFrames);
 NSString *loadUncompressed(NSString *filename, NSMutableArray *imageMipFrames);
 
 -(void)loadMipFramesFromFile:(NSString*)filename
+{
+	errorMessage = loadMipFrames(filename, imageMipFrames);
+}
+
+@end
+
+
+//------------------------------ Texture File Lookup -----------------------------------
+
+NSString *loadMipFrames(NSString *filename, NSMutableArray *imageMipFrames)
 {
 	// Try to load the .pvr version of this image by looking for "[filename].pvr" first.
 	// For example loading "image.png" would cause it to look for "image.png.pvr". If not found,
 	// it will revert to the original filename and load it using the uncompressed loader.
-	FILE *compressedFile = NULL;
-	NSString *compressedFilename = nil;
-	NSString *compressedFilepath = nil;
+	// Otherwise a cooked "[filename].xtex" (see XCookedTexture.h) is loaded as is, then the uncompressed
+	// image, and the .pvr is only decoded in software (see XTextureDecoder.h) when neither is shipped.
+	NSString *compressedFilename = filename;
+	NSString *extension = [filename pathExtension];
+	if (![extension isEqualToString:@"pvr"])
+		compressedFilename = [compressedFilename stringByAppendingPathExtension:@"pvr"];
+	
+	NSString *directory = [compressedFilename stringByDeletingLastPathComponent];
+	NSString *fileN = [compressedFilename lastPathComponent];
+	NSString *compressedFilepath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
 	
-	static int compressionSupported = -1;
-	if (compressionSupported)
-		compressionSupported = (xCheckExtensionSupported("GL_IMG_texture_compression_pvrtc") != 0);
+	BOOL compressedFound = NO;
+	FILE *compressedFile = fopen([compressedFilepath UTF8String], "rb");
+	if (compressedFile) {
+		fclose(compressedFile);
+		compressedFound = YES;
+	}
 	
-	if (compressionSupported == 1) {
-		compressedFilename = filename;
-		NSString *extension = [filename pathExtension];
-		if (![extension isEqualToString:@"pvr"])
-			compressedFilename = [compressedFilename stringByAppendingPathExtension:@"pvr"];
+	if (compressedFound && compressionSupported())
+		return loadCompressedPVR(compressedFilename, imageMipFrames, NO);
+	
+	directory = [filename stringByDeletingLastPathComponent];
+	fileN = [[filename lastPathComponent] stringByAppendingPathExtension:@"xtex"];
+	NSString *cookedFilepath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
+	if (cookedFilepath) {
+		NSString *errorMessage = loadCooked(cookedFilepath, imageMipFrames);
+		if (errorMessage == nil)
+			return nil;
+		NSLog(@"XTexture Warning! Ignoring cooked texture \"%@\": %@", cookedFilepath, errorMessage);
+	}
+	
+	fileN = [filename lastPathComponent];
+	NSString *uncompressedFilepath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
+	
+	FILE *uncompressedFile = fopen([uncompressedFilepath UTF8String], "rb");
+	if (uncompressedFile) {
+		fclose(uncompressedFile);
+		return loadUncompressed(filename, imageMipFrames);
+	}
+	else if (compressedFound) {
+		NSLog(@"XTexture Warning! PVRTC texture compression not supported. Decoding \"%@\" in software.", compressedFilename);
+		return loadCompressedPVR(compressedFilename, imageMipFrames, YES);
+	}
+	else {
+		return @"File not found.";
+	}
+}
+
 
-		NSString *directory = [compressedFilename stringByDeletingLastPathComponent];
-		NSString *fileN = [compressedFilename lastPathComponent];
-		compressedFilepath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
+//------------------------------ Cooked Texture Loader Implementation -----------------------------------
 
-		compressedFile = fopen([compressedFilepath UTF8String], "rb");
+NSString *loadCooked(NSString *filepath, NSMutableArray *imageMipFrames)
+{
+	// the whole file is read at once, and the mip frames point straight into it
+	NSData *fileData = [[NSData alloc] initWithContentsOfFile:filepath];
+	if ([fileData length] < sizeof(XCookedTextureHeader)) {
+		[fileData release];
+		return @"File does not appear to be a cooked texture.";
 	}
-	else {
-		NSLog(@"XTexture Warning! PVRTC texture compression not supported. Defaulting to uncompressed textures.");
+	const XCookedTextureHeader *header = (const XCookedTextureHeader*)[fileData bytes];
+	if (CFSwapInt32LittleToHost(header->magic) != XCOOKEDTEXTURE_MAGIC) {
+		[fileData release];
+		return @"File does not appear to be a cooked texture.";
+	}
+	if (CFSwapInt32LittleToHost(header->version) != XCOOKEDTEXTURE_VERSION) {
+		[fileData release];
+		return @"Cooked texture version mismatch (re-cook it with TextureCooker).";
 	}
 	
-	if (compressedFile) {
-		fclose(compressedFile);
-		errorMessage = loadCompressedPVR(compressedFilename, imageMipFrames);
+	uint32_t format = CFSwapInt32LittleToHost(header->format);
+	uint32_t levelCount = CFSwapInt32LittleToHost(header->levelCount);
+	if (format >= XCookedTextureFormat_Count || levelCount == 0 || levelCount > XCOOKEDTEXTURE_MAX_LEVELS) {
+		[fileData release];
+		return @"Invalid cooked texture header.";
 	}
-	else {
-		NSString *directory = [filename stringByDeletingLastPathComponent];
-		NSString *fileN = [filename lastPathComponent];
-		NSString *uncompressedFilepath = [[NSBundle mainBundle] pathForResource:fileN ofType:nil inDirectory:directory];
-
-		FILE *uncompressedFile = fopen([uncompressedFilepath UTF8String], "rb");
-		if (uncompressedFile) {
-			fclose(uncompressedFile);
-			errorMessage = loadUncompressed(filename, imageMipFrames);
-		}
-		else {
-			errorMessage = @"File not found.";
+	static const XTextureColorFormat colorFormats[XCookedTextureFormat_Count] = { XTexColorFormat_RGB, XTexColorFormat_RGBA, XTexColorFormat_RGBA };
+	static const XTextureByteFormat byteFormats[XCookedTextureFormat_Count] = { XTexByteFormat_RGB565, XTexByteFormat_RGBA4444, XTexByteFormat_FullBytes };
+	size_t bytesPerPixel = (format == XCookedTextureFormat_RGBA8888) ? 4 : 2;
+	
+	size_t width = CFSwapInt32LittleToHost(header->width);
+	size_t height = CFSwapInt32LittleToHost(header->height);
+	for (uint32_t i = 0; i < levelCount; ++i) {
+		uint32_t offset = CFSwapInt32LittleToHost(header->levels[i].offset);
+		uint32_t size = CFSwapInt32LittleToHost(header->levels[i].size);
+		if (size != width * height * bytesPerPixel || offset > [fileData length] || size > [fileData length] - offset) {
+			[imageMipFrames removeAllObjects];
+			[fileData release];
+			return @"Cooked texture data is truncated.";
 		}
+		XTextureMipFrame *mipFrame = [[XTextureMipFrame alloc] initWithBytesNoCopy:((unsigned char*)[fileData bytes] + offset) count:size ofData:fileData];
+		mipFrame->colorFormat = colorFormats[format];
+		mipFrame->byteFormat = byteFormats[format];
+		mipFrame->width = width;
+		mipFrame->height = height;
+		mipFrame->level = i;
+		[imageMipFrames addObject:mipFrame];
+		[mipFrame release];
+		
+		width = MAX(width >> 1, 1);
+		height = MAX(height >> 1, 1);
 	}
+	
+	[fileData release];
+	return nil;
 }
 
-@end
-
 
 //------------------------------ Uncompressed Image Loader Implementations -----------------------------------
 
@@ -499,15 +671,8 @@ NSString *loadCompressedTGA(FILE *file, NSMutableArray *imageMipFrames)
 
 //------------------------------ Compressed (PVR) Image Loader Implementation -----------------------------------
 
-#define PVR_TEXTURE_FLAG_TYPE_MASK 0xff
-
 static char gPVRTexIdentifier[4] = "PVR!";
 
-enum {
-	kPVRTextureFlagTypePVRTC_2 = 24,
-	kPVRTextureFlagTypePVRTC_4
-};
-
 typedef struct {
 	uint32_t headerLength;
 	uint32_t height;
@@ -524,7 +689,39 @@ typedef struct {
 	uint32_t numSurfs;
 } PVRTexHeader;
 
-NSString *loadCompressedPVR(NSString *filename, NSMutableArray *imageMipFrames)
+// decodes a compressed mip level to a new (retained) RGBA4444 mip frame, or RGB565 if *hasAlpha is 0;
+// *hasAlpha should start at -1, and is set from the first (top) level decoded
+static XTextureMipFrame *decodeCompressedMipFrame(XTextureDecoderFormat decoderFormat, const uint8_t *data, uint32_t width, uint32_t height, int *hasAlpha)
+{
+	XTextureMipFrame *mipFrame = [[XTextureMipFrame alloc] initWithByteCapacity:(width * height * 4)];
+	TextureDecoder_decode(decoderFormat, data, width, height, mipFrame->byteData);
+	
+	uint32_t pixelCount = width * height;
+	if (*hasAlpha < 0) {
+		*hasAlpha = 0;
+		for (uint32_t i = 0; i < pixelCount; ++i) {
+			if (mipFrame->byteData[i*4 + 3] != 255) {
+				*hasAlpha = 1;
+				break;
+			}
+		}
+	}
+	
+	for (uint32_t i = 0; i < pixelCount; ++i) {
+		uint8_t *RGBA = &mipFrame->byteData[i*4];
+		uint16_t *out = (uint16_t*)(&mipFrame->byteData[i*2]);
+		if (*hasAlpha)
+			*out = (RGBA[0]>>4) << 12 | (RGBA[1]>>4) << 8 | (RGBA[2]>>4) << 4 | (RGBA[3]>>4);
+		else
+			*out = (RGBA[0]>>3) << 11 | (RGBA[1]>>2) << 5 | (RGBA[2]>>3);
+	}
+	mipFrame->colorFormat = (*hasAlpha) ? XTexColorFormat_RGBA : XTexColorFormat_RGB;
+	mipFrame->byteFormat = (*hasAlpha) ? XTexByteFormat_RGBA4444 : XTexByteFormat_RGB565;
+	mipFrame->byteCount = pixelCount * 2;
+	return mipFrame;
+}
+
+NSString *loadCompressedPVR(NSString *filename, NSMutableArray *imageMipFrames, BOOL decode)
 {
 	NSString *directory = [filename stringByDeletingLastPathComponent];
 	NSString *fileN = [filename lastPathComponent];
@@ -533,14 +730,17 @@ NSString *loadCompressedPVR(NSString *filename, NSMutableArray *imageMipFrames)
 
 	BOOL success = FALSE;
 	PVRTexHeader *header = NULL;
-	uint32_t flags, pvrTag;
+	uint32_t pvrTag;
 	uint32_t dataLength = 0, dataOffset = 0, dataSize = 0;
-	uint32_t blockSize = 0, widthBlocks = 0, heightBlocks = 0;
-	uint32_t width = 0, height = 0, bpp = 4;
+	uint32_t width = 0, height = 0;
 	uint8_t *bytes = NULL;
-	uint32_t formatFlags;
+	XTextureDecoderFormat decoderFormat;
 	XTextureColorFormat format = XTexColorFormat_Null;
 	
+	if ([fileData length] < sizeof(PVRTexHeader)) {
+		[fileData release];
+		return @"File does not appear to be a PVR image.";
+	}
 	header = (PVRTexHeader*)[fileData bytes];
 	
 	pvrTag = CFSwapInt32LittleToHost(header->pvrTag);
@@ -552,60 +752,54 @@ NSString *loadCompressedPVR(NSString *filename, NSMutableArray *imageMipFrames)
 		return @"File does not appear to be a PVR image.";
 	}
 	
-	flags = CFSwapInt32LittleToHost(header->flags);
-	formatFlags = flags & PVR_TEXTURE_FLAG_TYPE_MASK;
+	decoderFormat = TextureDecoder_formatFromPVRFlags(CFSwapInt32LittleToHost(header->flags));
 	
-	if (formatFlags == kPVRTextureFlagTypePVRTC_4 || formatFlags == kPVRTextureFlagTypePVRTC_2) {
+	//if (CFSwapInt32LittleToHost(header->bitmaskAlpha)) {
+		if (decoderFormat == XTextureDecoderFormat_PVRTC_4BPP)
+			format = XTexColorFormat_RGBA_CompressedPVR_4BPP;
+		else if (decoderFormat == XTextureDecoderFormat_PVRTC_2BPP)
+			format = XTexColorFormat_RGBA_CompressedPVR_2BPP;
+	/*} else {
+		if (decoderFormat == XTextureDecoderFormat_PVRTC_4BPP)
+			format = XTexColorFormat_RGB_CompressedPVR_4BPP;
+		else if (decoderFormat == XTextureDecoderFormat_PVRTC_2BPP)
+			format = XTexColorFormat_RGB_CompressedPVR_2BPP;
+	}*/
+	
+	// (ETC1 can't be uploaded compressed under OpenGL ES 1.1, so it's always decoded)
+	if (decoderFormat == XTextureDecoderFormat_ETC1)
+		decode = YES;
+	
+	if (decoderFormat != XTextureDecoderFormat_Unknown) {
 		[imageMipFrames removeAllObjects];
 		
 		width = CFSwapInt32LittleToHost(header->width);
 		height = CFSwapInt32LittleToHost(header->height);
-				
+		
 		dataLength = CFSwapInt32LittleToHost(header->dataLength);
+		if (dataLength > [fileData length] - sizeof(PVRTexHeader))
+			dataLength = [fileData length] - sizeof(PVRTexHeader);
 		
 		bytes = ((uint8_t *)[fileData bytes]) + sizeof(PVRTexHeader);
 		
-		// calculate the data size for each texture level and respect the minimum number of blocks
+		// calculate the data size for each texture level (PVRTC levels are at least 2x2 blocks)
+		int hasAlpha = -1;
 		while (dataOffset < dataLength) {
-			if (formatFlags == kPVRTextureFlagTypePVRTC_4) {
-				blockSize = 4 * 4; //pixel by pixel block size for 4bpp
-				widthBlocks = width / 4;
-				heightBlocks = height / 4;
-				bpp = 4;
-			}
-			else {
-				blockSize = 8 * 4; //pixel by pixel block size for 2bpp
-				widthBlocks = width / 8;
-				heightBlocks = height / 4;
-				bpp = 2;
-			}
-			
-			// clamp to minimum number of blocks
-			if (widthBlocks < 2)
-				widthBlocks = 2;
-			if (heightBlocks < 2)
-				heightBlocks = 2;
-			
-			dataSize = widthBlocks * heightBlocks * ((blockSize  * bpp) / 8);
-			
-			//if (CFSwapInt32LittleToHost(header->bitmaskAlpha)) {
-				if (formatFlags == kPVRTextureFlagTypePVRTC_4)
-					format = XTexColorFormat_RGBA_CompressedPVR_4BPP;
-				else if (formatFlags == kPVRTextureFlagTypePVRTC_2)
-					format = XTexColorFormat_RGBA_CompressedPVR_2BPP;
-			/*} else {
-				if (formatFlags == kPVRTextureFlagTypePVRTC_4)
-					format = XTexColorFormat_RGB_CompressedPVR_4BPP;
-				else if (formatFlags == kPVRTextureFlagTypePVRTC_2)
-					format = XTexColorFormat_RGB_CompressedPVR_2BPP;
-			}*/
+			dataSize = TextureDecoder_levelSize(decoderFormat, width, height);
+			if (dataOffset + dataSize > dataLength)
+				break;
 			
 			// save image mip level
-			XTextureMipFrame *mipFrame = [[XTextureMipFrame alloc] initWithByteCapacity:dataSize];
-			memcpy(mipFrame->byteData, bytes+dataOffset, dataSize);
-			mipFrame->byteCount = dataSize;
-			mipFrame->colorFormat = format;
-			mipFrame->byteFormat = XTexByteFormat_Compressed;
+			XTextureMipFrame *mipFrame;
+			if (decode) {
+				mipFrame = decodeCompressedMipFrame(decoderFormat, bytes+dataOffset, width, height, &hasAlpha);
+			} else {
+				mipFrame = [[XTextureMipFrame alloc] initWithByteCapacity:dataSize];
+				memcpy(mipFrame->byteData, bytes+dataOffset, dataSize);
+				mipFrame->byteCount = dataSize;
+				mipFrame->colorFormat = format;
+				mipFrame->byteFormat = XTexByteFormat_Compressed;
+			}
 			mipFrame->width = width;
 			mipFrame->height = height;
 			mipFrame->level = imageMipFrames.count;
@@ -618,7 +812,7 @@ NSString *loadCompressedPVR(NSString *filename, NSMutableArray *imageMipFrames)
 			height = MAX(height >> 1, 1);
 		}
 		
-		success = TRUE;
+		success = (imageMipFrames.count > 0);
 	}
 	
 	[fileData release];
@@ -629,6 +823,3 @@ NSString *loadCompressedPVR(NSString *filename, NSMutableArray *imageMipFrames)
 		return nil;
 }
 
-
-
-
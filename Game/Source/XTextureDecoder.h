@@ -0,0 +1,36 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import <stdint.h>
+#import <stddef.h>
+
+// Software decoders for the compressed texture formats found in .pvr files (PVRTC 2/4bpp and ETC1),
+// written in plain C so they also build into the command line tools (see TextureCheck). XTexture
+// falls back to these when the GPU can't take the compressed data directly and no uncompressed
+// source image is shipped, and TextureCheck uses them to measure the quality of the .pvr files
+// against the images they were compressed from.
+
+typedef enum {
+	XTextureDecoderFormat_Unknown = 0,
+	XTextureDecoderFormat_PVRTC_2BPP,
+	XTextureDecoderFormat_PVRTC_4BPP,
+	XTextureDecoderFormat_ETC1,
+} XTextureDecoderFormat;
+
+// returns the format of a legacy (version 2) .pvr header's pixel type flags, or Unknown
+XTextureDecoderFormat TextureDecoder_formatFromPVRFlags(uint32_t flags);
+
+// returns the number of bytes of compressed data in one mip level of the given size
+// (PVRTC levels are padded to a minimum of 2x2 blocks, and ETC1 levels to whole blocks)
+size_t TextureDecoder_levelSize(XTextureDecoderFormat format, int width, int height);
+
+// decodes one mip level into width * height RGBA pixels (4 bytes each, in memory order);
+// PVRTC dimensions must be powers of two, as the hardware requires. Returns 0 if the format is unknown.
+int TextureDecoder_decode(XTextureDecoderFormat format, const uint8_t *data, int width, int height, uint8_t *destRGBA);
+
+void TextureDecoder_decodePVRTC(const uint8_t *data, int width, int height, int twoBitsPerPixel, uint8_t *destRGBA);
+void TextureDecoder_decodeETC1(const uint8_t *data, int width, int height, uint8_t *destRGBA);
+
+// peak signal to noise ratio (in dB) between two RGBA images, over the first 'channels' channels
+// (3 to ignore alpha); identical images return INFINITY
+double TextureDecoder_psnr(const uint8_t *imageRGBA, const uint8_t *referenceRGBA, int pixelCount, int channels);
+
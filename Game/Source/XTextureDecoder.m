@@ -0,0 +1,364 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XTextureDecoder.h"
+#import <stdlib.h>
+#import <string.h>
+#import <math.h>
+
+
+// legacy .pvr pixel types (the low byte of the header flags)
+enum {
+	kPVRPixelTypePVRTC_2 = 0x0c,
+	kPVRPixelTypePVRTC_4 = 0x0d,
+	kPVRPixelTypeOGLPVRTC_2 = 0x18,
+	kPVRPixelTypeOGLPVRTC_4 = 0x19,
+	kPVRPixelTypeETC1 = 0x36,
+};
+
+XTextureDecoderFormat TextureDecoder_formatFromPVRFlags(uint32_t flags)
+{
+	switch (flags & 0xff) {
+		case kPVRPixelTypePVRTC_2:
+		case kPVRPixelTypeOGLPVRTC_2:
+			return XTextureDecoderFormat_PVRTC_2BPP;
+		case kPVRPixelTypePVRTC_4:
+		case kPVRPixelTypeOGLPVRTC_4:
+			return XTextureDecoderFormat_PVRTC_4BPP;
+		case kPVRPixelTypeETC1:
+			return XTextureDecoderFormat_ETC1;
+		default:
+			return XTextureDecoderFormat_Unknown;
+	}
+}
+
+size_t TextureDecoder_levelSize(XTextureDecoderFormat format, int width, int height)
+{
+	int blocksX, blocksY;
+	switch (format) {
+		case XTextureDecoderFormat_PVRTC_2BPP:
+		case XTextureDecoderFormat_PVRTC_4BPP:
+			blocksX = width / ((format == XTextureDecoderFormat_PVRTC_2BPP) ? 8 : 4);
+			blocksY = height / 4;
+			if (blocksX < 2) blocksX = 2;
+			if (blocksY < 2) blocksY = 2;
+			return (size_t)blocksX * blocksY * 8;
+		case XTextureDecoderFormat_ETC1:
+			blocksX = (width + 3) / 4;
+			blocksY = (height + 3) / 4;
+			return (size_t)blocksX * blocksY * 8;
+		default:
+			return 0;
+	}
+}
+
+int TextureDecoder_decode(XTextureDecoderFormat format, const uint8_t *data, int width, int height, uint8_t *destRGBA)
+{
+	switch (format) {
+		case XTextureDecoderFormat_PVRTC_2BPP:
+			TextureDecoder_decodePVRTC(data, width, height, 1, destRGBA);
+			return 1;
+		case XTextureDecoderFormat_PVRTC_4BPP:
+			TextureDecoder_decodePVRTC(data, width, height, 0, destRGBA);
+			return 1;
+		case XTextureDecoderFormat_ETC1:
+			TextureDecoder_decodeETC1(data, width, height, destRGBA);
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+
+//------------------------------ PVRTC -----------------------------------
+
+// Each 64 bit PVRTC block holds two low resolution colors (A and B) and a 2 bit modulation value per
+// pixel (or per other pixel, at 2bpp). The full resolution A and B images are bilinearly upscaled from
+// the blocks, with every block's color centered on the block, and each pixel blends between its
+// upscaled A and B colors by its modulation weight. Blocks are stored in Morton order.
+
+static inline uint32_t readLittleEndian32(const uint8_t *bytes)
+{
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// interleaves the block coordinates (y in the low bit); the longer axis' extra bits are appended
+static uint32_t PVRTC_twiddle(uint32_t blocksX, uint32_t blocksY, uint32_t x, uint32_t y)
+{
+	uint32_t minDimension = (blocksY < blocksX) ? blocksY : blocksX;
+	uint32_t remaining = (blocksY < blocksX) ? x : y;
+	uint32_t twiddled = 0, srcBit = 1, dstBit = 1;
+	int shift = 0;
+	while (srcBit < minDimension) {
+		if (y & srcBit) twiddled |= dstBit;
+		if (x & srcBit) twiddled |= dstBit << 1;
+		srcBit <<= 1;
+		dstBit <<= 2;
+		++shift;
+	}
+	return twiddled | ((remaining >> shift) << (2 * shift));
+}
+
+// unpacks color A (bits 1-15) and color B (bits 16-31) of a block's color word to 5 bit RGB and
+// 4 bit alpha, as {r, g, b, a}
+static void PVRTC_unpackColors(uint32_t colorWord, int16_t *colorA, int16_t *colorB)
+{
+	uint32_t a = colorWord & 0xffff;
+	if (a & 0x8000) {
+		colorA[0] = (a >> 10) & 0x1f;
+		colorA[1] = (a >> 5) & 0x1f;
+		colorA[2] = (a & 0x1e) | ((a & 0x1e) >> 4);
+		colorA[3] = 0xf;
+	} else {
+		colorA[0] = ((a >> 7) & 0x1e) | ((a >> 11) & 0x1);
+		colorA[1] = ((a >> 3) & 0x1e) | ((a >> 7) & 0x1);
+		colorA[2] = ((a << 1) & 0x1c) | ((a >> 2) & 0x3);
+		colorA[3] = (a >> 11) & 0xe;
+	}
+
+	uint32_t b = colorWord >> 16;
+	if (b & 0x8000) {
+		colorB[0] = (b >> 10) & 0x1f;
+		colorB[1] = (b >> 5) & 0x1f;
+		colorB[2] = b & 0x1f;
+		colorB[3] = 0xf;
+	} else {
+		colorB[0] = ((b >> 7) & 0x1e) | ((b >> 11) & 0x1);
+		colorB[1] = ((b >> 3) & 0x1e) | ((b >> 7) & 0x1);
+		colorB[2] = ((b << 1) & 0x1e) | ((b >> 3) & 0x1);
+		colorB[3] = (b >> 11) & 0xe;
+	}
+}
+
+// modulation weights (out of 8) of the 2 bit values
+static const uint8_t PVRTC_weights[4] = { 0, 3, 5, 8 };
+static const uint8_t PVRTC_punchThroughWeights[4] = { 0, 4, 4, 8 };
+
+#define PVRTC_PUNCH_THROUGH 0x80
+
+enum {
+	PVRTCMode_Direct = 0,		// every pixel has its own value
+	PVRTCMode_Interpolated,		// (2bpp) missing pixels average their 4 neighbors
+	PVRTCMode_Horizontal,		// (2bpp) ... their left and right neighbors
+	PVRTCMode_Vertical,			// (2bpp) ... their top and bottom neighbors
+};
+
+void TextureDecoder_decodePVRTC(const uint8_t *data, int width, int height, int twoBitsPerPixel, uint8_t *destRGBA)
+{
+	int blockWidth = twoBitsPerPixel ? 8 : 4, blockHeight = 4;
+	int blocksX = width / blockWidth, blocksY = height / blockHeight;
+	if (blocksX < 2) blocksX = 2;
+	if (blocksY < 2) blocksY = 2;
+	int paddedWidth = blocksX * blockWidth, paddedHeight = blocksY * blockHeight;
+	int blockCount = blocksX * blocksY;
+
+	// unpack the block colors (in raster order) and the raw modulation values of every pixel
+	int16_t *colors = malloc(sizeof(int16_t) * 8 * blockCount);
+	uint8_t *modes = malloc(blockCount);
+	uint8_t *values = malloc((size_t)paddedWidth * paddedHeight);
+	for (int by = 0; by < blocksY; ++by) {
+		for (int bx = 0; bx < blocksX; ++bx) {
+			const uint8_t *block = data + 8 * PVRTC_twiddle(blocksX, blocksY, bx, by);
+			uint32_t modulation = readLittleEndian32(block);
+			uint32_t colorWord = readLittleEndian32(block + 4);
+			int index = by * blocksX + bx;
+			PVRTC_unpackColors(colorWord, &colors[index * 8], &colors[index * 8 + 4]);
+
+			uint8_t *v = &values[(by * blockHeight) * paddedWidth + bx * blockWidth];
+			int mode = colorWord & 1;
+			if (!twoBitsPerPixel) {
+				for (int y = 0; y < 4; ++y)
+					for (int x = 0; x < 4; ++x, modulation >>= 2)
+						v[y * paddedWidth + x] = modulation & 3;
+			}
+			else if (mode == 0) {
+				for (int y = 0; y < 4; ++y)
+					for (int x = 0; x < 8; ++x, modulation >>= 1)
+						v[y * paddedWidth + x] = (modulation & 1) ? 3 : 0;
+			}
+			else {
+				// the low bit of the first stored value selects how missing values are filled in
+				// (the bit it displaces is taken from its neighbor, as is one of the center pixel's)
+				if (modulation & 1) {
+					mode = (modulation & (1 << 20)) ? PVRTCMode_Vertical : PVRTCMode_Horizontal;
+					if (modulation & (1 << 21))
+						modulation |= (1 << 20);
+					else
+						modulation &= ~(1 << 20);
+				}
+				if (modulation & 2)
+					modulation |= 1;
+				else
+					modulation &= ~1;
+				for (int y = 0; y < 4; ++y) {
+					for (int x = 0; x < 8; ++x) {
+						if (((x ^ y) & 1) == 0) {
+							v[y * paddedWidth + x] = modulation & 3;
+							modulation >>= 2;
+						} else {
+							v[y * paddedWidth + x] = 0;
+						}
+					}
+				}
+			}
+			modes[index] = mode;
+		}
+	}
+
+	// upscale A and B; pixel (x, y) lies between the blocks whose centers surround it, at a fixed point
+	// offset of (fx, fy) blockWidths/blockHeights from the top left one
+	int halfWidth = blockWidth / 2, halfHeight = blockHeight / 2;
+	int shift = twoBitsPerPixel ? 5 : 4;	// log2(blockWidth * blockHeight)
+	for (int y = 0; y < height; ++y) {
+		int py = y + paddedHeight - halfHeight;
+		int by0 = (py / blockHeight) % blocksY, by1 = (by0 + 1) % blocksY;
+		int fy = py % blockHeight;
+		int blockY = y / blockHeight;
+		for (int x = 0; x < width; ++x) {
+			int px = x + paddedWidth - halfWidth;
+			int bx0 = (px / blockWidth) % blocksX, bx1 = (bx0 + 1) % blocksX;
+			int fx = px % blockWidth;
+
+			const int16_t *p = &colors[(by0 * blocksX + bx0) * 8];
+			const int16_t *q = &colors[(by0 * blocksX + bx1) * 8];
+			const int16_t *r = &colors[(by1 * blocksX + bx0) * 8];
+			const int16_t *s = &colors[(by1 * blocksX + bx1) * 8];
+			int wp = (blockWidth - fx) * (blockHeight - fy), wq = fx * (blockHeight - fy);
+			int wr = (blockWidth - fx) * fy, ws = fx * fy;
+
+			// modulation weight of this pixel, from its own block
+			int blockIndex = blockY * blocksX + x / blockWidth;
+			int mode = modes[blockIndex];
+			int value = values[y * paddedWidth + x];
+			int weight;
+			if (!twoBitsPerPixel) {
+				if (mode == 0)
+					weight = PVRTC_weights[value];
+				else
+					weight = PVRTC_punchThroughWeights[value] | ((value == 2) ? PVRTC_PUNCH_THROUGH : 0);
+			}
+			else if (mode == PVRTCMode_Direct || ((x ^ y) & 1) == 0) {
+				weight = PVRTC_weights[value];
+			}
+			else {
+				int left = values[y * paddedWidth + (x + paddedWidth - 1) % paddedWidth];
+				int right = values[y * paddedWidth + (x + 1) % paddedWidth];
+				int up = values[((y + paddedHeight - 1) % paddedHeight) * paddedWidth + x];
+				int down = values[((y + 1) % paddedHeight) * paddedWidth + x];
+				if (mode == PVRTCMode_Interpolated)
+					weight = (PVRTC_weights[left] + PVRTC_weights[right] + PVRTC_weights[up] + PVRTC_weights[down] + 2) / 4;
+				else if (mode == PVRTCMode_Horizontal)
+					weight = (PVRTC_weights[left] + PVRTC_weights[right] + 1) / 2;
+				else
+					weight = (PVRTC_weights[up] + PVRTC_weights[down] + 1) / 2;
+			}
+			int punchThrough = weight & PVRTC_PUNCH_THROUGH;
+			weight &= ~PVRTC_PUNCH_THROUGH;
+
+			uint8_t *dest = &destRGBA[(y * width + x) * 4];
+			for (int c = 0; c < 4; ++c) {
+				int a = p[c] * wp + q[c] * wq + r[c] * wr + s[c] * ws;
+				int b = p[c + 4] * wp + q[c + 4] * wq + r[c + 4] * wr + s[c + 4] * ws;
+				// 5 bit colors and 4 bit alphas to 8 bits, by replicating their high bits
+				if (c < 3) {
+					a = (a >> (shift - 3)) + (a >> (shift + 2));
+					b = (b >> (shift - 3)) + (b >> (shift + 2));
+				} else {
+					a = (a >> (shift - 4)) + (a >> shift);
+					b = (b >> (shift - 4)) + (b >> shift);
+				}
+				dest[c] = (uint8_t)((a * (8 - weight) + b * weight) / 8);
+			}
+			if (punchThrough)
+				dest[3] = 0;
+		}
+	}
+
+	free(values);
+	free(modes);
+	free(colors);
+}
+
+
+//------------------------------ ETC1 -----------------------------------
+
+// Each 64 bit (big endian) ETC1 block splits its 4x4 pixels into two 2x4 or 4x2 halves, each with a
+// base color and an intensity table; every pixel adds one of its half's 4 intensity offsets to the base.
+
+static const int ETC1_modifiers[8][4] = {
+	{ 2, 8, -2, -8 }, { 5, 17, -5, -17 }, { 9, 29, -9, -29 }, { 13, 42, -13, -42 },
+	{ 18, 60, -18, -60 }, { 24, 80, -24, -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 }
+};
+
+static inline uint8_t ETC1_clamp(int value)
+{
+	return (uint8_t)((value < 0) ? 0 : ((value > 255) ? 255 : value));
+}
+
+void TextureDecoder_decodeETC1(const uint8_t *data, int width, int height, uint8_t *destRGBA)
+{
+	int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	for (int by = 0; by < blocksY; ++by) {
+		for (int bx = 0; bx < blocksX; ++bx, data += 8) {
+			uint32_t high = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+			uint32_t low = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7];
+
+			int base[2][3];
+			if (high & 2) {
+				// differential: 5 bit base color, and a 3 bit signed delta to the second
+				for (int c = 0; c < 3; ++c) {
+					int shift = 27 - c * 8;
+					int color = (high >> shift) & 0x1f;
+					int delta = (int)((high >> (shift - 3)) & 0x7);
+					if (delta >= 4) delta -= 8;
+					int color2 = (color + delta) & 0x1f;
+					base[0][c] = (color << 3) | (color >> 2);
+					base[1][c] = (color2 << 3) | (color2 >> 2);
+				}
+			} else {
+				// individual: two 4 bit colors
+				for (int c = 0; c < 3; ++c) {
+					int shift = 28 - c * 8;
+					base[0][c] = ((high >> shift) & 0xf) * 17;
+					base[1][c] = ((high >> (shift - 4)) & 0xf) * 17;
+				}
+			}
+			const int *table[2] = { ETC1_modifiers[(high >> 5) & 7], ETC1_modifiers[(high >> 2) & 7] };
+			int flip = high & 1;
+
+			// pixel indexes are stored column by column, the high bits above the low bits
+			for (int x = 0; x < 4; ++x) {
+				for (int y = 0; y < 4; ++y) {
+					int px = bx * 4 + x, py = by * 4 + y;
+					if (px >= width || py >= height)
+						continue;
+					int bit = x * 4 + y;
+					int index = (((low >> (bit + 16)) & 1) << 1) | ((low >> bit) & 1);
+					int half = flip ? (y >= 2) : (x >= 2);
+					int modifier = table[half][index];
+					uint8_t *dest = &destRGBA[(py * width + px) * 4];
+					dest[0] = ETC1_clamp(base[half][0] + modifier);
+					dest[1] = ETC1_clamp(base[half][1] + modifier);
+					dest[2] = ETC1_clamp(base[half][2] + modifier);
+					dest[3] = 255;
+				}
+			}
+		}
+	}
+}
+
+
+double TextureDecoder_psnr(const uint8_t *imageRGBA, const uint8_t *referenceRGBA, int pixelCount, int channels)
+{
+	double squaredError = 0;
+	for (int i = 0; i < pixelCount; ++i) {
+		for (int c = 0; c < channels; ++c) {
+			int error = (int)imageRGBA[i * 4 + c] - (int)referenceRGBA[i * 4 + c];
+			squaredError += error * error;
+		}
+	}
+	if (squaredError == 0)
+		return INFINITY;
+	double meanSquaredError = squaredError / ((double)pixelCount * channels);
+	return 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+}
+
@@ -8,6 +8,7 @@
 
 -(void)loadMipFramesFromFile:(NSString*)filepath;
 -(void)configureGLTextureParameters;
+-(BOOL)generatesMipmaps;
 
 @end
 
@@ -21,4 +22,9 @@
 	glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_FALSE);
 }
 
+-(BOOL)generatesMipmaps
+{
+	return NO;
+}
+
 @end
@@ -0,0 +1,54 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMath.h"
+
+// XTreeSystem's level of detail selection and impostor generation, kept free of GL dependencies (like
+// XTreePlacement) so TreeBench can measure the rings a camera sees and the cost of the impostors.
+
+typedef enum {
+	XTreeLOD_Near,
+	XTreeLOD_Mid,
+	XTreeLOD_Far,
+	XTreeLOD_Count
+} XTreeLOD;
+
+typedef struct {
+	XVector3 position;
+	XColorBytes color;
+} XTreeVertex;
+
+typedef struct {
+	XVector3 position; //(base of the tree, on the terrain)
+	XScalar size;
+	XColorBytes color;
+} XTreeBillboard;
+
+// writes an upright quad from base - (halfX, 0, halfZ) to base + (halfX, height, halfZ): top-left,
+// top-right, bottom-left, bottom-right (matching XTreeSystem's shared texcoords)
+static inline XTreeVertex *TreeLOD_writeQuad(XTreeVertex *vPtr, const XVector3 *base, XScalar halfX, XScalar halfZ, XScalar height, XColorBytes color)
+{
+	vPtr->position.x = base->x - halfX; vPtr->position.y = base->y + height; vPtr->position.z = base->z - halfZ;
+	vPtr->color = color;
+	++vPtr;
+	vPtr->position.x = base->x + halfX; vPtr->position.y = base->y + height; vPtr->position.z = base->z + halfZ;
+	vPtr->color = color;
+	++vPtr;
+	vPtr->position.x = base->x - halfX; vPtr->position.y = base->y; vPtr->position.z = base->z - halfZ;
+	vPtr->color = color;
+	++vPtr;
+	vPtr->position.x = base->x + halfX; vPtr->position.y = base->y; vPtr->position.z = base->z + halfZ;
+	vPtr->color = color;
+	++vPtr;
+	return vPtr;
+}
+
+// the level of detail of a batch, by the horizontal distance from the eye to its bounds
+XTreeLOD TreeLOD_select(const XBoundingBox *batchBounds, const XVector3 *eye, XScalar nearDistance, XScalar farDistance);
+
+// vertexes drawn for a batch of treeCount trees at the given level of detail (two crossed quads per
+// tree near, one impostor per tree mid range, and a card for every other tree far away)
+int TreeLOD_vertexCount(XTreeLOD lod, int treeCount);
+
+// writes one camera facing, upright quad per billboard (4 vertexes each), right being the camera's
+// horizontal right vector; returns the vertex after the last one written
+XTreeVertex *TreeLOD_writeImpostors(XTreeVertex *vertexes, const XTreeBillboard *billboards, int count, const XVector3 *right);
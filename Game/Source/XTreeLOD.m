@@ -0,0 +1,41 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XTreeLOD.h"
+
+
+XTreeLOD TreeLOD_select(const XBoundingBox *batchBounds, const XVector3 *eye, XScalar nearDistance, XScalar farDistance)
+{
+	XScalar dx = 0, dz = 0;
+	if (eye->x < batchBounds->min.x) dx = batchBounds->min.x - eye->x;
+	else if (eye->x > batchBounds->max.x) dx = eye->x - batchBounds->max.x;
+	if (eye->z < batchBounds->min.z) dz = batchBounds->min.z - eye->z;
+	else if (eye->z > batchBounds->max.z) dz = eye->z - batchBounds->max.z;
+	XScalar distSq = dx*dx + dz*dz;
+
+	if (distSq < nearDistance * nearDistance)
+		return XTreeLOD_Near;
+	else if (distSq < farDistance * farDistance)
+		return XTreeLOD_Mid;
+	else
+		return XTreeLOD_Far;
+}
+
+int TreeLOD_vertexCount(XTreeLOD lod, int treeCount)
+{
+	if (lod == XTreeLOD_Near)
+		return treeCount * 8;
+	else if (lod == XTreeLOD_Mid)
+		return treeCount * 4;
+	else
+		return ((treeCount + 1) / 2) * 4;
+}
+
+XTreeVertex *TreeLOD_writeImpostors(XTreeVertex *vertexes, const XTreeBillboard *billboards, int count, const XVector3 *right)
+{
+	for (int i = 0; i < count; ++i) {
+		const XTreeBillboard *billboard = &billboards[i];
+		XScalar halfSize = billboard->size * 0.5f;
+		vertexes = TreeLOD_writeQuad(vertexes, &billboard->position, right->x * halfSize, right->z * halfSize, billboard->size, billboard->color);
+	}
+	return vertexes;
+}
@@ -0,0 +1,53 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XMath.h"
+
+// tree placement is kept free of any GL dependencies so offline tools (MapPacker)
+// can bake the exact same tree layouts the game would generate at load time
+
+
+typedef struct {
+	XVector2 position;
+	XScalar size;
+	XAngle rotation;
+} XTreeInstance;
+
+
+// returns how densely trees should grow at (x, z), from 0 (none) to 1
+typedef XScalar (*XTreeDensityFunc)(void *context, XScalar x, XScalar z);
+
+typedef struct {
+	XScalarRect area;
+	float minTreeSize, maxTreeSize;
+	unsigned int seed;
+	XTreeDensityFunc density; //(NULL uses TreePlacement_clusterDensity, seeded with seed)
+	void *densityContext;
+	int threadCount;
+} XTreePlacementParams;
+
+// Places up to treeCount trees by Poisson disk sampling, so no tree has another closer than the spacing
+// at its position (which grows where the density mask is low), and returns how many were placed.
+// The area is split into tiles, which are filled in four passes of non-adjacent tiles; the tiles of a
+// pass are filled in parallel on params->threadCount threads, each from its own random sequence, so
+// the result only depends on the parameters (not on the number of threads or their timing).
+int TreePlacement_populatePoissonDisk(XTreeInstance *array, int treeCount, const XTreePlacementParams *params);
+
+// default density mask: two octaves of value noise, for clustered forests and clearings
+// (context points to an unsigned int seed)
+XScalar TreePlacement_clusterDensity(void *context, XScalar x, XScalar z);
+
+// the cell of a gridRes x gridRes grid over [min, min + cellSize * gridRes) containing value (clamped)
+static inline int TreePlacement_gridCoordinate(XScalar value, XScalar min, XScalar cellSize, int gridRes)
+{
+	int i = (int)((value - min) / cellSize);
+	if (i < 0) i = 0;
+	else if (i > gridRes-1) i = gridRes-1;
+	return i;
+}
+
+// Counting sorts the trees by grid cell (cell index = x * gridRes + y, with tree position.y along the
+// grid's y axis) in O(trees + cells): the indexes of the trees in cell c are written to
+// sortedIndexes[bucketStart[c] ... bucketStart[c+1]-1], in increasing order. bucketStart must hold
+// gridRes * gridRes + 1 entries, and sortedIndexes treeCount.
+void TreePlacement_bucketTrees(const XTreeInstance *trees, int treeCount, XScalarRect area, int gridRes, int *bucketStart, int *sortedIndexes);
+
@@ -0,0 +1,335 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "XTreePlacement.h"
+#import <string.h>
+#import <stdlib.h>
+#import <stdint.h>
+#import <pthread.h>
+
+
+// ---------- Poisson disk placement ----------
+
+#define POISSON_CANDIDATES 24 //candidates tried around each active point
+#define POISSON_TILE_SEEDS 8 //fresh starting points tried per tile (for areas cut off by the mask)
+#define POISSON_MIN_DENSITY 0.0625f //(spacing grows at most 4x in sparse areas)
+#define POISSON_MAX_PASSES 6 //times the spacing is tightened when too few trees fit
+#define POISSON_PACKING 0.6f //approximate trees per spacing^2 of fully dense area
+#define POISSON_MIN_TILE_CELLS 32
+
+typedef struct {
+	const XTreePlacementParams *params;
+	XTreeDensityFunc density;
+	void *densityContext;
+	unsigned int pass;
+	
+	XScalar minRadius, maxRadius, cellSize;
+	int gridWidth, gridHeight, searchCells;
+	XTreeInstance *grid; //one point at most per cell (size 0 = empty); written only by the cell's tile
+	XScalar *gridRadius;
+	
+	int tileCells, tilesX, tilesY;
+	int *tilePointCount;
+	int *tilePoints; //(grid cell indexes, in the order points were placed, tileCells^2 per tile)
+} XPoissonState;
+
+typedef struct {
+	XPoissonState *state;
+	int phase, thread, threadCount;
+} XPoissonWork;
+
+
+static inline uint32_t Poisson_hash(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+	uint32_t h = a * 0x9E3779B1u;
+	h ^= b + 0x7F4A7C15u + (h << 6) + (h >> 2);
+	h ^= c + 0x85EBCA6Bu + (h << 6) + (h >> 2);
+	h ^= d + 0xC2B2AE35u + (h << 6) + (h >> 2);
+	h ^= h >> 16;
+	h *= 0x45d9f3bu;
+	h ^= h >> 16;
+	return h ? h : 1;
+}
+
+static inline float Poisson_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline float Poisson_noise(uint32_t seed, XScalar x, XScalar z, XScalar scale)
+{
+	x /= scale;
+	z /= scale;
+	int ix = (int)floorf(x), iz = (int)floorf(z);
+	float fx = x - ix, fz = z - iz;
+	fx = fx * fx * (3 - 2 * fx);
+	fz = fz * fz * (3 - 2 * fz);
+	float v00 = (Poisson_hash(seed, ix, iz, 0) >> 8) * (1.0f / 16777216.0f);
+	float v10 = (Poisson_hash(seed, ix+1, iz, 0) >> 8) * (1.0f / 16777216.0f);
+	float v01 = (Poisson_hash(seed, ix, iz+1, 0) >> 8) * (1.0f / 16777216.0f);
+	float v11 = (Poisson_hash(seed, ix+1, iz+1, 0) >> 8) * (1.0f / 16777216.0f);
+	float top = v00 + (v10 - v00) * fx;
+	float bottom = v01 + (v11 - v01) * fx;
+	return top + (bottom - top) * fz;
+}
+
+XScalar TreePlacement_clusterDensity(void *context, XScalar x, XScalar z)
+{
+	uint32_t seed = *(unsigned int*)context;
+	float n = Poisson_noise(seed, x, z, 120) * 0.65f + Poisson_noise(seed + 1, x, z, 40) * 0.35f;
+	n = xSaturate((n - 0.3f) * 2.5f);
+	return 0.1f + 0.9f * n * n * (3 - 2 * n);
+}
+
+// places a point at (x, z) if no other is within the spacing at (x, z), returning its cell index (or -1)
+static int Poisson_tryPoint(XPoissonState *s, XScalar x, XScalar z, uint32_t *random)
+{
+	const XTreePlacementParams *params = s->params;
+	XScalar density = s->density(s->densityContext, x, z);
+	if (density <= 0)
+		return -1;
+	if (density < POISSON_MIN_DENSITY)
+		density = POISSON_MIN_DENSITY;
+	XScalar radius = s->minRadius / xSqrt(density);
+	
+	int cx = (int)((x - params->area.left) / s->cellSize);
+	int cz = (int)((z - params->area.top) / s->cellSize);
+	if (cx < 0 || cz < 0 || cx >= s->gridWidth || cz >= s->gridHeight)
+		return -1;
+	int searchCells = (int)ceilf(radius / s->cellSize);
+	int x0 = cx - searchCells, x1 = cx + searchCells;
+	int z0 = cz - searchCells, z1 = cz + searchCells;
+	if (x0 < 0) x0 = 0;
+	if (z0 < 0) z0 = 0;
+	if (x1 > s->gridWidth-1) x1 = s->gridWidth-1;
+	if (z1 > s->gridHeight-1) z1 = s->gridHeight-1;
+	for (int j = z0; j <= z1; ++j) {
+		for (int i = x0; i <= x1; ++i) {
+			int cell = j * s->gridWidth + i;
+			XTreeInstance *other = &s->grid[cell];
+			if (other->size == 0)
+				continue;
+			XScalar dx = other->position.x - x, dz = other->position.y - z;
+			if (dx*dx + dz*dz < radius*radius)
+				return -1;
+		}
+	}
+	
+	int cell = cz * s->gridWidth + cx;
+	XTreeInstance *tree = &s->grid[cell];
+	tree->position.x = x;
+	tree->position.y = z;
+	tree->size = params->minTreeSize + Poisson_rand(random) * (params->maxTreeSize - params->minTreeSize);
+	tree->rotation = xDegToRad(-180) + Poisson_rand(random) * xDegToRad(360);
+	s->gridRadius[cell] = radius;
+	return cell;
+}
+
+// Bridson's algorithm, restricted to the cells of one tile
+static void Poisson_fillTile(XPoissonState *s, int tx, int tz)
+{
+	const XTreePlacementParams *params = s->params;
+	int tile = tz * s->tilesX + tx;
+	int *points = &s->tilePoints[tile * s->tileCells * s->tileCells];
+	int pointCount = 0;
+	uint32_t random = Poisson_hash(params->seed, tx, tz, s->pass);
+	
+	int cx0 = tx * s->tileCells, cz0 = tz * s->tileCells;
+	XScalar left = params->area.left + cx0 * s->cellSize;
+	XScalar top = params->area.top + cz0 * s->cellSize;
+	XScalar right = left + s->tileCells * s->cellSize;
+	XScalar bottom = top + s->tileCells * s->cellSize;
+	if (right > params->area.right) right = params->area.right;
+	if (bottom > params->area.bottom) bottom = params->area.bottom;
+	
+	int *active = malloc(sizeof(int) * s->tileCells * s->tileCells);
+	int activeCount = 0;
+	for (int seedTry = 0; seedTry < POISSON_TILE_SEEDS; ++seedTry) {
+		XScalar x = left + Poisson_rand(&random) * (right - left);
+		XScalar z = top + Poisson_rand(&random) * (bottom - top);
+		int cell = Poisson_tryPoint(s, x, z, &random);
+		if (cell < 0)
+			continue;
+		points[pointCount++] = cell;
+		active[activeCount++] = cell;
+		
+		while (activeCount > 0) {
+			int a = (int)(Poisson_rand(&random) * activeCount);
+			if (a >= activeCount) a = activeCount - 1;
+			XTreeInstance *origin = &s->grid[active[a]];
+			XScalar radius = s->gridRadius[active[a]];
+			BOOL placed = NO;
+			for (int k = 0; k < POISSON_CANDIDATES; ++k) {
+				XAngle angle = Poisson_rand(&random) * (XScalar)TWO_PI;
+				XScalar dist = radius * (1 + Poisson_rand(&random));
+				x = origin->position.x + xCos(angle) * dist;
+				z = origin->position.y + xSin(angle) * dist;
+				if (x < left || x >= right || z < top || z >= bottom)
+					continue;
+				cell = Poisson_tryPoint(s, x, z, &random);
+				if (cell >= 0) {
+					points[pointCount++] = cell;
+					active[activeCount++] = cell;
+					placed = YES;
+					break;
+				}
+			}
+			if (!placed)
+				active[a] = active[--activeCount];
+		}
+	}
+	free(active);
+	s->tilePointCount[tile] = pointCount;
+}
+
+// fills this thread's share of the tiles in one phase (tiles whose x and z parity match the phase)
+static void *Poisson_work(void *arg)
+{
+	XPoissonWork *work = arg;
+	XPoissonState *s = work->state;
+	int n = 0;
+	for (int tz = (work->phase >> 1); tz < s->tilesY; tz += 2) {
+		for (int tx = (work->phase & 1); tx < s->tilesX; tx += 2) {
+			if (n++ % work->threadCount == work->thread)
+				Poisson_fillTile(s, tx, tz);
+		}
+	}
+	return NULL;
+}
+
+int TreePlacement_populatePoissonDisk(XTreeInstance *array, int treeCount, const XTreePlacementParams *params)
+{
+	if (treeCount <= 0)
+		return 0;
+	XPoissonState s;
+	memset(&s, 0, sizeof(s));
+	s.params = params;
+	s.density = params->density;
+	s.densityContext = params->densityContext;
+	unsigned int densitySeed = params->seed;
+	if (s.density == NULL) {
+		s.density = TreePlacement_clusterDensity;
+		s.densityContext = &densitySeed;
+	}
+	int threadCount = params->threadCount;
+	if (threadCount < 1) threadCount = 1;
+	
+	// estimate the spacing which fits treeCount trees, from the average density
+	XScalar width = params->area.right - params->area.left;
+	XScalar height = params->area.bottom - params->area.top;
+	XScalar averageDensity = 0;
+	for (int j = 0; j < 32; ++j) {
+		for (int i = 0; i < 32; ++i) {
+			XScalar d = s.density(s.densityContext, params->area.left + (i + 0.5f) * width / 32, params->area.top + (j + 0.5f) * height / 32);
+			averageDensity += (d > POISSON_MIN_DENSITY) ? d : ((d > 0) ? POISSON_MIN_DENSITY : 0);
+		}
+	}
+	averageDensity /= 32 * 32;
+	if (averageDensity <= 0)
+		return 0;
+	XScalar minRadius = xSqrt(POISSON_PACKING * width * height * averageDensity / treeCount);
+	
+	int placed = 0;
+	for (s.pass = 0; s.pass < POISSON_MAX_PASSES; ++s.pass) {
+		s.minRadius = minRadius;
+		s.maxRadius = minRadius / xSqrt(POISSON_MIN_DENSITY);
+		s.cellSize = minRadius / (XScalar)M_SQRT2;
+		s.gridWidth = (int)ceilf(width / s.cellSize);
+		s.gridHeight = (int)ceilf(height / s.cellSize);
+		s.searchCells = (int)ceilf(s.maxRadius / s.cellSize);
+		s.tileCells = s.searchCells + 1;
+		if (s.tileCells < POISSON_MIN_TILE_CELLS) s.tileCells = POISSON_MIN_TILE_CELLS;
+		s.tilesX = (s.gridWidth + s.tileCells - 1) / s.tileCells;
+		s.tilesY = (s.gridHeight + s.tileCells - 1) / s.tileCells;
+		s.grid = calloc(s.gridWidth * s.gridHeight, sizeof(XTreeInstance));
+		s.gridRadius = malloc(sizeof(XScalar) * s.gridWidth * s.gridHeight);
+		s.tilePointCount = calloc(s.tilesX * s.tilesY, sizeof(int));
+		s.tilePoints = malloc(sizeof(int) * s.tilesX * s.tilesY * s.tileCells * s.tileCells);
+		
+		// tiles of the same phase are at least one tile (and so the largest spacing) apart, so they
+		// can't affect each other, and are filled in parallel
+		for (int phase = 0; phase < 4; ++phase) {
+			pthread_t threads[threadCount];
+			XPoissonWork work[threadCount];
+			for (int t = 0; t < threadCount; ++t) {
+				work[t].state = &s;
+				work[t].phase = phase;
+				work[t].thread = t;
+				work[t].threadCount = threadCount;
+			}
+			for (int t = 1; t < threadCount; ++t) {
+				if (pthread_create(&threads[t], NULL, Poisson_work, &work[t]) != 0) {
+					threads[t] = 0;
+					Poisson_work(&work[t]);
+				}
+			}
+			Poisson_work(&work[0]);
+			for (int t = 1; t < threadCount; ++t) {
+				if (threads[t])
+					pthread_join(threads[t], NULL);
+			}
+		}
+		
+		int total = 0;
+		for (int i = 0; i < s.tilesX * s.tilesY; ++i)
+			total += s.tilePointCount[i];
+		
+		if (total >= treeCount || s.pass == POISSON_MAX_PASSES - 1) {
+			// collect the trees in tile order, evenly thinning them out if there are too many
+			int keep = (total < treeCount) ? total : treeCount;
+			int index = 0;
+			for (int tile = 0; tile < s.tilesX * s.tilesY; ++tile) {
+				int *points = &s.tilePoints[tile * s.tileCells * s.tileCells];
+				for (int i = 0; i < s.tilePointCount[tile]; ++i, ++index) {
+					if ((long long)(index + 1) * keep / total > (long long)index * keep / total)
+						array[placed++] = s.grid[points[i]];
+				}
+			}
+		}
+		free(s.grid);
+		free(s.gridRadius);
+		free(s.tilePointCount);
+		free(s.tilePoints);
+		if (placed > 0)
+			break;
+		
+		// too few trees fit; tighten the spacing and start over
+		if (total > 0)
+			minRadius *= xSqrt((XScalar)total / treeCount) * 0.95f;
+		else
+			minRadius *= 0.5f;
+	}
+	return placed;
+}
+
+
+void TreePlacement_bucketTrees(const XTreeInstance *trees, int treeCount, XScalarRect area, int gridRes, int *bucketStart, int *sortedIndexes)
+{
+	int bucketCount = gridRes * gridRes;
+	XScalar cellWidth = (area.right - area.left) / gridRes;
+	XScalar cellHeight = (area.bottom - area.top) / gridRes;
+	
+	// count trees per cell, shifted by one so the prefix sum gives each cell's start
+	memset(bucketStart, 0, sizeof(int) * (bucketCount + 1));
+	for (int i = 0; i < treeCount; ++i) {
+		int x = TreePlacement_gridCoordinate(trees[i].position.x, area.left, cellWidth, gridRes);
+		int y = TreePlacement_gridCoordinate(trees[i].position.y, area.top, cellHeight, gridRes);
+		++bucketStart[x * gridRes + y + 1];
+	}
+	for (int b = 0; b < bucketCount; ++b)
+		bucketStart[b+1] += bucketStart[b];
+	
+	// scatter (advancing each cell's start to its end), then shift the starts back
+	for (int i = 0; i < treeCount; ++i) {
+		int x = TreePlacement_gridCoordinate(trees[i].position.x, area.left, cellWidth, gridRes);
+		int y = TreePlacement_gridCoordinate(trees[i].position.y, area.top, cellHeight, gridRes);
+		sortedIndexes[bucketStart[x * gridRes + y]++] = i;
+	}
+	for (int b = bucketCount; b > 0; --b)
+		bucketStart[b] = bucketStart[b-1];
+	bucketStart[0] = 0;
+}
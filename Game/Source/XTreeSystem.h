@@ -2,28 +2,50 @@
 
 #import "XMath.h"
 #import "XNode.h"
+#import "XGL.h"
+#import "XTreePlacement.h"
+#import "XTreeLOD.h"
 @class XTexture;
 @class XTerrain;
 @class XCamera;
-//@class XTreeBatch;
 
-#define TREE_BATCH_GRID_SIZE 4 //MUST be power-of-2 value
-#define MAX_TREES_PER_BATCH 100
+// Trees are grouped into a grid of batches, whose resolution is chosen from the number of trees
+// (a power of 2, giving about TREE_BATCH_TARGET_TREES trees per batch), and every batch is drawn at
+// one of three levels of detail depending on its distance from the camera:
+//  - near batches draw every tree as two crossed quads, from a static vertex buffer
+//  - mid range batches draw one camera facing quad (impostor) per tree, generated every frame and
+//    streamed together through one vertex buffer
+//  - far batches draw a static buffer of merged "cards": one quad for every other tree, enlarged to
+//    keep the same coverage, facing along whichever axis is closer to the view direction
+// Batches have no tree limit; ones larger than the 16-bit index range are drawn in several calls.
+//
+// Trees are counting sorted by batch once (see TreePlacement_bucketTrees), so every batch is built
+// from its own range of tree indexes. When individual trees are added, removed or moved, only the
+// batches containing them are rebuilt (see -treesChanged:treeCount:atPositions:count:).
+
+#define TREE_BATCH_TARGET_TREES 256
+#define TREE_BATCH_MAX_GRID_SIZE 64 //MUST be power-of-2 value
+#define TREE_MAX_DRAW_QUADS 16384 //(65536 vertexes, the most 16-bit indexes can address)
+#define TREE_IMPOSTOR_BUFFER_QUADS 4096
+#define TREE_CARD_SCALE 1.25f
 
 
 typedef struct {
-	XVector2 position;
-	XScalar size;
-	XAngle rotation;
-} XTreeInstance;
-
-typedef struct {
-	unsigned int glVertexBuffer;
-	int treeCount;
+	unsigned int glVertexBuffer; //crossed quads
+	unsigned int glCardBuffer; //far cards: X aligned quads, then Z aligned quads
+	int treeCount, cardCount;
+	XTreeBillboard *billboards; //(kept to generate impostors from)
 } XTreeBatch;
 
-
-void TreeSystem_populateTreeArrayProcedurally(XTreeInstance *array, int treeCount, float minTreeSize, float maxTreeSize, XScalarRect area);
+// counters, accumulated every frame until reset by the owner
+typedef struct {
+	int frames;
+	int batches[XTreeLOD_Count];
+	int trees[XTreeLOD_Count];
+	int vertexes[XTreeLOD_Count];
+	int generatedVertexes; //impostor vertexes written on the CPU
+	double impostorTime; //(only measured with XSCENE_BENCHMARK defined, see XScene.h)
+} XTreeStats;
 
 
 @interface XTreeSystem : XNode {
@@ -32,26 +54,48 @@ void TreeSystem_populateTreeArrayProcedurally(XTreeInstance *array, int treeCoun
 	XCamera *camera;
 
 	int batchGridRes;
-	XTreeBatch batchVertexBufferGrid[TREE_BATCH_GRID_SIZE][TREE_BATCH_GRID_SIZE];
+	XTreeBatch *batches; //batchGridRes x batchGridRes, see -batchX:Y:
 	XVector3 batchSize;
 	
-	size_t sharedIndexCount, sharedTexcoordCount;
+	int sharedQuadCount;
 	unsigned int sharedGLIndexBuffer, sharedGLTexcoordBuffer;
 	
+	unsigned int impostorGLVertexBuffer;
+	XTreeVertex *impostorVertexes;
+	int impostorQuadCount;
+	XVector3 impostorRight;
+	
 	XTreeInstance *treeArray;
 	int treeCount;
+	int *bucketStart; //(batchGridRes^2 + 1 entries)
+	int *bucketTrees; //tree indexes sorted by batch
+	
+	XTreeStats stats;
+@public
+	XScalar nearDistance, farDistance; //LOD ranges (horizontal distance to a batch)
 }
 
 @property(retain) XTexture *texture;
 @property(retain) XTerrain *terrain;
+@property(readonly) int batchGridRes;
+@property(readonly) XTreeStats stats;
 
 -(id)init;
 -(void)dealloc;
 
 -(void)setTreesArrayPointer:(XTreeInstance*)trees treeCount:(int)count;
--(void)updateTreesRegion:(XIntRect)region;
+-(void)updateTreesRegion:(XIntRect)region; //(in batches)
+-(void)updateAllTrees;
+
+// Call after adding, removing or moving individual trees (the array may have been reallocated);
+// positions are the old and new positions of the changed trees, and only their batches are rebuilt.
+-(void)treesChanged:(XTreeInstance*)trees treeCount:(int)count atPositions:(XVector2*)positions count:(int)positionCount;
+
+-(void)resetStats;
 
 // private
+-(XTreeBatch*)batchX:(int)x Y:(int)y;
+-(void)bucketTrees;
 -(void)updateTreeBatchX:(int)x Y:(int)y;
 -(XBoundingBox)boundsOfBatchRegion:(XIntRect)region;
 -(void)renderRegion:(XIntRect)region;
@@ -4,13 +4,9 @@
 #import "XTexture.h"
 #import "XTerrain.h"
 #import "XCamera.h"
+#import "XScene.h"
 
 
-typedef struct {
-	XVector3 position;
-	XColorBytes color;
-} XTreeVertex;
-
 typedef struct {
 	GLbyte u, v;
 } XTreeTexcoord;
@@ -18,73 +14,120 @@ typedef struct {
 typedef GLushort XTreeIndex;
 
 
+@interface XTreeSystem (private)
+
+-(void)freeBatches;
+-(void)ensureSharedQuads:(int)quadCount;
+-(void)drawQuads:(GLuint)vertexBuffer first:(int)firstQuad count:(int)quadCount;
+-(void)addImpostors:(XTreeBatch*)batch;
+-(void)flushImpostors;
+
+@end
+
+
 @implementation XTreeSystem
 
-@synthesize terrain;
+@synthesize terrain, batchGridRes, stats;
 
 -(id)init
 {
 	if ((self = [super init])) {
-		for (int i = 0; i < TREE_BATCH_GRID_SIZE; ++i) {
-			for (int j = 0; j < TREE_BATCH_GRID_SIZE; ++j) {
-				batchVertexBufferGrid[i][j].glVertexBuffer = 0;
-				batchVertexBufferGrid[i][j].treeCount = 0;
-			}
-		}
-
-		sharedIndexCount = MAX_TREES_PER_BATCH * 6 * 2;
-		{
-			XTreeIndex *indexData = malloc(sizeof(XTreeIndex)*sharedIndexCount);
-			XTreeIndex *ptr = indexData;
-			for (size_t i = 0; i < MAX_TREES_PER_BATCH * 2; ++i) {
-				size_t o = i * 4;
-				*ptr++ = 0+o; *ptr++ = 1+o; *ptr++ = 2+o;
-				*ptr++ = 1+o; *ptr++ = 2+o; *ptr++ = 3+o;
-			}
-			glGenBuffers(1, &sharedGLIndexBuffer);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sharedGLIndexBuffer);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(XTreeIndex)*sharedIndexCount, indexData, GL_STATIC_DRAW);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-			free(indexData);
-		}
+		batchGridRes = 0;
+		batches = NULL;
+		sharedQuadCount = 0;
+		sharedGLIndexBuffer = 0;
+		sharedGLTexcoordBuffer = 0;
+		[self ensureSharedQuads:TREE_IMPOSTOR_BUFFER_QUADS];
 		
-		sharedTexcoordCount = MAX_TREES_PER_BATCH * 4 * 2;
-		{
-			XTreeTexcoord *texcoordData = malloc(sizeof(XTreeTexcoord)*sharedTexcoordCount);
-			XTreeTexcoord t00; t00.u = 0; t00.v = 0;
-			XTreeTexcoord t10; t10.u = 1; t10.v = 0;
-			XTreeTexcoord t01; t01.u = 0; t01.v = 1;
-			XTreeTexcoord t11; t11.u = 1; t11.v = 1;
-			XTreeTexcoord *ptr = texcoordData;
-			for (size_t i = 0; i < MAX_TREES_PER_BATCH * 2; ++i) {
-				*ptr++ = t00; *ptr++ = t10;
-				*ptr++ = t01; *ptr++ = t11;
-			}
-			glGenBuffers(1, &sharedGLTexcoordBuffer);
-			glBindBuffer(GL_ARRAY_BUFFER, sharedGLTexcoordBuffer);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(XTreeTexcoord)*sharedTexcoordCount, texcoordData, GL_STATIC_DRAW);
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-			free(texcoordData);
-		}
+		impostorVertexes = malloc(sizeof(XTreeVertex) * TREE_IMPOSTOR_BUFFER_QUADS * 4);
+		impostorQuadCount = 0;
+		glGenBuffers(1, &impostorGLVertexBuffer);
+		
+		nearDistance = 150;
+		farDistance = 500;
+		memset(&stats, 0, sizeof(stats));
 	}
 	return self;
 }
 
 -(void)dealloc
 {
+	[self freeBatches];
 	glDeleteBuffers(1, &sharedGLIndexBuffer);
 	glDeleteBuffers(1, &sharedGLTexcoordBuffer);
-	for (int i = 0; i < TREE_BATCH_GRID_SIZE; ++i) {
-		for (int j = 0; j < TREE_BATCH_GRID_SIZE; ++j) {
-			XTreeBatch *batch = &batchVertexBufferGrid[i][j];
-			if (batch->glVertexBuffer)
-				glDeleteBuffers(1, &batch->glVertexBuffer);
-		}
-	}
+	glDeleteBuffers(1, &impostorGLVertexBuffer);
+	free(impostorVertexes);
 	[texture mediaRelease];
 	[super dealloc];
 }
 
+-(void)freeBatches
+{
+	for (int i = 0; i < batchGridRes * batchGridRes; ++i) {
+		XTreeBatch *batch = &batches[i];
+		if (batch->glVertexBuffer)
+			glDeleteBuffers(1, &batch->glVertexBuffer);
+		if (batch->glCardBuffer)
+			glDeleteBuffers(1, &batch->glCardBuffer);
+		free(batch->billboards);
+	}
+	free(batches);
+	batches = NULL;
+	free(bucketStart);
+	bucketStart = NULL;
+	free(bucketTrees);
+	bucketTrees = NULL;
+	batchGridRes = 0;
+}
+
+// makes the shared index and texcoord buffers cover at least quadCount quads
+-(void)ensureSharedQuads:(int)quadCount
+{
+	if (quadCount > TREE_MAX_DRAW_QUADS)
+		quadCount = TREE_MAX_DRAW_QUADS;
+	if (quadCount <= sharedQuadCount)
+		return;
+	sharedQuadCount = quadCount;
+	
+	{
+		size_t indexCount = sharedQuadCount * 6;
+		XTreeIndex *indexData = malloc(sizeof(XTreeIndex)*indexCount);
+		XTreeIndex *ptr = indexData;
+		for (size_t i = 0; i < sharedQuadCount; ++i) {
+			size_t o = i * 4;
+			*ptr++ = 0+o; *ptr++ = 1+o; *ptr++ = 2+o;
+			*ptr++ = 1+o; *ptr++ = 2+o; *ptr++ = 3+o;
+		}
+		if (!sharedGLIndexBuffer)
+			glGenBuffers(1, &sharedGLIndexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sharedGLIndexBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(XTreeIndex)*indexCount, indexData, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		free(indexData);
+	}
+	
+	{
+		size_t texcoordCount = sharedQuadCount * 4;
+		XTreeTexcoord *texcoordData = malloc(sizeof(XTreeTexcoord)*texcoordCount);
+		XTreeTexcoord t00; t00.u = 0; t00.v = 0;
+		XTreeTexcoord t10; t10.u = 1; t10.v = 0;
+		XTreeTexcoord t01; t01.u = 0; t01.v = 1;
+		XTreeTexcoord t11; t11.u = 1; t11.v = 1;
+		XTreeTexcoord *ptr = texcoordData;
+		for (size_t i = 0; i < sharedQuadCount; ++i) {
+			*ptr++ = t00; *ptr++ = t10;
+			*ptr++ = t01; *ptr++ = t11;
+		}
+		if (!sharedGLTexcoordBuffer)
+			glGenBuffers(1, &sharedGLTexcoordBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, sharedGLTexcoordBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(XTreeTexcoord)*texcoordCount, texcoordData, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		free(texcoordData);
+	}
+	xglNotifyMeshBindingsChanged();
+}
+
 -(void)setTexture:(XTexture*)tex
 {
 	[terrain release];
@@ -102,143 +145,190 @@ typedef GLushort XTreeIndex;
 {
 	treeArray = trees;
 	treeCount = count;
+	
+	// size the batch grid for the number of trees
+	[self freeBatches];
+	int res = 1;
+	while (res < TREE_BATCH_MAX_GRID_SIZE && treeCount > res * res * TREE_BATCH_TARGET_TREES)
+		res *= 2;
+	batchGridRes = res;
+	batches = calloc(batchGridRes * batchGridRes, sizeof(XTreeBatch));
+	bucketStart = malloc(sizeof(int) * (batchGridRes * batchGridRes + 1));
+	bucketTrees = malloc(sizeof(int) * (treeCount > 0 ? treeCount : 1));
+	[self bucketTrees];
+}
+
+-(void)bucketTrees
+{
+	XScalarRect area;
+	area.left = boundingBox.min.x; area.right = boundingBox.max.x;
+	area.top = boundingBox.min.z; area.bottom = boundingBox.max.z;
+	TreePlacement_bucketTrees(treeArray, treeCount, area, batchGridRes, bucketStart, bucketTrees);
+}
+
+-(void)treesChanged:(XTreeInstance*)trees treeCount:(int)count atPositions:(XVector2*)positions count:(int)positionCount
+{
+	if (batchGridRes == 0) {
+		[self setTreesArrayPointer:trees treeCount:count];
+		[self updateAllTrees];
+		return;
+	}
+	treeArray = trees;
+	if (count != treeCount) {
+		treeCount = count;
+		bucketTrees = realloc(bucketTrees, sizeof(int) * (treeCount > 0 ? treeCount : 1));
+	}
+	[self bucketTrees];
+	
+	// rebuild each affected batch once (cells computed exactly as TreePlacement_bucketTrees does)
+	XScalar cellWidth = (boundingBox.max.x - boundingBox.min.x) / batchGridRes;
+	XScalar cellHeight = (boundingBox.max.z - boundingBox.min.z) / batchGridRes;
+	for (int i = 0; i < positionCount; ++i) {
+		int x = TreePlacement_gridCoordinate(positions[i].x, boundingBox.min.x, cellWidth, batchGridRes);
+		int y = TreePlacement_gridCoordinate(positions[i].y, boundingBox.min.z, cellHeight, batchGridRes);
+		BOOL done = NO;
+		for (int j = 0; j < i && !done; ++j) {
+			done = (TreePlacement_gridCoordinate(positions[j].x, boundingBox.min.x, cellWidth, batchGridRes) == x
+				 && TreePlacement_gridCoordinate(positions[j].y, boundingBox.min.z, cellHeight, batchGridRes) == y);
+		}
+		if (!done)
+			[self updateTreeBatchX:x Y:y];
+	}
+}
+
+-(XTreeBatch*)batchX:(int)x Y:(int)y
+{
+	return &batches[x * batchGridRes + y];
+}
+
+-(void)updateAllTrees
+{
+	XIntRect region;
+	region.left = 0; region.right = batchGridRes-1;
+	region.top = 0; region.bottom = batchGridRes-1;
+	[self updateTreesRegion:region];
 }
 
 -(void)updateTreesRegion:(XIntRect)region
 {
+	if (batchGridRes == 0)
+		return;
 	if (region.left < 0) region.left = 0;
-	else if (region.left > TREE_BATCH_GRID_SIZE-1) region.left = TREE_BATCH_GRID_SIZE-1;
+	else if (region.left > batchGridRes-1) region.left = batchGridRes-1;
 	if (region.right < 0) region.right = 0;
-	else if (region.right > TREE_BATCH_GRID_SIZE-1) region.right = TREE_BATCH_GRID_SIZE-1;
+	else if (region.right > batchGridRes-1) region.right = batchGridRes-1;
 	if (region.top < 0) region.top = 0;
-	else if (region.top > TREE_BATCH_GRID_SIZE-1) region.top = TREE_BATCH_GRID_SIZE-1;
+	else if (region.top > batchGridRes-1) region.top = batchGridRes-1;
 	if (region.bottom < 0) region.bottom = 0;
-	else if (region.bottom > TREE_BATCH_GRID_SIZE-1) region.bottom = TREE_BATCH_GRID_SIZE-1;
+	else if (region.bottom > batchGridRes-1) region.bottom = batchGridRes-1;
 	
-	XScalar invGridSize = 1.0 / TREE_BATCH_GRID_SIZE;
+	XScalar invGridSize = 1.0 / batchGridRes;
 	batchSize.x = (boundingBox.max.x - boundingBox.min.x) * invGridSize;
 	batchSize.y = (boundingBox.max.y - boundingBox.min.y);
 	batchSize.z = (boundingBox.max.z - boundingBox.min.z) * invGridSize;
 	
+#ifdef XSCENE_BENCHMARK
+	CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+#endif
 	for (int y = region.top; y <= region.bottom; ++y) {
 		for (int x = region.left; x <= region.right; ++x) {
 			[self updateTreeBatchX:x Y:y];
 		}
 	}
+#ifdef XSCENE_BENCHMARK
+	CFTimeInterval buildTime = CFAbsoluteTimeGetCurrent() - startTime;
+	startTime = CFAbsoluteTimeGetCurrent();
+	[self bucketTrees];
+	CFTimeInterval bucketTime = CFAbsoluteTimeGetCurrent() - startTime;
+	NSLog(@"Trees: built %d batches (%dx%d grid, %d trees) in %.2f ms; bucketing all trees takes %.2f ms",
+		  (region.right - region.left + 1) * (region.bottom - region.top + 1), batchGridRes, batchGridRes, treeCount, buildTime * 1000.0, bucketTime * 1000.0);
+#endif
 }
 
 -(void)updateTreeBatchX:(int)x Y:(int)y
 {
-	XIntRect region;
-	region.left = x; region.right = x;
-	region.top = y; region.bottom = y;
-	XBoundingBox bounds = [self boundsOfBatchRegion:region];
-
-	XTreeBatch *batch = &batchVertexBufferGrid[x][y];
-	
-	GLuint vBuff = batch->glVertexBuffer;
-	if (vBuff) {
-		glDeleteBuffers(1, &vBuff);
-		vBuff = 0;
+	XTreeBatch *batch = [self batchX:x Y:y];
+	if (batch->glVertexBuffer) {
+		glDeleteBuffers(1, &batch->glVertexBuffer);
+		batch->glVertexBuffer = 0;
 	}
+	if (batch->glCardBuffer) {
+		glDeleteBuffers(1, &batch->glCardBuffer);
+		batch->glCardBuffer = 0;
+	}
+	free(batch->billboards);
+	batch->billboards = NULL;
+	batch->treeCount = 0;
+	batch->cardCount = 0;
 	
-	XTreeInstance localTreeArray[MAX_TREES_PER_BATCH];
-	int localTreeCount = 0;
-	
-	for (int i = 0; i < treeCount; ++i) {
-		XTreeInstance *tree = &treeArray[i];
-		if (tree->position.x >= bounds.min.x && tree->position.x <= bounds.max.x
-			&& tree->position.y >= bounds.min.z && tree->position.y <= bounds.max.z)
-		{
-			if (localTreeCount >= MAX_TREES_PER_BATCH)
-				break;
-			localTreeArray[localTreeCount] = *tree;
-			++localTreeCount;
-		}
+	// place the trees of this batch on the terrain
+	int bucket = x * batchGridRes + y;
+	int localTreeCount = bucketStart[bucket+1] - bucketStart[bucket];
+	if (localTreeCount == 0)
+		return;
+	batch->billboards = malloc(sizeof(XTreeBillboard) * localTreeCount);
+	XTreeBillboard *billboard = batch->billboards;
+	for (int i = bucketStart[bucket]; i < bucketStart[bucket+1]; ++i) {
+		XTreeInstance *tree = &treeArray[bucketTrees[i]];
+		
+		XVector3 pos;
+		pos.x = tree->position.x;
+		pos.z = tree->position.y;
+		pos.y = 0;
+		XTerrainIntersection intersection = [terrain intersectTerrainVerticallyAt:&pos];
+		pos.y = intersection.point.y;
+		
+		XColorBytes color; color.alpha = 0xFF;
+		float shade = xSaturate([terrain sampleTerrainLightmapAt:&pos] * 3);
+		color.red = color.green = color.blue = (unsigned char)((float)0xFF * shade);
+		
+		billboard->position = pos;
+		billboard->size = tree->size;
+		billboard->color = color;
+		++billboard;
 	}
+	batch->treeCount = localTreeCount;
 	
-	if (localTreeCount) {
+	// near geometry: two crossed quads per tree
+	{
 		int vertexCount = localTreeCount * 8;
 		XTreeVertex *vData = malloc(sizeof(XTreeVertex) * vertexCount);
 		XTreeVertex *vPtr = vData;
 		for (int i = 0; i < localTreeCount; ++i) {
-			XTreeInstance *tree = &localTreeArray[i];
-			
-			XVector3 pos;
-			pos.x = tree->position.x;
-			pos.z = tree->position.y;
-			pos.y = 0;
-			XTerrainIntersection intersection = [terrain intersectTerrainVerticallyAt:&pos];
-			pos.y = intersection.point.y;
-			
-			XColorBytes color; color.alpha = 0xFF;
-			float shade = xSaturate([terrain sampleTerrainLightmapAt:&pos] * 3);
-			color.red = color.green = color.blue = (unsigned char)((float)0xFF * shade);
-			
-			//XScalar cos = xCos(tree->rotation) * tree->size * 0.5f;
-			//XScalar sin = xSin(tree->rotation) * tree->size * 0.5f;
-			
-			vPtr->position.x = pos.x + -tree->size*0.5;
-			vPtr->position.y = pos.y + tree->size;
-			vPtr->position.z = pos.z + 0;
-			vPtr->color = color;
-			++vPtr;
-			
-			vPtr->position.x = pos.x + tree->size*0.5;
-			vPtr->position.y = pos.y + tree->size;
-			vPtr->position.z = pos.z + 0;
-			vPtr->color = color;
-			++vPtr;
-			
-			vPtr->position.x = pos.x + -tree->size*0.5;
-			vPtr->position.y = pos.y + 0;
-			vPtr->position.z = pos.z + 0;
-			vPtr->color = color;
-			++vPtr;
-			
-			vPtr->position.x = pos.x + tree->size*0.5;
-			vPtr->position.y = pos.y + 0;
-			vPtr->position.z = pos.z + 0;
-			vPtr->color = color;
-			++vPtr;
-			
-			
-			//cos = xCos(tree->rotation + xDegToRad(90)) * tree->size * 0.5f;
-			//sin = xSin(tree->rotation + xDegToRad(90)) * tree->size * 0.5f;
-
-			vPtr->position.x = pos.x + 0;
-			vPtr->position.y = pos.y + tree->size;
-			vPtr->position.z = pos.z + -tree->size*0.5;
-			vPtr->color = color;
-			++vPtr;
-			
-			vPtr->position.x = pos.x + 0;
-			vPtr->position.y = pos.y + tree->size;
-			vPtr->position.z = pos.z + tree->size*0.5;
-			vPtr->color = color;
-			++vPtr;
-			
-			vPtr->position.x = pos.x + 0;
-			vPtr->position.y = pos.y + 0;
-			vPtr->position.z = pos.z + -tree->size*0.5;
-			vPtr->color = color;
-			++vPtr;
-			
-			vPtr->position.x = pos.x + 0;
-			vPtr->position.y = pos.y + 0;
-			vPtr->position.z = pos.z + tree->size*0.5;
-			vPtr->color = color;
-			++vPtr;
+			billboard = &batch->billboards[i];
+			XScalar halfSize = billboard->size * 0.5f;
+			vPtr = TreeLOD_writeQuad(vPtr, &billboard->position, halfSize, 0, billboard->size, billboard->color);
+			vPtr = TreeLOD_writeQuad(vPtr, &billboard->position, 0, halfSize, billboard->size, billboard->color);
 		}
-		
-		glGenBuffers(1, &vBuff);
-		glBindBuffer(GL_ARRAY_BUFFER, vBuff);
+		glGenBuffers(1, &batch->glVertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, batch->glVertexBuffer);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(XTreeVertex) * vertexCount, vData, GL_STATIC_DRAW);
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		free(vData);
 	}
 	
-	batch->glVertexBuffer = vBuff;
-	batch->treeCount = localTreeCount;	
+	// far geometry: every other tree as an enlarged card, X aligned ones first, then Z aligned ones
+	{
+		int cardCount = (localTreeCount + 1) / 2;
+		int vertexCount = cardCount * 4 * 2;
+		XTreeVertex *vData = malloc(sizeof(XTreeVertex) * vertexCount);
+		XTreeVertex *xPtr = vData;
+		XTreeVertex *zPtr = vData + cardCount * 4;
+		for (int i = 0; i < localTreeCount; i += 2) {
+			billboard = &batch->billboards[i];
+			XScalar size = billboard->size * TREE_CARD_SCALE;
+			xPtr = TreeLOD_writeQuad(xPtr, &billboard->position, size * 0.5f, 0, size, billboard->color);
+			zPtr = TreeLOD_writeQuad(zPtr, &billboard->position, 0, size * 0.5f, size, billboard->color);
+		}
+		glGenBuffers(1, &batch->glCardBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, batch->glCardBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(XTreeVertex) * vertexCount, vData, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		free(vData);
+		batch->cardCount = cardCount;
+	}
+	
+	[self ensureSharedQuads:localTreeCount * 2];
 }
 
 -(XBoundingBox)boundsOfBatchRegion:(XIntRect)region
@@ -253,40 +343,45 @@ typedef GLushort XTreeIndex;
 	return regionAABB;
 }
 
--(NSString*)getRenderGroupID
+-(void)resetStats
 {
-	return @"2.5_trees";
+	memset(&stats, 0, sizeof(stats));
+}
+
+-(XRenderSortKey)getRenderGroupKey
+{
+	return xRenderGroupKey(XRenderPass_Trees, 0, 0, 0);
 }
 
 -(void)beginRenderGroup
 {
-	glDisable(GL_LIGHTING);
-	glDisableClientState(GL_NORMAL_ARRAY);
-	glDisable(GL_CULL_FACE);
+	xglDisable(GL_LIGHTING);
+	xglDisableClientState(GL_NORMAL_ARRAY);
+	xglDisable(GL_CULL_FACE);
 	
 	if (texture) {
-		glActiveTexture(GL_TEXTURE0);
+		xglActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, texture.glTexture);
-		glEnable(GL_TEXTURE_2D);
+		xglEnable(GL_TEXTURE_2D);
 
-		glAlphaFunc(GL_GREATER, 0.75f);
-		glEnable(GL_ALPHA_TEST);
-		glDisable(GL_BLEND);
+		xglAlphaFunc(GL_GREATER, 0.75f);
+		xglEnable(GL_ALPHA_TEST);
+		xglDisable(GL_BLEND);
 	}
 }
 
 -(void)endRenderGroup
 {
-	glEnable(GL_CULL_FACE);
-	glDisable(GL_ALPHA_TEST);
-	glEnable(GL_LIGHTING);
-	glDisableClientState(GL_VERTEX_ARRAY);
-	glDisableClientState(GL_COLOR_ARRAY);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	xglEnable(GL_CULL_FACE);
+	xglDisable(GL_ALPHA_TEST);
+	xglEnable(GL_LIGHTING);
+	xglDisableClientState(GL_VERTEX_ARRAY);
+	xglDisableClientState(GL_COLOR_ARRAY);
+    xglDisableClientState(GL_TEXTURE_COORD_ARRAY);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	if (texture) {
-		glActiveTexture(GL_TEXTURE0);
+		xglActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 	xglNotifyTextureBindingsChanged();
@@ -295,20 +390,85 @@ typedef GLushort XTreeIndex;
 
 -(void)render:(XCamera*)cam
 {
+	if (batchGridRes == 0)
+		return;
 	camera = cam;
 	
-	XScalar invGridSize = 1.0 / TREE_BATCH_GRID_SIZE;
+	XScalar invGridSize = 1.0 / batchGridRes;
 	batchSize.x = (boundingBox.max.x - boundingBox.min.x) * invGridSize;
 	batchSize.y = (boundingBox.max.y - boundingBox.min.y);
 	batchSize.z = (boundingBox.max.z - boundingBox.min.z) * invGridSize;
 	
+	// impostors face the camera, but stay upright
+	impostorRight = xCrossProduct_Vec3(&cam->lookVector, &cam->upVector);
+	impostorRight.y = 0;
+	if (xNormalize_Vec3(&impostorRight) == 0)
+		impostorRight.x = 1;
+	
 	XIntRect region;
 	region.left = 0;
-	region.right = TREE_BATCH_GRID_SIZE-1;
+	region.right = batchGridRes-1;
 	region.top = 0;
-	region.bottom = TREE_BATCH_GRID_SIZE-1;
+	region.bottom = batchGridRes-1;
 	
 	[self renderRegion:region];
+	[self flushImpostors];
+	++stats.frames;
+}
+
+-(void)drawQuads:(GLuint)vertexBuffer first:(int)firstQuad count:(int)quadCount
+{
+	glBindBuffer(GL_ARRAY_BUFFER, sharedGLTexcoordBuffer);
+	xglEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_BYTE, sizeof(XTreeTexcoord), 0);
+	
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sharedGLIndexBuffer);
+	
+	// (in as many calls as the shared index buffer requires)
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	xglEnableClientState(GL_VERTEX_ARRAY);
+	xglEnableClientState(GL_COLOR_ARRAY);
+	while (quadCount > 0) {
+		int drawCount = (quadCount < sharedQuadCount) ? quadCount : sharedQuadCount;
+		size_t byteOffset = firstQuad * 4 * sizeof(XTreeVertex);
+		glVertexPointer(3, GL_FLOAT, sizeof(XTreeVertex), (void*)(byteOffset + offsetof(XTreeVertex,position)));
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(XTreeVertex), (void*)(byteOffset + offsetof(XTreeVertex,color)));
+		glDrawElements(GL_TRIANGLES, drawCount * 6, GL_UNSIGNED_SHORT, (void*)0);
+		firstQuad += drawCount;
+		quadCount -= drawCount;
+	}
+}
+
+-(void)addImpostors:(XTreeBatch*)batch
+{
+#ifdef XSCENE_BENCHMARK
+	CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+#endif
+	int i = 0;
+	while (i < batch->treeCount) {
+		if (impostorQuadCount >= TREE_IMPOSTOR_BUFFER_QUADS)
+			[self flushImpostors];
+		int count = MIN(batch->treeCount - i, TREE_IMPOSTOR_BUFFER_QUADS - impostorQuadCount);
+		TreeLOD_writeImpostors(&impostorVertexes[impostorQuadCount * 4], &batch->billboards[i], count, &impostorRight);
+		impostorQuadCount += count;
+		i += count;
+	}
+	stats.generatedVertexes += batch->treeCount * 4;
+#ifdef XSCENE_BENCHMARK
+	stats.impostorTime += CFAbsoluteTimeGetCurrent() - startTime;
+#endif
+}
+
+-(void)flushImpostors
+{
+	if (impostorQuadCount == 0)
+		return;
+	
+	// respecifying the buffer orphans its previous contents, so earlier draws don't stall this
+	glBindBuffer(GL_ARRAY_BUFFER, impostorGLVertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(XTreeVertex) * impostorQuadCount * 4, impostorVertexes, GL_DYNAMIC_DRAW);
+	[self drawQuads:impostorGLVertexBuffer first:0 count:impostorQuadCount];
+	impostorQuadCount = 0;
 }
 
 -(void)renderRegion:(XIntRect)region
@@ -329,22 +489,28 @@ typedef GLushort XTreeIndex;
 		if (region.left == region.right) {
 			// cannot subdivide visibility checks any further, so render the batch
 			assert(region.top == region.bottom);
-			XTreeBatch *batch = &batchVertexBufferGrid[region.left][region.top];
-			if (batch->glVertexBuffer) {
-				glBindBuffer(GL_ARRAY_BUFFER, batch->glVertexBuffer);
-				glEnableClientState(GL_VERTEX_ARRAY);
-				glVertexPointer(3, GL_FLOAT, sizeof(XTreeVertex), (void*)offsetof(XTreeVertex,position));
-				glEnableClientState(GL_COLOR_ARRAY);
-				glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(XTreeVertex), (void*)offsetof(XTreeVertex,color));
-				
-				glBindBuffer(GL_ARRAY_BUFFER, sharedGLTexcoordBuffer);
-				glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-				glTexCoordPointer(2, GL_BYTE, sizeof(XTreeTexcoord), 0);
-				
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sharedGLIndexBuffer);
-				
-				glDrawElements(GL_TRIANGLES, batch->treeCount * 12, GL_UNSIGNED_SHORT, (void*)0);
+			XTreeBatch *batch = [self batchX:region.left Y:region.top];
+			if (batch->treeCount == 0)
+				return;
+			
+			// choose the level of detail by horizontal distance to the batch
+			XTreeLOD lod = TreeLOD_select(&regionAABB, &camera->origin, nearDistance, farDistance);
+			if (lod == XTreeLOD_Near) {
+				[self drawQuads:batch->glVertexBuffer first:0 count:batch->treeCount * 2];
+			}
+			else if (lod == XTreeLOD_Mid) {
+				[self addImpostors:batch];
 			}
+			else {
+				// draw the cards facing closest to the camera
+				XScalar viewX = (regionAABB.min.x + regionAABB.max.x) * 0.5f - camera->origin.x;
+				XScalar viewZ = (regionAABB.min.z + regionAABB.max.z) * 0.5f - camera->origin.z;
+				int first = (xAbs(viewX) > xAbs(viewZ)) ? batch->cardCount : 0;
+				[self drawQuads:batch->glCardBuffer first:first count:batch->cardCount];
+			}
+			stats.vertexes[lod] += TreeLOD_vertexCount(lod, batch->treeCount);
+			++stats.batches[lod];
+			stats.trees[lod] += batch->treeCount;
 		}
 		else {
 			// subdivide region into 4 quads
@@ -376,8 +542,8 @@ typedef GLushort XTreeIndex;
 			XIntRect *sortedSubRegions[4];
 			for (int i = 0; i < 4; ++i)
 				sortedSubRegions[i] = &subRegion[i];
-			int cameraX = TREE_BATCH_GRID_SIZE * (camera->origin.x - boundingBox.min.x) / (boundingBox.max.x - boundingBox.min.x);
-			int cameraZ = TREE_BATCH_GRID_SIZE * (camera->origin.z - boundingBox.min.z) / (boundingBox.max.z - boundingBox.min.z);
+			int cameraX = batchGridRes * (camera->origin.x - boundingBox.min.x) / (boundingBox.max.x - boundingBox.min.x);
+			int cameraZ = batchGridRes * (camera->origin.z - boundingBox.min.z) / (boundingBox.max.z - boundingBox.min.z);
 			BOOL sorted = NO;
 			while (!sorted) {
 				sorted = YES;
@@ -408,46 +574,3 @@ typedef GLushort XTreeIndex;
 
 
 @end
-
-
-void TreeSystem_populateTreeArrayProcedurally(XTreeInstance *array, int treeCount, float minTreeSize, float maxTreeSize, XScalarRect area)
-{
-	XScalar clusterSpacing = (area.right - area.left) * 0.025f;
-	
-	for (int i = 0; i < treeCount; ++i) {
-		XTreeInstance *instance = &array[i];
-
-		// misc. initialization
-		instance->size = xRangeRand(minTreeSize, maxTreeSize);
-		instance->rotation = xRangeRand(xDegToRad(-180), xDegToRad(180));
-		
-		// random clustered position within the bounds
-		BOOL cluster = NO;
-		if (xRand() < 0.4f)
-			cluster = YES;
-		if (cluster) {
-			XTreeInstance *clusterPoint = nil;
-			if (i > 0)
-				clusterPoint = &array[i-1];
-			if (!clusterPoint)
-				cluster = NO;
-			else {
-				int safetyCount = 0;
-				BOOL inBounds = YES;
-				do {
-					instance->position.x = clusterPoint->position.x + xRangeRand(-clusterSpacing, clusterSpacing);
-					instance->position.y = clusterPoint->position.y + xRangeRand(-clusterSpacing, clusterSpacing);
-					if (instance->position.x < area.left || instance->position.x > area.right || instance->position.y < area.top || instance->position.y > area.bottom)
-						inBounds = NO;
-					if (++safetyCount > 200) break;
-				} while (inBounds);
-			}
-		}
-		if (!cluster) {
-			instance->position.x = xRangeRand(area.left, area.right);
-			instance->position.y = xRangeRand(area.top, area.bottom);
-		}
-	}	
-}
-
-
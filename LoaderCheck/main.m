@@ -0,0 +1,211 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// LoaderCheck drives background resource loading (see XResourceLoader.h) the way a level load does, without
+// a GL context: it requests a set of stub textures from an XMediaGroup, which the worker threads "decode"
+// (sleeping for a while, as reading a file would), then finishes them once per frame under a time budget
+// with the recording device on top of the null device. It checks that every request finishes with its
+// texture uploaded once, that a second request for a texture which is already loading joins the first
+// (sharing its resource, and holding a reference of its own), and that a cancelled request never uploads.
+//
+// Builds as a Foundation command line tool, together with the following shared game sources:
+//   Game/Source/XMediaGroup.m, Game/Source/XResourceLoader.m, Game/Source/XResourceTable.m,
+//   Game/Source/XRenderDevice.m, Game/Source/XScript.m, Game/Source/XTime.m, Game/Source/XMath.m
+// (there are no OpenGL ES headers on the Mac, so the render device is built headless)
+
+#import "../Game/Source/XMediaGroup.h"
+#import "../Game/Source/XResourceLoader.h"
+#import "../Game/Source/XRenderDevice.h"
+#import <libkern/OSAtomic.h>
+#import <stdio.h>
+#import <unistd.h>
+
+#define STUB_TEXTURE_SIZE 128
+#define STUB_TEXTURE_BYTES (STUB_TEXTURE_SIZE * STUB_TEXTURE_SIZE * 2)
+#define MAX_REQUESTS 256
+#define MAX_FRAMES 10000
+
+static volatile int32_t preparedCount = 0;
+static int prepareMicroseconds = 5000;
+
+// A texture which "loads" any filename: the worker thread makes up RGBA4444 pixels, and the render thread
+// uploads them (through the current render device).
+@interface StubTexture : XResource {
+	GLuint glTexture;
+}
+@end
+
+@implementation StubTexture
+
++(id)newPreparedDataForFile:(NSString*)filename usingMedia:(XMediaGroup*)media
+{
+	usleep(prepareMicroseconds);
+	NSMutableData *pixels = [[NSMutableData alloc] initWithLength:STUB_TEXTURE_BYTES];
+	memset([pixels mutableBytes], (int)([filename hash] & 0xFF), STUB_TEXTURE_BYTES);
+	OSAtomicIncrement32Barrier(&preparedCount);
+	return pixels;
+}
+
+-(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media preparedData:(id)data
+{
+	if ((self = [super initWithFile:filename usingMedia:media])) {
+		// (loaded by retainResource rather than by a request, so prepare it here)
+		NSData *pixels = data ? [data retain] : [StubTexture newPreparedDataForFile:filename usingMedia:media];
+		glGenTextures(1, &glTexture);
+		glBindTexture(GL_TEXTURE_2D, glTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, STUB_TEXTURE_SIZE, STUB_TEXTURE_SIZE, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, [pixels bytes]);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		memorySize = [pixels length];
+		memoryType = XResourceMemory_Texture;
+		[pixels release];
+	}
+	return self;
+}
+
+-(id)initWithFile:(NSString*)filename usingMedia:(XMediaGroup*)media
+{
+	return [self initWithFile:filename usingMedia:media preparedData:nil];
+}
+
+-(void)dealloc
+{
+	glDeleteTextures(1, &glTexture);
+	[super dealloc];
+}
+
+@end
+
+
+int c_main(int argc, const char *argv[]);
+int main(int argc, const char *argv[])
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+	int ret = c_main(argc, argv);
+	[autoreleasePool release];
+	return ret;
+}
+
+static void printUsage()
+{
+	printf("Usage: loadercheck [-n requests] [-b budgetMilliseconds] [-p prepareMilliseconds]\n");
+	printf("Loads stub textures in the background, finishing them once per frame within the time budget\n");
+	printf("(16 requests, a 2 ms budget and 5 ms to prepare each by default)\n\n");
+}
+
+int c_main(int argc, const char *argv[])
+{
+	int requestCount = 16;
+	double budget = 0.002;
+	for (int i = 1; i < argc; ++i) {
+		if (argv[i][0] != '-' || argv[i][1] == 0 || argv[i][2] != 0 || i + 1 >= argc) {
+			printUsage();
+			return 1;
+		}
+		char option = argv[i][1];
+		const char *value = argv[++i];
+		if (option == 'n')
+			requestCount = atoi(value);
+		else if (option == 'b')
+			budget = atof(value) / 1000.0;
+		else if (option == 'p')
+			prepareMicroseconds = (int)(atof(value) * 1000.0);
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	if (requestCount < 2 || requestCount > MAX_REQUESTS || budget <= 0 || prepareMicroseconds < 0) {
+		printUsage();
+		return 1;
+	}
+
+	xglSetRenderDevice(xglRecordingDevice(xglNullDevice()));
+	xglResetRenderStats();
+	XMediaGroup *media = [[XMediaGroup alloc] init];
+
+	// request every texture, then the first one again (which should join the first request), and cancel
+	// the second one right away
+	XResourceRequest *requests[MAX_REQUESTS];
+	for (int i = 0; i < requestCount; ++i)
+		requests[i] = [media newRequestForResource:[StubTexture class] fromFile:[NSString stringWithFormat:@"Media/Stub/%d.tga", i]];
+	XResourceRequest *joiningRequest = [media newRequestForResource:[StubTexture class] fromFile:@"Media/Stub/0.tga"];
+	BOOL joined = (joiningRequest.joinedRequest == requests[0]);
+	XResourceRequest *cancelledRequest = requests[1];
+	[cancelledRequest cancel];
+
+	// finish them a frame at a time
+	int frames = 0, remaining = requestCount + 1;
+	double worstFrame = 0, totalFinishTime = 0;
+	while (remaining > 0 && frames < MAX_FRAMES) {
+		CFTimeInterval startTime = CFAbsoluteTimeGetCurrent();
+		remaining = [media finishRequestsWithTimeBudget:budget];
+		double finishTime = CFAbsoluteTimeGetCurrent() - startTime;
+		totalFinishTime += finishTime;
+		if (finishTime > worstFrame)
+			worstFrame = finishTime;
+		++frames;
+		usleep(1000);
+	}
+	XRenderStats stats = xglGetRenderStats();
+	XMediaMemoryStats memoryStats = media.memoryStats;
+
+	printf("%d requests (+1 joining, 1 cancelled) finished in %d frames: %.3f ms finishing in total, %.3f ms at most in a frame (budget %.3f ms)\n",
+		requestCount, frames, totalFinishTime * 1000.0, worstFrame * 1000.0, budget * 1000.0);
+	printf("prepared %d files, uploaded %d textures (%d bytes); %d resources resident (%d bytes)\n",
+		(int)preparedCount, stats.textureUploads, stats.textureUploadBytes, memoryStats.resources, (int)memoryStats.totalBytes);
+
+	int failures = 0;
+	if (remaining > 0) {
+		printf("FAILED: %d requests still pending after %d frames\n", remaining, frames);
+		++failures;
+	}
+	for (int i = 0; i < requestCount; ++i) {
+		XResourceRequest *request = requests[i];
+		BOOL loaded = (request.resource != nil);
+		if (!request.done || loaded == (request == cancelledRequest)) {
+			printf("FAILED: request for \"%s\" is %s\n", [request.filename UTF8String],
+				!request.done ? "not done" : (loaded ? "loaded, but was cancelled" : "done without its resource"));
+			++failures;
+		}
+	}
+	if (stats.textureUploads != requestCount - 1 || stats.textureUploadBytes != (requestCount - 1) * STUB_TEXTURE_BYTES) {
+		printf("FAILED: expected %d texture uploads (every request but the cancelled one, once each)\n", requestCount - 1);
+		++failures;
+	}
+	if (memoryStats.resources != requestCount - 1 || memoryStats.bytes[XResourceMemory_Texture] != (size_t)(requestCount - 1) * STUB_TEXTURE_BYTES) {
+		printf("FAILED: expected %d resident textures\n", requestCount - 1);
+		++failures;
+	}
+	if (preparedCount > requestCount) {
+		printf("FAILED: files were prepared more than once\n");
+		++failures;
+	}
+
+	// the joining request shares the first one's resource, and keeps it alive by itself
+	XResource *shared = requests[0].resource;
+	if (!joined || shared == nil || !joiningRequest.done || joiningRequest.resource != shared || joiningRequest.joinedRequest != nil || shared->_refCount != 2) {
+		printf("FAILED: the second request for \"%s\" didn't join the first (reference count %d)\n",
+			[requests[0].filename UTF8String], shared ? shared->_refCount : 0);
+		++failures;
+	}
+	[requests[0] release];
+	requests[0] = nil;
+	if (shared && (shared->_refCount != 1 || media.memoryStats.deadResources != 0)) {
+		printf("FAILED: releasing the first request released the joining request's reference too\n");
+		++failures;
+	}
+	[joiningRequest release];
+
+	for (int i = 1; i < requestCount; ++i)
+		[requests[i] release];
+	[media freeDeadResourcesNow];
+	if (media.memoryStats.resources != 0 || media.memoryStats.totalBytes != 0) {
+		printf("FAILED: %d resources (%d bytes) left after releasing every request\n", media.memoryStats.resources, (int)media.memoryStats.totalBytes);
+		++failures;
+	}
+	[media release];
+
+	if (failures > 0)
+		return 1;
+	printf("all requests loaded as expected\n");
+	return 0;
+}
@@ -0,0 +1,95 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// ManifestScanner prints the preload manifest of every level in levels.list (see Game/Source/GMapManifest.h),
+// with the size of each file the device loads and the total per level.
+//
+// Builds as a Foundation command line tool, together with the following shared game sources:
+//   Game/Source/XScript.m, Game/Source/GMapManifest.m
+
+#import "../Game/Source/GMapManifest.h"
+#import "../Game/Source/XScript.h"
+#import <stdio.h>
+
+int c_main(int argc, const char *argv[]);
+int main(int argc, const char *argv[])
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+	int ret = c_main(argc, argv);
+	[autoreleasePool release];
+	return ret;
+}
+
+static const char *mediaName(GManifestMedia media)
+{
+	return (media == GManifestMedia_Common) ? "common" : "map";
+}
+
+int c_main(int argc, const char *argv[])
+{
+	BOOL summaryOnly = NO;
+	const char *rootFolder = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-s") == 0)
+			summaryOnly = YES;
+		else
+			rootFolder = argv[i];
+	}
+	if (rootFolder == NULL) {
+		printf("manifestscanner: No game folder specified\n\n");
+		printf("Usage: manifestscanner [-s] Game\n");
+		printf("Prints the preload manifest of each level listed in Game/Media/levels.list\n");
+		printf("  -s   only print the total size of each level\n\n");
+		return 1;
+	}
+
+	NSString *root = [NSString stringWithUTF8String:rootFolder];
+	XScriptNode *levelList = [[XScriptNode alloc] initWithPath:[root stringByAppendingPathComponent:@"Media/levels.list"]];
+	XScriptNode *mapFolderNode = [levelList getSubnodeByIndex:0];
+	if (mapFolderNode == nil) {
+		printf("manifestscanner: Could not read \"%s/Media/levels.list\"\n", rootFolder);
+		[levelList release];
+		return 1;
+	}
+	NSString *mapFolder = [@"Media/" stringByAppendingPathComponent:mapFolderNode.name];
+
+	int failures = 0;
+	unsigned long long allBytes = 0;
+	NSMutableArray *summary = [NSMutableArray array];
+	for (XScriptNode *mapFileNode in mapFolderNode.subnodes) {
+		NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+		NSString *mapFile = [mapFolder stringByAppendingPathComponent:mapFileNode.name];
+		GMapManifest *manifest = [[GMapManifest alloc] initWithMap:mapFile mediaRoot:root];
+
+		unsigned long long totalBytes = 0;
+		int missing = 0;
+		if (!summaryOnly)
+			printf("\n%s\n", [mapFile UTF8String]);
+		for (GManifestEntry *entry in manifest.entries) {
+			unsigned long long bytes = [manifest fileSizeOfEntry:entry];
+			if (bytes == 0)
+				++missing;
+			totalBytes += bytes;
+			if (!summaryOnly)
+				printf("  %-16s %-7s %9llu  %s%s\n", [entry.typeName UTF8String], mediaName(entry.media), bytes,
+					   [entry.filename UTF8String], (bytes == 0) ? "  (missing)" : "");
+		}
+		if (!summaryOnly)
+			printf("  %d resources, %llu bytes\n", (int)manifest.entries.count, totalBytes);
+		if (manifest.entries.count == 0 || missing > 0)
+			++failures;
+
+		[summary addObject:[NSString stringWithFormat:@"  %-16s %4d resources %10.1f KB%@", [mapFileNode.name UTF8String],
+			(int)manifest.entries.count, totalBytes / 1024.0, (missing > 0) ? [NSString stringWithFormat:@"  (%d missing)", missing] : @""]];
+		allBytes += totalBytes;
+		[manifest release];
+		[autoreleasePool release];
+	}
+
+	printf("\nTotal per level:\n");
+	for (NSString *line in summary)
+		printf("%s\n", [line UTF8String]);
+	printf("  %d levels, %.1f KB\n\n", (int)mapFolderNode.subnodes.count, allBytes / 1024.0);
+
+	[levelList release];
+	return (failures > 0) ? 1 : 0;
+}
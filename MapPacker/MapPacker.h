@@ -0,0 +1,40 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// MapPacker converts a map script and its media folder (heightmap.png, texturemap.png) into
+// a single ".xmap" bundle (see Game/Source/XMapBundle.h) which the game memory maps at load time.
+//
+// Every bundle is read back with XMapBundle once saved, and checked against what was packed.
+//
+// Builds as a Foundation command line tool, together with the following shared game sources:
+//   Game/Source/XScript.m, Game/Source/XTreePlacement.m, Game/Source/XTerrainGeometry.m,
+//   Game/Source/XMapBundle.m, Game/Source/XResourceTable.m
+// (and linked against the ApplicationServices framework for PNG decoding)
+
+#import "../Game/Source/XMapBundle.h"
+@class XScriptNode;
+
+
+@interface MapPacker : NSObject {
+	XScriptNode *script;
+	NSString *mapFolder;
+	
+	int terrainRes, chunkTileRes;
+	float *heights;
+	XTerrainVertex *chunkVertexes;
+	int chunkVertexCount;
+	float skirtHeight;
+	
+	unsigned char *shadowMap;
+	int shadowMapRes;
+	
+	XTreeInstance *trees;
+	int treeCount;
+}
+
+-(id)initWithMapFile:(const char*)filename;
+-(void)dealloc;
+
+-(BOOL)saveToFile:(const char*)filename;
+-(BOOL)verifyFile:(const char*)filename; //loads a saved bundle as the game does, and compares it with the packed data
+
+@end
@@ -0,0 +1,337 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "MapPacker.h"
+#import "../Game/Source/XScript.h"
+#import "../Game/Source/XResourceTable.h"
+#import <ApplicationServices/ApplicationServices.h>
+#import <stdio.h>
+
+#define MAP_SKIRT_SIZE 3.0f // must match the skirt size GGame uses when loading terrains without a bundle
+
+
+// loads a PNG image as 8-bit grayscale, scaled down to at most maxSize x maxSize (0 = any size),
+// exactly the way XTerrain converts images through a CGBitmapContext
+unsigned char *loadGrayscaleImage(NSString *path, int maxSize, int *outWidth, int *outHeight)
+{
+	CGDataProviderRef provider = CGDataProviderCreateWithFilename([path fileSystemRepresentation]);
+	if (provider == NULL) {
+		NSLog(@"Error loading image \"%@\": File not found", path);
+		return NULL;
+	}
+	CGImageRef image = CGImageCreateWithPNGDataProvider(provider, NULL, false, kCGRenderingIntentDefault);
+	CGDataProviderRelease(provider);
+	if (image == NULL) {
+		NSLog(@"Error loading image \"%@\": Could not decode PNG image", path);
+		return NULL;
+	}
+
+	int width = CGImageGetWidth(image);
+	int height = CGImageGetHeight(image);
+	if (maxSize > 0) {
+		if (width > maxSize) width = maxSize;
+		if (height > maxSize) height = maxSize;
+	}
+
+	unsigned char *data = (unsigned char*)malloc(width * height);
+	CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceGray();
+	CGContextRef imageContext = CGBitmapContextCreate(data, width, height, 8, width, colorSpace, kCGImageAlphaNone);
+	CGColorSpaceRelease(colorSpace);
+	if (imageContext == NULL) {
+		NSLog(@"Error loading image \"%@\": Could not create bitmap context", path);
+		CGImageRelease(image);
+		free(data);
+		return NULL;
+	}
+	CGContextDrawImage(imageContext, CGRectMake(0.0, 0.0, (CGFloat)width, (CGFloat)height), image);
+	CGContextRelease(imageContext);
+	CGImageRelease(image);
+
+	*outWidth = width;
+	*outHeight = height;
+	return data;
+}
+
+
+@interface MapPacker (private)
+
+-(BOOL)loadTerrain:(NSString*)folderPath;
+-(BOOL)loadShadowMap:(NSString*)folderPath;
+-(void)bakeTrees;
+
+@end
+
+
+@implementation MapPacker
+
+-(id)initWithMapFile:(const char*)filename
+{
+	if ((self = [super init])) {
+		NSString *mapPath = [NSString stringWithUTF8String:filename];
+		script = [[XScriptNode alloc] initWithPath:mapPath];
+		if (!script) {
+			[self release];
+			return nil;
+		}
+		XScriptNode *root = [script getSubnodeByName:@"map"];
+		NSString *mediaFolder = [[root getSubnodeByName:@"media_folder"] getValue:0];
+		if (!mediaFolder) {
+			NSLog(@"Error loading map: map/media_folder not specified");
+			[self release];
+			return nil;
+		}
+
+		// map scripts are located in Media/Maps/, and media folders are relative to Media/
+		NSString *mediaRoot = [[mapPath stringByDeletingLastPathComponent] stringByDeletingLastPathComponent];
+		NSString *folderPath = [mediaRoot stringByAppendingPathComponent:mediaFolder];
+		mapFolder = [[@"Media/" stringByAppendingString:mediaFolder] retain];
+
+		if (![self loadTerrain:folderPath] || ![self loadShadowMap:folderPath]) {
+			[self release];
+			return nil;
+		}
+		[self bakeTrees];
+	}
+	return self;
+}
+
+-(void)dealloc
+{
+	if (heights) free(heights);
+	if (chunkVertexes) free(chunkVertexes);
+	if (shadowMap) free(shadowMap);
+	if (trees) free(trees);
+	[mapFolder release];
+	[script release];
+	[super dealloc];
+}
+
+-(BOOL)loadTerrain:(NSString*)folderPath
+{
+	int width, height;
+	unsigned char *image = loadGrayscaleImage([folderPath stringByAppendingPathComponent:@"heightmap.png"], 0, &width, &height);
+	if (!image)
+		return NO;
+	int pow2Res = 1;
+	while (pow2Res+1 < width)
+		pow2Res *= 2;
+	if (width != height || width != pow2Res+1 || pow2Res < TERRAIN_CHUNK_GRID_SIZE) {
+		NSLog(@"Error loading terrain: Terrain heightmap must be square, with a power-of-two-plus-one resolution");
+		free(image);
+		return NO;
+	}
+	terrainRes = width;
+	chunkTileRes = (terrainRes-1) / TERRAIN_CHUNK_GRID_SIZE;
+
+	heights = (float*)malloc(terrainRes * terrainRes * sizeof(float));
+	for (int i = 0; i < terrainRes * terrainRes; ++i)
+		heights[i] = (float)image[i] / 255.0f;
+	free(image);
+
+	// pre-build all chunk meshes
+	skirtHeight = TerrainGeometry_skirtHeight(terrainRes, MAP_SKIRT_SIZE);
+	chunkVertexCount = TerrainGeometry_chunkVertexCount(chunkTileRes);
+	chunkVertexes = (XTerrainVertex*)malloc(TERRAIN_CHUNK_GRID_SIZE * TERRAIN_CHUNK_GRID_SIZE * chunkVertexCount * sizeof(XTerrainVertex));
+	for (int y = 0; y < TERRAIN_CHUNK_GRID_SIZE; ++y) {
+		for (int x = 0; x < TERRAIN_CHUNK_GRID_SIZE; ++x) {
+			XIntRect region;
+			region.left = chunkTileRes * x;
+			region.top = chunkTileRes * y;
+			region.right = chunkTileRes * (x+1);
+			region.bottom = chunkTileRes * (y+1);
+			XTerrainVertex *vertexes = chunkVertexes + (y * TERRAIN_CHUNK_GRID_SIZE + x) * chunkVertexCount;
+			TerrainGeometry_buildChunkVertexes(vertexes, heights, terrainRes, region, chunkTileRes, skirtHeight);
+		}
+	}
+	return YES;
+}
+
+-(BOOL)loadShadowMap:(NSString*)folderPath
+{
+	int width, height;
+	shadowMap = loadGrayscaleImage([folderPath stringByAppendingPathComponent:@"texturemap.png"], terrainRes, &width, &height);
+	if (!shadowMap)
+		return NO;
+	if (width != height) {
+		NSLog(@"Error loading shadow map: Terrain texture map must be square");
+		return NO;
+	}
+	shadowMapRes = width;
+	return YES;
+}
+
+-(void)bakeTrees
+{
+	XScriptNode *node = [[script getSubnodeByName:@"map"] getSubnodeByName:@"trees"];
+	if (!node)
+		return;
+	treeCount = [node getValueI:0];
+	if (treeCount <= 0) {
+		treeCount = 0;
+		return;
+	}
+	trees = (XTreeInstance*)malloc(treeCount * sizeof(XTreeInstance));
+
+	// same area, seed and sizes as the procedural placement in GGame's loadMap
+	XScalarRect area;
+	float width = 1024, height = 1024;
+	area.left = -512 + width * 0.1f; area.right = 512 - width * 0.1f;
+	area.top = -512 + height * 0.1f; area.bottom = 512 - height * 0.1f;
+
+	XTreePlacementParams params;
+	memset(&params, 0, sizeof(params));
+	params.area = area;
+	params.minTreeSize = 8; params.maxTreeSize = 12;
+	XScriptNode *snode = [node getSubnodeByName:@"size"];
+	if (snode) {
+		params.minTreeSize = [snode getValueF:0];
+		params.maxTreeSize = [snode getValueF:1];
+	}
+	params.seed = (unsigned int)ResourceTable_hashString([mapFolder UTF8String]) + [[node getSubnodeByName:@"seed"] getValueI:0];
+	params.threadCount = 4;
+
+	treeCount = TreePlacement_populatePoissonDisk(trees, treeCount, &params);
+}
+
+// appends a string to the string pool (once), and returns its offset
+uint32_t addString(NSString *string, NSMutableData *pool, NSMutableDictionary *offsets)
+{
+	NSNumber *offset = [offsets objectForKey:string];
+	if (offset)
+		return [offset unsignedIntValue];
+	uint32_t newOffset = [pool length];
+	const char *utf8 = [string UTF8String];
+	[pool appendBytes:utf8 length:strlen(utf8)+1];
+	[offsets setObject:[NSNumber numberWithUnsignedInt:newOffset] forKey:string];
+	return newOffset;
+}
+
+// flattens a script node and its subnodes (in pre-order) into the node, value and string tables
+void flattenScriptNode(XScriptNode *node, NSMutableData *nodes, NSMutableData *values, NSMutableData *strings, NSMutableDictionary *stringOffsets)
+{
+	XMapBundleScriptNode flatNode;
+	flatNode.name = addString(node.name, strings, stringOffsets);
+	flatNode.firstValue = [values length] / sizeof(uint32_t);
+	flatNode.valueCount = node.valueCount;
+	flatNode.subnodeCount = node.subnodeCount;
+	[nodes appendBytes:&flatNode length:sizeof(flatNode)];
+
+	for (NSString *value in node.values) {
+		uint32_t str = addString(value, strings, stringOffsets);
+		[values appendBytes:&str length:sizeof(str)];
+	}
+	for (XScriptNode *subnode in node.subnodes)
+		flattenScriptNode(subnode, nodes, values, strings, stringOffsets);
+}
+
+// appends a section to the bundle, keeping every section aligned
+void appendSection(NSMutableData *bundle, XMapBundleHeader *header, XMapBundleSectionType section, const void *data, size_t size)
+{
+	size_t padding = (XMAPBUNDLE_SECTION_ALIGNMENT - ([bundle length] % XMAPBUNDLE_SECTION_ALIGNMENT)) % XMAPBUNDLE_SECTION_ALIGNMENT;
+	[bundle increaseLengthBy:padding];
+	header->sections[section].offset = [bundle length];
+	header->sections[section].size = size;
+	if (size > 0)
+		[bundle appendBytes:data length:size];
+}
+
+-(BOOL)saveToFile:(const char*)filename
+{
+	// flatten script
+	NSMutableData *scriptNodes = [NSMutableData data];
+	NSMutableData *scriptValues = [NSMutableData data];
+	NSMutableData *scriptStrings = [NSMutableData data];
+	NSMutableDictionary *stringOffsets = [NSMutableDictionary dictionary];
+	flattenScriptNode(script, scriptNodes, scriptValues, scriptStrings, stringOffsets);
+
+	// build bundle
+	XMapBundleHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = XMAPBUNDLE_MAGIC;
+	header.version = XMAPBUNDLE_VERSION;
+	header.terrainRes = terrainRes;
+	header.chunkGridSize = TERRAIN_CHUNK_GRID_SIZE;
+	header.chunkTileRes = chunkTileRes;
+	header.chunkVertexCount = chunkVertexCount;
+	header.shadowMapRes = shadowMapRes;
+	header.treeCount = treeCount;
+	header.skirtHeight = skirtHeight;
+
+	NSMutableData *bundle = [NSMutableData dataWithLength:sizeof(header)];
+	appendSection(bundle, &header, XMapBundleSection_ScriptNodes, [scriptNodes bytes], [scriptNodes length]);
+	appendSection(bundle, &header, XMapBundleSection_ScriptValues, [scriptValues bytes], [scriptValues length]);
+	appendSection(bundle, &header, XMapBundleSection_ScriptStrings, [scriptStrings bytes], [scriptStrings length]);
+	appendSection(bundle, &header, XMapBundleSection_Heights, heights, terrainRes * terrainRes * sizeof(float));
+	appendSection(bundle, &header, XMapBundleSection_ShadowMap, shadowMap, shadowMapRes * shadowMapRes);
+	appendSection(bundle, &header, XMapBundleSection_Trees, trees, treeCount * sizeof(XTreeInstance));
+	appendSection(bundle, &header, XMapBundleSection_TerrainVertexes, chunkVertexes, TERRAIN_CHUNK_GRID_SIZE * TERRAIN_CHUNK_GRID_SIZE * chunkVertexCount * sizeof(XTerrainVertex));
+	[bundle replaceBytesInRange:NSMakeRange(0, sizeof(header)) withBytes:&header];
+
+	// write
+	FILE *file = fopen(filename, "wb");
+	if (!file) {
+		NSLog(@"Error saving map bundle: Could not write output file");
+		return NO;
+	}
+	if (fwrite([bundle bytes], [bundle length], 1, file) != 1) {
+		fclose(file);
+		NSLog(@"Error saving map bundle: File write error");
+		return NO;
+	}
+	fclose(file);
+
+	printf("Successfully saved [%dx%d terrain, %dx%d shadow map, %d trees, %d KB total]\n", terrainRes, terrainRes, shadowMapRes, shadowMapRes, treeCount, (int)([bundle length] / 1024));
+	return YES;
+}
+
+// returns the path of the first difference between two script trees, or nil if they're the same
+NSString *compareScriptNodes(XScriptNode *a, XScriptNode *b)
+{
+	if (![a.name isEqualToString:b.name] || ![a.values isEqualToArray:b.values] || a.subnodeCount != b.subnodeCount)
+		return a.name;
+	for (int i = 0; i < a.subnodeCount; ++i) {
+		NSString *difference = compareScriptNodes([a getSubnodeByIndex:i], [b getSubnodeByIndex:i]);
+		if (difference)
+			return [NSString stringWithFormat:@"%@/%@", a.name, difference];
+	}
+	return nil;
+}
+
+-(BOOL)verifyFile:(const char*)filename
+{
+	XMapBundle *bundle = [[XMapBundle alloc] initWithPath:[NSString stringWithUTF8String:filename]];
+	if (bundle == nil) {
+		NSLog(@"Error verifying map bundle: Could not load the saved file");
+		return NO;
+	}
+
+	const char *difference = NULL;
+	if (bundle.terrainRes != terrainRes || bundle.chunkTileRes != chunkTileRes || bundle.shadowMapRes != shadowMapRes
+		|| bundle.treeCount != treeCount || bundle.skirtHeight != skirtHeight)
+		difference = "header";
+	else if (memcmp([bundle heights], heights, terrainRes * terrainRes * sizeof(float)) != 0)
+		difference = "heights";
+	else if (shadowMapRes > 0 && memcmp([bundle shadowMap], shadowMap, shadowMapRes * shadowMapRes) != 0)
+		difference = "shadow map";
+	else if (treeCount > 0 && memcmp([bundle trees], trees, treeCount * sizeof(XTreeInstance)) != 0)
+		difference = "trees";
+	else if (memcmp([bundle chunkVertexesAtX:0 Y:0], chunkVertexes, TERRAIN_CHUNK_GRID_SIZE * TERRAIN_CHUNK_GRID_SIZE * chunkVertexCount * sizeof(XTerrainVertex)) != 0)
+		difference = "terrain vertexes";
+	else {
+		XScriptNode *root = [bundle newScriptRoot];
+		NSString *scriptDifference = root ? compareScriptNodes(script, root) : @"(unreadable)";
+		if (scriptDifference)
+			NSLog(@"Error verifying map bundle: Script node \"%@\" differs", scriptDifference);
+		difference = scriptDifference ? "script" : NULL;
+		[root release];
+	}
+	[bundle release];
+
+	if (difference) {
+		NSLog(@"Error verifying map bundle: Mismatch in the saved %s", difference);
+		return NO;
+	}
+	printf("Verified: the bundle loads back identically\n");
+	return YES;
+}
+
+@end
@@ -0,0 +1,57 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+#import "MapPacker.h"
+#import <stdio.h>
+
+int c_main(int argc, const char *argv[]);
+int main(int argc, const char *argv[])
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+	int ret = c_main(argc, argv);
+	[autoreleasePool release];
+	return ret;
+}
+
+int c_main(int argc, const char *argv[])
+{
+	if (argc < 2) {
+		printf("mappacker: No input file specified\n\n");
+		printf("Usage: mappacker Media/Maps/level1.map [Media/Maps/level2.map ...]\n");
+		printf("Each map is packed into a bundle next to it (e.g. Media/Maps/level1.map.xmap)\n\n");
+		return 1;
+	}
+
+	int failures = 0;
+	for (int i = 1; i < argc; ++i) {
+		const char *sourceFile = argv[i];
+		char destFile[512];
+		if (strlen(sourceFile) + 6 > sizeof(destFile)) {
+			printf("mappacker: Path too long: \"%s\"\n", sourceFile);
+			++failures;
+			continue;
+		}
+		strcpy(destFile, sourceFile);
+		strcat(destFile, ".xmap");
+
+		printf("\n");
+		printf("Loading map: \"%s\"...\n", sourceFile);
+		NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+		MapPacker *packer = [[MapPacker alloc] initWithMapFile:sourceFile];
+		if (packer) {
+			printf("Saving to: \"%s\"...\n", destFile);
+			if ([packer saveToFile:destFile] && [packer verifyFile:destFile]) {
+				printf("Packing complete.\n");
+			} else {
+				printf("Error encountered. Packing aborted.\n");
+				++failures;
+			}
+			[packer release];
+		} else {
+			printf("Error encountered. Packing aborted.\n");
+			++failures;
+		}
+		[autoreleasePool release];
+	}
+	printf("\n");
+	return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,337 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// meshbatchbench: draws a battle's worth of tanks (the bodies, turrets, barrels and shadows of every
+// tank under Media/Tanks) the way XScene does, once drawing every node on its own (a matrix push and a
+// draw call per submesh instance) and once batching runs of small submeshes through XMeshBatch as
+// -[XSubModel renderBatch:count:buffer:camera:] does. The GL calls go through the recording device on
+// top of the null device, so the draw counts are exact and the times are the CPU cost alone. Reports
+// draws and time per frame for both, and the transform cost of XMeshBatch's NEON/SSE kernel and its
+// scalar version, and checks that both kernels write the same positions, normals and texcoords. (The
+// null device costs nothing per call, so the per node time leaves out what the driver spends per draw.)
+// Plain C, so it builds anywhere:
+//   cc -O2 -std=gnu99 -DXRENDERDEVICE_HEADLESS -include Game/Source/XStandalone.h -o meshbatchbench MeshBatchBench/main.c -x c Game/Source/XMeshBatch.m Game/Source/XRenderDevice.m Game/Source/XMath.m -lm
+
+#include "../Game/Source/XMeshBatch.h"
+#include "../Game/Source/XMeshFile.h"
+#include "../Game/Source/XRenderDevice.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+
+#define MAX_SUBMESHES 64
+#define WORLD_SIZE 800.0f
+#define POSITION_TOLERANCE 0.0001f
+#define NORMAL_TOLERANCE 0.00001f
+
+typedef struct {
+	XMeshVertex *vertexes;
+	XMeshIndex *indexes;
+	int vertexCount, indexCount;
+	GLuint glVertexBuffer, glIndexBuffer;
+} SubMesh;
+
+typedef struct {
+	XMatrix3 rotation;
+	XVector3 position;
+} Instance;
+
+// a visible submesh instance, as a render queue entry (the queue is sorted so each submesh's instances are consecutive)
+typedef struct {
+	int subMesh;
+	Instance *instance;
+} QueueEntry;
+
+typedef void (*TransformFunction)(XMeshVertex *dest, const XMeshVertex *src, int count, const XMatrix3 *rot, const XVector3 *pos);
+
+static SubMesh subMeshes[MAX_SUBMESHES];
+static int subMeshCount = 0;
+static GLuint boundVertexBuffer = 0; //(as xglCheckBindMesh tracks it)
+static double transformTime = 0;
+
+static double currentTime()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// loads every submesh of a version 2 .xmesh file (see XMeshFile.h) and uploads it, as XMesh does
+static BOOL loadMesh(const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+		return NO;
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned char *data = malloc(fileSize);
+	BOOL read = (fread(data, fileSize, 1, file) == 1);
+	fclose(file);
+	const XMeshFileHeader *header = (const XMeshFileHeader*)data;
+	if (!read || fileSize < (long)sizeof(XMeshFileHeader) || header->magic != XMESHFILE_MAGIC || header->version != XMESHFILE_VERSION
+		|| header->vertexSize != sizeof(XMeshVertex) || header->indexSize != sizeof(XMeshIndex)) {
+		free(data);
+		return NO;
+	}
+	const XMeshFileSubMesh *fileSubMeshes = (const XMeshFileSubMesh*)(data + header->subMeshes.offset);
+	const XMeshVertex *vertexes = (const XMeshVertex*)(data + header->vertexes.offset);
+	const XMeshIndex *indexes = (const XMeshIndex*)(data + header->indexes.offset);
+	for (uint32_t i = 0; i < header->subMeshCount && subMeshCount < MAX_SUBMESHES; ++i) {
+		const XMeshFileSubMesh *s = &fileSubMeshes[i];
+		SubMesh *subMesh = &subMeshes[subMeshCount++];
+		subMesh->vertexCount = s->vertexCount;
+		subMesh->indexCount = s->indexCount;
+		subMesh->vertexes = malloc(sizeof(XMeshVertex) * s->vertexCount);
+		subMesh->indexes = malloc(sizeof(XMeshIndex) * s->indexCount);
+		memcpy(subMesh->vertexes, vertexes + s->firstVertex, sizeof(XMeshVertex) * s->vertexCount);
+		memcpy(subMesh->indexes, indexes + s->firstIndex, sizeof(XMeshIndex) * s->indexCount);
+		glGenBuffers(1, &subMesh->glVertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, subMesh->glVertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(XMeshVertex) * s->vertexCount, subMesh->vertexes, GL_STATIC_DRAW);
+		glGenBuffers(1, &subMesh->glIndexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subMesh->glIndexBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(XMeshIndex) * s->indexCount, subMesh->indexes, GL_STATIC_DRAW);
+	}
+	free(data);
+	return YES;
+}
+
+static void bindMesh(GLuint vertexBuffer, GLuint indexBuffer)
+{
+	if (boundVertexBuffer == vertexBuffer)
+		return;
+	boundVertexBuffer = vertexBuffer;
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glVertexPointer(3, GL_FLOAT, sizeof(XMeshVertex), (void*)offsetof(XMeshVertex,position));
+	glNormalPointer(GL_FLOAT, sizeof(XMeshVertex), (void*)offsetof(XMeshVertex,normal));
+	glTexCoordPointer(2, GL_FLOAT, sizeof(XMeshVertex), (void*)offsetof(XMeshVertex,texcoord));
+}
+
+// as XScene draws a node which isn't batched
+static void renderNode(const SubMesh *subMesh, Instance *instance)
+{
+	XMatrix4 rotMatrix;
+	glPushMatrix();
+	glTranslatef(instance->position.x, instance->position.y, instance->position.z);
+	xBuildMatrix4FromMatrix3(&rotMatrix, &instance->rotation);
+	glMultMatrixf(xMatrix4ToArray(&rotMatrix));
+	bindMesh(subMesh->glVertexBuffer, subMesh->glIndexBuffer);
+	glDrawElements(GL_TRIANGLES, subMesh->indexCount, GL_UNSIGNED_SHORT, (void*)0);
+	glPopMatrix();
+}
+
+// as -[XSubModel renderBatch:count:buffer:camera:] does it, returning the number of entries drawn (0 if fewer than 2)
+static int renderBatch(const QueueEntry *entries, int count, XMeshBatchBuffer *buffer, TransformFunction transform)
+{
+	const SubMesh *subMesh = &subMeshes[entries[0].subMesh];
+	int vertexCount = subMesh->vertexCount, indexCount = subMesh->indexCount;
+	if (vertexCount > XMESH_BATCH_MAX_SUBMESH_VERTEXES)
+		return 0;
+	int maxInstances = XMESH_BATCH_BUFFER_VERTEXES / vertexCount;
+	if (maxInstances > XMESH_BATCH_BUFFER_INDEXES / indexCount)
+		maxInstances = XMESH_BATCH_BUFFER_INDEXES / indexCount;
+	int instanceCount = 1;
+	while (instanceCount < count && instanceCount < maxInstances && entries[instanceCount].subMesh == entries[0].subMesh)
+		++instanceCount;
+	if (instanceCount < 2)
+		return 0;
+
+	double startTime = currentTime();
+	for (int i = 0; i < instanceCount; ++i) {
+		Instance *instance = entries[i].instance;
+		transform(&buffer->vertexes[i * vertexCount], subMesh->vertexes, vertexCount, &instance->rotation, &instance->position);
+		MeshBatch_offsetIndexes(&buffer->indexes[i * indexCount], subMesh->indexes, indexCount, (XMeshIndex)(i * vertexCount));
+	}
+	transformTime += currentTime() - startTime;
+
+	bindMesh(buffer->glVertexBuffer, buffer->glIndexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, instanceCount * vertexCount * sizeof(XMeshVertex), buffer->vertexes, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, instanceCount * indexCount * sizeof(XMeshIndex), buffer->indexes, GL_DYNAMIC_DRAW);
+	glDrawElements(GL_TRIANGLES, instanceCount * indexCount, GL_UNSIGNED_SHORT, (void*)0);
+	++buffer->batchCount;
+	buffer->batchedInstances += instanceCount;
+	buffer->transformedVertexes += instanceCount * vertexCount;
+	return instanceCount;
+}
+
+// renders the queue as XScene does, batching with the given kernel (or not at all, if NULL)
+static void renderFrame(const QueueEntry *queue, int count, XMeshBatchBuffer *buffer, TransformFunction transform)
+{
+	boundVertexBuffer = 0;
+	int i = 0;
+	while (i < count) {
+		if (transform && count - i >= 2) {
+			int batched = renderBatch(&queue[i], count - i, buffer, transform);
+			if (batched >= 2) {
+				i += batched;
+				continue;
+			}
+		}
+		renderNode(&subMeshes[queue[i].subMesh], queue[i].instance);
+		++i;
+	}
+}
+
+static BOOL withinTolerance(const XVector3 *a, const XVector3 *b, XScalar tolerance)
+{
+	return xAbs(a->x - b->x) <= tolerance * (1 + xAbs(b->x)) && xAbs(a->y - b->y) <= tolerance * (1 + xAbs(b->y))
+		&& xAbs(a->z - b->z) <= tolerance * (1 + xAbs(b->z));
+}
+
+static const char *simdKernelName()
+{
+#if defined(__ARM_NEON__)
+	return "NEON";
+#elif defined(__SSE__)
+	return "SSE";
+#else
+	return "none (scalar fallback)";
+#endif
+}
+
+static void printUsage()
+{
+	printf("Usage: meshbatchbench [options]\n\n");
+	printf("  -n <count>   number of tanks (default 64)\n");
+	printf("  -r <count>   number of frames to draw them (default 200)\n");
+	printf("  -d <folder>  folder of tank folders with .xmesh files (default Game/Media/Tanks)\n\n");
+}
+
+int main(int argc, const char *argv[])
+{
+	int tankCount = 64, frames = 200;
+	const char *folder = "Game/Media/Tanks";
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc || argv[i][0] != '-') {
+			printUsage();
+			return 1;
+		}
+		char option = argv[i][1];
+		int value = atoi(argv[i + 1]);
+		if (option == 'n') tankCount = (value > 0) ? value : 1;
+		else if (option == 'r') frames = (value > 0) ? value : 1;
+		else if (option == 'd') folder = argv[i + 1];
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	xglSetRenderDevice(xglRecordingDevice(xglNullDevice()));
+
+	// every tank type's parts (each part a separate submesh, as in the game)
+	static const char *tankTypes[] = { "LightTank", "MediumTank", "HeavyTank", "Van" };
+	static const char *tankParts[] = { "body", "turret", "barrel", "shadow" };
+	const int typeCount = 4, partCount = 4;
+	int typeSubMeshes[4][4];
+	for (int t = 0; t < typeCount; ++t) {
+		for (int p = 0; p < partCount; ++p) {
+			char filename[512];
+			snprintf(filename, sizeof(filename), "%s/%s/%s.xmesh", folder, tankTypes[t], tankParts[p]);
+			typeSubMeshes[t][p] = subMeshCount;
+			if (!loadMesh(filename) || subMeshCount != typeSubMeshes[t][p] + 1) {
+				printf("Error loading \"%s\" (a version 2 .xmesh with one submesh is expected; run from the repository's root folder, or pass -d)\n", filename);
+				return 1;
+			}
+		}
+	}
+	XMeshBatchBuffer buffer;
+	MeshBatchBuffer_create(&buffer);
+
+	// scatter the tanks, then queue their parts grouped by submesh, as the render queue sorts them
+	srand(1);
+	Instance *instances = malloc(sizeof(Instance) * tankCount * partCount);
+	for (int i = 0; i < tankCount * partCount; ++i) {
+		Instance *instance = &instances[i];
+		instance->position.x = xRangeRand(-WORLD_SIZE * 0.5f, WORLD_SIZE * 0.5f);
+		instance->position.y = xRangeRand(0, 20);
+		instance->position.z = xRangeRand(-WORLD_SIZE * 0.5f, WORLD_SIZE * 0.5f);
+		XVector3 axis = { xRangeRand(-0.2f, 0.2f), 1, xRangeRand(-0.2f, 0.2f) };
+		xNormalize_Vec3(&axis);
+		xBuildAxisRotationMatrix3(&instance->rotation, xRangeRand(0, TWO_PI), &axis);
+	}
+	QueueEntry *queue = malloc(sizeof(QueueEntry) * tankCount * partCount);
+	int queueCount = 0, batchableCount = 0;
+	for (int s = 0; s < subMeshCount; ++s) {
+		for (int tank = 0; tank < tankCount; ++tank) {
+			for (int p = 0; p < partCount; ++p) {
+				if (typeSubMeshes[tank % typeCount][p] == s) {
+					queue[queueCount].subMesh = s;
+					queue[queueCount].instance = &instances[tank * partCount + p];
+					++queueCount;
+					batchableCount += (subMeshes[s].vertexCount <= XMESH_BATCH_MAX_SUBMESH_VERTEXES);
+				}
+			}
+		}
+	}
+	printf("%d tanks, %d submesh instances (%d small enough to batch), %d frames, SIMD kernel: %s\n\n",
+		tankCount, queueCount, batchableCount, frames, simdKernelName());
+
+	// draw every frame without batching, then batched with each kernel
+	const char *titles[3] = { "per node:       ", "batched, SIMD:  ", "batched, scalar:" };
+	TransformFunction kernels[3] = { NULL, MeshBatch_transformVertexes, MeshBatch_transformVertexesScalar };
+	double frameTime[3], kernelTime[3];
+	XRenderStats frameStats[3];
+	for (int k = 0; k < 3; ++k) {
+		renderFrame(queue, queueCount, &buffer, kernels[k]);
+		xglResetRenderStats();
+		MeshBatchBuffer_resetStats(&buffer);
+		transformTime = 0;
+		double startTime = currentTime();
+		for (int f = 0; f < frames; ++f)
+			renderFrame(queue, queueCount, &buffer, kernels[k]);
+		frameTime[k] = (currentTime() - startTime) / frames;
+		kernelTime[k] = transformTime / frames;
+		frameStats[k] = xglGetRenderStats();
+		XRenderStats *s = &frameStats[k];
+		printf("%s %4d draws, %5d matrix ops, %7d bytes uploaded, %7.1f us/frame", titles[k], s->drawCalls / frames,
+			s->matrixOps / frames, s->bufferUploadBytes / frames, frameTime[k] * 1e6);
+		if (k > 0)
+			printf(" (transform %6.1f us, %.2f ns/vertex)", kernelTime[k] * 1e6, transformTime * 1e9 / buffer.transformedVertexes);
+		printf("\n");
+	}
+	printf("\n");
+
+	// both kernels must write the same vertexes for every instance of every small submesh
+	long positionMismatches = 0, normalMismatches = 0, texcoordMismatches = 0, checkedVertexes = 0;
+	XMeshVertex *simdVertexes = malloc(sizeof(XMeshVertex) * XMESH_BATCH_MAX_SUBMESH_VERTEXES);
+	XMeshVertex *scalarVertexes = malloc(sizeof(XMeshVertex) * XMESH_BATCH_MAX_SUBMESH_VERTEXES);
+	for (int i = 0; i < queueCount; ++i) {
+		const SubMesh *subMesh = &subMeshes[queue[i].subMesh];
+		if (subMesh->vertexCount > XMESH_BATCH_MAX_SUBMESH_VERTEXES)
+			continue;
+		Instance *instance = queue[i].instance;
+		MeshBatch_transformVertexes(simdVertexes, subMesh->vertexes, subMesh->vertexCount, &instance->rotation, &instance->position);
+		MeshBatch_transformVertexesScalar(scalarVertexes, subMesh->vertexes, subMesh->vertexCount, &instance->rotation, &instance->position);
+		for (int v = 0; v < subMesh->vertexCount; ++v) {
+			positionMismatches += !withinTolerance(&simdVertexes[v].position, &scalarVertexes[v].position, POSITION_TOLERANCE);
+			normalMismatches += !withinTolerance(&simdVertexes[v].normal, &scalarVertexes[v].normal, NORMAL_TOLERANCE);
+			texcoordMismatches += (memcmp(&simdVertexes[v].texcoord, &scalarVertexes[v].texcoord, sizeof(XVector2)) != 0);
+		}
+		checkedVertexes += subMesh->vertexCount;
+	}
+	int drawMismatches = (frameStats[1].drawCalls != frameStats[2].drawCalls || frameStats[1].triangles != frameStats[0].triangles
+		|| frameStats[2].triangles != frameStats[0].triangles);
+	printf("draws saved by batching: %d of %d (%.1f%%), triangles the same: %s\n", (frameStats[0].drawCalls - frameStats[1].drawCalls) / frames,
+		frameStats[0].drawCalls / frames, 100.0 * (frameStats[0].drawCalls - frameStats[1].drawCalls) / frameStats[0].drawCalls, drawMismatches ? "NO" : "yes");
+	printf("SIMD/scalar mismatches in %ld vertexes: %ld positions, %ld normals, %ld texcoords\n\n", checkedVertexes,
+		positionMismatches, normalMismatches, texcoordMismatches);
+
+	free(scalarVertexes);
+	free(simdVertexes);
+	free(queue);
+	free(instances);
+	MeshBatchBuffer_destroy(&buffer);
+	for (int s = 0; s < subMeshCount; ++s) {
+		glDeleteBuffers(1, &subMeshes[s].glVertexBuffer);
+		glDeleteBuffers(1, &subMeshes[s].glIndexBuffer);
+		free(subMeshes[s].vertexes);
+		free(subMeshes[s].indexes);
+	}
+	if (positionMismatches > 0 || normalMismatches > 0 || texcoordMismatches > 0 || drawMismatches) {
+		printf("FAILED\n");
+		return 1;
+	}
+	return 0;
+}
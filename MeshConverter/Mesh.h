@@ -19,6 +19,8 @@ typedef struct {
 	XBoundingBox boundingBox;
 } MeshData;
 
+BOOL isXMeshFile(const char *filename);
+
 
 @interface Mesh : NSObject {
 	NSMutableArray *subMeshes;
@@ -2,9 +2,11 @@
 
 #import "Mesh.h"
 #import "XMath.h"
+#import "../Game/Source/XMeshFile.h"
 #import <stdio.h>
 
 BOOL loadOBJMesh(const char *filename, NSMutableArray *subMeshes);
+BOOL loadXMeshVersion1(const char *filename, NSMutableArray *subMeshes);
 
 
 @implementation Mesh
@@ -13,7 +15,8 @@ BOOL loadOBJMesh(const char *filename, NSMutableArray *subMeshes);
 {
 	if ((self = [super init])) {
 		subMeshes = [[NSMutableArray alloc] init];
-		if (!loadOBJMesh(filename, subMeshes)) {
+		// (an existing .xmesh is loaded as version 1, so it can be upgraded to the current format)
+		if (!(isXMeshFile(filename) ? loadXMeshVersion1(filename, subMeshes) : loadOBJMesh(filename, subMeshes))) {
 			[subMeshes release];
 			return nil;
 		}
@@ -90,8 +93,6 @@ BOOL loadOBJMesh(const char *filename, NSMutableArray *subMeshes);
 		printf("(Reduced total number of submeshes from %d to %d)\n", oldSubmeshesCount, newSubmeshesCount);
 }
 
-BOOL writeSubMesh(SubMesh *subMesh, FILE *file);
-
 BOOL fwrite2(const void *ptr, size_t size, size_t count, FILE *stream)
 {
 	if (fwrite(ptr, size, count, stream) != count)
@@ -99,28 +100,85 @@ BOOL fwrite2(const void *ptr, size_t size, size_t count, FILE *stream)
 	else return YES;
 }
 
+uint32_t alignOffset(uint32_t offset)
+{
+	return (offset + XMESHFILE_SECTION_ALIGNMENT - 1) & ~(uint32_t)(XMESHFILE_SECTION_ALIGNMENT - 1);
+}
+
+BOOL writePadding(FILE *file, uint32_t offset)
+{
+	// zero fill up to the start of the next section
+	static const char zeros[XMESHFILE_SECTION_ALIGNMENT] = { 0 };
+	long position = ftell(file);
+	if (position < 0 || position > offset)
+		return NO;
+	return fwrite2(zeros, 1, offset - position, file);
+}
+
 -(BOOL)saveToFile:(const char*)filename
 {
+	// lay out the file (see XMeshFile.h): header, submesh table, strings, then all vertexes and all indexes
+	uint32_t subMeshCount = [subMeshes count];
+	XMeshFileSubMesh *table = calloc(subMeshCount ? subMeshCount : 1, sizeof(XMeshFileSubMesh));
+	NSMutableData *strings = [NSMutableData data];
+	uint32_t vertexCount = 0, indexCount = 0;
+	int i = 0;
+	for (SubMesh *subMesh in subMeshes) {
+		XMeshFileSubMesh *entry = &table[i++];
+		entry->name = strings.length;
+		[strings appendBytes:subMesh->name length:strlen(subMesh->name) + 1];
+		entry->textureFile = strings.length;
+		[strings appendBytes:subMesh->textureFilename length:strlen(subMesh->textureFilename) + 1];
+		memcpy(entry->boundingBox, &subMesh->meshData.boundingBox, sizeof(entry->boundingBox));
+		entry->firstVertex = vertexCount;
+		entry->vertexCount = subMesh->meshData.vertexCount;
+		entry->firstIndex = indexCount;
+		entry->indexCount = subMesh->meshData.indexCount;
+		vertexCount += subMesh->meshData.vertexCount;
+		indexCount += subMesh->meshData.indexCount;
+	}
+	if (strings.length == 0)
+		[strings appendBytes:"" length:1];
+	
+	XMeshFileHeader header;
+	memset(&header, 0, sizeof(XMeshFileHeader));
+	header.magic = XMESHFILE_MAGIC;
+	header.version = XMESHFILE_VERSION;
+	header.subMeshCount = subMeshCount;
+	header.vertexSize = sizeof(MeshVertex);
+	header.indexSize = sizeof(MeshIndex);
+	header.subMeshes.offset = alignOffset(sizeof(XMeshFileHeader));
+	header.subMeshes.size = subMeshCount * sizeof(XMeshFileSubMesh);
+	header.strings.offset = alignOffset(header.subMeshes.offset + header.subMeshes.size);
+	header.strings.size = strings.length;
+	header.vertexes.offset = alignOffset(header.strings.offset + header.strings.size);
+	header.vertexes.size = vertexCount * sizeof(MeshVertex);
+	header.indexes.offset = alignOffset(header.vertexes.offset + header.vertexes.size);
+	header.indexes.size = indexCount * sizeof(MeshIndex);
+	
 	FILE *file = fopen(filename, "wb");
 	if (!file) {
+		free(table);
 		NSLog(@"Error saving XMESH mesh: Could not write output file");
 		return NO;
 	}
 	
-	unsigned int numSubMeshes = [subMeshes count];
-	if (!fwrite2(&numSubMeshes, sizeof(unsigned int), 1, file))
+	BOOL ok = fwrite2(&header, sizeof(XMeshFileHeader), 1, file);
+	ok = ok && writePadding(file, header.subMeshes.offset) && fwrite2(table, sizeof(XMeshFileSubMesh), subMeshCount, file);
+	ok = ok && writePadding(file, header.strings.offset) && fwrite2(strings.bytes, 1, strings.length, file);
+	ok = ok && writePadding(file, header.vertexes.offset);
+	for (SubMesh *subMesh in subMeshes)
+		ok = ok && fwrite2(subMesh->meshData.vertexBuffer, sizeof(MeshVertex), subMesh->meshData.vertexCount, file);
+	ok = ok && writePadding(file, header.indexes.offset);
+	for (SubMesh *subMesh in subMeshes)
+		ok = ok && fwrite2(subMesh->meshData.indexBuffer, sizeof(MeshIndex), subMesh->meshData.indexCount, file);
+	fclose(file);
+	free(table);
+	if (!ok) {
+		NSLog(@"Error saving XMESH mesh: File write error");
 		return NO;
-	
-	for (SubMesh *subMesh in subMeshes) {
-		if (!writeSubMesh(subMesh, file)) {
-			fclose(file);
-			NSLog(@"Error saving XMESH mesh: File write error");
-			return NO;
-		}
 	}
 	
-	fclose(file);
-	
 	int totalVerts = 0, totalTris = 0;
 	for (SubMesh *subMesh in subMeshes) {
 		totalVerts += subMesh->meshData.vertexCount;
@@ -131,27 +189,6 @@ BOOL fwrite2(const void *ptr, size_t size, size_t count, FILE *stream)
 	return YES;
 }
 
-BOOL writeSubMesh(SubMesh *subMesh, FILE *file)
-{
-	// write submesh name
-	unsigned int nameLen = strlen(subMesh->name);
-	if (!fwrite2(&nameLen, sizeof(unsigned int), 1, file)) return NO;
-	if (!fwrite2(subMesh->name, sizeof(char), nameLen, file)) return NO;
-	// write submesh texture
-	unsigned int textureFileLen = strlen(subMesh->textureFilename);
-	if (!fwrite2(&textureFileLen, sizeof(unsigned int), 1, file)) return NO;
-	if (!fwrite2(subMesh->textureFilename, sizeof(char), textureFileLen, file)) return NO;
-	// write bounding box
-	if (!fwrite2(&subMesh->meshData.boundingBox, sizeof(XBoundingBox), 1, file)) return NO;
-	// write vertex buffer
-	if (!fwrite2(&subMesh->meshData.vertexCount, sizeof(unsigned int), 1, file)) return NO;
-	if (!fwrite2(subMesh->meshData.vertexBuffer, sizeof(MeshVertex), subMesh->meshData.vertexCount, file)) return NO;
-	// write index buffer
-	if (!fwrite2(&subMesh->meshData.indexCount, sizeof(unsigned int), 1, file)) return NO;
-	if (!fwrite2(subMesh->meshData.indexBuffer, sizeof(MeshIndex), subMesh->meshData.indexCount, file)) return NO;
-	return YES;
-}
-
 @end
 
 
@@ -580,3 +617,68 @@ MeshData buildSubmeshData(XVector3 *vPositions, int vPositionCount,
 }
 
 
+BOOL isXMeshFile(const char *filename)
+{
+	size_t len = strlen(filename);
+	return (len >= 6 && strcasecmp(filename + len - 6, ".xmesh") == 0);
+}
+
+BOOL freadString(char *dest, size_t destSize, FILE *file)
+{
+	uint32_t len = 0;
+	if (fread(&len, sizeof(uint32_t), 1, file) != 1 || len >= destSize)
+		return NO;
+	if (len > 0 && fread(dest, len, 1, file) != 1)
+		return NO;
+	dest[len] = '\0';
+	return YES;
+}
+
+BOOL loadXMeshVersion1(const char *filename, NSMutableArray *subMeshes)
+{
+	// version 1 layout: submesh count, then per submesh a length-prefixed name and texture filename,
+	// a bounding box, a vertex count and vertexes, and an index count and indexes
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) {
+		NSLog(@"File not found.");
+		return NO;
+	}
+	uint32_t subMeshCount = 0;
+	if (fread(&subMeshCount, sizeof(uint32_t), 1, file) != 1 || subMeshCount == XMESHFILE_MAGIC) {
+		fclose(file);
+		NSLog(@"READ ERROR: Not a version 1 XMESH file");
+		return NO;
+	}
+	
+	for (uint32_t i = 0; i < subMeshCount; ++i) {
+		char name[256], textureFilename[512];
+		MeshData mData;
+		memset(&mData, 0, sizeof(MeshData));
+		BOOL ok = freadString(name, sizeof(name), file) && freadString(textureFilename, sizeof(textureFilename), file);
+		ok = ok && fread(&mData.boundingBox, sizeof(XBoundingBox), 1, file) == 1;
+		ok = ok && fread(&mData.vertexCount, sizeof(uint32_t), 1, file) == 1;
+		if (ok) {
+			mData.vertexBuffer = malloc(sizeof(MeshVertex) * (mData.vertexCount ? mData.vertexCount : 1));
+			ok = fread(mData.vertexBuffer, sizeof(MeshVertex), mData.vertexCount, file) == mData.vertexCount;
+		}
+		ok = ok && fread(&mData.indexCount, sizeof(uint32_t), 1, file) == 1;
+		if (ok) {
+			mData.indexBuffer = malloc(sizeof(MeshIndex) * (mData.indexCount ? mData.indexCount : 1));
+			ok = fread(mData.indexBuffer, sizeof(MeshIndex), mData.indexCount, file) == mData.indexCount;
+		}
+		if (!ok) {
+			free(mData.vertexBuffer);
+			free(mData.indexBuffer);
+			fclose(file);
+			NSLog(@"READ ERROR: File is truncated");
+			return NO;
+		}
+		
+		SubMesh *subMesh = [[SubMesh alloc] initWithName:name defaultTexture:textureFilename meshData:&mData];
+		[subMeshes addObject:subMesh];
+		[subMesh release];
+	}
+	fclose(file);
+	printf("(Loaded %u submeshes from a version 1 XMESH file)\n", subMeshCount);
+	return YES;
+}
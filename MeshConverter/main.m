@@ -22,7 +22,8 @@ int c_main(int argc, const char *argv[])
 	else if (argc == 2) {
 		sourceFile = argv[1];
 		strcpy(destFile, argv[1]);
-		strcat(destFile, ".xmesh");
+		if (!isXMeshFile(sourceFile))
+			strcat(destFile, ".xmesh"); //(an existing .xmesh is upgraded in place)
 	}
 	
 	// for debugging
@@ -36,8 +37,11 @@ int c_main(int argc, const char *argv[])
 		printf("Loading mesh file: \"%s\"...\n", sourceFile);
 		Mesh *mesh = [[Mesh alloc] initWithFile:sourceFile];
 		if (mesh) {
-			printf("Optimizing mesh...\n");
-			[mesh optimize];
+			// (an upgraded .xmesh was optimized when first converted, and keeps its submeshes as they are)
+			if (!isXMeshFile(sourceFile)) {
+				printf("Optimizing mesh...\n");
+				[mesh optimize];
+			}
 			printf("Saving to: \"%s\"...\n", destFile);
 			if ([mesh saveToFile:destFile]) {
 				printf("Conversion complete.\n");
@@ -58,6 +62,7 @@ int c_main(int argc, const char *argv[])
 		if (argc > 3)
 			printf("meshconverter: Too many parameters provided\n\n");
 		printf("Usage: meshconverter source-mesh.obj [converted-output.xmesh]\n");
+		printf("   or: meshconverter version1-mesh.xmesh [converted-output.xmesh]\n");
 	}
 	printf("\n");
     return 0;
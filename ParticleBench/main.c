@@ -0,0 +1,185 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// particlebench: times XParticleKernel's billboard expansion (the NEON/SSE kernel this machine builds,
+// and the scalar version) over tens of thousands of particles, split into systems the size of typical
+// effects and animated over their whole lifetime as XParticleSystem does. Also checks that the SIMD and
+// scalar kernels write the same particles (positions within a small tolerance, since the operations are
+// ordered differently, and alpha within one step) and the same bounds.
+// Plain C, so it builds anywhere:
+//   cc -O2 -std=gnu99 -include Game/Source/XStandalone.h -o particlebench ParticleBench/main.c -x c Game/Source/XParticleKernel.m Game/Source/XMath.m -lm
+
+#include "../Game/Source/XParticleKernel.h"
+#include <stdio.h>
+#include <time.h>
+
+#define FRAME_TIME (1.0f / 30.0f)
+#define MAX_LIFE 3.0f
+#define POSITION_TOLERANCE 0.001f
+
+static double currentTime()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// particles as an explosion or smoke effect emits them (see -[XParticleSystem beginAnimationWithEmitFraction:])
+static void emitParticles(XParticleArray *p, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		p->startX[i] = xRangeRand(-1, 1); p->startY[i] = xRangeRand(0, 1); p->startZ[i] = xRangeRand(-1, 1);
+		p->velocityX[i] = xRangeRand(-4, 4); p->velocityY[i] = xRangeRand(2, 8); p->velocityZ[i] = xRangeRand(-4, 4);
+		p->gravity[i] = xRangeRand(-9.8f, -2);
+		p->startAngle[i] = xRangeRand(0, TWO_PI);
+		p->rotateSpeed[i] = xRangeRand(-2, 2);
+		p->scale[i] = xRangeRand(0.5f, 2);
+		p->scaleSpeed[i] = xRangeRand(0, 1.5f);
+		p->color[i] = xParticleColor(200 + rand() % 56, 100 + rand() % 100, rand() % 64);
+		p->startAlpha[i] = 1;
+		p->endAlpha[i] = 0;
+		p->life[i] = xRangeRand(0.5f, MAX_LIFE);
+		p->invLife[i] = 1.0f / p->life[i];
+	}
+	p->count = count;
+}
+
+static BOOL sameBounds(const XBoundingBox *a, const XBoundingBox *b)
+{
+	return xAbs(a->min.x - b->min.x) <= POSITION_TOLERANCE && xAbs(a->min.y - b->min.y) <= POSITION_TOLERANCE && xAbs(a->min.z - b->min.z) <= POSITION_TOLERANCE
+		&& xAbs(a->max.x - b->max.x) <= POSITION_TOLERANCE && xAbs(a->max.y - b->max.y) <= POSITION_TOLERANCE && xAbs(a->max.z - b->max.z) <= POSITION_TOLERANCE;
+}
+
+static BOOL sameVertex(const XParticleVertex *a, const XParticleVertex *b)
+{
+	if (xAbs(a->position.x - b->position.x) > POSITION_TOLERANCE || xAbs(a->position.y - b->position.y) > POSITION_TOLERANCE ||
+		xAbs(a->position.z - b->position.z) > POSITION_TOLERANCE)
+		return NO;
+	if ((a->color & 0x00FFFFFF) != (b->color & 0x00FFFFFF))
+		return NO;
+	int alphaA = a->color >> 24, alphaB = b->color >> 24;
+	return (alphaA - alphaB <= 1 && alphaB - alphaA <= 1);
+}
+
+static const char *simdKernelName()
+{
+#if defined(__ARM_NEON__)
+	return "NEON";
+#elif defined(__SSE__)
+	return "SSE";
+#else
+	return "none (scalar fallback)";
+#endif
+}
+
+static void printUsage()
+{
+	printf("Usage: particlebench [options]\n\n");
+	printf("  -n <count>  total number of particles (default 50000)\n");
+	printf("  -s <count>  particles per system (default 64)\n");
+	printf("  -r <count>  number of times to animate every system through its lifetime (default 10)\n\n");
+}
+
+int main(int argc, const char *argv[])
+{
+	int particleCount = 50000, systemSize = 64, repeats = 10;
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc || argv[i][0] != '-') {
+			printUsage();
+			return 1;
+		}
+		char option = argv[i][1];
+		int value = atoi(argv[i + 1]);
+		if (option == 'n') particleCount = (value > 0) ? value : 1;
+		else if (option == 's') systemSize = (value > 0) ? value : 1;
+		else if (option == 'r') repeats = (value > 0) ? value : 1;
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	// systems share one allocation, as XParticleManager's pool does
+	srand(1);
+	int systemCount = (particleCount + systemSize - 1) / systemSize;
+	size_t storageSize = ParticleArray_storageSize(systemSize);
+	char *storage = malloc(storageSize * systemCount);
+	XParticleArray *systems = malloc(sizeof(XParticleArray) * systemCount);
+	for (int s = 0; s < systemCount; ++s) {
+		ParticleArray_initWithStorage(&systems[s], storage + storageSize * s, systemSize);
+		int count = particleCount - s * systemSize;
+		emitParticles(&systems[s], (count < systemSize) ? count : systemSize);
+	}
+	XParticleVertex *vertexes = malloc(sizeof(XParticleVertex) * 4 * systemSize);
+	XParticleVertex *checkVertexes = malloc(sizeof(XParticleVertex) * 4 * systemSize);
+	XVector3 offset = { 10, 0, -20 };
+	XVector3 right = { 0.8f, 0, 0.6f }, up = { -0.1f, 0.98f, 0.13f };
+	xNormalize_Vec3(&up);
+	int frames = (int)(MAX_LIFE / FRAME_TIME) + 1;
+	printf("%d particles in %d systems of %d, %d frames x %d, SIMD kernel: %s\n\n", particleCount, systemCount, systemSize, frames, repeats, simdKernelName());
+
+	// time both kernels over every frame of every system's life
+	double kernelTime[2] = { 0, 0 };
+	long liveTotal[2] = { 0, 0 };
+	for (int k = 0; k < 2; ++k) {
+		XBoundingBox bounds;
+		double startTime = currentTime();
+		for (int r = 0; r < repeats; ++r) {
+			for (int f = 0; f < frames; ++f) {
+				float time = f * FRAME_TIME;
+				for (int s = 0; s < systemCount; ++s) {
+					if (k == 0)
+						liveTotal[k] += ParticleKernel_expandBillboards(&systems[s], time, &offset, &right, &up, vertexes, &bounds);
+					else
+						liveTotal[k] += ParticleKernel_expandBillboardsScalar(&systems[s], time, &offset, &right, &up, vertexes, &bounds);
+				}
+			}
+		}
+		kernelTime[k] = currentTime() - startTime;
+	}
+	long countLiveTotal = 0;
+	double startTime = currentTime();
+	for (int r = 0; r < repeats; ++r)
+		for (int f = 0; f < frames; ++f)
+			for (int s = 0; s < systemCount; ++s)
+				countLiveTotal += ParticleKernel_countLive(&systems[s], f * FRAME_TIME);
+	double countLiveTime = currentTime() - startTime;
+
+	double evaluated = (double)particleCount * frames * repeats;
+	printf("SIMD:   %7.2f ns/particle, %7.2f ns/live particle\n", kernelTime[0] / evaluated * 1e9, kernelTime[0] / liveTotal[0] * 1e9);
+	printf("scalar: %7.2f ns/particle, %7.2f ns/live particle (SIMD is %.2fx)\n", kernelTime[1] / evaluated * 1e9, kernelTime[1] / liveTotal[1] * 1e9,
+		(kernelTime[0] > 0) ? kernelTime[1] / kernelTime[0] : 0.0);
+	printf("countLive: %5.2f ns/particle\n", countLiveTime / evaluated * 1e9);
+	printf("%.1f%% of particles alive on average\n\n", 100.0 * liveTotal[1] / evaluated);
+
+	// check the kernels against each other, frame by frame
+	long countMismatches = 0, vertexMismatches = 0, boundsMismatches = 0;
+	for (int f = 0; f < frames; ++f) {
+		float time = f * FRAME_TIME;
+		for (int s = 0; s < systemCount; ++s) {
+			XBoundingBox bounds, checkBounds;
+			int count = ParticleKernel_expandBillboards(&systems[s], time, &offset, &right, &up, vertexes, &bounds);
+			int checkCount = ParticleKernel_expandBillboardsScalar(&systems[s], time, &offset, &right, &up, checkVertexes, &checkBounds);
+			if (count != checkCount || count != ParticleKernel_countLive(&systems[s], time)) {
+				++countMismatches;
+				continue;
+			}
+			for (int v = 0; v < count * 4; ++v)
+				vertexMismatches += !sameVertex(&vertexes[v], &checkVertexes[v]);
+			if (count > 0 && !sameBounds(&bounds, &checkBounds))
+				++boundsMismatches;
+		}
+	}
+	printf("live count mismatches: %ld\n", countMismatches);
+	printf("vertex mismatches: %ld\n", vertexMismatches);
+	printf("bounds mismatches: %ld\n\n", boundsMismatches);
+
+	free(checkVertexes);
+	free(vertexes);
+	free(systems);
+	free(storage);
+	if (countMismatches > 0 || vertexMismatches > 0 || boundsMismatches > 0 || countLiveTotal != liveTotal[1]) {
+		printf("FAILED\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,370 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// rendercheck: drives the GL calls of a game frame (a sky box, terrain patches, models, a particle batch
+// and the HUD, issued as XSkyBox, XTerrain, XModel, XParticleSystem and X2D issue them) through the
+// recording device on top of the null device, without OpenGL ES or a GL context, and checks that
+// XRenderStats counts exactly the draw calls, triangles, uploads, binds and state changes the frame made.
+// Also checks that the stats are the same every frame once loading is done, and that the null device
+// hands out distinct object names. Then loads the 13 HUD textures and draws the texture switches of a
+// typical frame of -[GHUD render] (skipping rebinds of the bound texture, as X2D does), once with every
+// texture by itself and once from Media/HUD/hud.atlas, and reports the texture binds and upload bytes
+// of both.
+// Plain C, so it builds anywhere:
+//   cc -O2 -std=gnu99 -DXRENDERDEVICE_HEADLESS -include Game/Source/XStandalone.h -o rendercheck RenderCheck/main.c -x c Game/Source/XRenderDevice.m
+
+#include "../Game/Source/XRenderDevice.h"
+#include <stdio.h>
+
+#define SKY_FACES 5
+#define TERRAIN_PATCHES 16
+#define TERRAIN_PATCH_INDEXES (32 * 32 * 6)
+#define MODELS 24
+#define MODEL_SUBMESHES 2
+#define MODEL_SUBMESH_INDEXES 900
+#define PARTICLES 200
+#define HUD_QUADS 8
+#define TEXTURE_SIZE 256
+#define HUD_ATLAS_SIZE 512
+
+typedef struct {
+	GLuint vertexBuffer, indexBuffer;
+	GLsizeiptr vertexBytes, indexBytes;
+} Buffers;
+
+typedef struct {
+	GLuint skyTextures[SKY_FACES], terrainTexture, modelTexture, particleTexture, hudTexture;
+	Buffers terrain, model, particles;
+} Resources;
+
+// the HUD's textures at their sizes in hud.atlas (the three 64x64 ones also ship as 4bpp PVRTC, which
+// is used by itself; the rest are TGAs with alpha, converted to RGBA4444 as XTexture loads them)
+enum { HUD_MenuButton, HUD_Flag, HUD_Crosshairs, HUD_Arrow, HUD_FireButton, HUD_ArmorBG, HUD_ArmorBar,
+	HUD_DesertionWarning, HUD_VictoryDefeat, HUD_Map1, HUD_Map2, HUD_Map3, HUD_NA, HUD_ImageCount };
+static const struct { int width, height; BOOL pvrtc; } hudImages[HUD_ImageCount] = {
+	{ 32, 32, NO }, { 16, 16, NO }, { 32, 32, NO }, { 32, 32, NO }, { 64, 64, YES }, { 64, 64, YES }, { 64, 64, YES },
+	{ 128, 128, NO }, { 256, 256, NO }, { 128, 128, NO }, { 128, 128, NO }, { 128, 128, NO }, { 32, 32, NO }
+};
+
+// the textures -[GHUD render] sets in a typical frame, and how many quads it draws with each (three
+// outposts on screen, five movement arrows)
+static const int hudSequence[][2] = {
+	{ HUD_MenuButton, 1 }, { HUD_Flag, 3 }, { HUD_Crosshairs, 1 }, { HUD_Arrow, 5 }, { HUD_FireButton, 1 },
+	{ HUD_ArmorBG, 1 }, { HUD_ArmorBar, 1 }
+};
+#define HUD_SEQUENCE_LENGTH (int)(sizeof(hudSequence) / sizeof(hudSequence[0]))
+
+static GLuint boundHUDTexture;
+
+static GLfloat identityMatrix[16] = { 1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1 };
+
+static void loadBuffers(Buffers *b, GLsizeiptr vertexBytes, GLsizeiptr indexBytes, GLenum usage)
+{
+	b->vertexBytes = vertexBytes;
+	b->indexBytes = indexBytes;
+	glGenBuffers(1, &b->vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, b->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, usage);
+	glGenBuffers(1, &b->indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b->indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+}
+
+static void loadTexture(GLuint *texture, GLenum format, GLenum type)
+{
+	glGenTextures(1, texture);
+	glBindTexture(GL_TEXTURE_2D, *texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, TEXTURE_SIZE, TEXTURE_SIZE, 0, format, type, NULL);
+}
+
+static void loadResources(Resources *r)
+{
+	for (int i = 0; i < SKY_FACES; ++i)
+		loadTexture(&r->skyTextures[i], GL_RGB, GL_UNSIGNED_SHORT_5_6_5);
+	loadTexture(&r->terrainTexture, GL_RGB, GL_UNSIGNED_BYTE);
+	loadTexture(&r->modelTexture, GL_RGBA, GL_UNSIGNED_BYTE);
+	loadTexture(&r->particleTexture, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE);
+	loadTexture(&r->hudTexture, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4);
+	loadBuffers(&r->terrain, TERRAIN_PATCHES * 33 * 33 * 20, TERRAIN_PATCH_INDEXES * sizeof(GLushort), GL_STATIC_DRAW);
+	loadBuffers(&r->model, 700 * 32, MODEL_SUBMESHES * MODEL_SUBMESH_INDEXES * sizeof(GLushort), GL_STATIC_DRAW);
+	loadBuffers(&r->particles, PARTICLES * 4 * 16, PARTICLES * 6 * sizeof(GLushort), GL_DYNAMIC_DRAW);
+}
+
+static void unloadResources(Resources *r)
+{
+	GLuint buffers[6] = { r->terrain.vertexBuffer, r->terrain.indexBuffer, r->model.vertexBuffer, r->model.indexBuffer,
+		r->particles.vertexBuffer, r->particles.indexBuffer };
+	GLuint textures[SKY_FACES + 4] = { r->terrainTexture, r->modelTexture, r->particleTexture, r->hudTexture };
+	memcpy(&textures[4], r->skyTextures, sizeof(r->skyTextures));
+	glDeleteBuffers(6, buffers);
+	glDeleteTextures(SKY_FACES + 4, textures);
+}
+
+static void bindBuffers(const Buffers *b, GLsizei stride)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, b->vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b->indexBuffer);
+	glVertexPointer(3, GL_FLOAT, stride, (void*)0);
+	glTexCoordPointer(2, GL_FLOAT, stride, (void*)12);
+}
+
+static void renderFrame(const Resources *r)
+{
+	glViewport(0, 0, 320, 480);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(identityMatrix);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadMatrixf(identityMatrix);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+	// sky box: a client side strip per face, without depth
+	static GLfloat quad[4 * 5];
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glDepthMask(GL_FALSE);
+	for (int i = 0; i < SKY_FACES; ++i) {
+		glBindTexture(GL_TEXTURE_2D, r->skyTextures[i]);
+		glVertexPointer(3, GL_FLOAT, 20, quad);
+		glTexCoordPointer(2, GL_FLOAT, 20, &quad[3]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+	glDepthMask(GL_TRUE);
+
+	// terrain patches
+	glEnable(GL_DEPTH_TEST);
+	glBindTexture(GL_TEXTURE_2D, r->terrainTexture);
+	bindBuffers(&r->terrain, 20);
+	for (int i = 0; i < TERRAIN_PATCHES; ++i)
+		glDrawElements(GL_TRIANGLES, TERRAIN_PATCH_INDEXES, GL_UNSIGNED_SHORT, (void*)0);
+
+	// models, one draw per submesh
+	glEnable(GL_LIGHTING);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glBindTexture(GL_TEXTURE_2D, r->modelTexture);
+	bindBuffers(&r->model, 32);
+	glNormalPointer(GL_FLOAT, 32, (void*)20);
+	for (int i = 0; i < MODELS; ++i) {
+		glPushMatrix();
+		glMultMatrixf(identityMatrix);
+		for (int s = 0; s < MODEL_SUBMESHES; ++s)
+			glDrawElements(GL_TRIANGLES, MODEL_SUBMESH_INDEXES, GL_UNSIGNED_SHORT, (void*)(s * MODEL_SUBMESH_INDEXES * sizeof(GLushort)));
+		glPopMatrix();
+	}
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisable(GL_LIGHTING);
+
+	// particles: the expanded billboards are uploaded, then drawn in one batch
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(GL_FALSE);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glBindTexture(GL_TEXTURE_2D, r->particleTexture);
+	bindBuffers(&r->particles, 16);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 16, (void*)12);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, r->particles.vertexBytes, NULL);
+	glDrawElements(GL_TRIANGLES, PARTICLES * 6, GL_UNSIGNED_SHORT, (void*)0);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDepthMask(GL_TRUE);
+
+	// HUD: orthographic quads, as X2D draws them
+	glDisable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrthof(0, 320, 480, 0, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, r->hudTexture);
+	for (int i = 0; i < HUD_QUADS; ++i) {
+		glVertexPointer(3, GL_FLOAT, 20, quad);
+		glTexCoordPointer(2, GL_FLOAT, 20, &quad[3]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+	glDisable(GL_BLEND);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+}
+
+// loads the HUD textures by themselves, or (with an atlas) all as regions of one texture
+static void loadHUDTextures(GLuint *textures, BOOL atlas)
+{
+	if (atlas) {
+		GLuint atlasTexture;
+		glGenTextures(1, &atlasTexture);
+		glBindTexture(GL_TEXTURE_2D, atlasTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, HUD_ATLAS_SIZE, HUD_ATLAS_SIZE, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, NULL);
+		for (int i = 0; i < HUD_ImageCount; ++i)
+			textures[i] = atlasTexture;
+		return;
+	}
+	for (int i = 0; i < HUD_ImageCount; ++i) {
+		glGenTextures(1, &textures[i]);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		if (hudImages[i].pvrtc)
+			glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG, hudImages[i].width, hudImages[i].height, 0,
+				hudImages[i].width * hudImages[i].height / 2, NULL);
+		else
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, hudImages[i].width, hudImages[i].height, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, NULL);
+	}
+}
+
+// as x2D_setTexture
+static void setHUDTexture(GLuint texture)
+{
+	if (texture != boundHUDTexture) {
+		boundHUDTexture = texture;
+		glBindTexture(GL_TEXTURE_2D, texture);
+	}
+}
+
+static void renderHUD(const GLuint *textures)
+{
+	static GLfloat quad[4 * 4];
+	boundHUDTexture = (GLuint)-1; //(x2D_begin forgets the bound texture, then unbinds it)
+	setHUDTexture(0);
+	for (int i = 0; i < HUD_SEQUENCE_LENGTH; ++i) {
+		setHUDTexture(textures[hudSequence[i][0]]);
+		for (int q = 0; q < hudSequence[i][1]; ++q) {
+			glVertexPointer(2, GL_FLOAT, 0, quad);
+			glTexCoordPointer(2, GL_FLOAT, 0, &quad[8]);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		}
+	}
+}
+
+static void printStats(const char *title, const XRenderStats *s)
+{
+	printf("%s:\n", title);
+	printf("  draw calls %d, triangles %d\n", s->drawCalls, s->triangles);
+	printf("  buffer uploads %d (%d bytes), texture uploads %d (%d bytes)\n", s->bufferUploads, s->bufferUploadBytes, s->textureUploads, s->textureUploadBytes);
+	printf("  state changes %d, array pointers %d, matrix ops %d\n", s->stateChanges, s->arrayPointers, s->matrixOps);
+	printf("  texture binds %d, buffer binds %d, resource calls %d\n\n", s->textureBinds, s->bufferBinds, s->resourceCalls);
+}
+
+static int checkStat(const char *name, int counted, int expected)
+{
+	if (counted == expected)
+		return 0;
+	printf("%s: counted %d, expected %d\n", name, counted, expected);
+	return 1;
+}
+
+static void printUsage()
+{
+	printf("Usage: rendercheck [options]\n\n");
+	printf("  -r <count>  number of frames to render (default 3)\n\n");
+}
+
+int main(int argc, const char *argv[])
+{
+	int frames = 3;
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc || argv[i][0] != '-') {
+			printUsage();
+			return 1;
+		}
+		char option = argv[i][1];
+		int value = atoi(argv[i + 1]);
+		if (option == 'r') frames = (value > 0) ? value : 1;
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	xglSetRenderDevice(xglRecordingDevice(xglNullDevice()));
+	printf("device: %s, forwarding to %s\n\n", xglDevice->name, xglNullDevice()->name);
+	int failures = 0;
+
+	// loading
+	Resources r;
+	xglResetRenderStats();
+	loadResources(&r);
+	XRenderStats load = xglGetRenderStats();
+	printStats("load", &load);
+	int textureCount = SKY_FACES + 4;
+	int texelCount = TEXTURE_SIZE * TEXTURE_SIZE;
+	failures += checkStat("load resource calls", load.resourceCalls, textureCount + 6);
+	failures += checkStat("load texture uploads", load.textureUploads, textureCount);
+	failures += checkStat("load texture bytes", load.textureUploadBytes, texelCount * (SKY_FACES * 2 + 3 + 4 + 2 + 2));
+	failures += checkStat("load buffer uploads", load.bufferUploads, 6);
+	failures += checkStat("load buffer bytes", load.bufferUploadBytes, (int)(r.terrain.vertexBytes + r.terrain.indexBytes
+		+ r.model.vertexBytes + r.model.indexBytes + r.particles.vertexBytes + r.particles.indexBytes));
+	failures += checkStat("load draw calls", load.drawCalls, 0);
+
+	// names from the null device must be distinct
+	GLuint names[] = { r.terrain.vertexBuffer, r.terrain.indexBuffer, r.model.vertexBuffer, r.model.indexBuffer,
+		r.particles.vertexBuffer, r.particles.indexBuffer, r.terrainTexture, r.modelTexture, r.particleTexture, r.hudTexture };
+	int nameCount = sizeof(names) / sizeof(names[0]), duplicateNames = 0;
+	for (int i = 0; i < nameCount; ++i)
+		for (int j = i + 1; j < nameCount; ++j)
+			duplicateNames += (names[i] == 0 || names[i] == names[j]);
+	failures += checkStat("duplicate object names", duplicateNames, 0);
+
+	// frames: every one must record exactly the same calls
+	XRenderStats first;
+	int differentFrames = 0;
+	for (int f = 0; f < frames; ++f) {
+		xglResetRenderStats();
+		renderFrame(&r);
+		XRenderStats stats = xglGetRenderStats();
+		if (f == 0)
+			first = stats;
+		else if (memcmp(&stats, &first, sizeof(XRenderStats)) != 0)
+			++differentFrames;
+	}
+	printStats("frame", &first);
+	failures += checkStat("draw calls", first.drawCalls, SKY_FACES + TERRAIN_PATCHES + MODELS * MODEL_SUBMESHES + 1 + HUD_QUADS);
+	failures += checkStat("triangles", first.triangles, SKY_FACES * 2 + TERRAIN_PATCHES * TERRAIN_PATCH_INDEXES / 3
+		+ MODELS * MODEL_SUBMESHES * MODEL_SUBMESH_INDEXES / 3 + PARTICLES * 2 + HUD_QUADS * 2);
+	failures += checkStat("buffer uploads", first.bufferUploads, 1);
+	failures += checkStat("buffer upload bytes", first.bufferUploadBytes, (int)r.particles.vertexBytes);
+	failures += checkStat("texture uploads", first.textureUploads, 0);
+	failures += checkStat("texture binds", first.textureBinds, SKY_FACES + 4);
+	failures += checkStat("buffer binds", first.bufferBinds, 2 * 5);
+	failures += checkStat("array pointers", first.arrayPointers, SKY_FACES * 2 + 2 + 3 + 3 + HUD_QUADS * 2);
+	failures += checkStat("matrix ops", first.matrixOps, 4 + MODELS * 3 + 5);
+	failures += checkStat("state changes", first.stateChanges, 4 + 2 + 1 + 4 + 6 + 4);
+	failures += checkStat("resource calls", first.resourceCalls, 0);
+	failures += checkStat("frames with different stats", differentFrames, 0);
+	failures += checkStat("GL errors", (int)glGetError(), GL_NO_ERROR);
+
+	xglResetRenderStats();
+	unloadResources(&r);
+	failures += checkStat("unload resource calls", xglGetRenderStats().resourceCalls, 2);
+
+	// the HUD, with and without the atlas
+	XRenderStats hudLoad[2], hudFrame[2];
+	for (int atlas = 0; atlas < 2; ++atlas) {
+		GLuint hudTextures[HUD_ImageCount];
+		xglResetRenderStats();
+		loadHUDTextures(hudTextures, atlas);
+		hudLoad[atlas] = xglGetRenderStats();
+		xglResetRenderStats();
+		renderHUD(hudTextures);
+		hudFrame[atlas] = xglGetRenderStats();
+		glDeleteTextures(atlas ? 1 : HUD_ImageCount, hudTextures);
+	}
+	int hudQuads = 0;
+	for (int i = 0; i < HUD_SEQUENCE_LENGTH; ++i)
+		hudQuads += hudSequence[i][1];
+	printf("HUD (%d quads with %d textures):\n", hudQuads, HUD_SEQUENCE_LENGTH);
+	printf("  separate textures: %d texture binds per frame, %d textures uploaded (%d bytes)\n", hudFrame[0].textureBinds,
+		hudLoad[0].textureUploads, hudLoad[0].textureUploadBytes);
+	printf("  atlas:             %d texture binds per frame, %d texture uploaded (%d bytes)\n\n", hudFrame[1].textureBinds,
+		hudLoad[1].textureUploads, hudLoad[1].textureUploadBytes);
+	failures += checkStat("HUD texture binds without the atlas", hudFrame[0].textureBinds, 1 + HUD_SEQUENCE_LENGTH);
+	failures += checkStat("HUD texture binds with the atlas", hudFrame[1].textureBinds, 2);
+	failures += checkStat("HUD draw calls with the atlas", hudFrame[1].drawCalls, hudFrame[0].drawCalls);
+	failures += checkStat("HUD atlas bytes", hudLoad[1].textureUploadBytes, HUD_ATLAS_SIZE * HUD_ATLAS_SIZE * 2);
+
+	xglSetRenderDevice(xglGLESDevice());
+	if (failures > 0) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("all stats as expected\n");
+	return 0;
+}
@@ -0,0 +1,324 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// texturecheck: decodes .pvr textures in software and measures how closely they match the images
+// they were compressed from (the .pvr name minus its ".pvr", e.g. "tree.tga.pvr" -> "tree.tga"),
+// so the compressed media can be checked on machines without a PowerVR GPU or Apple's tools.
+//
+// Only TGA sources can be compared (other images are decoded and timed, but reported without a PSNR).
+// Plain C, so it builds anywhere:
+//   cc -O2 -std=gnu99 -o texturecheck TextureCheck/main.c -x c Game/Source/XTextureDecoder.m -lm
+
+#include "../Game/Source/XTextureDecoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define MAX_BASELINE_ENTRIES 1024
+#define PATH_LENGTH 512
+
+typedef struct {
+	char path[PATH_LENGTH];
+	double psnr;
+} BaselineEntry;
+
+typedef struct {
+	uint32_t headerLength, height, width, mipCount, flags, dataLength, bpp;
+	uint32_t bitmaskRed, bitmaskGreen, bitmaskBlue, bitmaskAlpha, pvrTag, surfaceCount;
+} PVRHeader;
+
+static uint8_t *readFile(const char *path, size_t *size)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return NULL;
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint8_t *data = (length > 0) ? malloc(length) : NULL;
+	if (data && fread(data, 1, length, file) != (size_t)length) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	*size = (size_t)length;
+	return data;
+}
+
+static uint32_t readLittleEndian32(const uint8_t *bytes)
+{
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// reads a type 2 (raw) or type 10 (RLE) 24/32 bit TGA into top-down RGBA; returns NULL on failure
+static uint8_t *loadTGA(const char *path, int *width, int *height, int *hasAlpha)
+{
+	size_t size;
+	uint8_t *file = readFile(path, &size);
+	if (!file)
+		return NULL;
+	if (size < 18 || (file[2] != 2 && file[2] != 10) || (file[16] != 24 && file[16] != 32)) {
+		free(file);
+		return NULL;
+	}
+	int w = file[12] | (file[13] << 8), h = file[14] | (file[15] << 8);
+	int bytesPerPixel = file[16] / 8;
+	int topDown = (file[17] & 0x20) != 0;
+	const uint8_t *src = file + 18 + file[0], *end = file + size;
+
+	uint8_t *pixels = malloc((size_t)w * h * 4);
+	int pixelCount = w * h, pixel = 0;
+	while (pixel < pixelCount) {
+		int run = 1, raw = 1;
+		if (file[2] == 10) {
+			if (src >= end) break;
+			uint8_t header = *src++;
+			run = (header & 0x7f) + 1;
+			raw = (header & 0x80) == 0;
+		}
+		for (int i = 0; i < run && pixel < pixelCount; ++i, ++pixel) {
+			if (src + bytesPerPixel > end) {
+				pixel = pixelCount + 1;
+				break;
+			}
+			int row = pixel / w, column = pixel % w;
+			uint8_t *dest = &pixels[((topDown ? row : h - 1 - row) * w + column) * 4];
+			dest[0] = src[2]; dest[1] = src[1]; dest[2] = src[0];
+			dest[3] = (bytesPerPixel == 4) ? src[3] : 255;
+			if (raw || i == run - 1)
+				src += bytesPerPixel;
+		}
+	}
+	free(file);
+	if (pixel != pixelCount) {
+		free(pixels);
+		return NULL;
+	}
+	*width = w;
+	*height = h;
+	*hasAlpha = (bytesPerPixel == 4);
+	return pixels;
+}
+
+static int saveTGA(const char *path, const uint8_t *pixels, int width, int height)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return 0;
+	uint8_t header[18] = { 0, 0, 2, 0,0,0,0,0, 0,0,0,0, width & 0xff, width >> 8, height & 0xff, height >> 8, 32, 0x28 };
+	fwrite(header, 1, sizeof(header), file);
+	for (int i = 0; i < width * height; ++i) {
+		uint8_t bgra[4] = { pixels[i*4+2], pixels[i*4+1], pixels[i*4], pixels[i*4+3] };
+		fwrite(bgra, 1, 4, file);
+	}
+	fclose(file);
+	return 1;
+}
+
+static double currentTime()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int loadBaseline(const char *path, BaselineEntry *entries)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return 0;
+	int count = 0;
+	char line[PATH_LENGTH + 64];
+	while (count < MAX_BASELINE_ENTRIES && fgets(line, sizeof(line), file)) {
+		// "<psnr> <path>", so paths may contain spaces
+		char *separator = strchr(line, ' ');
+		if (!separator || line[0] == '#')
+			continue;
+		entries[count].psnr = strtod(line, NULL);
+		strncpy(entries[count].path, separator + 1, PATH_LENGTH - 1);
+		entries[count].path[PATH_LENGTH - 1] = 0;
+		entries[count].path[strcspn(entries[count].path, "\r\n")] = 0;
+		++count;
+	}
+	fclose(file);
+	return count;
+}
+
+static const BaselineEntry *findBaseline(const BaselineEntry *entries, int count, const char *path)
+{
+	for (int i = 0; i < count; ++i)
+		if (strcmp(entries[i].path, path) == 0)
+			return &entries[i];
+	return NULL;
+}
+
+static const char *formatName(XTextureDecoderFormat format)
+{
+	switch (format) {
+		case XTextureDecoderFormat_PVRTC_2BPP: return "PVRTC 2bpp";
+		case XTextureDecoderFormat_PVRTC_4BPP: return "PVRTC 4bpp";
+		case XTextureDecoderFormat_ETC1: return "ETC1";
+		default: return "unknown";
+	}
+}
+
+static void printUsage()
+{
+	printf("Usage: texturecheck [options] texture.pvr [texture2.pvr ...]\n\n");
+	printf("  -t <dB>     flag textures whose PSNR against their source is below this (default 20)\n");
+	printf("  -b <file>   flag textures whose PSNR dropped more than 0.1 dB below this baseline\n");
+	printf("  -w <file>   write the measured PSNRs out as a new baseline\n");
+	printf("  -o <dir>    write each decoded texture (top mip level) to <dir>/<name>.decoded.tga\n");
+	printf("  -r <count>  decode every texture this many times when measuring throughput (default 1)\n\n");
+}
+
+int main(int argc, const char *argv[])
+{
+	double threshold = 20;
+	const char *baselinePath = NULL, *writePath = NULL, *outputDir = NULL;
+	int repeats = 1;
+	int firstFile = 1;
+	for (; firstFile < argc && argv[firstFile][0] == '-'; firstFile += 2) {
+		if (firstFile + 1 >= argc) {
+			printUsage();
+			return 1;
+		}
+		char option = argv[firstFile][1];
+		const char *value = argv[firstFile + 1];
+		if (option == 't') threshold = atof(value);
+		else if (option == 'b') baselinePath = value;
+		else if (option == 'w') writePath = value;
+		else if (option == 'o') outputDir = value;
+		else if (option == 'r') repeats = (atoi(value) > 0) ? atoi(value) : 1;
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	if (firstFile >= argc) {
+		printf("texturecheck: No input file specified\n\n");
+		printUsage();
+		return 1;
+	}
+
+	static BaselineEntry baseline[MAX_BASELINE_ENTRIES];
+	int baselineCount = baselinePath ? loadBaseline(baselinePath, baseline) : 0;
+	FILE *writeFile = writePath ? fopen(writePath, "w") : NULL;
+	if (writePath && !writeFile)
+		printf("texturecheck: Could not write baseline \"%s\"\n", writePath);
+
+	int flagged = 0, failures = 0;
+	double totalPixels = 0, totalTime = 0;
+	for (int i = firstFile; i < argc; ++i) {
+		const char *path = argv[i];
+		size_t size;
+		uint8_t *file = readFile(path, &size);
+		if (!file || size < sizeof(PVRHeader) || memcmp(file + 44, "PVR!", 4) != 0) {
+			printf("%s: not a PVR file\n", path);
+			free(file);
+			++failures;
+			continue;
+		}
+		PVRHeader header;
+		uint32_t *fields = &header.headerLength;
+		for (int f = 0; f < 13; ++f)
+			fields[f] = readLittleEndian32(file + f * 4);
+		XTextureDecoderFormat format = TextureDecoder_formatFromPVRFlags(header.flags);
+		if (format == XTextureDecoderFormat_Unknown) {
+			printf("%s: unsupported pixel type 0x%02x\n", path, header.flags & 0xff);
+			free(file);
+			++failures;
+			continue;
+		}
+
+		// decode every mip level (timed), keeping the top one
+		int width = header.width, height = header.height;
+		uint8_t *topLevel = malloc((size_t)width * height * 4);
+		uint8_t *scratch = malloc((size_t)width * height * 4);
+		double pixels = 0, startTime = currentTime();
+		int truncated = 0;
+		for (int r = 0; r < repeats; ++r) {
+			const uint8_t *data = file + header.headerLength;
+			const uint8_t *dataEnd = data + header.dataLength;
+			if (dataEnd > file + size)
+				dataEnd = file + size;
+			for (int w = width, h = height; data < dataEnd; w = (w > 1) ? w >> 1 : 1, h = (h > 1) ? h >> 1 : 1) {
+				size_t levelSize = TextureDecoder_levelSize(format, w, h);
+				if (data + levelSize > dataEnd) {
+					truncated = 1;
+					break;
+				}
+				TextureDecoder_decode(format, data, w, h, (data == file + header.headerLength) ? topLevel : scratch);
+				pixels += (double)w * h;
+				data += levelSize;
+				if (w == 1 && h == 1)
+					break;
+			}
+		}
+		double decodeTime = currentTime() - startTime;
+		totalPixels += pixels;
+		totalTime += decodeTime;
+		free(scratch);
+		free(file);
+
+		printf("%s: %dx%d %s, %.1f Mpixels/s", path, width, height, formatName(format),
+			(decodeTime > 0) ? pixels / decodeTime / 1e6 : 0.0);
+		if (truncated) {
+			printf(", TRUNCATED");
+			++flagged;
+		}
+
+		if (outputDir) {
+			const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+			char outputPath[PATH_LENGTH];
+			snprintf(outputPath, sizeof(outputPath), "%s/%s.decoded.tga", outputDir, name);
+			if (!saveTGA(outputPath, topLevel, width, height))
+				printf(", could not write \"%s\"", outputPath);
+		}
+
+		// compare against the source image
+		char sourcePath[PATH_LENGTH];
+		size_t length = strlen(path);
+		if (length >= 4 && length < sizeof(sourcePath) && strcmp(path + length - 4, ".pvr") == 0) {
+			memcpy(sourcePath, path, length - 4);
+			sourcePath[length - 4] = 0;
+		} else {
+			sourcePath[0] = 0;
+		}
+		int sourceWidth, sourceHeight, hasAlpha;
+		uint8_t *source = NULL;
+		if (strlen(sourcePath) > 4 && strcmp(sourcePath + strlen(sourcePath) - 4, ".tga") == 0)
+			source = loadTGA(sourcePath, &sourceWidth, &sourceHeight, &hasAlpha);
+		if (!source) {
+			printf(", no TGA source to compare\n");
+		} else if (sourceWidth != width || sourceHeight != height) {
+			printf(", source is %dx%d\n", sourceWidth, sourceHeight);
+			++flagged;
+		} else {
+			double psnr = TextureDecoder_psnr(topLevel, source, width * height, hasAlpha ? 4 : 3);
+			printf(", PSNR %.2f dB (%s)", psnr, hasAlpha ? "RGBA" : "RGB");
+			if (psnr < threshold) {
+				printf(", BELOW %.1f dB", threshold);
+				++flagged;
+			}
+			const BaselineEntry *entry = findBaseline(baseline, baselineCount, path);
+			if (entry && psnr < entry->psnr - 0.1) {
+				printf(", REGRESSED from %.2f dB", entry->psnr);
+				++flagged;
+			}
+			printf("\n");
+			if (writeFile)
+				fprintf(writeFile, "%.2f %s\n", psnr, path);
+		}
+		free(source);
+		free(topLevel);
+	}
+
+	if (writeFile)
+		fclose(writeFile);
+	printf("\n%d textures, %.1f Mpixels decoded at %.1f Mpixels/s, %d flagged, %d failed\n",
+		argc - firstFile, totalPixels / 1e6, (totalTime > 0) ? totalPixels / totalTime / 1e6 : 0.0, flagged, failures);
+	return (flagged > 0 || failures > 0) ? 1 : 0;
+}
+
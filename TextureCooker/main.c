@@ -0,0 +1,498 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// texturecooker: converts TGA and PNG images into cooked textures (see XCookedTexture.h), with a
+// gamma correct mip chain dithered down to the pixel format XTexture would otherwise convert to at
+// load time (RGBA4444 for TGAs with alpha, RGB565 for everything else), or a format given with -f.
+// Plain C, so it builds anywhere with zlib:
+//   cc -O2 -std=gnu99 -o texturecooker TextureCooker/main.c -lz -lm
+
+#include "../Game/Source/XCookedTexture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <zlib.h>
+
+#define PATH_LENGTH 512
+
+typedef struct {
+	int width, height;
+	int hasAlpha;
+	uint8_t *pixels;	// RGBA, top row first
+} Image;
+
+static uint8_t *readFile(const char *path, size_t *size)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return NULL;
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint8_t *data = (length > 0) ? malloc(length) : NULL;
+	if (data && fread(data, 1, length, file) != (size_t)length) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	*size = (size_t)length;
+	return data;
+}
+
+static uint32_t readBigEndian32(const uint8_t *bytes)
+{
+	return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+//------------------------------ Image Loaders -----------------------------------
+
+// type 2 (raw) or type 10 (RLE), 24 or 32 bit
+static const char *loadTGA(const uint8_t *file, size_t size, Image *image)
+{
+	if (size < 18 || (file[2] != 2 && file[2] != 10) || (file[16] != 24 && file[16] != 32))
+		return "TGA file must be a 24 or 32 bit type 2 or type 10";
+	int w = file[12] | (file[13] << 8), h = file[14] | (file[15] << 8);
+	int bytesPerPixel = file[16] / 8;
+	int topDown = (file[17] & 0x20) != 0;
+	const uint8_t *src = file + 18 + file[0], *end = file + size;
+
+	uint8_t *pixels = malloc((size_t)w * h * 4);
+	int pixelCount = w * h, pixel = 0;
+	while (pixel < pixelCount) {
+		int run = 1, raw = 1;
+		if (file[2] == 10) {
+			if (src >= end) break;
+			uint8_t header = *src++;
+			run = (header & 0x7f) + 1;
+			raw = (header & 0x80) == 0;
+		}
+		for (int i = 0; i < run && pixel < pixelCount; ++i, ++pixel) {
+			if (src + bytesPerPixel > end) {
+				free(pixels);
+				return "Could not read image data";
+			}
+			int row = pixel / w, column = pixel % w;
+			uint8_t *dest = &pixels[((topDown ? row : h - 1 - row) * w + column) * 4];
+			dest[0] = src[2]; dest[1] = src[1]; dest[2] = src[0];
+			dest[3] = (bytesPerPixel == 4) ? src[3] : 255;
+			if (raw || i == run - 1)
+				src += bytesPerPixel;
+		}
+	}
+	if (pixel != pixelCount) {
+		free(pixels);
+		return "Could not read image data";
+	}
+	image->width = w;
+	image->height = h;
+	image->hasAlpha = (bytesPerPixel == 4);
+	image->pixels = pixels;
+	return NULL;
+}
+
+static int paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	return (pb <= pc) ? b : c;
+}
+
+// non-interlaced, any color type, 1-8 bit (16 bit channels are truncated to 8)
+static const char *loadPNG(const uint8_t *file, size_t size, Image *image)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	if (size < 33 || memcmp(file, signature, 8) != 0)
+		return "Not a PNG file";
+
+	int width = 0, height = 0, bitDepth = 0, colorType = 0, interlaced = 0;
+	uint8_t palette[256][4];
+	memset(palette, 255, sizeof(palette));
+	uint8_t *compressed = NULL;
+	size_t compressedSize = 0;
+	const uint8_t *chunk = file + 8;
+	while (chunk + 12 <= file + size) {
+		uint32_t length = readBigEndian32(chunk);
+		const uint8_t *type = chunk + 4, *data = chunk + 8;
+		if (data + length + 4 > file + size)
+			break;
+		if (memcmp(type, "IHDR", 4) == 0) {
+			width = readBigEndian32(data);
+			height = readBigEndian32(data + 4);
+			bitDepth = data[8];
+			colorType = data[9];
+			interlaced = data[12];
+		}
+		else if (memcmp(type, "PLTE", 4) == 0) {
+			for (uint32_t i = 0; i < length / 3 && i < 256; ++i) {
+				palette[i][0] = data[i*3]; palette[i][1] = data[i*3+1]; palette[i][2] = data[i*3+2];
+			}
+		}
+		else if (memcmp(type, "tRNS", 4) == 0 && colorType == 3) {
+			for (uint32_t i = 0; i < length && i < 256; ++i)
+				palette[i][3] = data[i];
+		}
+		else if (memcmp(type, "IDAT", 4) == 0) {
+			compressed = realloc(compressed, compressedSize + length);
+			memcpy(compressed + compressedSize, data, length);
+			compressedSize += length;
+		}
+		else if (memcmp(type, "IEND", 4) == 0) {
+			break;
+		}
+		chunk = data + length + 4;
+	}
+	if (width <= 0 || height <= 0 || !compressed) {
+		free(compressed);
+		return "Missing PNG header or image data";
+	}
+	if (interlaced) {
+		free(compressed);
+		return "Interlaced PNGs are not supported";
+	}
+
+	static const int channelCounts[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	int channels = (colorType <= 6) ? channelCounts[colorType] : 0;
+	if (channels == 0 || (bitDepth != 8 && bitDepth != 16 && !(bitDepth < 8 && (colorType == 0 || colorType == 3)))) {
+		free(compressed);
+		return "Unsupported PNG color type or bit depth";
+	}
+	int bitsPerPixel = channels * bitDepth;
+	size_t rowBytes = ((size_t)width * bitsPerPixel + 7) / 8;
+	int pixelBytes = (bitsPerPixel + 7) / 8;
+
+	uLongf rawSize = (uLongf)(rowBytes + 1) * height;
+	uint8_t *raw = malloc(rawSize);
+	int result = uncompress(raw, &rawSize, compressed, compressedSize);
+	free(compressed);
+	if (result != Z_OK || rawSize != (rowBytes + 1) * height) {
+		free(raw);
+		return "Could not inflate PNG image data";
+	}
+
+	// undo the per-row filters in place
+	uint8_t *previous = NULL;
+	for (int y = 0; y < height; ++y) {
+		uint8_t *row = raw + y * (rowBytes + 1);
+		uint8_t filter = row[0];
+		uint8_t *line = row + 1;
+		for (size_t i = 0; i < rowBytes; ++i) {
+			int left = (i >= (size_t)pixelBytes) ? line[i - pixelBytes] : 0;
+			int up = previous ? previous[i] : 0;
+			int upLeft = (previous && i >= (size_t)pixelBytes) ? previous[i - pixelBytes] : 0;
+			switch (filter) {
+				case 1: line[i] += left; break;
+				case 2: line[i] += up; break;
+				case 3: line[i] += (left + up) / 2; break;
+				case 4: line[i] += paeth(left, up, upLeft); break;
+			}
+		}
+		previous = line;
+	}
+
+	uint8_t *pixels = malloc((size_t)width * height * 4);
+	int hasAlpha = 0;
+	for (int y = 0; y < height; ++y) {
+		const uint8_t *line = raw + y * (rowBytes + 1) + 1;
+		for (int x = 0; x < width; ++x) {
+			uint8_t *dest = &pixels[(y * width + x) * 4];
+			if (bitDepth < 8) {
+				int bitOffset = x * bitDepth;
+				int value = (line[bitOffset / 8] >> (8 - bitDepth - bitOffset % 8)) & ((1 << bitDepth) - 1);
+				if (colorType == 3) {
+					memcpy(dest, palette[value], 4);
+				} else {
+					uint8_t gray = (uint8_t)(value * 255 / ((1 << bitDepth) - 1));
+					dest[0] = dest[1] = dest[2] = gray;
+					dest[3] = 255;
+				}
+			} else {
+				// (the high byte of each 16 bit channel comes first)
+				int step = bitDepth / 8;
+				const uint8_t *src = line + x * channels * step;
+				switch (colorType) {
+					case 0: dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 255; break;
+					case 2: dest[0] = src[0]; dest[1] = src[step]; dest[2] = src[2*step]; dest[3] = 255; break;
+					case 3: memcpy(dest, palette[src[0]], 4); break;
+					case 4: dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[step]; break;
+					case 6: dest[0] = src[0]; dest[1] = src[step]; dest[2] = src[2*step]; dest[3] = src[3*step]; break;
+				}
+			}
+			if (dest[3] != 255)
+				hasAlpha = 1;
+		}
+	}
+	free(raw);
+
+	image->width = width;
+	image->height = height;
+	image->hasAlpha = hasAlpha;
+	image->pixels = pixels;
+	return NULL;
+}
+
+//------------------------------ Mip Generation -----------------------------------
+
+static float srgbToLinear[256];
+
+static void initGammaTables()
+{
+	for (int i = 0; i < 256; ++i) {
+		float c = i / 255.0f;
+		srgbToLinear[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+	}
+}
+
+static float linearToSRGB(float c)
+{
+	if (c <= 0.0031308f)
+		return c * 12.92f;
+	return 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// halves an image with a box filter, averaging colors in linear space (weighted by alpha, so fully
+// transparent texels don't bleed their color into visible ones) and alpha as is
+static void downsample(const float *src, int srcWidth, int srcHeight, float *dest, int destWidth, int destHeight)
+{
+	for (int y = 0; y < destHeight; ++y) {
+		for (int x = 0; x < destWidth; ++x) {
+			float sum[4] = { 0, 0, 0, 0 };
+			float colorSum[3] = { 0, 0, 0 };
+			int count = 0;
+			for (int sy = y * 2; sy < y * 2 + 2; ++sy) {
+				for (int sx = x * 2; sx < x * 2 + 2; ++sx) {
+					const float *s = &src[((sy < srcHeight ? sy : srcHeight - 1) * srcWidth + (sx < srcWidth ? sx : srcWidth - 1)) * 4];
+					for (int c = 0; c < 3; ++c) {
+						sum[c] += s[c] * s[3];
+						colorSum[c] += s[c];
+					}
+					sum[3] += s[3];
+					++count;
+				}
+			}
+			float *d = &dest[(y * destWidth + x) * 4];
+			for (int c = 0; c < 3; ++c)
+				d[c] = (sum[3] > 0) ? sum[c] / sum[3] : colorSum[c] / count;
+			d[3] = sum[3] / count;
+		}
+	}
+}
+
+//------------------------------ Pixel Format Conversion -----------------------------------
+
+static const int formatBits[XCookedTextureFormat_Count][4] = {
+	{ 5, 6, 5, 0 },
+	{ 4, 4, 4, 4 },
+	{ 8, 8, 8, 8 },
+};
+static const char *formatNames[XCookedTextureFormat_Count] = { "RGB565", "RGBA4444", "RGBA8888" };
+static const char *formatOptions[XCookedTextureFormat_Count] = { "565", "4444", "8888" };
+
+// quantizes one level (linear color, straight alpha) to the format with Floyd-Steinberg dithering of
+// the color channels (alpha is only rounded, so alpha tested edges don't crawl), and packs it
+static size_t packLevel(const float *linear, int width, int height, XCookedTextureFormat format, uint8_t *dest)
+{
+	const int *bits = formatBits[format];
+	float *error = calloc((size_t)(width + 2) * 2 * 3, sizeof(float));
+	float *currentError = error, *nextError = error + (width + 2) * 3;
+	size_t offset = 0;
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			const float *pixel = &linear[(y * width + x) * 4];
+			int quantized[4];
+			for (int c = 0; c < 4; ++c) {
+				int maxValue = (1 << bits[c]) - 1;
+				if (bits[c] == 0) {
+					quantized[c] = 0;
+					continue;
+				}
+				float value = (c < 3) ? linearToSRGB(pixel[c]) * 255.0f : pixel[3] * 255.0f;
+				if (c < 3 && bits[c] < 8)
+					value += currentError[(x + 1) * 3 + c];
+				int q = (int)floorf(value * maxValue / 255.0f + 0.5f);
+				q = (q < 0) ? 0 : ((q > maxValue) ? maxValue : q);
+				quantized[c] = q;
+				if (c < 3 && bits[c] < 8) {
+					// (GL expands n bit channels to q * 255 / maxValue)
+					float e = value - q * 255.0f / maxValue;
+					currentError[(x + 2) * 3 + c] += e * (7.0f / 16);
+					nextError[x * 3 + c] += e * (3.0f / 16);
+					nextError[(x + 1) * 3 + c] += e * (5.0f / 16);
+					nextError[(x + 2) * 3 + c] += e * (1.0f / 16);
+				}
+			}
+			if (format == XCookedTextureFormat_RGBA8888) {
+				for (int c = 0; c < 4; ++c)
+					dest[offset++] = (uint8_t)quantized[c];
+			} else {
+				uint16_t packed;
+				if (format == XCookedTextureFormat_RGB565)
+					packed = (uint16_t)(quantized[0] << 11 | quantized[1] << 5 | quantized[2]);
+				else
+					packed = (uint16_t)(quantized[0] << 12 | quantized[1] << 8 | quantized[2] << 4 | quantized[3]);
+				dest[offset++] = packed & 0xff;
+				dest[offset++] = packed >> 8;
+			}
+		}
+		float *swap = currentError;
+		currentError = nextError;
+		nextError = swap;
+		memset(nextError, 0, sizeof(float) * (width + 2) * 3);
+	}
+	free(error);
+	return offset;
+}
+
+//------------------------------ Cooking -----------------------------------
+
+static int cookTexture(const char *sourcePath, const char *destPath, int forcedFormat, int makeMips)
+{
+	size_t size;
+	uint8_t *file = readFile(sourcePath, &size);
+	if (!file) {
+		printf("Could not read \"%s\"\n", sourcePath);
+		return 0;
+	}
+	Image image;
+	const char *error;
+	size_t pathLength = strlen(sourcePath);
+	int isTGA = (pathLength > 4 && strcmp(sourcePath + pathLength - 4, ".tga") == 0);
+	if (isTGA)
+		error = loadTGA(file, size, &image);
+	else if (pathLength > 4 && strcmp(sourcePath + pathLength - 4, ".png") == 0)
+		error = loadPNG(file, size, &image);
+	else
+		error = "Only .tga and .png images can be cooked";
+	free(file);
+	if (error) {
+		printf("Error loading \"%s\": %s\n", sourcePath, error);
+		return 0;
+	}
+
+	// (XTexture loads PNGs through UIImage without their alpha, so cooked PNGs default to RGB565 too)
+	XCookedTextureFormat format;
+	if (forcedFormat >= 0)
+		format = forcedFormat;
+	else
+		format = (isTGA && image.hasAlpha) ? XCookedTextureFormat_RGBA4444 : XCookedTextureFormat_RGB565;
+
+	// convert to linear color for filtering
+	int width = image.width, height = image.height;
+	float *linear = malloc(sizeof(float) * 4 * width * height);
+	for (int i = 0; i < width * height; ++i) {
+		for (int c = 0; c < 3; ++c)
+			linear[i*4 + c] = srgbToLinear[image.pixels[i*4 + c]];
+		linear[i*4 + 3] = image.pixels[i*4 + 3] / 255.0f;
+	}
+	free(image.pixels);
+
+	XCookedTextureHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = XCOOKEDTEXTURE_MAGIC;
+	header.version = XCOOKEDTEXTURE_VERSION;
+	header.width = width;
+	header.height = height;
+	header.format = format;
+
+	int bytesPerPixel = (format == XCookedTextureFormat_RGBA8888) ? 4 : 2;
+	uint8_t *packed = malloc((size_t)width * height * bytesPerPixel);
+	FILE *out = fopen(destPath, "wb");
+	if (!out) {
+		printf("Could not write \"%s\"\n", destPath);
+		free(linear);
+		free(packed);
+		return 0;
+	}
+	fwrite(&header, sizeof(header), 1, out);
+
+	uint32_t offset = sizeof(header);
+	int levelWidth = width, levelHeight = height;
+	while (header.levelCount < XCOOKEDTEXTURE_MAX_LEVELS) {
+		// align every level
+		static const uint8_t padding[XCOOKEDTEXTURE_LEVEL_ALIGNMENT] = { 0 };
+		uint32_t aligned = (offset + XCOOKEDTEXTURE_LEVEL_ALIGNMENT - 1) & ~(XCOOKEDTEXTURE_LEVEL_ALIGNMENT - 1);
+		fwrite(padding, 1, aligned - offset, out);
+		offset = aligned;
+
+		size_t levelSize = packLevel(linear, levelWidth, levelHeight, format, packed);
+		fwrite(packed, 1, levelSize, out);
+		header.levels[header.levelCount].offset = offset;
+		header.levels[header.levelCount].size = (uint32_t)levelSize;
+		++header.levelCount;
+		offset += levelSize;
+
+		if (!makeMips || (levelWidth == 1 && levelHeight == 1))
+			break;
+		int nextWidth = (levelWidth > 1) ? levelWidth / 2 : 1, nextHeight = (levelHeight > 1) ? levelHeight / 2 : 1;
+		float *next = malloc(sizeof(float) * 4 * nextWidth * nextHeight);
+		downsample(linear, levelWidth, levelHeight, next, nextWidth, nextHeight);
+		free(linear);
+		linear = next;
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+	}
+	free(linear);
+	free(packed);
+
+	// (the header is little endian like everything else the game loads)
+	fseek(out, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, out);
+	int ok = (ferror(out) == 0);
+	fclose(out);
+
+	printf("%s: %dx%d %s, %d levels, %u bytes\n", destPath, width, height, formatNames[format], header.levelCount, offset);
+	return ok;
+}
+
+int main(int argc, const char *argv[])
+{
+	int forcedFormat = -1, makeMips = 1;
+	const char *outputPath = NULL;
+	int firstFile = 1;
+	for (; firstFile < argc && argv[firstFile][0] == '-'; ++firstFile) {
+		const char *option = argv[firstFile];
+		if (strcmp(option, "-n") == 0) {
+			makeMips = 0;
+		} else if ((strcmp(option, "-f") == 0 || strcmp(option, "-o") == 0) && firstFile + 1 < argc) {
+			const char *value = argv[++firstFile];
+			if (option[1] == 'o') {
+				outputPath = value;
+			} else {
+				for (int f = 0; f < XCookedTextureFormat_Count; ++f)
+					if (strcmp(value, formatOptions[f]) == 0 || strcmp(value, formatNames[f]) == 0)
+						forcedFormat = f;
+				if (forcedFormat < 0) {
+					printf("texturecooker: Unknown format \"%s\" (use 565, 4444 or 8888)\n", value);
+					return 1;
+				}
+			}
+		} else {
+			firstFile = argc;
+		}
+	}
+	if (firstFile >= argc || (outputPath && argc - firstFile > 1)) {
+		printf("Usage: texturecooker [-f 565|4444|8888] [-n] [-o output.xtex] image.tga [image2.png ...]\n");
+		printf("Each image is cooked into a texture next to it (e.g. HUD/arrow.tga -> HUD/arrow.tga.xtex),\n");
+		printf("or to the -o path when cooking a single image. -n skips mip generation.\n\n");
+		return 1;
+	}
+
+	initGammaTables();
+	int failures = 0;
+	for (int i = firstFile; i < argc; ++i) {
+		char destPath[PATH_LENGTH];
+		if (outputPath) {
+			snprintf(destPath, sizeof(destPath), "%s", outputPath);
+		} else if (strlen(argv[i]) + 6 > sizeof(destPath)) {
+			printf("texturecooker: Path too long: \"%s\"\n", argv[i]);
+			++failures;
+			continue;
+		} else {
+			snprintf(destPath, sizeof(destPath), "%s.xtex", argv[i]);
+		}
+		if (!cookTexture(argv[i], destPath, forcedFormat, makeMips))
+			++failures;
+	}
+	return (failures > 0) ? 1 : 0;
+}
+
@@ -0,0 +1,238 @@
+// Copyright © 2010 John Judnich. All rights reserved.
+
+// treebench: places trees over a map sized area as GMapLoader does, then
+//  - checks that TreePlacement_populatePoissonDisk places exactly the same trees on any number of
+//    threads (the result must only depend on the parameters), and times it on each, and
+//  - times TreePlacement_bucketTrees against the per batch scan XTreeSystem used before it (every
+//    batch testing every tree), checking that both find the same trees for every batch, and
+//  - from a fixed set of camera positions, sorts every batch into the near, mid and far rings as
+//    XTreeSystem does (with every batch in view), reporting the batches, trees and vertexes of each
+//    ring and the time to generate the mid ring's impostors, and checking every tree lands in one ring
+//    and every impostor is written.
+// Plain C, so it builds anywhere:
+//   cc -O2 -std=gnu99 -pthread -include Game/Source/XStandalone.h -o treebench TreeBench/main.c -x c Game/Source/XTreePlacement.m Game/Source/XTreeLOD.m -lm
+
+#include "../Game/Source/XTreePlacement.h"
+#include "../Game/Source/XTreeLOD.h"
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_THREADS 64
+#define TREE_BATCH_TARGET_TREES 256 //(as in XTreeSystem.h)
+#define TREE_BATCH_MAX_GRID_SIZE 64
+#define TREE_NEAR_DISTANCE 150 //(XTreeSystem's default LOD ranges)
+#define TREE_FAR_DISTANCE 500
+#define IMPOSTOR_REPEATS 20
+
+// where the LOD rings are measured from (map coordinates, as in the 1024 unit maps GMapLoader builds)
+static const struct { const char *name; XScalar x, z; } cameras[] = {
+	{ "center", 0, 0 }, { "inner", -150, 100 }, { "forest edge", 400, -400 }, { "map corner", -500, 500 }, { "outside", 0, 700 }
+};
+#define CAMERA_COUNT (int)(sizeof(cameras) / sizeof(cameras[0]))
+
+static double currentTime()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// the trees in batch (x, y), found by testing every tree (as -[XTreeSystem updateTreeBatchX:Y:] did)
+static int scanBatch(const XTreeInstance *trees, int treeCount, XScalarRect area, int gridRes, int x, int y, int *indexes)
+{
+	XScalar cellWidth = (area.right - area.left) / gridRes;
+	XScalar cellHeight = (area.bottom - area.top) / gridRes;
+	int count = 0;
+	for (int i = 0; i < treeCount; ++i) {
+		if (TreePlacement_gridCoordinate(trees[i].position.x, area.left, cellWidth, gridRes) == x
+			&& TreePlacement_gridCoordinate(trees[i].position.y, area.top, cellHeight, gridRes) == y)
+			indexes[count++] = i;
+	}
+	return count;
+}
+
+static void printUsage()
+{
+	printf("Usage: treebench [options]\n\n");
+	printf("  -n <count>  number of trees to place (default 65536)\n");
+	printf("  -g <res>    batch grid resolution (default: sized as XTreeSystem does, for about %d trees per batch)\n", TREE_BATCH_TARGET_TREES);
+	printf("  -t <count>  most threads to place trees on (default 8)\n");
+	printf("  -s <seed>   placement seed (default 1)\n\n");
+}
+
+int main(int argc, const char *argv[])
+{
+	int treeCount = 65536, gridRes = 0, maxThreads = 8;
+	unsigned int seed = 1;
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc || argv[i][0] != '-') {
+			printUsage();
+			return 1;
+		}
+		char option = argv[i][1];
+		int value = atoi(argv[i + 1]);
+		if (option == 'n') treeCount = (value > 0) ? value : 1;
+		else if (option == 'g') gridRes = (value > 0) ? value : 1;
+		else if (option == 't') maxThreads = (value < 1) ? 1 : ((value > MAX_THREADS) ? MAX_THREADS : value);
+		else if (option == 's') seed = (unsigned int)value;
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	// the area and tree sizes GMapLoader uses
+	XTreePlacementParams params;
+	memset(&params, 0, sizeof(params));
+	params.area.left = -512 + 1024 * 0.1f; params.area.right = 512 - 1024 * 0.1f;
+	params.area.top = -512 + 1024 * 0.1f; params.area.bottom = 512 - 1024 * 0.1f;
+	params.minTreeSize = 8; params.maxTreeSize = 12;
+	params.seed = seed;
+
+	// place the trees on 1, 2, 4 ... threads, and compare each layout with the single threaded one
+	XTreeInstance *trees = malloc(sizeof(XTreeInstance) * treeCount);
+	XTreeInstance *otherTrees = malloc(sizeof(XTreeInstance) * treeCount);
+	int placed = 0, placementMismatches = 0;
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		params.threadCount = threads;
+		double startTime = currentTime();
+		int count = TreePlacement_populatePoissonDisk((threads == 1) ? trees : otherTrees, treeCount, &params);
+		double placeTime = currentTime() - startTime;
+		BOOL same = YES;
+		if (threads == 1)
+			placed = count;
+		else
+			same = (count == placed && memcmp(trees, otherTrees, sizeof(XTreeInstance) * count) == 0);
+		printf("placed %d trees on %d thread%s in %.1f ms%s\n", count, threads, (threads == 1) ? "" : "s", placeTime * 1000,
+			(threads == 1) ? "" : (same ? " (same trees)" : " (DIFFERENT trees)"));
+		if (!same)
+			++placementMismatches;
+	}
+	printf("\n");
+
+	// bucket them, sized as -[XTreeSystem setTreesArrayPointer:treeCount:] does
+	if (gridRes == 0) {
+		gridRes = 1;
+		while (gridRes < TREE_BATCH_MAX_GRID_SIZE && placed > gridRes * gridRes * TREE_BATCH_TARGET_TREES)
+			gridRes *= 2;
+	}
+	int bucketCount = gridRes * gridRes;
+	int *bucketStart = malloc(sizeof(int) * (bucketCount + 1));
+	int *sortedIndexes = malloc(sizeof(int) * (placed > 0 ? placed : 1));
+	int *scanIndexes = malloc(sizeof(int) * (placed > 0 ? placed : 1));
+	int repeats = 20;
+	double startTime = currentTime();
+	for (int r = 0; r < repeats; ++r)
+		TreePlacement_bucketTrees(trees, placed, params.area, gridRes, bucketStart, sortedIndexes);
+	double bucketTime = (currentTime() - startTime) / repeats;
+
+	long scanned = 0;
+	startTime = currentTime();
+	for (int x = 0; x < gridRes; ++x)
+		for (int y = 0; y < gridRes; ++y)
+			scanned += scanBatch(trees, placed, params.area, gridRes, x, y, scanIndexes);
+	double scanTime = currentTime() - startTime;
+
+	printf("%d trees into a %dx%d batch grid:\n", placed, gridRes, gridRes);
+	printf("counting sort:  %8.3f ms\n", bucketTime * 1000);
+	printf("per batch scan: %8.3f ms (%.0fx)\n\n", scanTime * 1000, (bucketTime > 0) ? scanTime / bucketTime : 0.0);
+
+	// both must find the same trees, in the same order, for every batch
+	int bucketMismatches = (scanned != placed);
+	for (int x = 0; x < gridRes; ++x) {
+		for (int y = 0; y < gridRes; ++y) {
+			int b = x * gridRes + y;
+			int count = scanBatch(trees, placed, params.area, gridRes, x, y, scanIndexes);
+			if (count != bucketStart[b+1] - bucketStart[b] || memcmp(scanIndexes, &sortedIndexes[bucketStart[b]], sizeof(int) * count) != 0)
+				++bucketMismatches;
+		}
+	}
+	// build each batch's billboards (on flat ground) from its trees, as -[XTreeSystem updateTreeBatchX:Y:] does
+	XTreeBillboard *billboards = malloc(sizeof(XTreeBillboard) * (placed > 0 ? placed : 1));
+	for (int i = 0; i < placed; ++i) {
+		const XTreeInstance *tree = &trees[sortedIndexes[i]];
+		billboards[i].position.x = tree->position.x;
+		billboards[i].position.y = 0;
+		billboards[i].position.z = tree->position.y;
+		billboards[i].size = tree->size;
+		billboards[i].color.red = billboards[i].color.green = billboards[i].color.blue = billboards[i].color.alpha = 0xFF;
+	}
+	XTreeVertex *impostors = malloc(sizeof(XTreeVertex) * 4 * (placed > 0 ? placed : 1));
+
+	printf("LOD rings (near within %d, far from %d), with every batch in view:\n", TREE_NEAR_DISTANCE, TREE_FAR_DISTANCE);
+	printf("%-12s %-27s %-27s %-27s %s\n", "", "near", "mid", "far", "mid ring");
+	printf("%-12s", "camera");
+	for (int lod = 0; lod < XTreeLOD_Count; ++lod)
+		printf(" %7s %8s %10s", "batches", "trees", "vertexes");
+	printf(" impostors\n");
+	XScalar cellWidth = (params.area.right - params.area.left) / gridRes;
+	XScalar cellHeight = (params.area.bottom - params.area.top) / gridRes;
+	int ringMismatches = 0;
+	for (int c = 0; c < CAMERA_COUNT; ++c) {
+		XVector3 eye = { cameras[c].x, 30, cameras[c].z };
+		int batches[XTreeLOD_Count] = { 0 }, ringTrees[XTreeLOD_Count] = { 0 }, vertexes[XTreeLOD_Count] = { 0 };
+		XTreeLOD *lods = malloc(sizeof(XTreeLOD) * bucketCount);
+		for (int x = 0; x < gridRes; ++x) {
+			for (int y = 0; y < gridRes; ++y) {
+				int b = x * gridRes + y, count = bucketStart[b+1] - bucketStart[b];
+				XBoundingBox bounds;
+				bounds.min.x = params.area.left + cellWidth * x; bounds.max.x = bounds.min.x + cellWidth;
+				bounds.min.z = params.area.top + cellHeight * y; bounds.max.z = bounds.min.z + cellHeight;
+				bounds.min.y = 0; bounds.max.y = params.maxTreeSize;
+				lods[b] = TreeLOD_select(&bounds, &eye, TREE_NEAR_DISTANCE, TREE_FAR_DISTANCE);
+				if (count == 0)
+					continue;
+				++batches[lods[b]];
+				ringTrees[lods[b]] += count;
+				vertexes[lods[b]] += TreeLOD_vertexCount(lods[b], count);
+			}
+		}
+
+		// impostors face the camera, looking at the middle of the map
+		XVector3 right = { 1, 0, 0 };
+		XScalar length = sqrtf(eye.x * eye.x + eye.z * eye.z);
+		if (length > 0) {
+			right.x = eye.z / length;
+			right.z = -eye.x / length;
+		}
+		XTreeVertex *end = impostors;
+		startTime = currentTime();
+		for (int r = 0; r < IMPOSTOR_REPEATS; ++r) {
+			end = impostors;
+			for (int b = 0; b < bucketCount; ++b) {
+				if (lods[b] == XTreeLOD_Mid)
+					end = TreeLOD_writeImpostors(end, &billboards[bucketStart[b]], bucketStart[b+1] - bucketStart[b], &right);
+			}
+		}
+		double impostorTime = (currentTime() - startTime) / IMPOSTOR_REPEATS;
+		free(lods);
+
+		BOOL ok = (ringTrees[XTreeLOD_Near] + ringTrees[XTreeLOD_Mid] + ringTrees[XTreeLOD_Far] == placed && end - impostors == vertexes[XTreeLOD_Mid]);
+		if (!ok)
+			++ringMismatches;
+		printf("%-12s %7d %8d %10d %7d %8d %10d %7d %8d %10d %7.3f ms (%.1f ns/vertex)%s\n", cameras[c].name,
+			batches[XTreeLOD_Near], ringTrees[XTreeLOD_Near], vertexes[XTreeLOD_Near],
+			batches[XTreeLOD_Mid], ringTrees[XTreeLOD_Mid], vertexes[XTreeLOD_Mid],
+			batches[XTreeLOD_Far], ringTrees[XTreeLOD_Far], vertexes[XTreeLOD_Far],
+			impostorTime * 1000, (vertexes[XTreeLOD_Mid] > 0) ? impostorTime * 1e9 / vertexes[XTreeLOD_Mid] : 0.0,
+			ok ? "" : " (MISMATCH)");
+	}
+	printf("\n");
+
+	printf("placement mismatches across thread counts: %d\n", placementMismatches);
+	printf("batch mismatches: %d\n", bucketMismatches);
+	printf("LOD ring mismatches: %d\n\n", ringMismatches);
+
+	free(impostors);
+	free(billboards);
+	free(scanIndexes);
+	free(sortedIndexes);
+	free(bucketStart);
+	free(otherTrees);
+	free(trees);
+	if (placementMismatches > 0 || bucketMismatches > 0 || ringMismatches > 0) {
+		printf("FAILED\n");
+		return 1;
+	}
+	return 0;
+}